@@ -0,0 +1,133 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  Clock.h
+  Description  :  Time base of the loop code on Timer 1, unaffected by the bus code.
+  Author       :  Panin Aleksandr
+  Copyright    :  (c) 2022 aleksandrpanin.ru
+  ----------------------------------------------------------------------------------------------------
+     millis() and micros() count the overflows of Timer 0 (every 1.024 ms), and the bus code
+     restarts Timer 0 at every bit it reads or sends, at every start bit and in IsAvcBusFree():
+     while frames follow each other Timer 0 never overflows and both stand still. A rate, a
+     timeout or a task period taken from them runs late on a busy bus, or never.
+
+     Timer 1 runs freely at F_CPU / 8 (2 counts per us) and nobody writes it: the input capture
+     backend (INNER_COMPARATOR) sets it up so, else ClockInit() does. The tracepoints (Trace.h)
+     stamp with it as well. Spans below its period, 32.768 ms, are the difference of two TCNT1
+     reads (a uint16_t). Longer ones come from ClockMillis() and ClockMicros(), which add the counts
+     since their last call to ClockMs and ClockUs: they replace millis() and micros() in the
+     loop code, wrap the same way and are compared the same way, (long)( now - due ) >= 0.
+
+     The counts since the last update are the 16 bit difference of two TCNT1 reads, right only
+     if the updates are less than one Timer 1 period, 32.768 ms, apart. A longer gap loses
+     32.768 ms per full period: the clock runs late and never jumps back. The update runs
+
+       - in SchedulerService(), on every loop pass. A pass is at most one frame long: 22 ms for
+         the longest payload of the load test (32 bytes) in mode 1.
+       - in LogPrint(), before every string: a report printing more than the TX buffer holds
+         waits for the UART, one string takes at most 5.5 ms at 115200 baud.
+       - in SendFrame(), while it waits for a free bus.
+
+     Other code shall not keep the loop for 32.768 ms without calling ClockUpdate().
+  --------------------------------------------------------------------------------------------------*/
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#define CLOCK_COUNTS_PER_US     2           // Timer 1 at F_CPU / 8.
+
+/*--------------------------------------------------------------------------------------------------
+                                         Prototypes
+--------------------------------------------------------------------------------------------------*/
+void            ClockInit ( void );
+void            ClockUpdate ( void );
+unsigned long   ClockMillis ( void );
+unsigned long   ClockMicros ( void );
+unsigned long   ClockMicrosAt ( uint16_t stamp );
+
+/*--------------------------------------------------------------------------------------------------
+                                      Global Variables
+  --------------------------------------------------------------------------------------------------*/
+static uint16_t         ClockLast;          // TCNT1 at the last update.
+static byte             ClockHalf = 0;      // Odd count carried to the next update (0.5 us).
+static word             ClockRest = 0;      // us not counted in ClockMs yet.
+static unsigned long    ClockUs = 0;        // us since ClockInit().
+static unsigned long    ClockMs = 0;        // ms since ClockInit().
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ClockInit
+  Description  :  Runs Timer 1 freely at F_CPU / 8, unless the input capture backend already
+                  does, and starts the clock. Call from setup() after RxInit().
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void ClockInit ( void ) {
+
+#if (!INNER_COMPARATOR)
+  TCCR1A = 0;
+  TCCR1B = _BV( CS11 );
+#endif
+
+  ClockLast = TCNT1;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ClockUpdate
+  Description  :  Adds the Timer 1 counts since the last update to ClockUs and ClockMs. Call at
+                  least every 32.768 ms from code that keeps the loop longer.
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void ClockUpdate ( void ) {
+  uint16_t now = TCNT1;
+  uint16_t counts = now - ClockLast;
+  ClockLast = now;
+
+  word us = counts >> 1;
+  if ( ( counts & 1 ) && ( ClockHalf ^= 1 ) == 0 ) {
+    us++;
+  }
+
+  ClockUs   += us;
+  ClockRest += us;
+  while ( ClockRest >= 1000 ) {
+    ClockRest -= 1000;
+    ClockMs++;
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ClockMillis
+  Description  :  millis() that goes on while the bus code restarts Timer 0.
+  Argument(s)  :  None.
+  Return value :  (unsigned long) -> ms since ClockInit(), wraps after 49 days.
+  --------------------------------------------------------------------------------------------------*/
+unsigned long ClockMillis ( void ) {
+  ClockUpdate();
+  return ClockMs;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ClockMicros
+  Description  :  micros() that goes on while the bus code restarts Timer 0.
+  Argument(s)  :  None.
+  Return value :  (unsigned long) -> us since ClockInit(), wraps after 71 minutes.
+  --------------------------------------------------------------------------------------------------*/
+unsigned long ClockMicros ( void ) {
+  ClockUpdate();
+  return ClockUs;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ClockMicrosAt
+  Description  :  ClockMicros() of an earlier TCNT1 read, less than 32.768 ms ago.
+  Argument(s)  :  stamp (uint16_t) -> TCNT1 read.
+  Return value :  (unsigned long) -> us since ClockInit() at the read.
+  --------------------------------------------------------------------------------------------------*/
+unsigned long ClockMicrosAt ( uint16_t stamp ) {
+  ClockUpdate();
+  return ClockUs - (uint16_t)( ClockLast - stamp ) / CLOCK_COUNTS_PER_US;
+}
+
+#endif // _CLOCK_H_
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,230 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  EdgeRecorder.h
+  Description  :  Flight recorder of the last bus edges, frozen on decode and ack errors.
+  Author       :  Panin Aleksandr
+  Copyright    :  (c) 2022 aleksandrpanin.ru
+  ----------------------------------------------------------------------------------------------------
+     "Parity error @ Control" or "No Ack @ DataSize" tell where a frame failed, not why: a short
+     pulse, a late edge, two drivers at once. The bit loops write every edge they see or drive in
+     EdgeRing, a ring of the last EDGE_RECORDER_SIZE edges, one byte each:
+
+       bit 7      level after the edge, 1 rise (EDGE_RISE), 0 fall
+       bits 6..0  Timer 0 ticks (4 us) since the last rise, the bit timer restarts at every rise:
+                  the bit length for a rise, the high time for a fall
+
+     EDGE_START (a rise of 127 ticks) marks a start bit, the idle time before it is not known.
+     A fall is kept as 1 .. 127 ticks: a glitch shorter than a tick counts 1, a high time of 127
+     ticks and more counts 127. 0x00 is never written and marks a slot not written since the ring
+     was cleared. A write is a store and a masked index increment, a fall also the clamp. The
+     cycles charged to the simulator clock, EDGE_RECORD_CYCLES, are an estimate from the
+     instruction count, not measured on the ATmega328P.
+
+     EdgeFreeze() is called by the error paths of AvcReadMessage(), RxAbort() and SendFrame().
+     It keeps the ring as it is and sends the next writes to a spare byte behind it, so the bit
+     loops never test whether the recorder runs. EdgeRecorderService(), a scheduler task, prints
+     the frozen ring between dump lines, at once (EDGE_RECORDER_STREAM) or when an 'E' arrives
+     on the serial port, oldest edge first, in lines of 16:
+
+       EDGES PARITY CB M:2
+       E:FF 2A 8A 05 8A 08 8A 05 ... 
+       EDGES END
+
+     and starts recording again EDGE_RECORDER_HOLDOFF ms later. tools/edges renders the dump as
+     a timing diagram with the compare points of IebusTimings.
+  --------------------------------------------------------------------------------------------------*/
+#ifndef _EDGERECORDER_H_
+#define _EDGERECORDER_H_
+
+#define EDGE_RISE               0x80
+#define EDGE_TICKS              0x7F
+#define EDGE_START              ( EDGE_RISE | EDGE_TICKS )
+#define EDGE_EMPTY              0x00        // Never written: EdgeFall() keeps 1 tick at least.
+
+#define EDGE_RECORD_CYCLES      14          // Estimate: lds, st, subi, lds, and, sts, the pointer setup and the clamp.
+#define EDGE_LINE_ENTRIES       16
+
+/*--------------------------------------------------------------------------------------------------
+                                       Type definitions
+--------------------------------------------------------------------------------------------------*/
+typedef enum
+{
+    EDGE_PARITY_MASTER = 0,
+    EDGE_PARITY_SLAVE,
+    EDGE_PARITY_CONTROL,
+    EDGE_PARITY_SIZE,
+    EDGE_PARITY_DATA,
+    EDGE_NOACK_SLAVE,
+    EDGE_NOACK_CONTROL,
+    EDGE_NOACK_SIZE,
+    EDGE_NOACK_DATA,
+    EDGE_ABORT_LATE,                        // No rise after a bit (ReadBits).
+    EDGE_ABORT_LONG,                        // High time over a '0' (ReadBits).
+    EDGE_REASON_COUNT
+
+} EdgeReason;
+
+#if (USE_EDGE_RECORDER)
+
+static_assert( ( EDGE_RECORDER_SIZE & ( EDGE_RECORDER_SIZE - 1 ) ) == 0 && EDGE_RECORDER_SIZE <= 128,
+               "EDGE_RECORDER_SIZE shall be a power of 2, up to 128" );
+
+// Restarts the bit timer and keeps the ticks since the last rise for EdgeRise(). The At form
+// starts it at ticks, for a rise that was latched ticks ago.
+#define EdgeTimerRestart()      byte edgePeriod = TCNT0; TCNT0 = 0
+#define EdgeTimerRestartAt( ticks ) byte edgeLag = (ticks); byte edgePeriod = TCNT0 - edgeLag; TCNT0 = edgeLag
+#define EdgeRecord( entry )     { SIM_CYCLES( EDGE_RECORD_CYCLES ); EdgeRing[ EdgeHead ] = (entry); \
+                                  EdgeHead = ( EdgeHead + 1 ) & EdgeMask; }
+#define EdgeRise()              EdgeRecord( EDGE_RISE | ( edgePeriod & EDGE_TICKS ) )
+#define EdgeFall( ticks )       { byte edgeHigh = (ticks); \
+                                  EdgeRecord( edgeHigh >= EDGE_TICKS ? EDGE_TICKS : edgeHigh ? edgeHigh : 1 ) }
+#define EdgeStart()             EdgeRecord( EDGE_START )
+
+/*--------------------------------------------------------------------------------------------------
+                                         Prototypes
+--------------------------------------------------------------------------------------------------*/
+void            EdgeFreeze ( EdgeReason reason, byte mode );
+void            EdgeRecorderService ( void );
+
+static void     EdgeRearm ( void );
+
+/*--------------------------------------------------------------------------------------------------
+                                      Global Variables
+  --------------------------------------------------------------------------------------------------*/
+// Field names of the dump line, copied to UsartMsgBuffer (12 characters).
+static const char EdgeReasonNames[ EDGE_REASON_COUNT ][ 12 ] PROGMEM =
+{
+  "PARITY M", "PARITY S", "PARITY CB", "PARITY L", "PARITY DATA",
+  "NOACK S", "NOACK CB", "NOACK L", "NOACK DATA", "ABORT LATE", "ABORT LONG"
+};
+
+static byte             EdgeRing[ EDGE_RECORDER_SIZE + 1 ];     // Last byte: writes while frozen.
+static byte             EdgeHead = 0;
+static byte             EdgeMask = EDGE_RECORDER_SIZE - 1;
+static bool             EdgeFrozen = false;
+static byte             EdgeFrozenHead;     // Oldest entry of the frozen ring.
+static byte             EdgeFrozenMode;     // IEBus mode of the failed frame.
+static byte             EdgeFrozenReason;
+static byte             EdgeLine = 0;       // Next dump line, 0: header, not started.
+static bool             EdgeDumped = false;
+static unsigned long    EdgeRearmAt;
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  EdgeFreeze
+  Description  :  Keeps the recorded edges for printing. Later errors are ignored until the ring
+                  is printed and recording again.
+  Argument(s)  :  reason (EdgeReason) -> Error.
+                  mode (byte) -> IEBus mode of the frame (IebusMode).
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void EdgeFreeze ( EdgeReason reason, byte mode ) {
+
+  if ( EdgeFrozen ) {
+    return;
+  }
+
+  EdgeFrozen       = true;
+  EdgeFrozenHead   = EdgeHead;
+  EdgeFrozenMode   = mode;
+  EdgeFrozenReason = reason;
+
+  EdgeHead = EDGE_RECORDER_SIZE;
+  EdgeMask = EDGE_RECORDER_SIZE;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  EdgeRecorderService
+  Description  :  Prints a frozen ring one line per run, between dump lines and while the line
+                  fits the serial TX buffer, then starts recording again. Scheduler task.
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void EdgeRecorderService ( void ) {
+
+  if ( !EdgeFrozen ) {
+    return;
+  }
+
+  if ( EdgeDumped ) {
+    if ( (long)( ClockMillis() - EdgeRearmAt ) >= 0 ) {
+      EdgeRearm();
+    }
+    return;
+  }
+
+  // Longest line: "E:" and EDGE_LINE_ENTRIES entries "XX ".
+  if ( LogToken != 0 || Serial.availableForWrite() < 2 + EDGE_LINE_ENTRIES * 3 + 2 ) {
+    return;
+  }
+
+  if ( EdgeLine == 0 && !EDGE_RECORDER_STREAM ) {
+    if ( Serial.available() == 0 || Serial.read() != 'E' ) {
+      return;
+    }
+  }
+
+  const byte lines = EDGE_RECORDER_SIZE / EDGE_LINE_ENTRIES;
+
+  if ( EdgeLine == 0 ) {
+    LogPrint( "EDGES " );
+    strcpy_P( UsartMsgBuffer, EdgeReasonNames[ EdgeFrozenReason ] );
+    LogPrint( UsartMsgBuffer );
+    LogValue( " M:", EdgeFrozenMode + 1, 10 );
+    LogPrint( "\r\n" );
+
+  } else if ( EdgeLine <= lines ) {
+    byte at = EdgeFrozenHead + ( EdgeLine - 1 ) * EDGE_LINE_ENTRIES;
+
+    LogPrint( "E:" );
+    for ( byte i = 0; i < EDGE_LINE_ENTRIES; i++, at++ ) {
+      byte entry = EdgeRing[ at & ( EDGE_RECORDER_SIZE - 1 ) ];
+      if ( entry == EDGE_EMPTY ) {
+        continue;
+      }
+      char * end = LogNumber( UsartMsgBuffer, entry, 16, 2 );
+      end[0] = ' ';
+      end[1] = '\0';
+      LogPrint( UsartMsgBuffer );
+    }
+    LogPrint( "\r\n" );
+
+  } else {
+    LogPrint( "EDGES END\r\n" );
+    EdgeDumped  = true;
+    EdgeRearmAt = ClockMillis() + EDGE_RECORDER_HOLDOFF;
+    return;
+  }
+
+  EdgeLine++;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  EdgeRearm
+  Description  :  Clears the ring and records again.
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void EdgeRearm ( void ) {
+  memset( EdgeRing, EDGE_EMPTY, sizeof( EdgeRing ) );
+  EdgeLine   = 0;
+  EdgeDumped = false;
+  EdgeHead   = 0;
+  EdgeMask   = EDGE_RECORDER_SIZE - 1;
+  EdgeFrozen = false;
+}
+
+#else
+
+#define EdgeTimerRestart()      TCNT0 = 0
+#define EdgeTimerRestartAt( ticks ) TCNT0 = (ticks)
+#define EdgeRise()
+#define EdgeFall( ticks )
+#define EdgeStart()
+#define EdgeFreeze( reason, mode )
+
+#endif // USE_EDGE_RECORDER
+
+#endif // _EDGERECORDER_H_
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,315 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  FrameCache.h
+  Description  :  Last frame cache for change-only reporting of incoming messages.
+  Author       :  Panin Aleksandr
+  Copyright    :  (c) 2022 aleksandrpanin.ru
+  ----------------------------------------------------------------------------------------------------
+     The HU repeats identical status frames many times per second. The cache keeps the last
+     payload seen for every (master, slave, control) so a frame is dumped only when its payload
+     changed. Payloads are compared byte for byte: a frame longer than FRAME_CACHE_DATA bytes is
+     not kept and always dumped, and the next one of its key counts as changed. Repeats are counted and printed when the payload changes and every
+     FRAME_CACHE_REPORT ms as
+
+       RPT:25 M:0X130 S:0X140 CB:0XF
+
+     followed by the total of suppressed frames and the serial bytes their dumps would have taken:
+
+       CACHE HIT:1200 SAVED:52800
+
+     The cache is FRAME_CACHE_SIZE entries of 9 + FRAME_CACHE_DATA bytes, split in sets of
+     FRAME_CACHE_WAYS entries.
+     The set is chosen by a hash of the addresses, inside a set the least recently seen entry is
+     evicted.
+
+     FrameCacheUpdate() runs in AvcReadMessage() and prints nothing. The repeats of a payload that
+     changed or of an evicted entry go to FrameCachePending, FRAME_CACHE_PENDING records of 6
+     bytes. On a full queue the repeats of a changed payload stay in the entry and are reported
+     with those of the new one, the repeats of an evicted entry are only counted in HIT.
+
+     FrameCacheReport() prints nothing either, it starts a sweep of the cache. FrameCacheDrain(),
+     a scheduler task, prints one line a run between two log lines, when the serial TX buffer
+     has room for it: a pending record first, else the next entry of the sweep with repeats,
+     else the CACHE line that ends the sweep. No line waits for the UART, and the line of a
+     changed payload may come after the dump of the new one.
+  --------------------------------------------------------------------------------------------------*/
+#ifndef _FRAMECACHE_H_
+#define _FRAMECACHE_H_
+
+#if (USE_FRAME_CACHE)
+
+#define FRAME_CACHE_SETS        ( FRAME_CACHE_SIZE / FRAME_CACHE_WAYS )
+#define FRAME_CACHE_VALID       0x80000000UL
+#define FRAME_CACHE_LINE        39          // "CACHE HIT:4294967295 SAVED:4294967295\r\n", RPT lines are 34.
+#define FRAME_CACHE_IDLE        ( FRAME_CACHE_SIZE + 1 )    // FrameCacheSweep: no report running.
+
+static_assert( FRAME_CACHE_DATA <= IEBUS_DATA_SIZE, "FRAME_CACHE_DATA shall fit IebusFrame::Data" );
+
+/*--------------------------------------------------------------------------------------------------
+                                       Type definitions
+--------------------------------------------------------------------------------------------------*/
+typedef struct{
+    unsigned long       Key;                // FRAME_CACHE_VALID | Master(12) | Slave(12) | Control(4).
+    word                Repeats;            // Identical frames since last report.
+    word                LastSeen;           // Cache clock stamp for eviction.
+    byte                DataSize;           // Length of the last payload.
+    byte                Data[ FRAME_CACHE_DATA ]; // Last payload, unused above FRAME_CACHE_DATA bytes.
+
+} FrameCacheEntry;
+
+typedef struct{
+    unsigned long       Key;                // Key of the entry.
+    word                Repeats;            // Repeats to report.
+
+} FrameCacheRecord;
+
+static_assert( FRAME_CACHE_IDLE <= 255, "FrameCacheSweep shall fit a byte" );
+
+/*--------------------------------------------------------------------------------------------------
+                                         Prototypes
+--------------------------------------------------------------------------------------------------*/
+bool            FrameCacheUpdate ( const IebusFrame * frame );
+void            FrameCacheDrain ( void );
+void            FrameCacheReport ( void );
+
+static bool     FrameCacheDefer ( FrameCacheEntry * entry );
+static void     FrameCachePrint ( unsigned long key, word repeats );
+static byte     HexDigits ( word value );
+static word     FrameDumpLength ( const IebusFrame * frame );
+static void     FrameCacheStore ( FrameCacheEntry * entry, const IebusFrame * frame );
+
+/*--------------------------------------------------------------------------------------------------
+                                      Global Variables
+  --------------------------------------------------------------------------------------------------*/
+static FrameCacheEntry  FrameCache[ FRAME_CACHE_SIZE ];
+static word             FrameCacheClock = 0;
+static unsigned long    FrameCacheHits = 0;
+static unsigned long    FrameCacheSavedBytes = 0;
+static FrameCacheRecord FrameCachePending[ FRAME_CACHE_PENDING ];
+static byte             FrameCachePendingHead = 0;
+static byte             FrameCachePendingCount = 0;
+static byte             FrameCacheSweep = FRAME_CACHE_IDLE;     // Next entry of the report, FRAME_CACHE_SIZE: the CACHE line.
+static bool             FrameCacheReported = false;             // The sweep printed a RPT line.
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  FrameCacheUpdate
+  Description  :  Looks up the frame in the cache and stores its payload.
+  Argument(s)  :  frame (const IebusFrame *) -> Received frame.
+  Return value :  (bool) -> TRUE if the frame is new or changed and shall be dumped.
+  --------------------------------------------------------------------------------------------------*/
+bool FrameCacheUpdate ( const IebusFrame * frame ) {
+  word master  = frame->MasterAddress;
+  word slave   = frame->SlaveAddress;
+  byte control = frame->Control;
+  byte size    = frame->DataSize;
+
+  unsigned long key = FRAME_CACHE_VALID | ( (unsigned long)master << 16 ) | ( slave << 4 ) | ( control & 0xF );
+
+  FrameCacheClock++;
+
+  byte set = (byte)( master ^ ( master >> 7 ) ^ slave ^ ( slave >> 5 ) ^ control ) % FRAME_CACHE_SETS;
+  FrameCacheEntry * entry = &FrameCache[ set * FRAME_CACHE_WAYS ];
+  FrameCacheEntry * victim = entry;
+
+  for ( byte way = 0; way < FRAME_CACHE_WAYS; way++, entry++ ) {
+
+    if ( entry->Key == key ) {
+      entry->LastSeen = FrameCacheClock;
+
+      if ( size <= FRAME_CACHE_DATA && entry->DataSize == size && memcmp( entry->Data, frame->Data, size ) == 0 ) {
+        entry->Repeats++;
+        FrameCacheHits++;
+        FrameCacheSavedBytes += FrameDumpLength( frame );
+        return false;
+      }
+
+      // Repeats belong to the previous payload.
+      FrameCacheDefer( entry );
+
+      FrameCacheStore( entry, frame );
+      return true;
+    }
+
+    // Prefer an empty slot, else the entry not seen for the longest time.
+    if ( victim->Key != 0 &&
+         ( entry->Key == 0 || (word)( FrameCacheClock - entry->LastSeen ) > (word)( FrameCacheClock - victim->LastSeen ) ) ) {
+      victim = entry;
+    }
+  }
+
+  // Report the repeats of the evicted frame, they are in HIT anyway.
+  FrameCacheDefer( victim );
+
+  victim->Key = key;
+  FrameCacheStore( victim, frame );
+  victim->Repeats = 0;
+  victim->LastSeen = FrameCacheClock;
+
+  return true;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  FrameCacheStore
+  Description  :  Keeps the payload of a frame in its cache entry, the length only if it is longer
+                  than FRAME_CACHE_DATA: no frame matches it.
+  Argument(s)  :  entry (FrameCacheEntry *) -> Cache entry of the frame.
+                  frame (const IebusFrame *) -> Received frame.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void FrameCacheStore ( FrameCacheEntry * entry, const IebusFrame * frame ) {
+  entry->DataSize = frame->DataSize;
+
+  if ( frame->DataSize <= FRAME_CACHE_DATA ) {
+    memcpy( entry->Data, frame->Data, frame->DataSize );
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  FrameCacheDrain
+  Description  :  Prints one line if the serial TX buffer has room and no log line is half
+                  printed: the oldest record of FrameCachePending, else the next line of the
+                  report sweep. Scheduler task.
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void FrameCacheDrain ( void ) {
+
+  if ( LogToken != 0 || Serial.availableForWrite() < FRAME_CACHE_LINE ) {
+    return;
+  }
+
+  if ( FrameCachePendingCount != 0 ) {
+    FrameCacheRecord * record = &FrameCachePending[ FrameCachePendingHead ];
+    FrameCachePrint( record->Key, record->Repeats );
+
+    if ( ++FrameCachePendingHead >= FRAME_CACHE_PENDING ) {
+      FrameCachePendingHead = 0;
+    }
+    FrameCachePendingCount--;
+    return;
+  }
+
+  while ( FrameCacheSweep < FRAME_CACHE_SIZE ) {
+    FrameCacheEntry * entry = &FrameCache[ FrameCacheSweep++ ];
+
+    if ( entry->Repeats != 0 ) {
+      FrameCachePrint( entry->Key, entry->Repeats );
+      entry->Repeats = 0;
+      FrameCacheReported = true;
+      return;
+    }
+  }
+
+  if ( FrameCacheSweep == FRAME_CACHE_SIZE ) {
+    FrameCacheSweep = FRAME_CACHE_IDLE;
+
+    if ( FrameCacheReported ) {
+      LogValue( "CACHE HIT:", FrameCacheHits, 10 );
+      LogValue( " SAVED:", FrameCacheSavedBytes, 10 );
+      LogPrint( "\r\n" );
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  FrameCacheReport
+  Description  :  Starts a sweep printing the repeat counters of all cached frames, one line per
+                  FrameCacheDrain() run, unless the last one is still running. Scheduler task,
+                  every FRAME_CACHE_REPORT ms.
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void FrameCacheReport ( void ) {
+
+  if ( FrameCacheSweep == FRAME_CACHE_IDLE ) {
+    FrameCacheSweep = 0;
+    FrameCacheReported = false;
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  FrameCacheDefer
+  Description  :  Moves the repeat counter of one cached frame to FrameCachePending.
+  Argument(s)  :  entry (FrameCacheEntry *) -> Cache entry.
+  Return value :  (bool) -> FALSE if the queue is full, the counter is left in the entry.
+  --------------------------------------------------------------------------------------------------*/
+bool FrameCacheDefer ( FrameCacheEntry * entry ) {
+
+  if ( entry->Repeats == 0 ) {
+    return true;
+  }
+
+  if ( FrameCachePendingCount >= FRAME_CACHE_PENDING ) {
+    return false;
+  }
+
+  byte tail = FrameCachePendingHead + FrameCachePendingCount;
+  if ( tail >= FRAME_CACHE_PENDING ) {
+    tail -= FRAME_CACHE_PENDING;
+  }
+
+  FrameCachePending[ tail ].Key     = entry->Key;
+  FrameCachePending[ tail ].Repeats = entry->Repeats;
+  FrameCachePendingCount++;
+
+  entry->Repeats = 0;
+  return true;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  FrameCachePrint
+  Description  :  Prints the repeat line of a cached frame.
+  Argument(s)  :  key (unsigned long) -> Key of the entry.
+                  repeats (word) -> Repeat count.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void FrameCachePrint ( unsigned long key, word repeats ) {
+  LogValue( "RPT:", repeats, 10 );
+  LogValue( " M:0X", (word)( key >> 16 ) & 0xFFF, 16 );
+  LogValue( " S:0X", (word)( key >> 4 ) & 0xFFF, 16 );
+  LogValue( " CB:0X", (byte)key & 0xF, 16 );
+  LogPrint( "\r\n" );
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  HexDigits
+  Description  :  Number of digits printed by "%X" for the given value.
+  Argument(s)  :  value (word) -> Value to print.
+  Return value :  (byte) -> Digit count.
+  --------------------------------------------------------------------------------------------------*/
+byte HexDigits ( word value ) {
+  byte n = 1;
+  while ( value >>= 4 ) {
+    n++;
+  }
+  return n;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  FrameDumpLength
+  Description  :  Number of characters DumpRawMessage() prints for the given frame.
+  Argument(s)  :  frame (const IebusFrame *) -> Frame.
+  Return value :  (word) -> Line length, CR LF included.
+  --------------------------------------------------------------------------------------------------*/
+word FrameDumpLength ( const IebusFrame * frame ) {
+  // "B:1 " "M:0X" " " "S:0X" " " "CB:0X" " " "L:" " " "DATA: " "\r\n"
+  word length = 4 + 5 + 5 + 6 + 3 + 6 + 2;
+  byte size = frame->DataSize;
+
+  length += HexDigits( frame->MasterAddress ) + HexDigits( frame->SlaveAddress ) + HexDigits( frame->Control );
+  length += ( size < 10 ) ? 1 : ( size < 100 ) ? 2 : 3;
+
+  for ( byte i = 0; i < IEBUS_STORED( frame ); i++ ) {
+    // "0X" " "
+    length += 3 + HexDigits( frame->Data[i] );
+  }
+
+  return length;
+}
+
+#endif // USE_FRAME_CACHE
+
+#endif // _FRAMECACHE_H_
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,340 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  HuEmulator.h
+  Description  :  Head unit emulator for benchmarking displays without the car.
+  Author       :  Panin Aleksandr
+  Copyright    :  (c) 2022 aleksandrpanin.ru
+  ----------------------------------------------------------------------------------------------------
+     With HU_EMULATOR_MODE the device stops emulating the display and plays the head unit at
+     HU_ADDRESS: it acks the frames sent to HU_ADDRESS and runs the steps of HuScript (PROGMEM):
+
+       HU_LISTEN   Receive only, devices register with their 0x12 broadcast.
+       HU_SCAN     Net scan, broadcast 0x10 handle 0x01. Every device answers 0x11 ...
+       HU_PING     Handle ping 0x10 handle 0x01 to every known device, one after the other.
+
+     Devices are known from their registration or from an 0x11 answer to the HU (up to
+     HU_DEVICES). For every ping the emulator counts a missing ack as an ack failure, else it
+     waits up to HU_REPLY_TIMEOUT ms for the answer of the device. The wait does not keep the
+     loop: loop() reads the frames meanwhile, HuReceive() takes the answer and the scheduler runs
+     its tasks. The next device is pinged on the loop pass after the answer or the timeout. The
+     latency is the time from the end of the ping (last ack bit) to the start bit of the answer,
+     from ClockMicros() (Clock.h) and the Timer 1 stamp of that start bit (RxFrameStart, IEBUS.h):
+     micros() stands still while frames are read.
+
+     Every HU_REPORT ms the scheduler prints two lines per device, one per run, and clears the
+     counters:
+
+       HU 0X140 REG:1 P:50 NA:0 TO:0
+       HU 0X140 A:50 LAT:480/512/604us
+
+     REG registrations, P pings, NA pings not acknowledged, TO answers timed out, A answers, LAT
+     min/avg/max latency of the answers. A line waits while a log line is half printed or the
+     serial TX buffer has no room for it.
+  --------------------------------------------------------------------------------------------------*/
+#ifndef _HUEMULATOR_H_
+#define _HUEMULATOR_H_
+
+#define HU_LINE                 46          // "HU 0XFFF REG:65535 P:65535 NA:65535 TO:65535\r\n", A lines are 42.
+
+/*--------------------------------------------------------------------------------------------------
+                                       Type definitions
+--------------------------------------------------------------------------------------------------*/
+typedef enum
+{
+    HU_LISTEN = 0,                          // Receive only.
+    HU_SCAN,                                // Net scan broadcast.
+    HU_PING                                 // Handle ping to every known device.
+
+} HuAction;
+
+typedef struct{
+    HuAction            Action;             // Step to run.
+    byte                Handle;             // Handle byte of the scan or ping.
+    byte                Repeat;             // Runs of the step, at least 1.
+    word                Wait;               // ms from one run to the next.
+
+} HuScriptStep;
+
+typedef struct{
+    word                Address;            // Device address.
+    word                Registrations;      // 0x12 broadcasts seen.
+    word                Pings;              // Pings sent.
+    word                AckFails;           // Pings not acknowledged.
+    word                Answers;            // Answers received in time.
+    word                Timeouts;           // Pings acked but not answered in time.
+    word                LatencyMin;         // us
+    word                LatencyMax;         // us
+    unsigned long       LatencySum;         // us
+
+} HuDevice;
+
+/*--------------------------------------------------------------------------------------------------
+                                         Prototypes
+--------------------------------------------------------------------------------------------------*/
+void            HuEmulatorService ( void );
+void            HuEmulatorReport ( void );
+void            HuReceive ( const IebusFrame * frame );
+
+static HuDevice * HuAddDevice ( word address );
+static void     HuLoadPing ( word slave, byte handle );
+static void     HuPing ( HuDevice * dev, byte handle );
+static void     HuAnswered ( HuDevice * dev );
+
+void            SchedulerSetPeriod ( word period );     // Scheduler.h
+
+/*--------------------------------------------------------------------------------------------------
+                                      Global Variables
+  --------------------------------------------------------------------------------------------------*/
+static const HuScriptStep HuScript[] PROGMEM =
+{
+  { HU_LISTEN, 0x00, 1,  500 },             // Registrations after power on.
+  { HU_SCAN,   0x00, 1,  200 },
+  { HU_PING,   0x01, 50, 100 },
+};
+
+const byte HuScriptSize = sizeof( HuScript ) / sizeof( HuScriptStep );
+const byte HuScriptLoop = 1;                // Step the script goes on with after the last one.
+
+static HuDevice         HuDevices[ HU_DEVICES ];
+static byte             HuDeviceCount = 0;
+static IebusFrame       HuOut;
+static unsigned long    HuDue = 0;
+static byte             HuStep = 0;
+static byte             HuRun = 0;
+static byte             HuPingNext = HU_DEVICES;   // Next device of the HU_PING step, HU_DEVICES: none.
+static byte             HuPingHandle;
+static HuDevice *       HuWaiting = NULL;          // Device whose answer is awaited.
+static unsigned long    HuSent;                    // ClockMicros() at the end of its ping.
+static byte             HuReportLine = 0;          // Next report line, two per device.
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  HuEmulatorService
+  Description  :  Times out the awaited answer, else pings the next device of a HU_PING step,
+                  else runs the next step of HuScript when due. Call from loop().
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void HuEmulatorService ( void ) {
+
+  if ( HuWaiting != NULL ) {
+    if ( ClockMicros() - HuSent < HU_REPLY_TIMEOUT * 1000UL ) {
+      return;
+    }
+    HuWaiting->Timeouts++;
+    HuWaiting = NULL;
+  }
+
+  if ( HuPingNext < HuDeviceCount ) {
+    HuPing( &HuDevices[ HuPingNext++ ], HuPingHandle );
+    return;
+  }
+  HuPingNext = HU_DEVICES;
+
+  if ( (long)( ClockMillis() - HuDue ) < 0 ) {
+    return;
+  }
+
+  const HuScriptStep * step = &HuScript[ HuStep ];
+  byte handle = pgm_read_byte_near( &step->Handle );
+
+  switch ( pgm_read_byte_near( &step->Action ) ) {
+    case HU_SCAN:
+      HuLoadPing( BROADCAST_ADDRESS, handle );
+      SendMessage( &HuOut );
+      break;
+
+    case HU_PING:
+      HuPingNext   = 0;
+      HuPingHandle = handle;
+      break;
+
+    default:
+      break;
+  }
+
+  HuDue = ClockMillis() + pgm_read_word_near( &step->Wait );
+
+  if ( ++HuRun >= pgm_read_byte_near( &step->Repeat ) ) {
+    HuRun = 0;
+    if ( ++HuStep >= HuScriptSize ) {
+      HuStep = HuScriptLoop;
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  HuLoadPing
+  Description  :  Loads the handle ping 0x10 handle 0x01 in HuOut, a broadcast for the net scan.
+  Argument(s)  :  slave (word) -> Device address, BROADCAST_ADDRESS for the net scan.
+                  handle (byte) -> Handle byte.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void HuLoadPing ( word slave, byte handle ) {
+  HuOut.Broadcast     = ( slave == BROADCAST_ADDRESS ) ? MSG_BCAST : MSG_NORMAL;
+  HuOut.MasterAddress = HU_ADDRESS;
+  HuOut.SlaveAddress  = slave;
+  HuOut.Control       = CONTROL_FLAGS;
+  HuOut.Mode          = IEBUS_MODE;
+  HuOut.DataSize      = 3;
+  HuOut.Data[0]       = 0x10;
+  HuOut.Data[1]       = handle;
+  HuOut.Data[2]       = 0x01;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  HuPing
+  Description  :  Pings a device. An acknowledged ping waits for the answer in HuWaiting.
+  Argument(s)  :  dev (HuDevice *) -> Device.
+                  handle (byte) -> Handle byte.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void HuPing ( HuDevice * dev, byte handle ) {
+
+  HuLoadPing( dev->Address, handle );
+  dev->Pings++;
+
+  if ( !SendMessage( &HuOut ) ) {
+    dev->AckFails++;
+    return;
+  }
+
+  // Timer 1, frames read meanwhile restart Timer 0.
+  HuSent    = ClockMicros();
+  HuWaiting = dev;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  HuAnswered
+  Description  :  Counts the answer of the awaited device with its latency, unless its start bit
+                  came after HU_REPLY_TIMEOUT (HuEmulatorService() counts a timeout).
+  Argument(s)  :  dev (HuDevice *) -> Device, HuWaiting.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void HuAnswered ( HuDevice * dev ) {
+  unsigned long latency = ClockMicrosAt( RxFrameStart ) - HuSent;
+
+  if ( latency >= HU_REPLY_TIMEOUT * 1000UL ) {
+    return;
+  }
+
+  if ( latency > 0xFFFF ) {
+    latency = 0xFFFF;
+  }
+  if ( dev->Answers == 0 || latency < dev->LatencyMin ) {
+    dev->LatencyMin = latency;
+  }
+  if ( latency > dev->LatencyMax ) {
+    dev->LatencyMax = latency;
+  }
+  dev->LatencySum += latency;
+  dev->Answers++;
+  HuWaiting = NULL;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  HuReceive
+  Description  :  Learns the devices from their registrations and answers. Called by
+                  AvcReadMessage() for every frame in HU emulator mode.
+  Argument(s)  :  frame (const IebusFrame *) -> Received frame.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void HuReceive ( const IebusFrame * frame ) {
+
+  if ( frame->DataSize == 0 ) {
+    return;
+  }
+
+  if ( frame->Broadcast == MSG_BCAST && frame->Data[0] == 0x12 ) {
+    HuDevice * dev = HuAddDevice( frame->MasterAddress );
+    if ( dev != NULL ) {
+      dev->Registrations++;
+    }
+  } else if ( frame->SlaveAddress == HU_ADDRESS && frame->Data[0] == 0x11 ) {
+    HuDevice * dev = HuAddDevice( frame->MasterAddress );
+    if ( dev != NULL && dev == HuWaiting ) {
+      HuAnswered( dev );
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  HuAddDevice
+  Description  :  Finds a device, adds it if it is new.
+  Argument(s)  :  address (word) -> Device address.
+  Return value :  (HuDevice *) -> Device, NULL if HuDevices is full.
+  --------------------------------------------------------------------------------------------------*/
+HuDevice * HuAddDevice ( word address ) {
+
+  for ( byte i = 0; i < HuDeviceCount; i++ ) {
+    if ( HuDevices[i].Address == address ) {
+      return &HuDevices[i];
+    }
+  }
+
+  if ( HuDeviceCount >= HU_DEVICES ) {
+    return NULL;
+  }
+
+  HuDevice * dev = &HuDevices[ HuDeviceCount++ ];
+  memset( dev, 0, sizeof( HuDevice ) );
+  dev->Address = address;
+  return dev;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  HuEmulatorReport
+  Description  :  Prints one line of the statistics of a device per run and clears what it
+                  printed. Scheduler task, every HU_REPORT ms.
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void HuEmulatorReport ( void ) {
+
+  // The next line 1 ms later, until the last one.
+  SchedulerSetPeriod( 1 );
+
+  if ( LogToken != 0 || Serial.availableForWrite() < HU_LINE ) {
+    return;
+  }
+
+  if ( HuReportLine >= 2 * HuDeviceCount ) {
+    HuReportLine = 0;
+    SchedulerSetPeriod( HU_REPORT );
+    return;
+  }
+
+  HuDevice * dev = &HuDevices[ HuReportLine / 2 ];
+
+  LogValue( "HU 0X", dev->Address, 16 );
+
+  if ( ( HuReportLine & 1 ) == 0 ) {
+    LogValue( " REG:", dev->Registrations, 10 );
+    LogValue( " P:", dev->Pings, 10 );
+    LogValue( " NA:", dev->AckFails, 10 );
+    LogValue( " TO:", dev->Timeouts, 10 );
+    LogPrint( "\r\n" );
+
+    dev->Registrations = 0;
+    dev->Pings         = 0;
+    dev->AckFails      = 0;
+    dev->Timeouts      = 0;
+  } else {
+    LogValue( " A:", dev->Answers, 10 );
+    LogValue( " LAT:", dev->LatencyMin, 10 );
+    LogValue( "/", dev->Answers ? dev->LatencySum / dev->Answers : 0UL, 10 );
+    LogValue( "/", dev->LatencyMax, 10 );
+    LogPrint( "us\r\n" );
+
+    dev->Answers    = 0;
+    dev->LatencyMin = 0;
+    dev->LatencyMax = 0;
+    dev->LatencySum = 0;
+  }
+
+  HuReportLine++;
+}
+
+#endif // _HUEMULATOR_H_
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/
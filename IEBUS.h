@@ -78,15 +78,125 @@
 
 --------------------------------------------------------------------------------------------------*/
 
-// Following multipliers result of Timer 0 prescaler having 2 counts/us
-#define NORMAL_BIT_LENGTH           10  //37*2
+// The figures above are mode 2. Tick counts of every mode (Timer 0 prescaler 64, 4 us per
+// tick) are in IebusTimings (IebusTiming.h); the row of the frame on the bus is copied in Timing.
 
-#define BIT_1_HOLD_ON_LENGTH        5   //20*2
-#define BIT_0_HOLD_ON_LENGTH        9   //33*2
-#define BIT_HOLD_HALF_PERIOD        7   //26*2 // Compare half way between a '1' (20 us) and a '0' (32 us ): 32 - (32 - 20) /2 = 26 us
 
-#define START_BIT_LENGTH            47  //186*2 372
-#define START_BIT_HOLD_ON_LENGTH    42  //168*2 336
+/*--------------------------------------------------------------------------------------------------
+                                       IE_BUS receive backend
+  ----------------------------------------------------------------------------------------------------
+     The decoder only needs the high time of every pulse. RX_RISEN tells a rising edge, then
+     RxTakeRise() restarts TCNT0 there for the bit timing, RxWaitFall( limit ) returns at the
+     falling edge with the high time in RxTime units, compared against RX_TICKS( Timer 0 length ).
+     With the input capture backend, a line still high limit after the rise ends the wait with a
+     high time of limit or more, which the caller rejects (start bit too long, '0' too long). TCNT0 counts
+     from the rise, so the '1' wait and the late rise test of ReadBits() and the low time test of
+     getStartBit() run on the timebase of the high time.
+
+     External comparator: both edges are busy-polled on PIN_IN, the high time is TCNT0.
+
+     Internal comparator (INNER_COMPARATOR): the comparator output drives Timer1 input capture
+     with noise canceller, Timer1 runs at 2 counts/us. Edges are latched in ICR1 by hardware, the
+     loop only waits for ICF1, so the measured high time has no polling jitter. The loop notices
+     the rise some us after ICR1, TCNT0 is started at the Timer 0 ticks since ICR1. A pulse that
+     falls before RxTakeRise() armed the fall capture leaves no capture: RxCaptureFall() sees the
+     line low without one and returns a high time of 0, a glitch. A pulse that rises before the
+     rise capture is armed again (right after a noise pulse) leaves no capture either: RX_RISEN
+     also tells a high line, and RxTakeRise() times that pulse from the moment it is seen, like
+     the external comparator. The capture edge is flipped after every edge.
+
+     RxArm() drops the edges captured while the loop did not look at the bus, after code that
+     polls the bus itself (acks, start of a field) and after the wait for the end of a '1', and
+     arms the rise capture. A rise captured in that wait was noise, its stale ICR1 would restart
+     the bit timing of the next bit. RxArm() does not wait for a low line: a line already high
+     is the next bit, read through RX_RISEN.
+
+     Both backends write the edges to the flight recorder (EdgeRecorder.h) in Timer 0 ticks,
+     RX_TO_TICKS() converts a high time.
+--------------------------------------------------------------------------------------------------*/
+
+#if (!INNER_COMPARATOR)
+
+typedef byte                        RxTime;
+
+#define RX_TICKS( ticks )           ( ticks )
+
+#define RxInit()
+#define RxArm()
+
+#define RX_TO_TICKS( time )         ( time )
+
+// Ticks the loop may have been away from a high line before getStartBit() (scheduler tasks), at
+// most the gap between the start bit windows of the two modes.
+static constexpr byte               RxBlindMax = IebusTimings[ IEBUS_MODE_1 ].StartMin - IebusTimings[ IEBUS_MODE_2 ].StartMax;
+static byte                         RxBlind = 0;
+
+#define RxBlindSince( stamp )       { uint16_t blind = (uint16_t)( TCNT1 - (stamp) ) / ( CLOCK_COUNTS_PER_US * 4 ); \
+                                      RxBlind = INPUT_IS_CLEAR ? 0 : ( blind < RxBlindMax ) ? blind : RxBlindMax; }
+
+#define RX_RISEN                    ( INPUT_IS_SET )
+#define RxTakeRise()                { EdgeTimerRestart(); EdgeRise(); }
+#define RxHighTime()                ( TCNT0 )
+#define RxWaitFall( limit )         { while ( INPUT_IS_SET ); }    // limit unused, a long pulse is rejected at its fall.
+
+#else
+
+typedef uint16_t                    RxTime;
+
+#define RX_TICKS( ticks )           ( (ticks) * 8 )  // Timer1 / 8 vs Timer0 / 64
+#define RX_TO_TICKS( time )         ( (time) >> 3 )
+
+static uint16_t                     RxRiseStamp;
+static uint16_t                     RxWidth;
+
+#define RX_CAPTURED                 ( TIFR1 & _BV( ICF1 ) )
+#define RX_CAPTURE_RISE()           do { TCCR1B |= _BV( ICES1 ); TIFR1 = _BV( ICF1 ); } while ( 0 )
+#define RX_CAPTURE_FALL()           do { TCCR1B &= ~_BV( ICES1 ); TIFR1 = _BV( ICF1 ); } while ( 0 )
+
+#define RxBlindSince( stamp )       ( (void)( stamp ) )     // The start bit rise is captured.
+
+#define RxInit()                    { ACSR = _BV( ACIC ); DIDR1 = _BV( AIN1D ) | _BV( AIN0D ); \
+                                      TCCR1A = 0; TCCR1B = _BV( ICNC1 ) | _BV( ICES1 ) | _BV( CS11 ); }
+#define RxArm()                     RX_CAPTURE_RISE()
+
+#define RX_RISEN                    ( RX_CAPTURED || INPUT_IS_SET )
+#define RX_SINCE_RISE()             RX_TO_TICKS( (uint16_t)( TCNT1 - RxRiseStamp ) )
+#define RxTakeRise()                { RxRiseStamp = RX_CAPTURED ? ICR1 : TCNT1; RX_CAPTURE_FALL(); EdgeTimerRestartAt( RX_SINCE_RISE() ); EdgeRise(); }
+#define RxHighTime()                ( RxWidth )
+#define RxWaitFall( limit )         RxCaptureFall( limit )
+
+#endif
+
+
+/*--------------------------------------------------------------------------------------------------
+                                       IE_BUS noise rejection
+  ----------------------------------------------------------------------------------------------------
+     Ignition noise puts short high pulses on the bus. They are rejected in three places.
+
+     Inside a frame, a high pulse shorter than RX_GLITCH_TICKS Timer 0 ticks (8 us by default) is
+     noise: ReadBits() skips it and takes the next pulse as the bit.
+
+     getStartBit() drops a pulse that is already over when it first looks at the line. It also
+     checks the low time that follows a start bit: the line shall stay low for the first half of
+     the low time of our start bit (StartLength - StartHold), counted from the fall. A rise in
+     that half is noise and no frame is read.
+
+     A bit that cannot be one gives the frame up at once, instead of decoding noise up to the
+     next parity bit. A bit is invalid when its high time is longer than the high time of a '0'
+     plus RX_ABORT_SLACK ticks (a start bit, a stuck line). It is also invalid when its rise does
+     not come within the bit length plus RX_ABORT_SLACK ticks of the previous rise. For the first
+     bit of a frame the limit is twice the start bit low time plus RX_ABORT_SLACK ticks after the
+     fall of the start bit (a frame cut short).
+
+     ReadBits() returns RX_ABORTED for an invalid bit. The value fails the parity compare of the
+     field, AvcReadMessage() drops the frame, and every further ReadBits() call returns
+     RX_ABORTED at once until the next start bit.
+--------------------------------------------------------------------------------------------------*/
+
+#define RX_ABORTED                  0xFFFF      // Not a value of 12 bits or less.
+
+static_assert( RX_GLITCH_TICKS * 2 <= IebusTimings[ IEBUS_MODE_COUNT - 1 ].Bit1Hold,
+               "RX_GLITCH_TICKS shall stay below half of the '1' of the fastest mode" );
 
 
 
@@ -127,22 +237,71 @@ typedef struct{
     AvcTransmissionMode Mode;               // Transmission mode: normal (1) or broadcast (0).
     byte                DataSize;           // Payload data size (bytes).
     byte                Data[ 22 ];         // Payload data.
+#if (!SIZE_PROFILE)
     char                Description[ 17 ];  // ASCII description of the command for terminal dump.
+#endif
 
 } AvcOutgoingMessageStruct;
 
+// Description of an AvcOutMessage initializer, nothing in SIZE_PROFILE.
+#if (!SIZE_PROFILE)
+  #define AVC_DESCRIPTION( text )   , text
+#else
+  #define AVC_DESCRIPTION( text )
+#endif
+
 typedef const AvcOutgoingMessageStruct AvcOutMessage;
 
+typedef enum
+{
+    ID_UNREGISTERED = 0,                    // Registration request is due.
+    ID_REGISTERING,                         // Registration sent, not sent again for TIMEOUT_NETPING.
+    ID_REGISTERED                           // HU talks to us.
+
+} AvcIdentityState;
+
+typedef struct{
+    word                Address;            // Logical device address.
+    AvcOutMessage *     Register;           // Registration broadcast.
+    AvcOutMessage *     Answer;             // Answer to the HU handle ping, Data[1] is the handle.
+    byte                Mode;               // IEBus mode (IebusMode) of the frames we send.
+
+} AvcIdentityStruct;
+
+typedef const AvcIdentityStruct AvcIdentityConfig;
+
+typedef struct{
+    word                Address;            // Copy of the config address, matched in the ack window.
+    AvcIdentityState    State;              // Registration state.
+    byte                Handle;             // Handle byte given by the HU ping.
+    unsigned long       LastSeen;           // ClockMillis() of the last frame for this device, of the registration in ID_REGISTERING.
+    AvcIdentityConfig * Config;             // Entry of IdentityTable (PROGMEM).
+
+} AvcIdentity;
+
+// Host simulator cost annotation (tools/sim), compiles to nothing on the device.
+#ifndef SIM_CYCLES
+  #define SIM_CYCLES( cycles )
+#endif
+
 /*--------------------------------------------------------------------------------------------------
                                          Prototypes
 --------------------------------------------------------------------------------------------------*/
 
-bool            AvcReadMessage ( void );
+bool            AvcReadMessage ( IebusFrame * frame );
+bool            AvcRegisterMe ( AvcIdentity * id );
+
+void            IdentityInit ( void );
+void            IdentityRegisterTask ( void );
+void            IdentityTimeoutTask ( void );
 
 //bool            AvcProcessActionID ( AvcActionID actionID );
 //void            AvcUpdateStatus ( void );
 
-void            DumpRawMessage ( bool incoming );
+void            DumpRawMessage ( const IebusFrame * frame );
+void            DumpChangedMessage ( const IebusFrame * frame );
+
+void            HuReceive ( const IebusFrame * frame );     // HuEmulator.h
 
 
 
@@ -159,16 +318,27 @@ static void         Send12BitWord ( word data );
 static void         Send8BitWord ( byte data );
 static void         Send4BitWord ( byte data );
 static void         Send1BitWord ( bool data );
-static bool         SendMessage ( void );
+static bool         SendMessage ( const IebusFrame * frame );
+static bool         SendMessage_P ( AvcOutMessage * msg, AvcIdentity * id );
+static bool         SendFrame ( const IebusFrame * frame, const byte * flash );
+static void         LogSent ( const IebusFrame * frame, const byte * flash );
 
 static word         ReadBits ( byte nbBits );
+static word         RxAbort ( EdgeReason reason );
+#if (INNER_COMPARATOR)
+static void         RxCaptureFall ( RxTime limit );
+#endif
+static bool         Parity ( word data );
 
-static bool         HandleAcknowledge ( void );
+static bool         HandleAcknowledge ( bool broadcast );
 static void         SendAcknowledge ( void );
 static bool         IsAvcBusFree ( void );
 
 //static AvcActionID  GetActionID ( void );
-static void         LoadDataInGlogalRegisters ( AvcOutMessage * msg );
+static void         LoadHeader_P ( IebusFrame * frame, AvcOutMessage * msg, AvcIdentity * id );
+static void         IebusSelectMode ( byte mode );
+static void         AvcAnswerPing ( AvcIdentity * id );
+static AvcIdentity * FindIdentity ( word address );
 static bool         getStartBit ( void );
 
 static void LedOff( void );
@@ -179,25 +349,43 @@ static void LedOn( void );
 /*--------------------------------------------------------------------------------------------------
                                       Global Variables
   --------------------------------------------------------------------------------------------------*/
-// Message frame global registers
-static const char * Description;
-static bool         Broadcast;
-static word         MasterAddress;
-static word         SlaveAddress;
-static word         SlaveAddress2 = 0x000;
-static byte         Control;
-static byte         DataSize;
-static bool         ParityBit;
-static byte         Data[ 32 ];
-
-static bool         isRegistred = false;
-//static bool         isRegistredTest = false;
-static byte         emulatorHandleBite = 0x00;
-static int         isRegistredTimer = 4;
-
-//unsigned long timing;
-unsigned long lastRegistred;
-//static bool emulatrorRegistred = false;
+// Last received frame
+static IebusFrame   RxFrame;
+
+// TCNT1 when the start bit of the last frame was seen, for the answer latency of HuEmulator.h.
+static uint16_t     RxFrameStart;
+
+// Parity of every byte value: P6 spreads the parities of 0..63 over the four 64 entry quarters.
+// Checked for every 12 bit field by the parity mode of tools/sim. The cycle counts are
+// approximate, not avr-gcc -Os output (no avr-gcc at hand): hand written IR of both ways through
+// the AVR backend of LLVM (llc -mcpu=atmega328p -O2). Toggling a parity flag took about 6 per
+// '1' bit in the bit loops (ldi, lds, eor, sts) and 4 per field to clear and read it, Parity()
+// about 11 per field between the bits (8 single cycle instructions and lpm).
+#define PARITY_P2( n )      n, n ^ 1, n ^ 1, n
+#define PARITY_P4( n )      PARITY_P2( n ), PARITY_P2( n ^ 1 ), PARITY_P2( n ^ 1 ), PARITY_P2( n )
+#define PARITY_P6( n )      PARITY_P4( n ), PARITY_P4( n ^ 1 ), PARITY_P4( n ^ 1 ), PARITY_P4( n )
+
+static const byte   ParityTable[ 256 ] PROGMEM =
+{
+  PARITY_P6( 0 ), PARITY_P6( 1 ), PARITY_P6( 1 ), PARITY_P6( 0 )
+};
+
+// Timings of the frame on the bus, a copy of its IebusTimings row.
+static IebusTiming  Timing = IebusTimings[ IEBUS_MODE ];
+static byte         TimingMode = IEBUS_MODE;
+
+// Frame given up by ReadBits() (RX_ABORTED), and the TCNT0 limit for the next rise.
+static bool         RxAborted = false;
+static byte         RxLate;
+
+static bool         DumpOutgoing = !( LOAD_TEST_MODE && !LOAD_TEST_DUMP );
+
+// Head unit emulator (HuEmulator.h): pings are sent, not answered.
+static bool         PlayHeadUnit = HU_EMULATOR_MODE;
+
+// Emulated devices, see IdentityTable.
+static AvcIdentity  Identities[ IDENTITY_MAX ];
+static byte         IdentityCount = 0;
 
 
 //bool                inMessageComplite = true;
@@ -221,78 +409,208 @@ unsigned long lastRegistred;
                                     Our (CD) Commands
   --------------------------------------------------------------------------------------------------*/
 
-AvcOutMessage CmdHuPing PROGMEM = { MSG_NORMAL, 1, {0x1F}, "Display ping" };
-AvcOutMessage CmdDdisplayReg PROGMEM = { MSG_BCAST, 1, {0x12}, "Display register" };
-AvcOutMessage CmdDdisplayRegPing PROGMEM = { MSG_NORMAL, 1, {0x1f}, "Display register" };
+AvcOutMessage CmdHuPing PROGMEM = { MSG_NORMAL, 1, {0x1F} AVC_DESCRIPTION( "Display ping" ) };
+AvcOutMessage CmdDdisplayReg PROGMEM = { MSG_BCAST, 1, {0x12} AVC_DESCRIPTION( "Display register" ) };
+AvcOutMessage CmdDdisplayRegPing PROGMEM = { MSG_NORMAL, 1, {0x1f} AVC_DESCRIPTION( "Display register" ) };
+
+AvcOutMessage CmdDdisplayAnsver PROGMEM = { MSG_NORMAL, 5, {0x11, 0x00, 0x01, 0x01, 0x85} AVC_DESCRIPTION( "Ddisplay ansver" ) };
+
+AvcOutMessage CmdDdisplayAnsver2 PROGMEM = { MSG_NORMAL, 6, {0x11, 0x00, 0x01, 0x02, 0x85, 0x93} AVC_DESCRIPTION( "Ddisplay ansver" ) };
+
+/*--------------------------------------------------------------------------------------------------
+                                    Emulated devices
+  Every entry answers for its own address: acks, registration and handle ping answer. Up to
+  IDENTITY_MAX entries, the first one is the display.
+  --------------------------------------------------------------------------------------------------*/
+
+static AvcIdentityConfig IdentityTable[] PROGMEM =
+{
+#if (HU_EMULATOR_MODE)
+  { HU_ADDRESS, NULL, NULL, IEBUS_MODE },   // Acks the answers, never registers.
+#else
+  { MY_ADDRESS, &CmdDdisplayReg, &CmdDdisplayAnsver2, IEBUS_MODE_2 },
+#endif
+};
+
+const byte IdentityTableSize = sizeof( IdentityTable ) / sizeof( AvcIdentityConfig );
 
-AvcOutMessage CmdDdisplayAnsver PROGMEM = { MSG_NORMAL, 5, {0x11, 0x00, 0x01, 0x01, 0x85}, "Ddisplay ansver from register request" };
+/*--------------------------------------------------------------------------------------------------
+  Name         :  IdentityInit
+  Description  :  Loads the emulated devices from IdentityTable.
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void IdentityInit ( void ) {
+  IdentityCount = 0;
 
-AvcOutMessage CmdDdisplayAnsver2 PROGMEM = { MSG_NORMAL, 6, {0x11, 0x00, 0x01, 0x02, 0x85, 0x93}, "Ddisplay ansver from register request" };
+  for ( byte i = 0; i < IdentityTableSize && i < IDENTITY_MAX; i++ ) {
+    AvcIdentity * id = &Identities[ IdentityCount++ ];
+
+    id->Config      = &IdentityTable[i];
+    id->Address     = pgm_read_word_near( &IdentityTable[i].Address );
+    id->State       = ID_UNREGISTERED;
+    id->Handle      = 0x00;
+    id->LastSeen    = ClockMillis();
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  IdentityRegisterTask
+  Description  :  Sends the registration of every emulated device the HU does not talk to. A
+                  registration on the bus is outstanding for TIMEOUT_NETPING ms, one that
+                  SendFrame() failed to send goes again at the next run.
+                  Scheduler task, every TIMEOUT_NETPING / 4 ms.
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void IdentityRegisterTask ( void ) {
+
+  for ( byte i = 0; i < IdentityCount; i++ ) {
+    AvcIdentity * id = &Identities[i];
+
+    // The HU did not answer the last registration.
+    if ( id->State == ID_REGISTERING && ClockMillis() - id->LastSeen >= TIMEOUT_NETPING ) {
+      id->State = ID_UNREGISTERED;
+    }
+
+    if ( id->State == ID_UNREGISTERED && AvcRegisterMe( id ) ) {
+      id->State = ID_REGISTERING;
+      id->LastSeen = ClockMillis();
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  IdentityTimeoutTask
+  Description  :  Drops the registration of devices the HU did not address for TIMEOUT_RECONNECT ms.
+                  Scheduler task.
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void IdentityTimeoutTask ( void ) {
+
+  for ( byte i = 0; i < IdentityCount; i++ ) {
+    AvcIdentity * id = &Identities[i];
+
+    if ( id->State == ID_REGISTERED && ClockMillis() - id->LastSeen > TIMEOUT_RECONNECT ) {
+      id->State = ID_UNREGISTERED;
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  FindIdentity
+  Description  :  Matches a slave address against the emulated devices. Runs between the slave
+                  address parity bit and the ack bit, 12 cycles per device on the ATmega328P.
+  Argument(s)  :  address (word) -> Slave address.
+  Return value :  (AvcIdentity *) -> Matching device or NULL.
+  --------------------------------------------------------------------------------------------------*/
+AvcIdentity * FindIdentity ( word address ) {
+  AvcIdentity * id = Identities;
+
+  for ( byte i = IdentityCount; i > 0; i--, id++ ) {
+    SIM_CYCLES( 12 );
+    if ( id->Address == address ) {
+      return id;
+    }
+  }
+
+  return NULL;
+}
 
 /*--------------------------------------------------------------------------------------------------
   Name         :  AvcRegisterMe
   Description  :  Sends registration message to master controller.
-  Argument(s)  :  None.
+  Argument(s)  :  id (AvcIdentity *) -> Emulated device to register.
   Return value :  (bool) -> TRUE if successful else FALSE.
   --------------------------------------------------------------------------------------------------*/
-bool AvcRegisterMe ( void ) {
-  Broadcast     = MSG_BCAST; //MSG_NORMAL;
-  MasterAddress = MY_ADDRESS;
-  SlaveAddress  = BROADCAST_ADDRESS; //HU_ADDRESS;
-  Control       = CONTROL_FLAGS;
-  DataSize      = 1;
-  Data[0]       = 0x12; //0x1F;
-  
-  return SendMessage();
+bool AvcRegisterMe ( AvcIdentity * id ) {
+  return SendMessage_P( (AvcOutMessage *)pgm_read_ptr( &id->Config->Register ), id );
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  AvcAnswerPing
+  Description  :  Answers the HU handle ping (0x10 handle 0x01) for an emulated device.
+  Argument(s)  :  id (AvcIdentity *) -> Emulated device.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void AvcAnswerPing ( AvcIdentity * id ) {
+  Trace( TRACE_REPLY );
+  AvcOutMessage * msg = (AvcOutMessage *)pgm_read_ptr( &id->Config->Answer );
+  IebusFrame answer;
+
+  // The handle is patched in, so this one is copied.
+  LoadHeader_P( &answer, msg, id );
+  memcpy_P( answer.Data, msg->Data, answer.DataSize );
+  answer.Data[1] = id->Handle;
+  Trace( TRACE_REPLY_LOADED );
+
+  // Not answered, the state stays and IdentityRegisterTask() goes on registering.
+  if ( SendMessage( &answer ) ) {
+    id->State = ID_REGISTERED;
+    id->LastSeen = ClockMillis();
+  }
+  Trace( TRACE_REPLY_END );
 }
 
 /*--------------------------------------------------------------------------------------------------
   Name         :  AvcReadMessage
   Description  :  Read incoming messages on the AVC LAN bus.
-  Argument(s)  :  None.
-  Return value :  bool.
+  Argument(s)  :  frame (IebusFrame *) -> Receives the frame, partly written on errors.
+  Return value :  (bool) -> TRUE if a complete frame was received.
   --------------------------------------------------------------------------------------------------*/
-bool AvcReadMessage ( void ) {
+bool AvcReadMessage ( IebusFrame * frame ) {
 
   if(INPUT_IS_CLEAR){
     return false;
   }
+  RxFrameStart = TCNT1;
   
 // Start bit.
   if( !getStartBit() ){
     return false;
   }
 
+  Trace( TRACE_START_BIT );
   LedOn();
-  
-  Broadcast = ReadBits( 1 );
 
-  MasterAddress = ReadBits( 12 );
-  bool p = ParityBit;
+  frame->Mode = TimingMode;
+  frame->Broadcast = ReadBits( 1 );
+
+  frame->MasterAddress = ReadBits( 12 );
+  bool p = Parity( frame->MasterAddress );
   if ( p != ReadBits( 1 ) ) {
     
+    EdgeFreeze( EDGE_PARITY_MASTER, TimingMode );
+
     if(SHOW_ERROR){
   //    UsartPutCStr( PSTR("AvcReadMessage: Parity error @ MasterAddress! \r\n") );
-      sprintf( UsartMsgBuffer, "AvcReadMessage: Parity error @ MasterAddress! B:0x%X M:0x%X \r\n", Broadcast, MasterAddress );
+      LogFlush();
+      sprintf( UsartMsgBuffer, "AvcReadMessage: Parity error @ MasterAddress! B:0x%X M:0x%X \r\n", frame->Broadcast, frame->MasterAddress );
       Serial.print( UsartMsgBuffer );
     }
     return false;
   }
+  Trace( TRACE_MASTER );
 
-  SlaveAddress = ReadBits( 12 );
-  p = ParityBit;
+  frame->SlaveAddress = ReadBits( 12 );
+  p = Parity( frame->SlaveAddress );
   if ( p != ReadBits( 1 ) ) {
     
+    EdgeFreeze( EDGE_PARITY_SLAVE, TimingMode );
+
     if(SHOW_ERROR){
   //    UsartPutCStr( PSTR("AvcReadMessage: Parity error @ SlaveAddress!\r\n") );
-      sprintf( UsartMsgBuffer, "AvcReadMessage: Parity error @ SlaveAddress! B:0x%X M:0x%X S:0x%X \r\n", Broadcast, MasterAddress, SlaveAddress );
+      LogFlush();
+      sprintf( UsartMsgBuffer, "AvcReadMessage: Parity error @ SlaveAddress! B:0x%X M:0x%X S:0x%X \r\n", frame->Broadcast, frame->MasterAddress, frame->SlaveAddress );
       Serial.print( UsartMsgBuffer );
     }
     return false;
   }
 
 
-  bool forMe = ( SlaveAddress == MY_ADDRESS );
+  AvcIdentity * me = FindIdentity( frame->SlaveAddress );
+  bool forMe = ( me != NULL );
 
   // In point-to-point communication, sender issues an ack bit with value '1' (20us). Receiver
   // upon acking will extend the bit until it looks like a '0' (32us) on the bus. In broadcast
@@ -304,19 +622,23 @@ bool AvcReadMessage ( void ) {
   }  else {
     ReadBits( 1 );
   }
+  Trace( TRACE_SLAVE );
 
-  Control = ReadBits( 4 );
-  p = ParityBit;
+  frame->Control = ReadBits( 4 );
+  p = Parity( frame->Control );
   if ( p != ReadBits( 1 ) )    {
     
+    EdgeFreeze( EDGE_PARITY_CONTROL, TimingMode );
+
     if(SHOW_ERROR){
   //    UsartPutCStr( PSTR("AvcReadMessage: Parity error @ Control!\r\n") );
-      sprintf( UsartMsgBuffer, "AvcReadMessage: Parity error @ Control! B:0x%X M:0x%X S:0x%X, C:0x%X \r\n", Broadcast, MasterAddress, SlaveAddress, Control );
+      LogFlush();
+      sprintf( UsartMsgBuffer, "AvcReadMessage: Parity error @ Control! B:0x%X M:0x%X S:0x%X, C:0x%X \r\n", frame->Broadcast, frame->MasterAddress, frame->SlaveAddress, frame->Control );
       Serial.print( UsartMsgBuffer );
     }
   
-    if(isRegistred && forMe){
-      isRegistred = false;
+    if(forMe && me->State == ID_REGISTERED){
+      me->State = ID_UNREGISTERED;
     }
     
     return false;
@@ -328,19 +650,23 @@ bool AvcReadMessage ( void ) {
   }    else    {
     ReadBits( 1 );
   }
+  Trace( TRACE_CONTROL );
 
-  DataSize = ReadBits( 8 );
-  p = ParityBit;
+  frame->DataSize = ReadBits( 8 );
+  p = Parity( frame->DataSize );
   if ( p != ReadBits( 1 ) )    {
     
+    EdgeFreeze( EDGE_PARITY_SIZE, TimingMode );
+
     if(SHOW_ERROR){
   //    UsartPutCStr( PSTR("AvcReadMessage: Parity error @ DataSize!\r\n") );
-      sprintf( UsartMsgBuffer, "AvcReadMessage: Parity error @ DataSize! B:0x%X M:0x%X S:0x%X, C:0x%X, L:0x%X \r\n", Broadcast, MasterAddress, SlaveAddress, Control, DataSize );
+      LogFlush();
+      sprintf( UsartMsgBuffer, "AvcReadMessage: Parity error @ DataSize! B:0x%X M:0x%X S:0x%X, C:0x%X, L:0x%X \r\n", frame->Broadcast, frame->MasterAddress, frame->SlaveAddress, frame->Control, frame->DataSize );
       Serial.print( UsartMsgBuffer );
     }
   
-    if(isRegistred && forMe){
-      isRegistred = false;
+    if(forMe && me->State == ID_REGISTERED){
+      me->State = ID_UNREGISTERED;
     }
     
     return false;
@@ -352,21 +678,28 @@ bool AvcReadMessage ( void ) {
   }    else    {
     ReadBits( 1 );
   }
+  Trace( TRACE_SIZE );
 
   byte i;
 
-  for ( i = 0; i < DataSize; i++ )    {
-    Data[i] = ReadBits( 8 );
-    p = ParityBit;
+  for ( i = 0; i < frame->DataSize; i++ )    {
+    byte value = ReadBits( 8 );
+    if ( i < IEBUS_DATA_SIZE ) {
+      frame->Data[i] = value;
+    }
+    p = Parity( value );
     if ( p != ReadBits( 1 ) )        {
       
+      EdgeFreeze( EDGE_PARITY_DATA, TimingMode );
+
       if(SHOW_ERROR){
+        LogFlush();
         sprintf( UsartMsgBuffer, "AvcReadMessage: Parity error @ Data[%d]\r\n", i );
         Serial.print( UsartMsgBuffer );
       }
   
-      if(isRegistred && forMe){
-        isRegistred = false;
+      if(forMe && me->State == ID_REGISTERED){
+        me->State = ID_UNREGISTERED;
       }
     
       return false;
@@ -380,6 +713,7 @@ bool AvcReadMessage ( void ) {
       ReadBits( 1 );
     }
   }
+  Trace( TRACE_DATA );
 
   // Dump message on terminal.
 //  if ( forMe ) UsartPutCStr( PSTR("AvcReadMessage: This message is for me!\r\n") );
@@ -390,28 +724,34 @@ bool AvcReadMessage ( void ) {
 
 
   if ( forMe ){
-    isRegistred = true;
-    lastRegistred = millis();
+    me->State = ID_REGISTERED;
+    me->LastSeen = ClockMillis();
   }
 
 //  inMessageComplite = true;
 
 
+  if ( PlayHeadUnit ) {
+    HuReceive( frame );
+  }
+
   // ====== Start Handle ping request from HU ======= //
-  if(DataSize == 0x3 && Data[0] == 0x10 && Data[2] == 0x1){
-    emulatorHandleBite = Data[1];
-//    LoadDataInGlogalRegisters ( &CmdDdisplayAnsver );
-    LoadDataInGlogalRegisters ( &CmdDdisplayAnsver2 );
-    
-    Data[1] = emulatorHandleBite;
-    SendMessage();
+  if(!PlayHeadUnit && frame->DataSize == 0x3 && frame->Data[0] == 0x10 && frame->Data[2] == 0x1){
+    byte handle = frame->Data[1];
+
+    if ( forMe ) {
+      me->Handle = handle;
+      AvcAnswerPing( me );
+    } else if ( frame->Broadcast == MSG_BCAST || frame->SlaveAddress == BROADCAST_ADDRESS ) {
+      // Net scan: every emulated device answers. A ping to another device is not ours.
+      for ( byte i = 0; i < IdentityCount; i++ ) {
+        Identities[i].Handle = handle;
+        AvcAnswerPing( &Identities[i] );
+      }
+    }
 
-    
-    isRegistred = true;
-    lastRegistred = millis();
-    
     LedOff();
-    return false;
+    return true;
   }
   // ====== End Handle ping request from HU ======= //
 
@@ -430,18 +770,18 @@ bool AvcReadMessage ( void ) {
 
 
   if(ONLY_MY){
-    if(forMe || (!Broadcast && SlaveAddress == BROADCAST_ADDRESS )){
-      DumpRawMessage( false );
+    if(forMe || (!frame->Broadcast && frame->SlaveAddress == BROADCAST_ADDRESS )){
+      DumpChangedMessage( frame );
     }
   }
   else{
-    DumpRawMessage( false );
+    DumpChangedMessage( frame );
   }
 
   
   LedOff();
 
-  return false;
+  return true;
 }
 
 
@@ -497,29 +837,27 @@ bool AvcReadMessage ( void ) {
 //}
 
 /*--------------------------------------------------------------------------------------------------
-  Name         :  LoadDataInGlogalRegisters
-  Description  :  Loads message data in global registers for given mesage ID.
-  Argument(s)  :  msg (AvcOutMessage *) -> Message to load.
+  Name         :  LoadHeader_P
+  Description  :  Loads the header of a PROGMEM message in a frame, the payload is not copied.
+  Argument(s)  :  frame (IebusFrame *) -> Frame to load.
+                  msg (AvcOutMessage *) -> Message in PROGMEM.
+                  id (AvcIdentity *) -> Sending device, gives the master address and the mode.
   Return value :  None.
   --------------------------------------------------------------------------------------------------*/
-void LoadDataInGlogalRegisters ( AvcOutMessage * msg ) {
-//  Description = msg->Description;
-  Broadcast = pgm_read_byte_near( &msg->Mode );
-  MasterAddress = MY_ADDRESS;
+void LoadHeader_P ( IebusFrame * frame, AvcOutMessage * msg, AvcIdentity * id ) {
+  frame->Broadcast = pgm_read_byte_near( &msg->Mode );
+  frame->MasterAddress = id->Address;
+  frame->Mode = pgm_read_byte_near( &id->Config->Mode );
 
-  if ( Broadcast == MSG_BCAST ) {
-    SlaveAddress = BROADCAST_ADDRESS;
+  if ( frame->Broadcast == MSG_BCAST ) {
+    frame->SlaveAddress = BROADCAST_ADDRESS;
   } else {
-    SlaveAddress = HU_ADDRESS;
+    frame->SlaveAddress = HU_ADDRESS;
   }
 
-  Control = CONTROL_FLAGS;
-
-  DataSize = pgm_read_byte_near( &msg->DataSize );
+  frame->Control = CONTROL_FLAGS;
 
-  for ( byte i = 0; i < DataSize; i++ ) {
-    Data[i] = pgm_read_byte_near( &msg->Data[i] );
-  }
+  frame->DataSize = pgm_read_byte_near( &msg->DataSize );
 }
 
 ///*--------------------------------------------------------------------------------------------------
@@ -561,32 +899,34 @@ void LoadDataInGlogalRegisters ( AvcOutMessage * msg ) {
   Return value :  None.
   --------------------------------------------------------------------------------------------------*/
 void Send12BitWord ( word data ){
-  ParityBit = 0;
+  const byte bit1 = Timing.Bit1Hold;
+  const byte bit0 = Timing.Bit0Hold;
+  const byte length = Timing.BitLength;
 
   // Most significant bit out first.
   for ( char nbBits = 0; nbBits < 12; nbBits++ )  {
     // Reset timer to measure bit length.
-    TCNT0 = 0;
+    EdgeTimerRestart();
 
     // Drive output to signal high.
     OUT_SET;
+    EdgeRise();
 
     if ( data & 0x0800 )    {
-      // Adjust parity.
-      ParityBit = ! ParityBit;
-      while ( TCNT0 < BIT_1_HOLD_ON_LENGTH );
+      while ( TCNT0 < bit1 );
     }    else    {
-      while ( TCNT0 < BIT_0_HOLD_ON_LENGTH );
+      while ( TCNT0 < bit0 );
     }
 
     // Release output.
     OUT_CLEAR;
+    EdgeFall( TCNT0 );
 
     // Fetch next bit.
     data <<= 1;
 
     // Hold output low until end of bit.
-    while ( TCNT0 < NORMAL_BIT_LENGTH );
+    while ( TCNT0 < length );
   }
 }
 
@@ -597,32 +937,34 @@ void Send12BitWord ( word data ){
   Return value :  None.
   --------------------------------------------------------------------------------------------------*/
 void Send8BitWord ( byte data ){
-  ParityBit = 0;
+  const byte bit1 = Timing.Bit1Hold;
+  const byte bit0 = Timing.Bit0Hold;
+  const byte length = Timing.BitLength;
 
   // Most significant bit out first.
   for ( char nbBits = 0; nbBits < 8; nbBits++ )  {
     // Reset timer to measure bit length.
-    TCNT0 = 0;
+    EdgeTimerRestart();
 
     // Drive output to signal high.
     OUT_SET;
+    EdgeRise();
 
     if ( data & 0x80 ) {
-      // Adjust parity.
-      ParityBit = ! ParityBit;
-      while ( TCNT0 < BIT_1_HOLD_ON_LENGTH );
+      while ( TCNT0 < bit1 );
     } else {
-      while ( TCNT0 < BIT_0_HOLD_ON_LENGTH );
+      while ( TCNT0 < bit0 );
     }
 
     // Release output.
     OUT_CLEAR;
+    EdgeFall( TCNT0 );
 
     // Fetch next bit.
     data <<= 1;
 
     // Hold output low until end of bit.
-    while ( TCNT0 < NORMAL_BIT_LENGTH );
+    while ( TCNT0 < length );
   }
 }
 
@@ -633,32 +975,34 @@ void Send8BitWord ( byte data ){
   Return value :  None.
   --------------------------------------------------------------------------------------------------*/
 void Send4BitWord ( byte data ){
-  ParityBit = 0;
+  const byte bit1 = Timing.Bit1Hold;
+  const byte bit0 = Timing.Bit0Hold;
+  const byte length = Timing.BitLength;
 
   // Most significant bit out first.
   for ( char nbBits = 0; nbBits < 4; nbBits++ )  {
     // Reset timer to measure bit length.
-    TCNT0 = 0;
+    EdgeTimerRestart();
 
     // Drive output to signal high.
     OUT_SET;
+    EdgeRise();
 
     if ( data & 0x8 )  {
-      // Adjust parity.
-      ParityBit = ! ParityBit;
-      while ( TCNT0 < BIT_1_HOLD_ON_LENGTH );
+      while ( TCNT0 < bit1 );
     }    else    {
-      while ( TCNT0 < BIT_0_HOLD_ON_LENGTH );
+      while ( TCNT0 < bit0 );
     }
 
     // Release output.
     OUT_CLEAR;
+    EdgeFall( TCNT0 );
 
     // Fetch next bit.
     data <<= 1;
 
     // Hold output low until end of bit.
-    while ( TCNT0 < NORMAL_BIT_LENGTH );
+    while ( TCNT0 < length );
   }
   
 }
@@ -671,21 +1015,23 @@ void Send4BitWord ( byte data ){
   --------------------------------------------------------------------------------------------------*/
 void Send1BitWord ( bool data ){
   // Reset timer to measure bit length.
-  TCNT0 = 0;
+  EdgeTimerRestart();
   // Drive output to signal high.
   OUT_SET;
+  EdgeRise();
 
   if ( data )  {
-    while ( TCNT0 < BIT_1_HOLD_ON_LENGTH );
+    while ( TCNT0 < Timing.Bit1Hold );
   }  else  {
-    while ( TCNT0 < BIT_0_HOLD_ON_LENGTH );
+    while ( TCNT0 < Timing.Bit0Hold );
   }
 
   // Release output.
   OUT_CLEAR;
+  EdgeFall( TCNT0 );
 
   // Pulse level low duration until 40 us.
-  while ( TCNT0 <  NORMAL_BIT_LENGTH );
+  while ( TCNT0 < Timing.BitLength );
 }
 
 /*--------------------------------------------------------------------------------------------------
@@ -700,15 +1046,17 @@ void SendStartBit ( void ){
 
   // Drive output to signal high.
   OUT_SET;
+  EdgeStart();
 
   // Pulse level high duration.
-  while ( TCNT0 < START_BIT_HOLD_ON_LENGTH );
+  while ( TCNT0 < Timing.StartHold );
 
   // Release output.
   OUT_CLEAR;
+  EdgeFall( TCNT0 );
 
   // Pulse level low duration until ~185 us.
-  while ( TCNT0 < START_BIT_LENGTH );
+  while ( TCNT0 < Timing.StartLength );
 }
 
 /*--------------------------------------------------------------------------------------------------
@@ -723,39 +1071,134 @@ void SendStartBit ( void ){
                        |---- 32 us ----| 7 |- 20 us -|- 19 us -|
   --------------------------------------------------------------------------------------------------*/
 word ReadBits ( byte nbBits ){
+  const RxTime half = RX_TICKS( Timing.HalfPeriod );
+  const RxTime glitch = RX_TICKS( RX_GLITCH_TICKS );
+  const RxTime longest = RX_TICKS( Timing.Bit0Hold + RX_ABORT_SLACK );
+  const byte bit0 = Timing.Bit0Hold;
+  byte late = RxLate;
   word data = 0;
 
-  ParityBit = 0;
+  if ( RxAborted ) {
+    return RX_ABORTED;
+  }
+
+  RxArm();
 
   while ( nbBits-- > 0 )  {
     // Insert new bit
     data <<= 1;
 
-    // Wait until rising edge of new bit.
-    while ( INPUT_IS_CLEAR );
+    RxTime high;
 
-    // Reset timer to measure bit length.
-    TCNT0 = 0;
+    // Pulses shorter than RX_GLITCH_TICKS are noise, the bit is the next pulse.
+    do {
+      // Wait until rising edge of new bit, bit timing restarts. No rise in time: the frame ended.
+      while ( !RX_RISEN ) {
+        if ( TCNT0 >= late ) {
+          return RxAbort( EDGE_ABORT_LATE );
+        }
+      }
+      RxTakeRise();
+      late = Timing.BitLength + RX_ABORT_SLACK;
+
+      // Wait until falling edge, a pulse longer than a '0' is not waited for.
+      RxWaitFall( longest + 1 );
+
+      high = RxHighTime();
+      EdgeFall( RX_TO_TICKS( high ) );
+      SIM_CYCLES( 2 );
+    } while ( high < glitch );
+
+    if ( high > longest ) {
+      return RxAbort( EDGE_ABORT_LONG );
+    }
 
-    // Wait until falling edge.
-    while ( INPUT_IS_SET );
-    
     // Compare half way between a '1' (20 us) and a '0' (32 us ): 32 - (32 - 20) /2 = 26 us
-    if ( TCNT0 < BIT_HOLD_HALF_PERIOD )    {
+    if ( high < half )    {
       // Set new bit.
       data |= 0x0001;
 
-      // Adjust parity.
-      ParityBit = ! ParityBit;
-      
-      while(TCNT0 < BIT_0_HOLD_ON_LENGTH);
+      while(TCNT0 < bit0);
+
+      RxArm();
     }
     
   }
 
+  RxLate = late;
   return data;
 }
 
+/*--------------------------------------------------------------------------------------------------
+  Name         :  RxAbort
+  Description  :  Gives the frame being read up after a bit that cannot be one.
+  Argument(s)  :  reason (EdgeReason) -> EDGE_ABORT_LATE or EDGE_ABORT_LONG.
+  Return value :  (word) -> RX_ABORTED, for ReadBits() to return.
+  --------------------------------------------------------------------------------------------------*/
+word RxAbort ( EdgeReason reason ){
+  RxAborted = true;
+
+  EdgeFreeze( reason, TimingMode );
+
+  if(SHOW_ERROR){
+    LogFlush();
+    Serial.print( reason == EDGE_ABORT_LATE ? "AvcReadMessage: No bit after a bit! \r\n" :
+                                              "AvcReadMessage: Pulse longer than a '0'! \r\n" );
+  }
+  return RX_ABORTED;
+}
+
+#if (INNER_COMPARATOR)
+/*--------------------------------------------------------------------------------------------------
+  Name         :  RxCaptureFall
+  Description  :  Waits for the fall capture armed by RxTakeRise(), sets RxWidth and arms the rise
+                  capture. A line low without a capture fell before the capture was armed, the
+                  pulse is a glitch (RxWidth 0). A line still high limit after the rise is not
+                  waited for any longer (RxWidth limit or more).
+  Argument(s)  :  limit (RxTime) -> Longest high time waited for (Timer 1 counts).
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void RxCaptureFall ( RxTime limit ){
+
+  while ( !RX_CAPTURED ) {
+    uint16_t elapsed = TCNT1 - RxRiseStamp;
+
+    if ( elapsed >= limit ) {
+      RxWidth = elapsed;
+      RX_CAPTURE_RISE();
+      return;
+    }
+
+    if ( INPUT_IS_CLEAR ) {
+      // The capture lags the comparator by the noise canceller (4 cycles), give it one count.
+      uint16_t low = TCNT1;
+      while ( (uint16_t)( TCNT1 - low ) < 2 );
+
+      if ( !RX_CAPTURED ) {
+        // A line high again is the next pulse, RX_RISEN sees it without a capture.
+        RxWidth = 0;
+        RX_CAPTURE_RISE();
+        return;
+      }
+    }
+  }
+
+  RxWidth = ICR1 - RxRiseStamp;
+  RX_CAPTURE_RISE();
+}
+#endif
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  Parity
+  Description  :  Parity of a field of up to 12 bits, from ParityTable instead of counting the '1'
+                  bits in the bit loops. Called between the last bit of the field and its parity bit.
+  Argument(s)  :  data (word) -> Field value.
+  Return value :  (bool) -> TRUE if the field has an odd number of '1' bits.
+  --------------------------------------------------------------------------------------------------*/
+bool Parity ( word data ){
+  return pgm_read_byte_near( &ParityTable[ (byte)( data ^ ( data >> 8 ) ) ] );
+}
+
 
 /*--------------------------------------------------------------------------------------------------
   Name         :  getStartBit
@@ -769,37 +1212,130 @@ word ReadBits ( byte nbBits ){
                        |---- 32 us ----| 7 |- 20 us -|- 19 us -|
   --------------------------------------------------------------------------------------------------*/
 bool getStartBit ( void ){
-  
-  // Wait until rising edge of new bit.
-  while ( INPUT_IS_CLEAR ) {
-    // Reset watchdog.
-    wdt_reset();
+
+#if (INNER_COMPARATOR)
+  // Drop edges captured while nobody was listening. If a pulse is in progress its rise is
+  // already latched in ICR1, if the pulse AvcReadMessage() saw is over it was noise.
+  if ( INPUT_IS_CLEAR ) {
+    RX_CAPTURE_RISE();
+    return false;
+  }
+
+  // A pulse that rose while the fall capture was armed is timed from here, like RxTakeRise().
+  RxRiseStamp = RX_CAPTURED ? ICR1 : TCNT1;
+  RX_CAPTURE_FALL();
+  TCNT0 = RX_SINCE_RISE();
+  EdgeStart();
+
+  const byte blind = 0;
+#else
+  // A start bit that rose while the scheduler tasks ran is seen up to RxBlind ticks late.
+  byte blind = RxBlind;
+  RxBlind = 0;
+
+  // The pulse AvcReadMessage() saw is over already: noise, not a start bit.
+  if ( INPUT_IS_CLEAR ) {
+    return false;
   }
 
   // Reset timer to measure bit length.
   TCNT0 = 0;
+  EdgeStart();
+#endif
 
-  // Wait until falling edge.
-  while ( INPUT_IS_SET );
-  
-  if ( TCNT0 > START_BIT_HOLD_ON_LENGTH - 2 && TCNT0 < START_BIT_LENGTH) {
-    return true;
-  }
-  else{
-    return false;
+  // Wait until falling edge, at most the longest start bit accepted.
+  RxWaitFall( RX_TICKS( pgm_read_byte_near( &IebusTimings[ IEBUS_AUTO_MODE ? 0 : IEBUS_MODE ].StartMax ) ) );
+
+  RxTime width = RxHighTime();
+  EdgeFall( ( RX_TO_TICKS( width ) < EDGE_TICKS ) ? RX_TO_TICKS( width ) : EDGE_TICKS );
+
+  // The start bit width tells the mode, the rest of the frame is read with its timings.
+  for ( byte mode = 0; mode < IEBUS_MODE_COUNT; mode++ ) {
+
+    if ( !IEBUS_AUTO_MODE && mode != IEBUS_MODE ) {
+      continue;
+    }
+
+    if ( width + RX_TICKS( blind ) > RX_TICKS( pgm_read_byte_near( &IebusTimings[ mode ].StartMin ) ) &&
+         width < RX_TICKS( pgm_read_byte_near( &IebusTimings[ mode ].StartMax ) ) ) {
+      IebusSelectMode( mode );
+
+      // Low time of the start bit, ours is StartLength - StartHold, the HU's up to twice that.
+      // A pulse in the first half of it is noise, no first bit.
+      byte low = Timing.StartLength - Timing.StartHold;
+      byte fall = RX_TO_TICKS( width );
+
+      while ( TCNT0 < fall + ( low >> 1 ) ) {
+        if ( INPUT_IS_SET ) {
+          return false;
+        }
+      }
+
+      RxLate = fall + 2 * low + RX_ABORT_SLACK;
+      RxAborted = false;
+      return true;
+    }
   }
 
+  return false;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  IebusSelectMode
+  Description  :  Loads the timings of a mode for the frame being read or sent. Runs in the low
+                  time after the start bit (30 us) when receiving.
+  Argument(s)  :  mode (byte) -> IEBus mode (IebusMode).
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void IebusSelectMode ( byte mode ){
+
+  if ( mode != TimingMode ) {
+    SIM_CYCLES( 40 );
+    memcpy_P( &Timing, &IebusTimings[ mode ], sizeof( IebusTiming ) );
+    TimingMode = mode;
+  }
 }
 
 /*--------------------------------------------------------------------------------------------------
   Name         :  SendMessage
-  Description  :  Sends the message in global registers on the AVC LAN bus.
-  Argument(s)  :  None.
+  Description  :  Sends a frame on the AVC LAN bus.
+  Argument(s)  :  frame (const IebusFrame *) -> Frame to send.
+  Return value :  (bool) -> TRUE if successful else FALSE.
+  --------------------------------------------------------------------------------------------------*/
+bool SendMessage ( const IebusFrame * frame ){
+  return SendFrame( frame, NULL );
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  SendMessage_P
+  Description  :  Sends a PROGMEM message on the AVC LAN bus, the payload is read from flash while
+                  it is sent.
+  Argument(s)  :  msg (AvcOutMessage *) -> Message in PROGMEM.
+                  id (AvcIdentity *) -> Sending device.
+  Return value :  (bool) -> TRUE if successful else FALSE.
+  --------------------------------------------------------------------------------------------------*/
+bool SendMessage_P ( AvcOutMessage * msg, AvcIdentity * id ){
+  IebusFrame frame;   // Header only, Data[] stays unused.
+
+  LoadHeader_P( &frame, msg, id );
+  return SendFrame( &frame, msg->Data );
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  SendFrame
+  Description  :  Sends a frame header and its payload on the AVC LAN bus.
+  Argument(s)  :  frame (const IebusFrame *) -> Frame to send.
+                  flash (const byte *) -> Payload in PROGMEM, NULL for frame->Data.
   Return value :  (bool) -> TRUE if successful else FALSE.
   --------------------------------------------------------------------------------------------------*/
-bool SendMessage ( void ){
+bool SendFrame ( const IebusFrame * frame, const byte * flash ){
   
-  while ( ! IsAvcBusFree() );
+  // A frame of another master may keep the bus longer than a Timer 1 period.
+  while ( ! IsAvcBusFree() ) {
+    ClockUpdate();
+  }
+  Trace( TRACE_BUS_FREE );
+  IebusSelectMode( frame->Mode );
   // At this point we know the bus is available.
   LedOn();
 
@@ -808,21 +1344,24 @@ bool SendMessage ( void ){
   
 
   // Broadcast bit.
-  Send1BitWord( Broadcast );
+  Send1BitWord( frame->Broadcast );
 
   // Master address = me.
-  Send12BitWord( MasterAddress );
-  Send1BitWord( ParityBit );
+  Send12BitWord( frame->MasterAddress );
+  Send1BitWord( Parity( frame->MasterAddress ) );
 
   // Slave address = head unit (HU).
-  Send12BitWord( SlaveAddress );
-  Send1BitWord( ParityBit );
+  Send12BitWord( frame->SlaveAddress );
+  Send1BitWord( Parity( frame->SlaveAddress ) );
   
 
-  if ( ! HandleAcknowledge() ) {
+  if ( ! HandleAcknowledge( frame->Broadcast ) ) {
     
+    EdgeFreeze( EDGE_NOACK_SLAVE, TimingMode );
+
     if(SHOW_ERROR){
-      DumpRawMessage( true );
+      LogSent( frame, flash );
+      LogFlush();
       Serial.print( (char*)"SendMessage: No Ack @ Slave address\r\n" );
     }
     
@@ -830,13 +1369,16 @@ bool SendMessage ( void ){
   }
 
   // Control flag + parity.
-  Send4BitWord( Control );
-  Send1BitWord( ParityBit );
+  Send4BitWord( frame->Control );
+  Send1BitWord( Parity( frame->Control ) );
 
-  if ( ! HandleAcknowledge() ) {
+  if ( ! HandleAcknowledge( frame->Broadcast ) ) {
     
+    EdgeFreeze( EDGE_NOACK_CONTROL, TimingMode );
+
     if(SHOW_ERROR){
-      DumpRawMessage( true );
+      LogSent( frame, flash );
+      LogFlush();
       Serial.print( (char*)"SendMessage: No Ack @ Control\r\n" );
     }
     
@@ -844,27 +1386,34 @@ bool SendMessage ( void ){
   }
 
   // Data length + parity.
-  Send8BitWord( DataSize );
-  Send1BitWord( ParityBit );
+  Send8BitWord( frame->DataSize );
+  Send1BitWord( Parity( frame->DataSize ) );
 
-  if ( ! HandleAcknowledge() ) {
+  if ( ! HandleAcknowledge( frame->Broadcast ) ) {
     
+    EdgeFreeze( EDGE_NOACK_SIZE, TimingMode );
+
     if(SHOW_ERROR){
-      DumpRawMessage( true );
+      LogSent( frame, flash );
+      LogFlush();
       Serial.print( (char*)"SendMessage: No Ack @ DataSize\r\n" );
     }
     
     return false;
   }
 
-  for ( byte i = 0; i < DataSize; i++ )  {
-    Send8BitWord( Data[i] );
-    Send1BitWord( ParityBit );
+  for ( byte i = 0; i < frame->DataSize; i++ )  {
+    byte value = flash ? pgm_read_byte_near( &flash[i] ) : frame->Data[i];
+    Send8BitWord( value );
+    Send1BitWord( Parity( value ) );
 
-    if ( ! HandleAcknowledge() )  {
+    if ( ! HandleAcknowledge( frame->Broadcast ) )  {
     
+      EdgeFreeze( EDGE_NOACK_DATA, TimingMode );
+
       if(SHOW_ERROR){
-        DumpRawMessage( true );
+        LogSent( frame, flash );
+        LogFlush();
         sprintf( UsartMsgBuffer, "SendMessage: No Ack @ Data[%d]\r\n", i );
         Serial.print( UsartMsgBuffer );
       }
@@ -874,8 +1423,11 @@ bool SendMessage ( void ){
   }
 
 
-      
-  DumpRawMessage( true );
+  Trace( TRACE_SENT );
+
+  if ( DumpOutgoing ) {
+    LogSent( frame, flash );
+  }
 
   LedOff();
   return true;
@@ -883,15 +1435,36 @@ bool SendMessage ( void ){
 
 
 
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LogSent
+  Description  :  Queues a sent frame for the log, a PROGMEM payload is copied in the log slot.
+  Argument(s)  :  See SendFrame.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void LogSent ( const IebusFrame * frame, const byte * flash ){
+
+  if ( flash == NULL ) {
+    LogPush( frame );
+    return;
+  }
+
+  IebusFrame * slot = LogAlloc();
+  if ( slot != NULL ) {
+    memcpy( slot, frame, offsetof( IebusFrame, Data ) );
+    memcpy_P( slot->Data, flash, IEBUS_STORED( frame ) );
+    LogCommit();
+  }
+}
+
 /*--------------------------------------------------------------------------------------------------
   Name         :  HandleAcknowledge
   Description  :  Sends ack bit if I am broadcasting otherwise wait and return received ack bit.
-  Argument(s)  :  None.
+  Argument(s)  :  broadcast (bool) -> Transmission mode of the frame being sent.
   Return value :  (bool) -> FALSE if ack bit not detected.
   --------------------------------------------------------------------------------------------------*/
-bool HandleAcknowledge ( void ){
+bool HandleAcknowledge ( bool broadcast ){
   
-  if ( Broadcast == MSG_BCAST )  {
+  if ( broadcast == MSG_BCAST )  {
     // Acknowledge.
     Send1BitWord( 0 );
     return true;
@@ -902,28 +1475,31 @@ bool HandleAcknowledge ( void ){
   // taken over the bus maintaining the pulse until the equivalent of a bit '0' (32 us) is formed.
 
   // Reset timer to measure bit length.
-  TCNT0 = 0;
+  EdgeTimerRestart();
 
   // Drive output to signal high.
   OUT_SET;
+  EdgeRise();
 
   // Generate bit '0'.
-  while ( TCNT0 < BIT_1_HOLD_ON_LENGTH );
+  while ( TCNT0 < Timing.Bit1Hold );
 
   // Release output.
   OUT_CLEAR;
 
   // Measure final resulting bit.
   while ( INPUT_IS_SET );
+  byte high = TCNT0;
+  EdgeFall( high );
 
   // Sample half-way through bit '0' (26 us) to detect whether the target is acknowledging.
-  if ( TCNT0 > BIT_HOLD_HALF_PERIOD ) {
+  if ( high > Timing.HalfPeriod ) {
     // Slave is acknowledging (ack = 0). Wait until end of ack bit.
-    while ( TCNT0 <  NORMAL_BIT_LENGTH );
+    while ( TCNT0 < Timing.BitLength );
     return true;
   }
   else{
-    while ( TCNT0 <  NORMAL_BIT_LENGTH );
+    while ( TCNT0 < Timing.BitLength );
     return false;
   }
 
@@ -943,18 +1519,20 @@ void SendAcknowledge ( void ){
   }
   
   // Reset timer to measure bit length.
-  TCNT0 = 0;
+  EdgeTimerRestart();
   while ( TCNT0 < 1 );
 
   // Drive output to signal high.
   OUT_SET;
+  EdgeRise();
 
   // Generate bit '0'.
-  while ( TCNT0 < BIT_0_HOLD_ON_LENGTH );
+  while ( TCNT0 < Timing.Bit0Hold );
 
   // Release output.
   OUT_CLEAR;
-  
+  EdgeFall( TCNT0 );
+  Trace( TRACE_ACK );
 }
 
 /*--------------------------------------------------------------------------------------------------
@@ -968,8 +1546,9 @@ bool IsAvcBusFree ( void ){
   TCNT0 = 0;
 
   while ( INPUT_IS_CLEAR ) {
-    // We assume the bus is free if anything happens for the length of 1 bit.
-    if ( TCNT0 > NORMAL_BIT_LENGTH )
+    // We assume the bus is free if anything happens for the length of 1 bit, of the mode last
+    // seen on the bus.
+    if ( TCNT0 > Timing.BitLength )
     {
       return true;
     }
@@ -979,89 +1558,36 @@ bool IsAvcBusFree ( void ){
 
 /*--------------------------------------------------------------------------------------------------
   Name         :  DumpRawMessage
-  Description  :  Dumps raw content of message registers on the terminal.
-  Argument(s)  :  incoming (bool) -> TRUE means incoming data, FALSE means outgoing.
+  Description  :  Dumps a frame on the terminal right away, after the lines still queued.
+  Argument(s)  :  frame (const IebusFrame *) -> Frame to dump.
   Return value :  None.
   --------------------------------------------------------------------------------------------------*/
-void DumpRawMessage ( bool incoming ){
-  // Dump message on terminal.
-
-//  if ( incoming )
-//    Serial.print("I:OUT ");
-//  else
-//    Serial.print("I:IN  ");
-
-  sprintf( UsartMsgBuffer, "B:%d ", Broadcast );
-  Serial.print( UsartMsgBuffer );
-  
-  #if (USE_SOFTSERIAL)
-    altSerial.print( UsartMsgBuffer );
-  #endif
-
-  sprintf( UsartMsgBuffer, "M:0X%0X ", MasterAddress );
-  Serial.print( UsartMsgBuffer );
-  
-  #if (USE_SOFTSERIAL)
-    altSerial.print( UsartMsgBuffer );
-  #endif
-
-  sprintf( UsartMsgBuffer, "S:0X%0X ", SlaveAddress );
-  Serial.print( UsartMsgBuffer );
-  
-  #if (USE_SOFTSERIAL)
-    altSerial.print( UsartMsgBuffer );
-  #endif
-
-  sprintf( UsartMsgBuffer, "CB:0X%0X ", Control );
-  Serial.print( UsartMsgBuffer );
-  
-  #if (USE_SOFTSERIAL)
-    altSerial.print( UsartMsgBuffer );
-  #endif
+void DumpRawMessage ( const IebusFrame * frame ){
+  Trace( TRACE_DUMP );
+  LogFlush();
 
-  sprintf( UsartMsgBuffer, "L:%0d ", DataSize );
-  Serial.print( UsartMsgBuffer );
-  
-  #if (USE_SOFTSERIAL)
-    altSerial.print( UsartMsgBuffer );
-  #endif
-
-  sprintf( UsartMsgBuffer, "DATA: " );
-  Serial.print( UsartMsgBuffer );
-  
-  #if (USE_SOFTSERIAL)
-    altSerial.print( UsartMsgBuffer );
-  #endif
-
-  for ( byte i = 0; i < DataSize; i++ ) {
-    sprintf( UsartMsgBuffer, "0X%0X ", Data[i] );
-    Serial.print( UsartMsgBuffer );
-  
-    #if (USE_SOFTSERIAL)
-      altSerial.print( UsartMsgBuffer );
-    #endif
+  for ( byte token = 0; LogFormatToken( frame, token, UsartMsgBuffer ); token++ ) {
+    LogPrint( UsartMsgBuffer );
   }
+  Trace( TRACE_DUMP_END );
+}
 
-  Serial.println();
-  
-  #if (USE_SOFTSERIAL)
-    altSerial.println();
-  #endif
-
+/*--------------------------------------------------------------------------------------------------
+  Name         :  DumpChangedMessage
+  Description  :  Queues the incoming message for the log unless the frame cache has seen the same
+                  payload.
+  Argument(s)  :  frame (const IebusFrame *) -> Received frame.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void DumpChangedMessage ( const IebusFrame * frame ){
 
-//  if(incoming){
-////    ctrlSerial.print("$");
-//    for ( byte i = 0; i < DataSize; i++ ) {
-//      if(i > 0)
-//        ctrlSerial.print(",");
-//      
-//      sprintf( UsartMsgBuffer, "%0X ", Data[i] );
-//      ctrlSerial.print(UsartMsgBuffer);
-//    }
-//    ctrlSerial.print(";");
-//    ctrlSerial.println();
-//  }
+#if (USE_FRAME_CACHE)
+  if ( !FrameCacheUpdate( frame ) ) {
+    return;
+  }
+#endif
 
+  LogPush( frame );
 }
 
 /*--------------------------------------------------------------------------------------------------
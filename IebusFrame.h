@@ -0,0 +1,51 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  IebusFrame.h
+  Description  :  IEBUS frame passed between the bus driver, the log and the frame cache.
+  Author       :  Panin Aleksandr
+  Copyright    :  (c) 2022 aleksandrpanin.ru
+  ----------------------------------------------------------------------------------------------------
+     AvcReadMessage() decodes into a frame given by the caller, SendMessage() sends one, the log
+     queue and the frame cache take them by pointer. No module works on shared message registers,
+     so a frame received while a reply is prepared does not overwrite the reply.
+
+     DataSize is the length field seen on the bus, Data[] keeps the first IEBUS_DATA_SIZE bytes.
+     Frames sent from SRAM shall not be longer than IEBUS_DATA_SIZE.
+     Messages in PROGMEM (AvcOutMessage) are sent with SendMessage_P() without a copy in SRAM.
+  --------------------------------------------------------------------------------------------------*/
+#ifndef _IEBUSFRAME_H_
+#define _IEBUSFRAME_H_
+
+#include <stddef.h>
+
+#define IEBUS_DATA_SIZE         32
+
+/*--------------------------------------------------------------------------------------------------
+                                       Type definitions
+--------------------------------------------------------------------------------------------------*/
+typedef struct{
+    bool                Broadcast;          // Transmission mode: normal (1) or broadcast (0).
+    word                MasterAddress;      // Master address.
+    word                SlaveAddress;       // Slave address.
+    byte                Control;            // Control bits.
+    byte                DataSize;           // Payload data size (bytes).
+    byte                Mode;               // IEBus mode (IebusMode): detected on receive, used to send.
+    byte                Data[ IEBUS_DATA_SIZE ]; // Payload data.
+
+} IebusFrame;
+
+// The SRAM sizes of Settings.h and tools/footprint count a frame as 40 bytes, the AVR pads nothing.
+#if defined( __AVR__ )
+static_assert( sizeof( IebusFrame ) == 8 + IEBUS_DATA_SIZE, "IebusFrame is counted as 8 + IEBUS_DATA_SIZE bytes" );
+#endif
+
+// Payload bytes stored in Data[].
+#define IEBUS_STORED( frame )   ( ( (frame)->DataSize < IEBUS_DATA_SIZE ) ? (frame)->DataSize : IEBUS_DATA_SIZE )
+
+// Frame header and stored payload, for copies.
+#define IEBUS_FRAME_BYTES( frame )  ( offsetof( IebusFrame, Data ) + IEBUS_STORED( frame ) )
+
+#endif // _IEBUSFRAME_H_
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/
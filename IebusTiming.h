@@ -0,0 +1,85 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  IebusTiming.h
+  Description  :  Bit timings of the IEBus modes, in Timer 0 ticks (4 us).
+  Author       :  Panin Aleksandr
+  Copyright    :  (c) 2022 aleksandrpanin.ru
+  ----------------------------------------------------------------------------------------------------
+     IEBus defines several bit rates (modes). The start bit of every frame is longer the slower
+     the mode, so the receiver tells the mode of a frame from the width of its start bit and reads
+     the rest of the frame with the matching row of IebusTimings. Frames are sent in the mode of
+     the sending identity (IdentityTable) or of the frame (IebusFrame.Mode).
+
+       Mode   Bit     '1' high   '0' high   Start high   Accepted start high
+       1      60 us   30 us      50 us      248 us       228 us .. below 280 us
+       2      40 us   20 us      33 us      168 us       156 us .. below 188 us
+
+     Mode 2 is the one of the Subaru head unit and keeps the figures the driver always used, but
+     for the lower bound of the start window: the head unit holds its start bit 165 us, and the
+     external comparator build times it from the loop pass that sees the rise, some us late, in
+     Timer 0 ticks of an arbitrary phase. It read 40 ticks now and then and was taken for noise.
+     Mode 1 is mode 2 scaled by the bit rate ratio (26 / 17 kbit/s, ~1.5); no mode 1 device was
+     captured yet, adjust its row against a real one.
+
+     Mode 0 (~6 kbit/s) is not supported: its start bit is longer than one Timer 0 period (255
+     ticks, 1020 us) and the Timer 0 overflow belongs to millis().
+
+     The table is constexpr, so the rules below are checked by the compiler. It lives in PROGMEM,
+     the row of the current frame is copied in SRAM (IebusSelectMode) so the bit loops compare
+     against a register load instead of a flash read.
+  --------------------------------------------------------------------------------------------------*/
+#ifndef _IEBUSTIMING_H_
+#define _IEBUSTIMING_H_
+
+/*--------------------------------------------------------------------------------------------------
+                                       Type definitions
+--------------------------------------------------------------------------------------------------*/
+typedef enum
+{
+    IEBUS_MODE_1 = 0,                       // ~17 kbit/s, 60 us bit
+    IEBUS_MODE_2,                           // ~26 kbit/s, 40 us bit, Subaru head unit
+    IEBUS_MODE_COUNT
+
+} IebusMode;
+
+typedef struct{
+    byte                BitLength;          // Length of a bit.
+    byte                Bit1Hold;           // High time of a '1' (also of an ack slot we send).
+    byte                Bit0Hold;           // High time of a '0' (also of an ack we give).
+    byte                HalfPeriod;         // Compare point between a '1' and a '0'.
+    byte                StartHold;          // High time of a start bit we send.
+    byte                StartLength;        // Length of a start bit we send.
+    byte                StartMin;           // A received start bit is longer than StartMin ...
+    byte                StartMax;           // ... and shorter than StartMax.
+
+} IebusTiming;
+
+/*--------------------------------------------------------------------------------------------------
+                                       Timing table
+--------------------------------------------------------------------------------------------------*/
+static constexpr IebusTiming IebusTimings[ IEBUS_MODE_COUNT ] PROGMEM =
+{
+  //  Bit  '1'  '0'  Half  Start  StartLen  Min  Max
+  {   15,   8,  13,   10,    62,      73,    56,  70 },    // IEBUS_MODE_1
+  {   10,   5,   9,    7,    42,      47,    38,  47 },    // IEBUS_MODE_2
+};
+
+// Rows sane, start windows ordered from the slowest mode and not overlapping.
+constexpr bool IebusTimingValid ( byte mode ) {
+  return mode >= IEBUS_MODE_COUNT ||
+         ( IebusTimings[ mode ].Bit1Hold < IebusTimings[ mode ].HalfPeriod &&
+           IebusTimings[ mode ].HalfPeriod < IebusTimings[ mode ].Bit0Hold &&
+           IebusTimings[ mode ].Bit0Hold < IebusTimings[ mode ].BitLength &&
+           IebusTimings[ mode ].StartMin < IebusTimings[ mode ].StartHold &&
+           IebusTimings[ mode ].StartHold < IebusTimings[ mode ].StartMax &&
+           IebusTimings[ mode ].StartHold < IebusTimings[ mode ].StartLength &&
+           ( mode == 0 || IebusTimings[ mode ].StartMax <= IebusTimings[ mode - 1 ].StartMin + 1 ) &&
+           IebusTimingValid( mode + 1 ) );
+}
+
+static_assert( IebusTimingValid( 0 ), "IebusTimings: bad row or overlapping start bit windows" );
+
+#endif // _IEBUSTIMING_H_
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,515 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  Inject.h
+  Description  :  Frames queued from binary commands on the serial port, sent between the frames.
+  Author       :  Panin Aleksandr
+  Copyright    :  (c) 2022 aleksandrpanin.ru
+  ----------------------------------------------------------------------------------------------------
+     With USE_INJECT a host sends frames through the device without a new AvcOutMessage in the
+     firmware. A command is a packet on the serial port:
+
+       0xA5  command  length  payload (length bytes, up to INJECT_COMMAND_SIZE)  CRC-8
+
+     The CRC (polynomial 0x07, from 0) covers command, length and payload. Bytes before a 0xA5
+     are skipped, so the text typed for other modules does no harm. Commands (InjectCommand):
+
+       INJECT_CMD_SEND      payload: frame records back to back, all queued in order
+       INJECT_CMD_PERIODIC  payload: slot, period (ms, 2 bytes), one frame record. The frame is
+                            sent now and then every period; period 0 without a record stops it
+       INJECT_CMD_CLEAR     no payload: empties the queue and stops the periodic frames
+
+     A frame record (numbers big endian):
+
+       tag        echoed in the status reports of the frame
+       flags      bit 7 broadcast (INJECT_BROADCAST), bit 6 master address follows
+                  (INJECT_MASTER, else the address of the first emulated device), bits 1..0
+                  IEBus mode (IebusMode)
+       [master]   2 bytes with INJECT_MASTER
+       address    2 bytes, control << 12 | slave address
+       size       payload bytes, up to IEBUS_DATA_SIZE
+       data       size bytes
+
+     InjectPoll(), a scheduler task, reads at most INJECT_PARSE_BYTES bytes a run and only the
+     ones already received, so it never waits for the host and returns to the bus between two
+     frames, and stops early when a start bit rises. Bytes arriving while a frame is read or sent
+     wait in the serial RX buffer, which holds INJECT_RX_BYTES. A command left unfinished for
+     INJECT_TIMEOUT ms is dropped.
+
+     Queued frames are kept as records in InjectQueue (INJECT_QUEUE_BYTES) and periodic ones in
+     InjectSchedules (INJECT_SCHEDULES slots, INJECT_SCHEDULE_DATA payload bytes). loop() calls
+     InjectService(), which sends one due frame per pass, the periodic ones first, back to back
+     like the load test, so the queue keeps the bus as busy as the frames allow.
+
+     The status of every frame is reported asynchronously, INJECT_LINE_ENTRIES "tag code" pairs a
+     line, between dump lines, followed by the free queue bytes (F) and the count of command
+     bytes read so far, modulo 256 (R):
+
+       TX:1AQ 1BQ 1AS 1BF F:97 R:212
+       TX LOST:3 F:97 R:212
+
+     Q queued, S sent and acked (broadcast: sent), F failed (no ack), O queue full, not queued,
+     B bad command (CRC, length, field; tag 00 when no record was read), C stopped (periodic slot
+     or INJECT_CMD_CLEAR, tag 00). Every command gets at least one report. Reports that do not fit
+     INJECT_STATUS_DEPTH are counted and printed as LOST. tools/inject sends commands from a text
+     script and prints the reports.
+
+     F and R give the host a window instead of waiting for the reports of every command, which
+     would leave the queue empty while the next one is on its way: the bytes sent but not read
+     yet (sent - R, modulo 256) shall fit INJECT_RX_BYTES, and the records of a command
+     (INJECT_RECORD_HEADER + size queued bytes each) shall fit F less the records sent and not
+     reported Q or O yet. Both figures are late by the time the line takes to the host, so the
+     window is only ever too small. Without a line yet, or with all records reported, a host
+     sends one command and waits for its reports (tools/inject/InjectHost.h).
+  --------------------------------------------------------------------------------------------------*/
+#ifndef _INJECT_H_
+#define _INJECT_H_
+
+#define INJECT_SYNC_BYTE        0xA5
+#define INJECT_RX_BYTES         63          // Serial RX buffer of the device.
+#define INJECT_COMMAND_SIZE     ( INJECT_RX_BYTES - 4 )     // A packet fills the RX buffer.
+
+#define INJECT_BROADCAST        0x80        // Record flags.
+#define INJECT_MASTER           0x40
+#define INJECT_MODE             0x03
+
+#define INJECT_RECORD_HEADER    7           // Queued record: tag, flags, master, address, size.
+#define INJECT_WIRE_HEADER      5           // Record in a command without the master address.
+
+// Queued size of a command record of used bytes.
+#define INJECT_STORED_BYTES( in, used ) ( (used) + ( ( (in)[1] & INJECT_MASTER ) ? 0 : 2 ) )
+
+#define INJECT_LINE_ENTRIES     8           // "TTC " each.
+#define INJECT_LINE_BYTES       ( 3 + INJECT_LINE_ENTRIES * 4 + 11 + 2 )   // "F:255 R:255".
+
+/*--------------------------------------------------------------------------------------------------
+                                       Type definitions
+--------------------------------------------------------------------------------------------------*/
+typedef enum
+{
+    INJECT_CMD_SEND = 1,
+    INJECT_CMD_PERIODIC,
+    INJECT_CMD_CLEAR
+
+} InjectCommand;
+
+typedef enum
+{
+    INJECT_QUEUED   = 'Q',
+    INJECT_SENT     = 'S',
+    INJECT_FAILED   = 'F',
+    INJECT_OVERFLOW = 'O',
+    INJECT_BAD      = 'B',
+    INJECT_STOPPED  = 'C'
+
+} InjectStatus;
+
+typedef enum
+{
+    INJECT_WAIT_SYNC = 0,
+    INJECT_WAIT_COMMAND,
+    INJECT_WAIT_LENGTH,
+    INJECT_WAIT_PAYLOAD,
+    INJECT_WAIT_CHECK
+
+} InjectParserState;
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  InjectCrc8
+  Description  :  CRC-8 of the command packets, polynomial 0x07. Shared with the host tools.
+  Argument(s)  :  crc (byte) -> CRC so far, 0 before the first byte.
+                  data (byte) -> Next byte.
+  Return value :  (byte) -> CRC with the byte.
+  --------------------------------------------------------------------------------------------------*/
+static inline byte InjectCrc8 ( byte crc, byte data ) {
+  crc ^= data;
+  for ( byte i = 0; i < 8; i++ ) {
+    crc = ( crc & 0x80 ) ? (byte)( ( crc << 1 ) ^ 0x07 ) : (byte)( crc << 1 );
+  }
+  return crc;
+}
+
+#ifdef INJECT_QUEUE_BYTES                   // Without the settings (host tools) the protocol only.
+
+#if (USE_INJECT)
+static_assert( !( USE_EDGE_RECORDER && !EDGE_RECORDER_STREAM ),
+               "USE_INJECT reads the serial port, the edge recorder shall stream (EDGE_RECORDER_STREAM)" );
+#endif
+static_assert( INJECT_QUEUE_BYTES <= 255 && INJECT_QUEUE_BYTES >= INJECT_RECORD_HEADER + IEBUS_DATA_SIZE,
+               "INJECT_QUEUE_BYTES shall hold the longest frame and fit a byte" );
+static_assert( INJECT_SCHEDULE_DATA <= IEBUS_DATA_SIZE, "INJECT_SCHEDULE_DATA is a payload size" );
+
+/*--------------------------------------------------------------------------------------------------
+                                       Type definitions
+--------------------------------------------------------------------------------------------------*/
+typedef struct{
+    word                Period;             // ms, 0: slot free.
+    unsigned long       Due;                // ClockMillis() of the next send.
+    byte                Record[ INJECT_RECORD_HEADER + INJECT_SCHEDULE_DATA ];
+
+} InjectSchedule;
+
+typedef struct{
+    byte                Tag;
+    byte                Status;             // InjectStatus.
+
+} InjectReport;
+
+/*--------------------------------------------------------------------------------------------------
+                                         Prototypes
+--------------------------------------------------------------------------------------------------*/
+void            InjectPoll ( void );
+void            InjectService ( void );
+
+static void     InjectExecute ( void );
+static byte     InjectCheckRecord ( const byte * in, const byte * end );
+static byte     InjectCopyRecord ( const byte * in, byte * out );
+static void     InjectLoadFrame ( IebusFrame * frame, const byte * record );
+static void     InjectReportStatus ( byte tag, byte status );
+static void     InjectPrintReports ( void );
+
+/*--------------------------------------------------------------------------------------------------
+                                      Global Variables
+  --------------------------------------------------------------------------------------------------*/
+static byte             InjectQueue[ INJECT_QUEUE_BYTES ];      // Records, oldest first.
+static byte             InjectQueueUsed = 0;
+static InjectSchedule   InjectSchedules[ INJECT_SCHEDULES ];
+
+static byte             InjectState = INJECT_WAIT_SYNC;
+static byte             InjectCommandId;
+static byte             InjectLength;
+static byte             InjectFilled;
+static byte             InjectCrc;
+static byte             InjectPayload[ INJECT_COMMAND_SIZE ];
+static unsigned long    InjectLastByte;     // ClockMillis() of the last byte of an unfinished command.
+static byte             InjectReadBytes = 0;    // Bytes read, modulo 256 (R of the status lines).
+
+static InjectReport     InjectReports[ INJECT_STATUS_DEPTH ];
+static byte             InjectReportHead = 0;
+static byte             InjectReportCount = 0;
+static unsigned long    InjectLost = 0;
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  InjectPoll
+  Description  :  Reads the command bytes received so far and prints the status reports.
+                  Scheduler task.
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void InjectPoll ( void ) {
+
+  if ( InjectState != INJECT_WAIT_SYNC && Serial.available() == 0 &&
+       ClockMillis() - InjectLastByte > INJECT_TIMEOUT ) {
+    InjectState = INJECT_WAIT_SYNC;
+    InjectReportStatus( 0, INJECT_BAD );
+  }
+
+  for ( byte n = 0; n < INJECT_PARSE_BYTES && Serial.available() > 0; n++ ) {
+
+    // A start bit: the rest waits for the next run, as in LogDrain().
+    if ( INPUT_IS_SET ) {
+      break;
+    }
+
+    byte data = Serial.read();
+
+    InjectLastByte = ClockMillis();
+    InjectReadBytes++;
+
+    switch ( InjectState ) {
+      case INJECT_WAIT_SYNC:
+        if ( data == INJECT_SYNC_BYTE ) {
+          InjectCrc   = 0;
+          InjectState = INJECT_WAIT_COMMAND;
+        }
+        continue;
+
+      case INJECT_WAIT_COMMAND:
+        InjectCommandId = data;
+        InjectState     = INJECT_WAIT_LENGTH;
+        break;
+
+      case INJECT_WAIT_LENGTH:
+        if ( data > INJECT_COMMAND_SIZE ) {
+          InjectState = INJECT_WAIT_SYNC;
+          InjectReportStatus( 0, INJECT_BAD );
+          continue;
+        }
+        InjectLength = data;
+        InjectFilled = 0;
+        InjectState  = ( data != 0 ) ? INJECT_WAIT_PAYLOAD : INJECT_WAIT_CHECK;
+        break;
+
+      case INJECT_WAIT_PAYLOAD:
+        InjectPayload[ InjectFilled++ ] = data;
+        if ( InjectFilled == InjectLength ) {
+          InjectState = INJECT_WAIT_CHECK;
+        }
+        break;
+
+      default:
+        InjectState = INJECT_WAIT_SYNC;
+        if ( data == InjectCrc ) {
+          InjectExecute();
+        } else {
+          InjectReportStatus( 0, INJECT_BAD );
+        }
+        continue;
+    }
+
+    InjectCrc = InjectCrc8( InjectCrc, data );
+  }
+
+  InjectPrintReports();
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  InjectExecute
+  Description  :  Runs the command in InjectPayload.
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void InjectExecute ( void ) {
+  const byte * in  = InjectPayload;
+  const byte * end = InjectPayload + InjectLength;
+
+  switch ( InjectCommandId ) {
+    case INJECT_CMD_SEND:
+      if ( in == end ) {
+        InjectReportStatus( 0, INJECT_BAD );
+      }
+      while ( in < end ) {
+        byte used = InjectCheckRecord( in, end );
+
+        if ( used == 0 ) {
+          // The records after a bad one cannot be found.
+          InjectReportStatus( in[0], INJECT_BAD );
+          return;
+        }
+        if ( INJECT_STORED_BYTES( in, used ) > INJECT_QUEUE_BYTES - InjectQueueUsed ) {
+          InjectReportStatus( in[0], INJECT_OVERFLOW );
+        } else {
+          InjectQueueUsed += InjectCopyRecord( in, &InjectQueue[ InjectQueueUsed ] );
+          InjectReportStatus( in[0], INJECT_QUEUED );
+        }
+        in += used;
+      }
+      break;
+
+    case INJECT_CMD_PERIODIC:
+    {
+      if ( InjectLength < 3 || in[0] >= INJECT_SCHEDULES ) {
+        InjectReportStatus( 0, INJECT_BAD );
+        break;
+      }
+
+      InjectSchedule * slot = &InjectSchedules[ in[0] ];
+      word period = ( (word)in[1] << 8 ) | in[2];
+      byte used = InjectCheckRecord( in + 3, end );
+
+      if ( period == 0 ) {
+        InjectReportStatus( slot->Period ? slot->Record[0] : 0, INJECT_STOPPED );
+        slot->Period = 0;
+        break;
+      }
+      if ( used == 0 || used != InjectLength - 3 ||
+           INJECT_STORED_BYTES( in + 3, used ) > (int)sizeof( slot->Record ) ) {
+        InjectReportStatus( InjectLength > 3 ? in[3] : 0, INJECT_BAD );
+        break;
+      }
+
+      InjectCopyRecord( in + 3, slot->Record );
+      slot->Period = period;
+      slot->Due    = ClockMillis();
+      InjectReportStatus( in[3], INJECT_QUEUED );
+      break;
+    }
+
+    case INJECT_CMD_CLEAR:
+      InjectQueueUsed = 0;
+      for ( byte i = 0; i < INJECT_SCHEDULES; i++ ) {
+        InjectSchedules[i].Period = 0;
+      }
+      InjectReportStatus( 0, INJECT_STOPPED );
+      break;
+
+    default:
+      InjectReportStatus( 0, INJECT_BAD );
+      break;
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  InjectCheckRecord
+  Description  :  Checks a frame record of a command: fields in range, all bytes in the command.
+  Argument(s)  :  in (const byte *) -> Record in the command.
+                  end (const byte *) -> End of the command payload.
+  Return value :  (byte) -> Bytes of the record, 0 if it is bad.
+  --------------------------------------------------------------------------------------------------*/
+byte InjectCheckRecord ( const byte * in, const byte * end ) {
+
+  if ( end - in < 2 ) {
+    return 0;
+  }
+
+  byte header = INJECT_WIRE_HEADER + ( ( in[1] & INJECT_MASTER ) ? 2 : 0 );
+
+  if ( end - in < header || ( in[1] & INJECT_MODE ) >= IEBUS_MODE_COUNT ) {
+    return 0;
+  }
+
+  byte size = in[ header - 1 ];
+  if ( size > IEBUS_DATA_SIZE || end - in < header + size ) {
+    return 0;
+  }
+
+  return header + size;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  InjectCopyRecord
+  Description  :  Copies a checked record of a command as a queued record, the master address
+                  filled in.
+  Argument(s)  :  in (const byte *) -> Record in the command.
+                  out (byte *) -> Queued record.
+  Return value :  (byte) -> Bytes of the queued record.
+  --------------------------------------------------------------------------------------------------*/
+byte InjectCopyRecord ( const byte * in, byte * out ) {
+  const byte * field = in + 2;
+  word master = Identities[0].Address;
+
+  if ( in[1] & INJECT_MASTER ) {
+    master = ( (word)field[0] << 8 ) | field[1];
+    field += 2;
+  }
+
+  out[0] = in[0];
+  out[1] = in[1] & ( INJECT_BROADCAST | INJECT_MODE );
+  out[2] = master >> 8;
+  out[3] = master & 0xFF;
+  memcpy( &out[4], field, 3 + field[2] );
+
+  return INJECT_RECORD_HEADER + field[2];
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  InjectLoadFrame
+  Description  :  Loads a queued record in a frame.
+  Argument(s)  :  frame (IebusFrame *) -> Frame to load.
+                  record (const byte *) -> Queued record.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void InjectLoadFrame ( IebusFrame * frame, const byte * record ) {
+  frame->Broadcast     = ( record[1] & INJECT_BROADCAST ) ? MSG_BCAST : MSG_NORMAL;
+  frame->Mode          = record[1] & INJECT_MODE;
+  frame->MasterAddress = ( (word)record[2] << 8 ) | record[3];
+  frame->SlaveAddress  = ( (word)( record[4] & 0x0F ) << 8 ) | record[5];
+  frame->Control       = record[4] >> 4;
+  frame->DataSize      = record[6];
+  memcpy( frame->Data, &record[ INJECT_RECORD_HEADER ], frame->DataSize );
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  InjectService
+  Description  :  Sends one due frame: a periodic one, else the oldest queued one. Call from
+                  loop().
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void InjectService ( void ) {
+  IebusFrame frame;
+  byte tag;
+
+  for ( byte i = 0; i < INJECT_SCHEDULES; i++ ) {
+    InjectSchedule * slot = &InjectSchedules[i];
+
+    if ( slot->Period == 0 || (long)( ClockMillis() - slot->Due ) < 0 ) {
+      continue;
+    }
+    // Do not try to catch up after the bus was busy for longer than a period.
+    if ( ClockMillis() - slot->Due > slot->Period ) {
+      slot->Due = ClockMillis();
+    }
+    slot->Due += slot->Period;
+
+    InjectLoadFrame( &frame, slot->Record );
+    InjectReportStatus( slot->Record[0], SendMessage( &frame ) ? INJECT_SENT : INJECT_FAILED );
+    return;
+  }
+
+  if ( InjectQueueUsed == 0 ) {
+    return;
+  }
+
+  InjectLoadFrame( &frame, InjectQueue );
+  tag = InjectQueue[0];
+
+  byte size = INJECT_RECORD_HEADER + frame.DataSize;
+  InjectQueueUsed -= size;
+  memmove( InjectQueue, &InjectQueue[ size ], InjectQueueUsed );
+
+  InjectReportStatus( tag, SendMessage( &frame ) ? INJECT_SENT : INJECT_FAILED );
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  InjectReportStatus
+  Description  :  Queues a status report, counts it as lost when the queue is full.
+  Argument(s)  :  tag (byte) -> Tag of the frame.
+                  status (byte) -> InjectStatus.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void InjectReportStatus ( byte tag, byte status ) {
+
+  if ( InjectReportCount == INJECT_STATUS_DEPTH ) {
+    InjectLost++;
+    return;
+  }
+
+  InjectReport * report = &InjectReports[ ( InjectReportHead + InjectReportCount++ ) % INJECT_STATUS_DEPTH ];
+  report->Tag    = tag;
+  report->Status = status;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  InjectPrintReports
+  Description  :  Prints one line of status reports and the window of the host, between dump
+                  lines and while the line fits the serial TX buffer.
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void InjectPrintReports ( void ) {
+
+  if ( ( InjectReportCount == 0 && InjectLost == 0 ) || LogToken != 0 ||
+       Serial.availableForWrite() < INJECT_LINE_BYTES ) {
+    return;
+  }
+
+  if ( InjectReportCount == 0 ) {
+    LogValue( "TX LOST:", InjectLost, 10 );
+    LogPrint( " " );
+    InjectLost = 0;
+  } else {
+    LogPrint( "TX:" );
+  }
+  for ( byte i = 0; i < INJECT_LINE_ENTRIES && InjectReportCount != 0; i++ ) {
+    const InjectReport * report = &InjectReports[ InjectReportHead ];
+    char * end = LogNumber( UsartMsgBuffer, report->Tag, 16, 2 );
+
+    end[0] = report->Status;
+    end[1] = ' ';
+    end[2] = '\0';
+    LogPrint( UsartMsgBuffer );
+
+    InjectReportHead = ( InjectReportHead + 1 ) % INJECT_STATUS_DEPTH;
+    InjectReportCount--;
+  }
+  LogValue( "F:", INJECT_QUEUE_BYTES - InjectQueueUsed, 10 );
+  LogValue( " R:", InjectReadBytes, 10 );
+  LogPrint( "\r\n" );
+}
+
+#endif // INJECT_QUEUE_BYTES
+
+#endif // _INJECT_H_
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,227 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LoadTest.h
+  Description  :  Bus traffic generator for stress-testing IEBUS receivers.
+  Author       :  Panin Aleksandr
+  Copyright    :  (c) 2022 aleksandrpanin.ru
+  ----------------------------------------------------------------------------------------------------
+     With LOAD_TEST_MODE the device stops emulating the display and acts as a master sending
+     generated frames through SendMessage(). Frames come either from LoadTestScript (PROGMEM) or
+     from a xorshift generator: broadcast or point-to-point, to HU_ADDRESS, MY_ADDRESS or a random
+     address, with 0..LOAD_TEST_MAX_SIZE payload bytes.
+
+     Frames go out every 1/LOAD_TEST_RATE s, or back to back when LOAD_TEST_RATE is 0. Every
+     LOAD_TEST_REPORT ms the scheduler prints the achieved rate, or 1 ms later while a log line
+     is half printed or the serial TX buffer has no room for the line. Both the pacing and the
+     report run from ClockMicros() and ClockMillis() (Clock.h): millis() and micros() stand still
+     while the bus code restarts Timer 0 at every bit.
+
+       LT FPS:412 OK:398 FAIL:14
+
+     The generator only fills an IebusFrame, so tools/sim drives the same code on the host and the
+     numbers of the bench and of the simulator are comparable.
+  --------------------------------------------------------------------------------------------------*/
+#ifndef _LOADTEST_H_
+#define _LOADTEST_H_
+
+#define LOAD_TEST_LINE          44          // "LT FPS:65535 OK:4294967295 FAIL:4294967295\r\n"
+
+/*--------------------------------------------------------------------------------------------------
+                                       Type definitions
+--------------------------------------------------------------------------------------------------*/
+typedef struct{
+    AvcTransmissionMode Mode;               // Transmission mode: normal (1) or broadcast (0).
+    word                SlaveAddress;       // Target address.
+    byte                DataSize;           // Payload data size, bytes past Data[] are a counter.
+    byte                Data[ 6 ];          // Payload data.
+
+} LoadTestFrame;
+
+/*--------------------------------------------------------------------------------------------------
+                                         Prototypes
+--------------------------------------------------------------------------------------------------*/
+void            LoadTestNextFrame ( IebusFrame * frame );
+void            LoadTestService ( void );
+void            LoadTestReport ( void );
+
+void            SchedulerSetPeriod ( word period );     // Scheduler.h
+
+static void     LoadTestRandomFrame ( IebusFrame * frame );
+static void     LoadTestScriptFrame ( IebusFrame * frame );
+static uint16_t LoadTestRandom ( void );
+
+/*--------------------------------------------------------------------------------------------------
+                                      Global Variables
+  --------------------------------------------------------------------------------------------------*/
+static const LoadTestFrame LoadTestScript[] PROGMEM =
+{
+  { MSG_NORMAL, HU_ADDRESS,         1, {0x1F} },
+  { MSG_BCAST,  BROADCAST_ADDRESS,  1, {0x12} },
+  { MSG_NORMAL, MY_ADDRESS,         3, {0x10, 0x01, 0x01} },
+  { MSG_NORMAL, HU_ADDRESS,         6, {0x11, 0x00, 0x01, 0x02, 0x85, 0x93} },
+  { MSG_NORMAL, MY_ADDRESS,         0, {} },
+  { MSG_BCAST,  BROADCAST_ADDRESS,  32, {0x00, 0xFF, 0x55, 0xAA} },
+  { MSG_NORMAL, HU_ADDRESS,         32, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF} },
+};
+
+const byte LoadTestScriptSize = sizeof( LoadTestScript ) / sizeof( LoadTestFrame );
+
+#if (LOAD_TEST_RATE)
+  static unsigned long  LoadTestPeriod = 1000000UL / LOAD_TEST_RATE;  // us
+#else
+  static unsigned long  LoadTestPeriod = 0;
+#endif
+static IebusFrame       LoadTestOut;
+static unsigned long    LoadTestDue = 0;
+static unsigned long    timerLoadTestReport = 0;
+static unsigned long    LoadTestSent = 0;
+static unsigned long    LoadTestFailed = 0;
+static unsigned long    LoadTestWindow = 0;
+static bool             LoadTestRandomFrames = LOAD_TEST_RANDOM;
+static uint16_t         LoadTestSeed = LOAD_TEST_SEED;
+static byte             LoadTestScriptIndex = 0;
+static byte             LoadTestMode = IEBUS_MODE;
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LoadTestNextFrame
+  Description  :  Loads the next generated frame.
+  Argument(s)  :  frame (IebusFrame *) -> Frame to load.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void LoadTestNextFrame ( IebusFrame * frame ) {
+  frame->MasterAddress = MY_ADDRESS;
+  frame->Control       = CONTROL_FLAGS;
+  frame->Mode          = LoadTestMode;
+
+  if ( LoadTestRandomFrames ) {
+    LoadTestRandomFrame( frame );
+  } else {
+    LoadTestScriptFrame( frame );
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LoadTestRandomFrame
+  Description  :  Loads a random frame.
+  Argument(s)  :  frame (IebusFrame *) -> Frame to load.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void LoadTestRandomFrame ( IebusFrame * frame ) {
+  byte pick = LoadTestRandom() & 0x7;
+
+  if ( pick == 0 ) {
+    frame->Broadcast    = MSG_BCAST;
+    frame->SlaveAddress = BROADCAST_ADDRESS;
+  } else {
+    frame->Broadcast    = MSG_NORMAL;
+    if ( pick <= 2 ) {
+      frame->SlaveAddress = MY_ADDRESS;
+    } else if ( pick <= 5 ) {
+      frame->SlaveAddress = HU_ADDRESS;
+    } else {
+      frame->SlaveAddress = LoadTestRandom() & 0xFFF;
+    }
+  }
+
+  frame->DataSize = LoadTestRandom() % ( LOAD_TEST_MAX_SIZE + 1 );
+
+  for ( byte i = 0; i < IEBUS_STORED( frame ); i++ ) {
+    frame->Data[i] = (byte)LoadTestRandom();
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LoadTestScriptFrame
+  Description  :  Loads the next frame of LoadTestScript.
+  Argument(s)  :  frame (IebusFrame *) -> Frame to load.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void LoadTestScriptFrame ( IebusFrame * frame ) {
+  const LoadTestFrame * entry = &LoadTestScript[ LoadTestScriptIndex ];
+
+  if ( ++LoadTestScriptIndex >= LoadTestScriptSize ) {
+    LoadTestScriptIndex = 0;
+  }
+
+  frame->Broadcast    = pgm_read_byte_near( &entry->Mode );
+  frame->SlaveAddress = pgm_read_word_near( &entry->SlaveAddress );
+  frame->DataSize     = pgm_read_byte_near( &entry->DataSize );
+
+  for ( byte i = 0; i < IEBUS_STORED( frame ); i++ ) {
+    frame->Data[i] = ( i < sizeof( entry->Data ) ) ? pgm_read_byte_near( &entry->Data[i] ) : i;
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LoadTestService
+  Description  :  Sends the next frame when due. Call from loop().
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void LoadTestService ( void ) {
+
+  if ( (long)( ClockMicros() - LoadTestDue ) >= 0 ) {
+    // Do not try to catch up after the bus was busy for longer than a period.
+    if ( (long)( ClockMicros() - LoadTestDue ) > (long)LoadTestPeriod ) {
+      LoadTestDue = ClockMicros();
+    }
+    LoadTestDue += LoadTestPeriod;
+
+    LoadTestNextFrame( &LoadTestOut );
+
+    if ( SendMessage( &LoadTestOut ) ) {
+      LoadTestSent++;
+    } else {
+      LoadTestFailed++;
+    }
+    LoadTestWindow++;
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LoadTestReport
+  Description  :  Prints the achieved rate when the line fits the serial TX buffer, else tries
+                  again 1 ms later. Scheduler task, every LOAD_TEST_REPORT ms.
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void LoadTestReport ( void ) {
+
+  if ( LogToken != 0 || Serial.availableForWrite() < LOAD_TEST_LINE ) {
+    SchedulerSetPeriod( 1 );
+    return;
+  }
+  SchedulerSetPeriod( LOAD_TEST_REPORT );
+
+  unsigned long elapsed = ClockMillis() - timerLoadTestReport;
+
+  if ( elapsed == 0 ) {
+    return;
+  }
+  timerLoadTestReport = ClockMillis();
+
+  LogValue( "LT FPS:", LoadTestWindow * 1000UL / elapsed, 10 );
+  LogValue( " OK:", LoadTestSent, 10 );
+  LogValue( " FAIL:", LoadTestFailed, 10 );
+  LogPrint( "\r\n" );
+
+  LoadTestWindow = 0;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LoadTestRandom
+  Description  :  16 bit xorshift generator, same sequence on the device and on the host.
+  Argument(s)  :  None.
+  Return value :  (uint16_t) -> Next random value.
+  --------------------------------------------------------------------------------------------------*/
+uint16_t LoadTestRandom ( void ) {
+  LoadTestSeed ^= LoadTestSeed << 7;
+  LoadTestSeed ^= LoadTestSeed >> 9;
+  LoadTestSeed ^= LoadTestSeed << 8;
+  return LoadTestSeed;
+}
+
+#endif // _LOADTEST_H_
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,295 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  Log.h
+  Description  :  Frame log queue, printed on the serial port without blocking the bus reader.
+  Author       :  Panin Aleksandr
+  Copyright    :  (c) 2022 aleksandrpanin.ru
+  ----------------------------------------------------------------------------------------------------
+     A dump line is up to 200 characters, 17 ms at 115200 baud, while the HU sends the next frame
+     a few ms later. Printing it right after the frame keeps the CPU in Serial.print() and the
+     following frames are lost.
+
+     LogPush() copies the frame in a queue of LOG_QUEUE_DEPTH frames (LogAlloc() / LogCommit()
+     let the sender fill a slot in place). LogDrain() runs as a
+     scheduler task between frames and prints the head record one token ("M:0X130 ", "0X85 ", ...)
+     at a time, only while the token fits the free space of the serial TX buffer and at most
+     LOG_DRAIN_BYTES per run, so it never waits for the UART. It also stops when a start bit
+     rises, which the external comparator build would see too late (Scheduler.h). A frame
+     arriving on a full queue is not printed and counted in LogDropped. Other output (reports,
+     errors) calls LogFlush() first.
+
+     The line format is the one of DumpRawMessage():
+
+       B:1 M:0X130 S:0X140 CB:0XF L:3 DATA: 0X10 0X1 0X1
+
+     Numbers are written by LogNumber() with the digits of LogDigits (PROGMEM) and the header
+     tokens come from LogFields (PROGMEM), so the log and the reports do not link the printf
+     formatter and keep no format strings in SRAM.
+  --------------------------------------------------------------------------------------------------*/
+#ifndef _LOG_H_
+#define _LOG_H_
+
+/*--------------------------------------------------------------------------------------------------
+                                         Prototypes
+--------------------------------------------------------------------------------------------------*/
+bool            LogPush ( const IebusFrame * frame );
+IebusFrame *    LogAlloc ( void );
+void            LogCommit ( void );
+void            LogDrain ( void );
+void            LogFlush ( void );
+bool            LogFormatToken ( const IebusFrame * frame, byte token, char * buf );
+void            LogPrint ( const char * str );
+char *          LogNumber ( char * buf, unsigned long value, byte radix, byte digits );
+void            LogValue ( const char * label, unsigned long value, byte radix );
+
+/*--------------------------------------------------------------------------------------------------
+                                       Type definitions
+--------------------------------------------------------------------------------------------------*/
+typedef struct{
+    char                Label[ 6 ];         // Printed before the value.
+    byte                Offset;             // Field in IebusFrame.
+    bool                Wide;               // Field is a word, else a byte.
+    byte                Radix;              // 10 or 16.
+
+} LogField;
+
+/*--------------------------------------------------------------------------------------------------
+                                      Global Variables
+  --------------------------------------------------------------------------------------------------*/
+static IebusFrame       LogQueue[ LOG_QUEUE_DEPTH ];
+static byte             LogHead = 0;
+static byte             LogCount = 0;
+static byte             LogToken = 0;       // Next token of the head record.
+static unsigned long    LogDropped = 0;
+
+static const char       LogDigits[] PROGMEM = "0123456789ABCDEF";
+
+// Header tokens of a dump line, "DATA: " and the payload follow.
+static const LogField   LogFields[] PROGMEM =
+{
+  { "B:",    offsetof( IebusFrame, Broadcast ),     false, 10 },
+  { "M:0X",  offsetof( IebusFrame, MasterAddress ), true,  16 },
+  { "S:0X",  offsetof( IebusFrame, SlaveAddress ),  true,  16 },
+  { "CB:0X", offsetof( IebusFrame, Control ),       false, 16 },
+  { "L:",    offsetof( IebusFrame, DataSize ),      false, 10 },
+};
+
+const byte LogFieldCount = sizeof( LogFields ) / sizeof( LogField );
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LogPush
+  Description  :  Queues a copy of a frame for printing.
+  Argument(s)  :  frame (const IebusFrame *) -> Frame.
+  Return value :  (bool) -> FALSE if the queue is full and the frame was dropped.
+  --------------------------------------------------------------------------------------------------*/
+bool LogPush ( const IebusFrame * frame ) {
+  IebusFrame * slot = LogAlloc();
+
+  if ( slot == NULL ) {
+    return false;
+  }
+
+  memcpy( slot, frame, IEBUS_FRAME_BYTES( frame ) );
+  LogCommit();
+  return true;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LogAlloc
+  Description  :  Free slot at the tail of the queue, queued by LogCommit() once filled.
+  Argument(s)  :  None.
+  Return value :  (IebusFrame *) -> Slot, NULL if the queue is full (the frame is counted dropped).
+  --------------------------------------------------------------------------------------------------*/
+IebusFrame * LogAlloc ( void ) {
+
+  if ( LogCount >= LOG_QUEUE_DEPTH ) {
+    LogDropped++;
+    return NULL;
+  }
+
+  byte tail = LogHead + LogCount;
+  if ( tail >= LOG_QUEUE_DEPTH ) {
+    tail -= LOG_QUEUE_DEPTH;
+  }
+
+  return &LogQueue[ tail ];
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LogCommit
+  Description  :  Queues the slot returned by LogAlloc().
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void LogCommit ( void ) {
+  LogCount++;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LogDrain
+  Description  :  Hands queued lines to the serial port as far as its TX buffer has room.
+                  Scheduler task.
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void LogDrain ( void ) {
+  byte budget = LOG_DRAIN_BYTES;
+
+  while ( LogCount ) {
+
+    // A start bit: getStartBit() allows for one token printed since its rise, not for a run.
+    if ( INPUT_IS_SET ) {
+      return;
+    }
+
+    if ( !LogFormatToken( &LogQueue[ LogHead ], LogToken, UsartMsgBuffer ) ) {
+      // Line complete.
+      LogToken = 0;
+      if ( ++LogHead >= LOG_QUEUE_DEPTH ) {
+        LogHead = 0;
+      }
+      LogCount--;
+      continue;
+    }
+
+    byte length = strlen( UsartMsgBuffer );
+    if ( length > budget || Serial.availableForWrite() < length ) {
+      return;
+    }
+
+    budget -= length;
+    LogPrint( UsartMsgBuffer );
+    LogToken++;
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LogFlush
+  Description  :  Prints all queued lines, waiting for the serial port. Call before printing
+                  anything else so lines are not cut and stay in order.
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void LogFlush ( void ) {
+
+  while ( LogCount ) {
+
+    if ( LogFormatToken( &LogQueue[ LogHead ], LogToken++, UsartMsgBuffer ) ) {
+      LogPrint( UsartMsgBuffer );
+      continue;
+    }
+
+    LogToken = 0;
+    if ( ++LogHead >= LOG_QUEUE_DEPTH ) {
+      LogHead = 0;
+    }
+    LogCount--;
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LogFormatToken
+  Description  :  Formats one token of a dump line.
+  Argument(s)  :  frame (const IebusFrame *) -> Frame.
+                  token (byte) -> Token index: header fields, payload bytes, then CR LF.
+                  buf (char *) -> Output, USART_BUFFER_SIZE characters.
+  Return value :  (bool) -> FALSE past the end of the line.
+  --------------------------------------------------------------------------------------------------*/
+bool LogFormatToken ( const IebusFrame * frame, byte token, char * buf ) {
+  unsigned long value;
+  byte radix = 16;
+
+  if ( token < LogFieldCount ) {
+    const LogField * field = &LogFields[ token ];
+    const byte * at = (const byte *)frame + pgm_read_byte_near( &field->Offset );
+
+    value = pgm_read_byte_near( &field->Wide ) ? *(const word *)at : *at;
+    radix = pgm_read_byte_near( &field->Radix );
+    strcpy_P( buf, field->Label );
+    buf += strlen( buf );
+
+  } else if ( token == LogFieldCount ) {
+    strcpy( buf, "DATA: " );
+    return true;
+
+  } else {
+    token -= LogFieldCount + 1;
+    if ( token < IEBUS_STORED( frame ) ) {
+      value = frame->Data[ token ];
+      *buf++ = '0';
+      *buf++ = 'X';
+    } else if ( token == IEBUS_STORED( frame ) ) {
+      strcpy( buf, "\r\n" );
+      return true;
+    } else {
+      return false;
+    }
+  }
+
+  buf = LogNumber( buf, value, radix, 1 );
+  *buf++ = ' ';
+  *buf = '\0';
+
+  return true;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LogPrint
+  Description  :  Prints a string on the serial port(s).
+  Argument(s)  :  str (const char *) -> String to print.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void LogPrint ( const char * str ) {
+  // A report longer than the TX buffer waits for the UART here, Timer 1 shall not wrap unseen.
+  ClockUpdate();
+  Serial.print( str );
+
+  #if (USE_SOFTSERIAL)
+    altSerial.print( str );
+  #endif
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LogNumber
+  Description  :  Writes a number without leading zeros, like "%X" / "%u" of printf.
+  Argument(s)  :  buf (char *) -> Output, 11 characters for a decimal unsigned long.
+                  value (unsigned long) -> Number.
+                  radix (byte) -> 10 or 16.
+                  digits (byte) -> Fewest digits, padded with '0' ("%02X"), at least 1.
+  Return value :  (char *) -> End of the output, at the '\0'.
+  --------------------------------------------------------------------------------------------------*/
+char * LogNumber ( char * buf, unsigned long value, byte radix, byte digits ) {
+  char reverse[ 10 ];
+  byte n = 0;
+
+  do {
+    reverse[ n++ ] = pgm_read_byte_near( &LogDigits[ value % radix ] );
+    value /= radix;
+  } while ( value != 0 || n < digits );
+
+  while ( n > 0 ) {
+    *buf++ = reverse[ --n ];
+  }
+  *buf = '\0';
+
+  return buf;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LogValue
+  Description  :  Prints a label and a number, the pieces of the report lines.
+  Argument(s)  :  label (const char *) -> Label, separators included ("REG:", " P:").
+                  value (unsigned long) -> Number.
+                  radix (byte) -> 10 or 16.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void LogValue ( const char * label, unsigned long value, byte radix ) {
+  LogPrint( label );
+  LogNumber( UsartMsgBuffer, value, radix, 1 );
+  LogPrint( UsartMsgBuffer );
+}
+
+#endif // _LOG_H_
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/
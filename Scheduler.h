@@ -0,0 +1,230 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  Scheduler.h
+  Description  :  Cooperative scheduler for the periodic jobs of the main loop.
+  Author       :  Panin Aleksandr
+  Copyright    :  (c) 2022 aleksandrpanin.ru
+  ----------------------------------------------------------------------------------------------------
+     Registration, session timeout, reports and log draining used to check their own millis()
+     timers on every loop pass. They are now tasks of a fixed table of SCHEDULER_TASKS entries
+     (no dynamic allocation), each with a deadline and a period.
+
+     The earliest deadline is kept in SchedulerNext, so a loop pass with nothing due costs one
+     compare and AvcReadMessage() gets back to the bus at once. Deadlines are ClockMillis()
+     (Clock.h), which goes on under traffic, unlike millis(), and this call on every loop pass
+     keeps it from missing a Timer 1 wrap. They are compared as (long)( now - due ) >= 0 and
+     survive the wrap after 49 days.
+
+     Tasks never run while a frame is in flight: when something is due the bus must have been
+     idle for one bit (IsAvcBusFree), else the tasks wait for the next loop pass. The line is
+     checked again before every task, a start bit that rose during a task leaves the others due.
+     The external comparator build has no timestamp of that rise: RxBlindSince() tells
+     getStartBit() how long the line was not looked at, and a start bit that much short (at most
+     RxBlindMax ticks, 36 us) is still taken. A task runs to completion and shall return quickly;
+     the longest run time of every task is measured on Timer 1, as the tracepoints do (Trace.h),
+     and printed every SCHEDULER_REPORT ms. A run of 32.768 ms or more (one Timer 1 period) reads
+     short:
+
+       TASK 0 RUN:1234 MAX:180us
+
+     The report prints one line per run, like the other reports: it asks SchedulerSetPeriod() for
+     a run 1 ms later until the last line is out. A line waits while the serial TX buffer has no
+     room for it or a log line is half printed. With SCHEDULER_REPORT 0 nothing is measured and a
+     slot is 4 bytes shorter.
+  --------------------------------------------------------------------------------------------------*/
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#define SCHEDULER_LINE          32          // "TASK 255 RUN:65535 MAX:65535us\r\n", "LOG DROP:" lines are 21.
+
+/*--------------------------------------------------------------------------------------------------
+                                       Type definitions
+--------------------------------------------------------------------------------------------------*/
+typedef void ( *SchedulerFunction )( void );
+
+typedef struct{
+    SchedulerFunction   Run;                // Task body.
+    unsigned long       Due;                // ClockMillis() of the next run.
+    word                Period;             // ms between runs.
+#if (SCHEDULER_REPORT)
+    word                Runs;               // Runs since the last report.
+    word                WorstTime;          // Longest run (us), below 32768.
+#endif
+
+} SchedulerTask;
+
+/*--------------------------------------------------------------------------------------------------
+                                         Prototypes
+--------------------------------------------------------------------------------------------------*/
+byte            SchedulerAdd ( SchedulerFunction run, word period );
+void            SchedulerService ( void );
+void            SchedulerSetPeriod ( word period );
+void            SchedulerReport ( void );
+
+/*--------------------------------------------------------------------------------------------------
+                                      Global Variables
+  --------------------------------------------------------------------------------------------------*/
+static SchedulerTask    SchedulerTasks[ SCHEDULER_TASKS ];
+static byte             SchedulerCount = 0;
+static unsigned long    SchedulerNext = 0;
+static SchedulerTask *  SchedulerRunning = NULL;   // Task being run, for SchedulerSetPeriod().
+#if (SCHEDULER_REPORT)
+static byte             SchedulerLine = 0;         // Task of the next report line, SchedulerCount: LOG DROP.
+#endif
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  SchedulerAdd
+  Description  :  Adds a periodic task, first run one period from now.
+  Argument(s)  :  run (SchedulerFunction) -> Task body.
+                  period (word) -> Period (ms), at least 1.
+  Return value :  (byte) -> Task number, 0xFF if the table is full.
+  --------------------------------------------------------------------------------------------------*/
+byte SchedulerAdd ( SchedulerFunction run, word period ) {
+
+  if ( SchedulerCount >= SCHEDULER_TASKS ) {
+    return 0xFF;
+  }
+
+  SchedulerTask * task = &SchedulerTasks[ SchedulerCount ];
+
+  task->Run       = run;
+  task->Period    = period;
+  task->Due       = ClockMillis() + period;
+#if (SCHEDULER_REPORT)
+  task->Runs      = 0;
+  task->WorstTime = 0;
+#endif
+
+  if ( SchedulerCount == 0 || (long)( task->Due - SchedulerNext ) < 0 ) {
+    SchedulerNext = task->Due;
+  }
+
+  return SchedulerCount++;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  SchedulerService
+  Description  :  Runs the due tasks when the bus is idle. Call from loop().
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void SchedulerService ( void ) {
+  unsigned long now = ClockMillis();
+
+  if ( (long)( now - SchedulerNext ) < 0 ) {
+    return;
+  }
+
+  // A frame is in flight, AvcReadMessage() comes first.
+  if ( !IsAvcBusFree() ) {
+    return;
+  }
+
+  SchedulerTask * task = SchedulerTasks;
+  unsigned long next = now + 0xFFFF;
+  uint16_t low = TCNT1;
+
+  for ( byte i = SchedulerCount; i > 0; i--, task++ ) {
+
+    if ( (long)( now - task->Due ) >= 0 ) {
+
+      // A start bit rose during the last task, the next ones wait for the next loop pass.
+      if ( INPUT_IS_SET ) {
+        next = now;
+        break;
+      }
+
+      uint16_t start = TCNT1;
+      low = start;
+      TraceTaskBegin();
+
+      SchedulerRunning = task;
+      task->Run();
+      SchedulerRunning = NULL;
+
+      TraceTaskEnd( task );
+#if (SCHEDULER_REPORT)
+      word time = (uint16_t)( TCNT1 - start ) / CLOCK_COUNTS_PER_US;
+      if ( time > task->WorstTime ) {
+        task->WorstTime = time;
+      }
+      task->Runs++;
+#endif
+
+      // Skip the missed periods instead of running the task back to back.
+      task->Due += task->Period;
+      if ( (long)( now - task->Due ) >= 0 ) {
+        task->Due = now + task->Period;
+      }
+    }
+
+    if ( (long)( task->Due - next ) < 0 ) {
+      next = task->Due;
+    }
+  }
+
+  SchedulerNext = next;
+
+  // The line was last seen low at low, getStartBit() allows for a start bit that rose since.
+  RxBlindSince( low );
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  SchedulerSetPeriod
+  Description  :  Changes the period of the running task, from its next run on. Does nothing when
+                  not called from a task.
+  Argument(s)  :  period (word) -> Period (ms), at least 1.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void SchedulerSetPeriod ( word period ) {
+
+  if ( SchedulerRunning != NULL ) {
+    SchedulerRunning->Period = period;
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  SchedulerReport
+  Description  :  Prints run count and worst run time of one task and clears them, one line per
+                  run, then the log drops. Scheduler task, every SCHEDULER_REPORT ms.
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+#if (SCHEDULER_REPORT)
+void SchedulerReport ( void ) {
+
+  // The next line 1 ms later, until the last one.
+  SchedulerSetPeriod( 1 );
+
+  if ( LogToken != 0 || Serial.availableForWrite() < SCHEDULER_LINE ) {
+    return;
+  }
+
+  if ( SchedulerLine < SchedulerCount ) {
+    SchedulerTask * task = &SchedulerTasks[ SchedulerLine ];
+
+    LogValue( "TASK ", SchedulerLine, 10 );
+    LogValue( " RUN:", task->Runs, 10 );
+    LogValue( " MAX:", task->WorstTime, 10 );
+    LogPrint( "us\r\n" );
+
+    task->Runs = 0;
+    task->WorstTime = 0;
+    SchedulerLine++;
+    return;
+  }
+
+  if ( LogDropped ) {
+    LogValue( "LOG DROP:", LogDropped, 10 );
+    LogPrint( "\r\n" );
+  }
+
+  SchedulerLine = 0;
+  SchedulerSetPeriod( SCHEDULER_REPORT );
+}
+#endif
+
+#endif // _SCHEDULER_H_
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/
@@ -41,6 +41,12 @@
 #define PIN_ACC                 9
 
 
+#ifndef INNER_COMPARATOR
+  #define INNER_COMPARATOR      false     // Turn "true" for read the bus with the internal analog comparator and Timer1 input capture instead of HA12187
+#endif
+
+#if (!INNER_COMPARATOR)
+
 //////// for use outer comparator HA12187
 
 #define DATA_PORT               PORTD
@@ -52,18 +58,29 @@
 
 #define OUT_SET                 ( bitSet(DATA_PORT, PIN_OUT) ) //( PORTD &= bit(PIN_OUT) ) //
 #define OUT_CLEAR               ( bitClear(DATA_PORT, PIN_OUT) ) //( PORTD |= bit(PIN_OUT) ) //
-  
+
+#else
+
 //////// else for use inner comporator
-  
-//// AVC LAN bus directly connected to internal analog comparator (PD6/7)
-//// PD6 AIN0 +
-//// PD7 AIN1 -
-//
-//#define DATAIN_PIN              ACSR
-//#define DATAIN                  ACO
-//
-//#define INPUT_IS_SET            ( bit_is_set( DATAIN_PIN, DATAIN ) )
-//#define INPUT_IS_CLEAR          ( bit_is_clear( DATAIN_PIN, DATAIN ) )
+
+// AVC LAN bus directly connected to internal analog comparator (PD6/7)
+// PD6 AIN0 +
+// PD7 AIN1 -
+// Comparator output triggers Timer1 input capture (ACIC), edges are timestamped in ICR1.
+
+#define DATA_PORT               PORTD
+#define PIN_OUT                 5         // PD6 is AIN0, the bus driver moves to PD5
+
+#define DATAIN_PIN              ACSR
+#define DATAIN                  ACO
+
+#define INPUT_IS_SET            ( bit_is_set( DATAIN_PIN, DATAIN ) )
+#define INPUT_IS_CLEAR          ( bit_is_clear( DATAIN_PIN, DATAIN ) )
+
+#define OUT_SET                 ( bitSet(DATA_PORT, PIN_OUT) )
+#define OUT_CLEAR               ( bitClear(DATA_PORT, PIN_OUT) )
+
+#endif
 
 
 /*--------------------------------------------------------------------------------------------------
@@ -76,25 +93,107 @@
 #define BROADCAST_ADDRESS       0xFFF // All devices      //0x01FF // All audio devices
 #define CONTROL_FLAGS           0xE
 
+#define IDENTITY_MAX            4         // Emulated devices answering at once, entries of IdentityTable (IEBUS.h) past it are ignored
+
+#define IEBUS_AUTO_MODE         true      // On by default: the mode of every received frame is detected from its start bit, mode 2 frames read the same as with "false". Turn "false" for receive IEBUS_MODE frames only
+#define IEBUS_MODE              IEBUS_MODE_2 // Mode received without IEBUS_AUTO_MODE and sent by the load test, see IebusTiming.h
+
+#define RX_GLITCH_TICKS         2         // High pulses inside a frame shorter than this (Timer 0 ticks, 4 us) are noise and skipped, 0 = no filter. Up to half of a '1' (5 ticks in mode 2)
+#define RX_ABORT_SLACK          2         // Ticks a bit may run over IebusTimings (high time of a '0', bit length, start bit length) before the frame is given up
+
 
 /*--------------------------------------------------------------------------------------------------
                                        Other settings
 --------------------------------------------------------------------------------------------------*/
 
 
+#define SIZE_PROFILE            false     // Turn "true" for the size optimised build: no command descriptions, no task report (one task slot and the run time fields of the others), 2 repeat records less, 1 more frame of log queue, see tools/footprint
+
 #define ONLY_MY                 true      // Recive all adres define this paremrte "false", or recive only for MY_ADDRESS or BROADCAST_ADDRESS define "ture"
 #define SHOW_ERROR              false     // Turn "true" for print errors to serial port.
 
-#define USART_BUFFER_SIZE       40
+// load test settings
+#define LOAD_TEST_MODE          false     // Turn "true" for send generated frames as a master instead of emulating the display
+#define LOAD_TEST_RANDOM        true      // Turn "true" for random frames, "false" for frames from LoadTestScript table
+#define LOAD_TEST_RATE          0         // Frames per second, 0 = back to back (full bus capacity)
+#define LOAD_TEST_MAX_SIZE      32        // Longest random payload (bytes), up to IEBUS_DATA_SIZE
+#define LOAD_TEST_SEED          0xACE1    // Random generator seed, must not be 0
+#define LOAD_TEST_REPORT        1000      // Period of the frames per second report (ms)
+#define LOAD_TEST_DUMP          false     // Turn "true" for dump every sent frame (limits the rate to the serial speed)
+
+// head unit emulator settings
+#define HU_EMULATOR_MODE        false     // Turn "true" for play the head unit (pings, net scan, statistics) instead of emulating the display, see HuEmulator.h
+#define HU_DEVICES              4         // Devices the head unit emulator follows, 18 bytes of SRAM each
+#define HU_REPLY_TIMEOUT        20        // Longest wait for the answer to a ping (ms)
+#define HU_REPORT               5000      // Period of the per device statistics report (ms)
+
+// last frame cache settings
+#ifndef USE_FRAME_CACHE
+  #define USE_FRAME_CACHE       true      // Turn "true" for print only changed incoming frames, repeats are counted and reported periodically
+#endif
+#define FRAME_CACHE_SIZE        8         // Cache entries, 9 + FRAME_CACHE_DATA bytes of SRAM each. Must be a multiple of FRAME_CACHE_WAYS
+#define FRAME_CACHE_DATA        16        // Payload bytes kept per entry, longer frames are always dumped. Up to IEBUS_DATA_SIZE
+#define FRAME_CACHE_WAYS        2         // Entries per hash set, the least recently seen one is evicted
+#define FRAME_CACHE_REPORT      5000      // Period of the "repeated N times" report (ms)
+#if (!SIZE_PROFILE)
+  #define FRAME_CACHE_PENDING   4         // Repeat lines of changed or evicted frames waiting to be printed, 6 bytes of SRAM each
+#else
+  #define FRAME_CACHE_PENDING   2
+#endif
+
+// edge flight recorder settings
+#ifndef USE_EDGE_RECORDER
+  #define USE_EDGE_RECORDER     false     // Turn "true" for keep the last bus edges and print them on a decode or ack error, see EdgeRecorder.h
+#endif
+#define EDGE_RECORDER_SIZE      64        // Edges kept, 1 byte of SRAM each. Power of 2, up to 128
+#ifndef EDGE_RECORDER_STREAM
+  #define EDGE_RECORDER_STREAM  false     // Turn "true" for print the edges at once, "false" for keep them until an 'E' arrives on the serial port
+#endif
+#define EDGE_RECORDER_HOLDOFF   1000      // Time from a print to the next recording (ms), limits the output when every frame fails
+
+// tracepoint settings
+#define USE_TRACE               false     // Turn "true" for record the tracepoints of the bus code (start bit, fields, acks, ping answer, dumps, long tasks) with a Timer 1 stamp, see Trace.h and tools/trace
+#define TRACE_TO_PIN            false     // Turn "true" for a pulse on TRACE_PIN per tracepoint instead of the ring (logic analyser, nothing printed)
+#define TRACE_PORT              PORTC
+#define TRACE_DDR               DDRC
+#define TRACE_PIN               0         // TRACE_PORT bit pulsed with TRACE_TO_PIN (A0)
+#define TRACE_BUFFER_SIZE       48        // Tracepoints kept until printed, 3 bytes of SRAM each, up to 255
+#define TRACE_TASK_MIN          100       // Shortest scheduler task run traced (Timer 1 ticks, 0.5 us)
+
+// serial frame injection settings
+#define USE_INJECT              false     // Turn "true" for send frames queued by binary commands on the serial port (batches, periodic frames, status reports), see Inject.h and tools/inject
+#define INJECT_QUEUE_BYTES      128       // Queued frames, 7 bytes and the payload each, bytes of SRAM, up to 255
+#define INJECT_SCHEDULES        2         // Periodic frames, 21 bytes of SRAM each
+#define INJECT_SCHEDULE_DATA    8         // Longest payload of a periodic frame (bytes)
+#define INJECT_STATUS_DEPTH     16        // Status reports waiting to be printed, 2 bytes of SRAM each
+#define INJECT_PARSE_BYTES      32        // Most command bytes read per task run, about 22 a frame keep the bus busy
+#define INJECT_TIMEOUT          50        // Longest pause inside a command (ms) before it is dropped
+
+// log settings
+#if (!SIZE_PROFILE)
+  #define LOG_QUEUE_DEPTH       4         // Frames waiting to be printed, 40 bytes of SRAM each
+#else
+  #define LOG_QUEUE_DEPTH       5         // 40 of the 44 bytes freed: the report slot (12), the run time fields of 5 slots (4 each), 2 repeat records (6 each)
+#endif
+#define LOG_DRAIN_BYTES         16        // Most characters handed to the serial port per log task run
+
+// scheduler settings
+#define TRACE_TASKS             ( USE_TRACE && !TRACE_TO_PIN ) // TraceReport
+#if (!SIZE_PROFILE)
+  #define SCHEDULER_REPORT      30000     // Period of the task run time report (ms), 0 = no report and no run time fields
+#else
+  #define SCHEDULER_REPORT      0
+#endif
+#define SCHEDULER_TASKS         ( 3 + 2 * USE_FRAME_CACHE + USE_EDGE_RECORDER + TRACE_TASKS + USE_INJECT + ( SCHEDULER_REPORT > 0 ) ) // Task slots, 12 bytes of SRAM each, 8 without SCHEDULER_REPORT
 
-#if(!SHOW_ERROR)
+#if(SHOW_ERROR)
+  #define USART_BUFFER_SIZE     96        // Longest error line of AvcReadMessage()
+#else
   #define USART_BUFFER_SIZE     12
 #endif
 
 char UsartMsgBuffer[ USART_BUFFER_SIZE ];
 
-unsigned long timerRegister = millis();
-
 
 #endif // _AVCLANDRV_H_
 
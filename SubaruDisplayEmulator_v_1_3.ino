@@ -18,7 +18,18 @@
   SoftwareSerial altSerial(PIN_SS_RX, PIN_SS_TX); // RX, TX
 #endif
 
+#include "IebusFrame.h"
+#include "IebusTiming.h"
+#include "Clock.h"
+#include "Log.h"
+#include "FrameCache.h"
+#include "EdgeRecorder.h"
+#include "Trace.h"
 #include "IEBUS.h"
+#include "LoadTest.h"
+#include "HuEmulator.h"
+#include "Inject.h"
+#include "Scheduler.h"
 
 
 void setup() {
@@ -42,6 +53,50 @@ void setup() {
   TCCR0B = (1<<CS01) | (1<<CS00);
   DDRD |= _BV(PIN_OUT);
   OUT_CLEAR;
+
+  // Comparator & input capture for the inner comparator backend
+  RxInit();
+
+  // Free running Timer 1 for the loop code and the tracepoints
+  ClockInit();
+
+  // Pin for the tracepoints
+  TraceInit();
+
+  IdentityInit();
+
+  // Periodic jobs, run between frames
+  SchedulerAdd( LogDrain, 1 );
+
+#if (LOAD_TEST_MODE)
+  SchedulerAdd( LoadTestReport, LOAD_TEST_REPORT );
+#elif (HU_EMULATOR_MODE)
+  SchedulerAdd( HuEmulatorReport, HU_REPORT );
+#else
+  SchedulerAdd( IdentityRegisterTask, TIMEOUT_NETPING / 4 );
+  SchedulerAdd( IdentityTimeoutTask, TIMEOUT_RECONNECT / 10 );
+#endif
+
+#if (USE_FRAME_CACHE)
+  SchedulerAdd( FrameCacheDrain, 1 );
+  SchedulerAdd( FrameCacheReport, FRAME_CACHE_REPORT );
+#endif
+
+#if (USE_EDGE_RECORDER)
+  SchedulerAdd( EdgeRecorderService, 10 );
+#endif
+
+#if (TRACE_TASKS)
+  SchedulerAdd( TraceReport, 5 );
+#endif
+
+#if (USE_INJECT)
+  SchedulerAdd( InjectPoll, 1 );
+#endif
+
+#if (SCHEDULER_REPORT)
+  SchedulerAdd( SchedulerReport, SCHEDULER_REPORT );
+#endif
     
   //  Enable watchdog @ ~2 sec.
   wdt_enable( WDTO_2S );
@@ -54,19 +109,24 @@ void loop() {
   wdt_reset();
 
   // Read message from lan
-  AvcReadMessage();
-
-  // Check register session timeout & change register status to false
-  if((lastRegistred + TIMEOUT_RECONNECT) < millis()){
-    isRegistred = false;
-  }
-
-  // Init registration in timer
-  if(!isRegistred){
-    if((timerRegister + TIMEOUT_NETPING) < millis()){
-      timerRegister = millis();
-      AvcRegisterMe();
-    }
-  }
+  AvcReadMessage( &RxFrame );
+
+#if (LOAD_TEST_MODE)
+  // Generate traffic instead of emulating the display
+  LoadTestService();
+#endif
+
+#if (HU_EMULATOR_MODE)
+  // Play the head unit: net scan, pings and latency statistics
+  HuEmulatorService();
+#endif
+
+#if (USE_INJECT)
+  // Frames queued by the host on the serial port
+  InjectService();
+#endif
+
+  // Registration, timeouts, reports and log output
+  SchedulerService();
 
 }
@@ -0,0 +1,167 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  Trace.h
+  Description  :  Tracepoints of the bus code with a Timer 1 time stamp, for latency profiling.
+  Author       :  Panin Aleksandr
+  Copyright    :  (c) 2022 aleksandrpanin.ru
+  ----------------------------------------------------------------------------------------------------
+     The LED tells that a frame is in work, not where the time of a frame goes. With USE_TRACE
+     the bus code passes tracepoints (TracePoint):
+
+       TRACE_START_BIT      start bit read (AvcReadMessage)
+       TRACE_MASTER ..      end of a field of the received frame: master address, slave address
+       TRACE_DATA           and its ack, control and ack, size and ack, last data byte and ack
+       TRACE_ACK            end of an ack we drive (SendAcknowledge)
+       TRACE_REPLY          ping answer starts (AvcAnswerPing), the ping is read and decoded
+       TRACE_REPLY_LOADED   answer frame loaded from IdentityTable, handle patched in
+       TRACE_BUS_FREE       bus found free for a frame we send, our start bit follows (SendFrame)
+       TRACE_SENT           last ack of a frame we sent
+       TRACE_REPLY_END      ping answer done
+       TRACE_DUMP, _END     DumpRawMessage()
+       TRACE_TASK + n       scheduler task n (in the order of SchedulerAdd() in setup(), task 0 is
+       TRACE_TASK_END       LogDrain) ran TRACE_TASK_MIN ticks or more, the start and the end
+
+     Each tracepoint writes its id and the Timer 1 count (F_CPU / 8, 0.5 us, wraps every
+     32.768 ms) in TraceBuffer, TRACE_BUFFER_SIZE entries of 3 bytes. The cycles charged to the
+     simulator clock, TRACE_RECORD_CYCLES, are an estimate from the instruction count, not
+     measured on the ATmega328P. With no avr-gcc at hand, the AVR backend of LLVM (llc
+     -mcpu=atmega328p -O2) makes 35 cycles of the same code, the index taken times 3 with a mul.
+     Timer 1 is the free running time base of Clock.h, nothing more to set up. TraceReport(), a scheduler task, prints the entries between
+     dump lines, at most TRACE_LINE_ENTRIES a line while the line fits the serial TX buffer, and
+     empties the buffer once all are printed:
+
+       T:01 3A0C 02 3D42 03 3EA0 ...
+       TRACE FULL
+
+     A full buffer takes no more entries until it is printed, the second line tells that some
+     may be missing after the last one. The serial port is shared with the frame log: a busy
+     bus fills the buffer, and is traced in windows of TRACE_BUFFER_SIZE entries or more.
+     tools/trace turns the lines into per stage latency histograms and the budget from a ping
+     to the start bit of the answer.
+
+     With TRACE_TO_PIN nothing is kept: a tracepoint is a pulse of 2 cycles on TRACE_PIN, for a
+     logic analyser next to the bus line. Without USE_TRACE the tracepoints are empty.
+  --------------------------------------------------------------------------------------------------*/
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#define TRACE_RECORD_CYCLES     22          // Estimate: lds, cpi, brsh, inc, sts, index * 3, pointer, st, 2 x lds TCNT1, 2 x std.
+#define TRACE_LINE_ENTRIES      5           // "II TTTT " each.
+#define TRACE_LINE_BYTES        ( 2 + TRACE_LINE_ENTRIES * 8 + 2 + 12 ) // With "TRACE FULL", within the 63 bytes of the TX buffer.
+
+/*--------------------------------------------------------------------------------------------------
+                                       Type definitions
+--------------------------------------------------------------------------------------------------*/
+typedef enum
+{
+    TRACE_START_BIT = 1,
+    TRACE_MASTER,
+    TRACE_SLAVE,
+    TRACE_CONTROL,
+    TRACE_SIZE,
+    TRACE_DATA,
+    TRACE_ACK,
+    TRACE_REPLY,
+    TRACE_REPLY_LOADED,
+    TRACE_BUS_FREE,
+    TRACE_SENT,
+    TRACE_REPLY_END,
+    TRACE_DUMP,
+    TRACE_DUMP_END,
+    TRACE_TASK_END,
+    TRACE_TASK = 0x40                       // + task number.
+
+} TracePoint;
+
+#if (USE_TRACE) && (!TRACE_TO_PIN)
+
+static_assert( TRACE_BUFFER_SIZE <= 255, "TRACE_BUFFER_SIZE shall fit a byte" );
+static_assert( SCHEDULER_TASKS < 0x40, "Task numbers shall fit TRACE_TASK" );
+
+typedef struct{
+    byte                Id;                 // TracePoint.
+    word                Tick;               // Timer 1 count.
+
+} TraceEntry;
+
+#define TraceAt( id, tick )     do { SIM_CYCLES( TRACE_RECORD_CYCLES ); if ( TraceCount < TRACE_BUFFER_SIZE ) { \
+                                  TraceEntry * traceEntry = &TraceBuffer[ TraceCount++ ]; \
+                                  traceEntry->Id = (id); traceEntry->Tick = (tick); } } while ( 0 )
+#define Trace( id )             TraceAt( id, TCNT1 )
+
+// Around a task run of SchedulerService(): kept if the run took TRACE_TASK_MIN ticks or more.
+#define TraceTaskBegin()        uint16_t traceStart = TCNT1
+#define TraceTaskEnd( task )    { uint16_t traceEnd = TCNT1; \
+                                  if ( (uint16_t)( traceEnd - traceStart ) >= TRACE_TASK_MIN && (task)->Run != TraceReport ) { \
+                                    TraceAt( TRACE_TASK + ( (task) - SchedulerTasks ), traceStart ); \
+                                    TraceAt( TRACE_TASK_END, traceEnd ); } }
+#define TraceInit()
+
+/*--------------------------------------------------------------------------------------------------
+                                         Prototypes
+--------------------------------------------------------------------------------------------------*/
+void            TraceReport ( void );
+
+/*--------------------------------------------------------------------------------------------------
+                                      Global Variables
+  --------------------------------------------------------------------------------------------------*/
+static TraceEntry       TraceBuffer[ TRACE_BUFFER_SIZE ];
+static byte             TraceCount = 0;     // Entries written.
+static byte             TracePrinted = 0;   // Entries printed.
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  TraceReport
+  Description  :  Prints one line of entries not printed yet, empties the buffer after the last
+                  one. Scheduler task.
+  Argument(s)  :  None.
+  Return value :  None.
+  --------------------------------------------------------------------------------------------------*/
+void TraceReport ( void ) {
+
+  // Nothing new, a dump line is half printed, or the lines would not fit the TX buffer.
+  if ( TracePrinted == TraceCount || LogToken != 0 ||
+       Serial.availableForWrite() < TRACE_LINE_BYTES ) {
+    return;
+  }
+
+  LogPrint( "T:" );
+  for ( byte i = 0; i < TRACE_LINE_ENTRIES && TracePrinted != TraceCount; i++, TracePrinted++ ) {
+    const TraceEntry * entry = &TraceBuffer[ TracePrinted ];
+    char * end = LogNumber( UsartMsgBuffer, entry->Id, 16, 2 );
+    *end++ = ' ';
+    end = LogNumber( end, entry->Tick, 16, 4 );
+    end[0] = ' ';
+    end[1] = '\0';
+    LogPrint( UsartMsgBuffer );
+  }
+  LogPrint( "\r\n" );
+
+  if ( TracePrinted == TraceCount ) {
+    if ( TraceCount == TRACE_BUFFER_SIZE ) {
+      LogPrint( "TRACE FULL\r\n" );
+    }
+    TraceCount   = 0;
+    TracePrinted = 0;
+  }
+}
+
+#elif (USE_TRACE)
+
+#define Trace( id )             do { SIM_CYCLES( 2 ); TRACE_PORT |= _BV( TRACE_PIN ); TRACE_PORT &= ~_BV( TRACE_PIN ); } while ( 0 )
+#define TraceTaskBegin()        Trace( TRACE_TASK )
+#define TraceTaskEnd( task )    Trace( TRACE_TASK_END )
+#define TraceInit()             { TRACE_DDR |= _BV( TRACE_PIN ); }
+
+#else
+
+#define Trace( id )
+#define TraceTaskBegin()
+#define TraceTaskEnd( task )
+#define TraceInit()
+
+#endif // USE_TRACE
+
+#endif // _TRACE_H_
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/
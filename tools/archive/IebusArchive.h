@@ -0,0 +1,143 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  IebusArchive.h
+  Description  :  Columnar binary archive of logged frames, shared by the host archive tools.
+  ----------------------------------------------------------------------------------------------------
+     A file is a FileHeader followed by blocks of up to BlockFrames frames. Every block keeps
+     its frames column by column, widest first so every column is naturally aligned:
+
+       BlockHeader
+       BlockIndex                   time range, address and payload prefix bitmaps
+       int64_t   Time[n]            us, from the log line prefix, else the frame number
+       uint32_t  PayloadOffset[n+1] payload of frame i is Payload[ Offset[i] .. Offset[i+1] )
+       uint16_t  Master[n]
+       uint16_t  Slave[n]
+       uint8_t   Control[n]
+       uint8_t   Flags[n]           FLAG_BROADCAST = broadcast bit as sent (1 = point-to-point)
+       uint8_t   Length[n]          length field of the frame
+       uint8_t   Payload[]          stored payload bytes (DumpRawMessage prints IEBUS_DATA_SIZE)
+       padding to 8 bytes
+
+     The fields are the ones of IebusFrame (IebusFrame.h). All values are little endian.
+
+     The file is meant to be mapped: a reader walks the block headers (Bytes), tests a query
+     against the BlockIndex and scans the columns of the blocks that may hold a match in place.
+     A bit of the index set means "may be present", a bit clear means "not in this block".
+  --------------------------------------------------------------------------------------------------*/
+#ifndef _IEBUS_ARCHIVE_H_
+#define _IEBUS_ARCHIVE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+namespace Archive {
+
+const char      FileMagic[8]    = { 'I', 'E', 'B', 'U', 'S', 'A', 'R', 'C' };
+const uint32_t  FileVersion     = 2;            // 2: BlockIndex added.
+const uint32_t  BlockMagic      = 0x314B4C42;   // "BLK1"
+const uint32_t  BlockFrames     = 65536;
+const uint32_t  AddressCount    = 4096;         // 12 bit addresses.
+
+const uint8_t   FLAG_BROADCAST  = 0x01;
+
+// FileHeader.Flags
+const uint32_t  TIME_FROM_LOG   = 0x01;         // Time[] from line prefixes, else frame numbers.
+
+struct FileHeader {
+  char          Magic[8];
+  uint32_t      Version;
+  uint32_t      Flags;
+  uint64_t      Frames;
+  uint64_t      Blocks;
+};
+
+struct BlockHeader {
+  uint32_t      Magic;
+  uint32_t      Frames;
+  uint32_t      PayloadBytes;
+  uint32_t      Reserved;
+  uint64_t      Bytes;          // Whole block, header included.
+};
+
+struct BlockIndex {
+  int64_t       MinTime;
+  int64_t       MaxTime;
+  uint64_t      Master[ AddressCount / 64 ];    // Bit per master address.
+  uint64_t      Slave[ AddressCount / 64 ];     // Bit per slave address.
+  uint64_t      Prefix1[ 256 / 64 ];            // Bit per first payload byte.
+  uint64_t      Prefix2[ 65536 / 64 ];          // Bit per first two payload bytes (first << 8 | second).
+};
+
+static_assert( sizeof( FileHeader ) == 32 && sizeof( BlockHeader ) == 24, "packed layout" );
+static_assert( sizeof( BlockIndex ) % 8 == 0, "packed layout" );
+
+inline uint64_t Align8 ( uint64_t v ) { return ( v + 7 ) & ~(uint64_t)7; }
+
+inline bool TestBit ( const uint64_t * bits, uint32_t i ) { return ( bits[ i >> 6 ] >> ( i & 63 ) ) & 1; }
+inline void SetBit ( uint64_t * bits, uint32_t i ) { bits[ i >> 6 ] |= (uint64_t)1 << ( i & 63 ); }
+
+// Columns start behind the header and the index.
+inline uint64_t ColumnsOffset ( void ) { return Align8( sizeof( BlockHeader ) ) + sizeof( BlockIndex ); }
+
+inline BlockIndex * Index ( uint8_t * block ) { return (BlockIndex *)( block + Align8( sizeof( BlockHeader ) ) ); }
+
+// Column pointers of a block.
+struct BlockColumns {
+  int64_t *     Time;
+  uint32_t *    PayloadOffset;
+  uint16_t *    Master;
+  uint16_t *    Slave;
+  uint8_t *     Control;
+  uint8_t *     Flags;
+  uint8_t *     Length;
+  uint8_t *     Payload;
+};
+
+inline uint64_t BlockBytes ( uint32_t frames, uint32_t payloadBytes ) {
+  return Align8( ColumnsOffset() + (uint64_t)frames * 8 + ( frames + 1 ) * 4 +
+                 frames * 2 * 2 + frames * 3 + payloadBytes );
+}
+
+inline BlockColumns Columns ( uint8_t * block, uint32_t frames ) {
+  BlockColumns c;
+  uint8_t * p = block + ColumnsOffset();
+  c.Time          = (int64_t *)p;             p += (uint64_t)frames * 8;
+  c.PayloadOffset = (uint32_t *)p;            p += ( frames + 1 ) * 4;
+  c.Master        = (uint16_t *)p;            p += frames * 2;
+  c.Slave         = (uint16_t *)p;            p += frames * 2;
+  c.Control       = p;                        p += frames;
+  c.Flags         = p;                        p += frames;
+  c.Length        = p;                        p += frames;
+  c.Payload       = p;
+  return c;
+}
+
+// Fills the index of a block from its columns.
+inline void BuildIndex ( uint8_t * block ) {
+  const BlockHeader * h = (const BlockHeader *)block;
+  BlockIndex * x = Index( block );
+  BlockColumns c = Columns( block, h->Frames );
+
+  memset( x, 0, sizeof( *x ) );
+  x->MinTime = h->Frames ? c.Time[0] : 0;
+  x->MaxTime = x->MinTime;
+
+  for ( uint32_t i = 0; i < h->Frames; i++ ) {
+    if ( c.Time[i] < x->MinTime ) x->MinTime = c.Time[i];
+    if ( c.Time[i] > x->MaxTime ) x->MaxTime = c.Time[i];
+    SetBit( x->Master, c.Master[i] & ( AddressCount - 1 ) );
+    SetBit( x->Slave, c.Slave[i] & ( AddressCount - 1 ) );
+
+    const uint8_t * d = c.Payload + c.PayloadOffset[i];
+    uint32_t n = c.PayloadOffset[i + 1] - c.PayloadOffset[i];
+    if ( n >= 1 ) SetBit( x->Prefix1, d[0] );
+    if ( n >= 2 ) SetBit( x->Prefix2, d[0] << 8 | d[1] );
+  }
+}
+
+} // namespace Archive
+
+#endif // _IEBUS_ARCHIVE_H_
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/
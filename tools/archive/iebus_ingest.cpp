@@ -0,0 +1,580 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  iebus_ingest.cpp
+  Description  :  Converts DumpRawMessage() text logs to the columnar archive (IebusArchive.h).
+  ----------------------------------------------------------------------------------------------------
+     Build (from the repository root):
+
+       g++ -std=c++17 -O3 -march=native -pthread -o iebus_ingest tools/archive/iebus_ingest.cpp
+
+     Usage:
+
+       iebus_ingest [-j threads] <log> <archive>    ingest a log
+       iebus_ingest dump <archive>                  print an archive back as log lines
+       iebus_ingest gen <MB> <log>                  write a synthetic log
+       iebus_ingest bench [-j threads] <MB>         ingest a synthetic log from memory, MB/s
+
+     Frame lines are the ones of DumpRawMessage() / LogFormatToken():
+
+       B:1 M:0X130 S:0X140 CB:0XE L:3 DATA: 0X10 0X1 0X1
+
+     optionally behind a time stamp: "12:34:56.789 -> " (Arduino serial monitor, the day is
+     counted when the clock wraps) or seconds "1234.567 ". Other lines (reports, errors) are
+     skipped and counted.
+
+     The log is mapped read only and split at line ends, one part per thread. Line ends are
+     found 64 bytes at a time with SSE2 compares into a bit mask, the fields are read with a hex
+     lookup table. Every thread appends to its own columns, reserved from the part size, so no
+     line allocates. The columns are then cut into blocks, indexed and written in log order.
+     iebus_query searches the archives.
+  --------------------------------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+#include "IebusArchive.h"
+
+/*--------------------------------------------------------------------------------------------------
+                                         Columns
+--------------------------------------------------------------------------------------------------*/
+const int64_t NO_TIME = INT64_MIN;
+
+struct FrameColumns {
+  std::vector<int64_t>  Time;
+  std::vector<uint32_t> End;            // End of the payload of every frame in Payload.
+  std::vector<uint16_t> Master;
+  std::vector<uint16_t> Slave;
+  std::vector<uint8_t>  Control;
+  std::vector<uint8_t>  Flags;
+  std::vector<uint8_t>  Length;
+  std::vector<uint8_t>  Payload;
+  uint64_t              Lines = 0;
+  uint64_t              Skipped = 0;
+
+  void Reserve ( size_t bytes ) {
+    size_t frames = bytes / 40 + 16;    // Shortest frame line is ~40 characters.
+    Time.reserve( frames );
+    End.reserve( frames );
+    Master.reserve( frames );
+    Slave.reserve( frames );
+    Control.reserve( frames );
+    Flags.reserve( frames );
+    Length.reserve( frames );
+    Payload.reserve( bytes / 5 + 64 );  // "0XAB " per byte.
+  }
+
+  size_t Size ( void ) const { return Time.size(); }
+};
+
+/*--------------------------------------------------------------------------------------------------
+                                         Scanner
+--------------------------------------------------------------------------------------------------*/
+static uint8_t Hex[ 256 ];              // Digit value, 0xFF if not a hex digit.
+
+static void InitTables ( void ) {
+  memset( Hex, 0xFF, sizeof Hex );
+  for ( int i = 0; i < 10; i++ ) Hex[ '0' + i ] = i;
+  for ( int i = 0; i < 6; i++ ) Hex[ 'A' + i ] = Hex[ 'a' + i ] = 10 + i;
+}
+
+// Hex number at p, at most digits digits. Returns the end, NULL if no digit.
+static inline const char * ReadHex ( const char * p, const char * end, uint32_t & v, int digits ) {
+  v = 0;
+  const char * b = p;
+  while ( p < end && digits-- && Hex[ (uint8_t)*p ] != 0xFF ) {
+    v = ( v << 4 ) | Hex[ (uint8_t)*p++ ];
+  }
+  return p == b ? nullptr : p;
+}
+
+static inline const char * ReadDec ( const char * p, const char * end, uint32_t & v ) {
+  v = 0;
+  const char * b = p;
+  while ( p < end && (unsigned)( *p - '0' ) < 10 ) {
+    v = v * 10 + ( *p++ - '0' );
+  }
+  return p == b ? nullptr : p;
+}
+
+// Literal s at p, returns the end or NULL.
+static inline const char * Expect ( const char * p, const char * end, const char * s, size_t n ) {
+  return ( (size_t)( end - p ) >= n && memcmp( p, s, n ) == 0 ) ? p + n : nullptr;
+}
+
+#define EXPECT( p, s )          ( p = Expect( p, end, s, sizeof( s ) - 1 ) )
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ParseStamp
+  Description  :  Time stamp in front of a frame: "HH:MM:SS.mmm -> " or "seconds.fraction ".
+  Return value :  us (ms of the day for the clock format, the day is added later), NO_TIME.
+  --------------------------------------------------------------------------------------------------*/
+static int64_t ParseStamp ( const char * p, const char * end ) {
+  uint32_t a, b, c, frac = 0;
+  const char * q;
+
+  while ( p < end && ( *p == ' ' || *p == '[' ) ) p++;
+
+  if ( !( q = ReadDec( p, end, a ) ) ) {
+    return NO_TIME;
+  }
+
+  if ( q < end && *q == ':' ) {
+    if ( !( q = ReadDec( q + 1, end, b ) ) || q >= end || *q != ':' ) return NO_TIME;
+    if ( !( q = ReadDec( q + 1, end, c ) ) ) return NO_TIME;
+    if ( q < end && *q == '.' ) {
+      const char * f = q + 1;
+      if ( ( q = ReadDec( f, end, frac ) ) ) {
+        for ( long n = q - f; n < 3; n++ ) frac *= 10;
+      }
+    }
+    return ( ( (int64_t)a * 60 + b ) * 60 + c ) * 1000000 + (int64_t)frac * 1000;
+  }
+
+  int64_t us = (int64_t)a * 1000000;
+  if ( q < end && *q == '.' ) {
+    const char * f = q + 1;
+    int64_t scale = 100000;
+    for ( q = f; q < end && (unsigned)( *q - '0' ) < 10; q++ ) {
+      us += ( *q - '0' ) * scale;
+      scale /= 10;
+    }
+  }
+  return us;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ParseLine
+  Description  :  Appends the frame of a line to the columns.
+  Return value :  FALSE if the line is not a frame line.
+  --------------------------------------------------------------------------------------------------*/
+static bool ParseLine ( const char * p, const char * end, FrameColumns & col ) {
+  int64_t time = NO_TIME;
+
+  // Frame lines start with "B:", anything before is a time stamp.
+  if ( end - p < 2 || p[0] != 'B' || p[1] != ':' ) {
+    const char * b = p;
+    while ( ( b = (const char *)memchr( b, 'B', end - b ) ) ) {
+      if ( b + 1 < end && b[1] == ':' && ( b == p || b[-1] == ' ' ) ) break;
+      b++;
+    }
+    if ( !b ) {
+      return false;
+    }
+    time = ParseStamp( p, b );
+    p = b;
+  }
+
+  uint32_t broadcast, master, slave, control, length;
+  p += 2;
+  if ( !( p = ReadDec( p, end, broadcast ) ) || !EXPECT( p, " M:0X" ) ||
+       !( p = ReadHex( p, end, master, 3 ) ) || !EXPECT( p, " S:0X" ) ||
+       !( p = ReadHex( p, end, slave, 3 ) ) || !EXPECT( p, " CB:0X" ) ||
+       !( p = ReadHex( p, end, control, 1 ) ) || !EXPECT( p, " L:" ) ||
+       !( p = ReadDec( p, end, length ) ) || !EXPECT( p, " DATA: " ) ) {
+    return false;
+  }
+
+  // Payload: "0XAB " per byte up to CR LF.
+  size_t start = col.Payload.size();
+  while ( p + 3 <= end && p[0] == '0' && p[1] == 'X' ) {
+    uint32_t v;
+    if ( !( p = ReadHex( p + 2, end, v, 2 ) ) ) {
+      col.Payload.resize( start );
+      return false;
+    }
+    col.Payload.push_back( (uint8_t)v );
+    if ( p < end && *p == ' ' ) p++;
+  }
+
+  col.Time.push_back( time );
+  col.End.push_back( (uint32_t)col.Payload.size() );
+  col.Master.push_back( (uint16_t)master );
+  col.Slave.push_back( (uint16_t)slave );
+  col.Control.push_back( (uint8_t)control );
+  col.Flags.push_back( broadcast ? Archive::FLAG_BROADCAST : 0 );
+  col.Length.push_back( (uint8_t)length );
+  return true;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ScanLines
+  Description  :  Parses the lines of text, line ends found 64 bytes at a time.
+  --------------------------------------------------------------------------------------------------*/
+static void ScanLines ( const char * text, const char * end, FrameColumns & col ) {
+  const char * line = text;
+  const char * p = text;
+
+  auto take = [&]( const char * eol ) {
+    const char * e = ( eol > line && eol[-1] == '\r' ) ? eol - 1 : eol;
+    col.Lines++;
+    if ( !ParseLine( line, e, col ) ) {
+      col.Skipped += ( e > line );
+    }
+    line = eol + 1;
+  };
+
+#ifdef __SSE2__
+  const __m128i nl = _mm_set1_epi8( '\n' );
+  for ( ; p + 64 <= end; p += 64 ) {
+    uint64_t mask = 0;
+    for ( int k = 0; k < 4; k++ ) {
+      __m128i v = _mm_loadu_si128( (const __m128i *)( p + 16 * k ) );
+      mask |= (uint64_t)(uint16_t)_mm_movemask_epi8( _mm_cmpeq_epi8( v, nl ) ) << ( 16 * k );
+    }
+    while ( mask ) {
+      take( p + __builtin_ctzll( mask ) );
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for ( ; p < end; p++ ) {
+    if ( *p == '\n' ) take( p );
+  }
+  if ( line < end ) {
+    take( end );
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  Ingest
+  Description  :  Parses text on all threads into columns, one set per part.
+  --------------------------------------------------------------------------------------------------*/
+static std::vector<FrameColumns> Ingest ( const char * text, size_t size, unsigned threads ) {
+  std::vector<FrameColumns> parts( threads );
+  std::vector<size_t> bound( threads + 1, size );
+  bound[0] = 0;
+
+  for ( unsigned t = 1; t < threads; t++ ) {
+    size_t p = std::max( size / threads * t, bound[t - 1] );
+    const char * q = p < size ? (const char *)memchr( text + p, '\n', size - p ) : nullptr;
+    bound[t] = q ? q + 1 - text : size;
+  }
+
+  std::vector<std::thread> pool;
+  for ( unsigned t = 0; t < threads; t++ ) {
+    pool.emplace_back( [&, t]() {
+      parts[t].Reserve( bound[t + 1] - bound[t] );
+      ScanLines( text + bound[t], text + bound[t + 1], parts[t] );
+    } );
+  }
+  for ( auto & th : pool ) th.join();
+  return parts;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  FixTimes
+  Description  :  Day wrap of clock stamps, frames without a stamp take the one before. Without
+                  any stamp the time is the frame number.
+  Return value :  TRUE if the times come from the log.
+  --------------------------------------------------------------------------------------------------*/
+static bool FixTimes ( std::vector<FrameColumns> & parts ) {
+  const int64_t day = 86400LL * 1000000;
+  bool any = false;
+
+  for ( auto & c : parts ) {
+    for ( int64_t t : c.Time ) any |= ( t != NO_TIME );
+  }
+
+  int64_t last = 0, offset = 0, frame = 0;
+  for ( auto & c : parts ) {
+    for ( int64_t & t : c.Time ) {
+      if ( !any ) {
+        t = frame++;
+        continue;
+      }
+      if ( t == NO_TIME ) {
+        t = last;
+        continue;
+      }
+      // A clock stamp far behind the last one is the next day.
+      if ( t + offset < last - day / 2 ) {
+        offset += day;
+      }
+      t += offset;
+      last = t;
+    }
+  }
+  return any;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  WriteArchive
+  Description  :  Writes the columns of all parts as blocks of BlockFrames frames.
+  --------------------------------------------------------------------------------------------------*/
+static bool WriteArchive ( FILE * f, const std::vector<FrameColumns> & parts, bool timed,
+                           uint64_t & bytesOut ) {
+  Archive::FileHeader fh = {};
+  memcpy( fh.Magic, Archive::FileMagic, sizeof fh.Magic );
+  fh.Version = Archive::FileVersion;
+  fh.Flags = timed ? Archive::TIME_FROM_LOG : 0;
+  for ( auto & c : parts ) fh.Frames += c.Size();
+  fh.Blocks = ( fh.Frames + Archive::BlockFrames - 1 ) / Archive::BlockFrames;
+
+  if ( f && fwrite( &fh, sizeof fh, 1, f ) != 1 ) {
+    return false;
+  }
+  bytesOut = sizeof fh;
+
+  std::vector<uint8_t> block;
+  size_t part = 0, pos = 0;
+
+  for ( uint64_t b = 0; b < fh.Blocks; b++ ) {
+    uint32_t n = (uint32_t)std::min<uint64_t>( Archive::BlockFrames, fh.Frames - b * Archive::BlockFrames );
+
+    // Frames of this block, possibly from several parts: (part, first, count).
+    struct Slice { size_t Part, First, Count; };
+    std::vector<Slice> slices;
+    uint32_t payload = 0;
+    for ( uint32_t left = n; left; ) {
+      while ( pos >= parts[part].Size() ) { part++; pos = 0; }
+      const FrameColumns & c = parts[part];
+      size_t count = std::min<size_t>( left, c.Size() - pos );
+      uint32_t from = pos ? c.End[pos - 1] : 0;
+      payload += c.End[pos + count - 1] - from;
+      slices.push_back( { part, pos, count } );
+      pos += count;
+      left -= count;
+    }
+
+    uint64_t bytes = Archive::BlockBytes( n, payload );
+    block.assign( bytes, 0 );
+    Archive::BlockHeader * bh = (Archive::BlockHeader *)block.data();
+    bh->Magic = Archive::BlockMagic;
+    bh->Frames = n;
+    bh->PayloadBytes = payload;
+    bh->Bytes = bytes;
+
+    Archive::BlockColumns out = Archive::Columns( block.data(), n );
+    uint32_t i = 0, offset = 0;
+    for ( const Slice & s : slices ) {
+      const FrameColumns & c = parts[ s.Part ];
+      uint32_t from = s.First ? c.End[ s.First - 1 ] : 0;
+      uint32_t to = c.End[ s.First + s.Count - 1 ];
+
+      memcpy( out.Time + i, &c.Time[ s.First ], s.Count * 8 );
+      memcpy( out.Master + i, &c.Master[ s.First ], s.Count * 2 );
+      memcpy( out.Slave + i, &c.Slave[ s.First ], s.Count * 2 );
+      memcpy( out.Control + i, &c.Control[ s.First ], s.Count );
+      memcpy( out.Flags + i, &c.Flags[ s.First ], s.Count );
+      memcpy( out.Length + i, &c.Length[ s.First ], s.Count );
+      memcpy( out.Payload + offset, &c.Payload[ from ], to - from );
+      for ( size_t k = 0; k < s.Count; k++ ) {
+        out.PayloadOffset[ i + k ] = offset + ( ( s.First + k ) ? c.End[ s.First + k - 1 ] : 0 ) - from;
+      }
+      i += s.Count;
+      offset += to - from;
+    }
+    out.PayloadOffset[n] = offset;
+    Archive::BuildIndex( block.data() );
+
+    if ( f && fwrite( block.data(), 1, bytes, f ) != bytes ) {
+      return false;
+    }
+    bytesOut += bytes;
+  }
+  return true;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  Synthesize
+  Description  :  Synthetic log of about bytes characters: frames with 0..32 payload bytes, every
+                  16th with a clock stamp, a report line now and then.
+  --------------------------------------------------------------------------------------------------*/
+static void Synthesize ( std::string & out, size_t bytes ) {
+  uint32_t seed = 0xACE1;
+  auto rnd = [&]() { seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5; return seed; };
+  char line[ 256 ];
+  uint64_t ms = 0;
+
+  out.reserve( bytes + 256 );
+  while ( out.size() < bytes ) {
+    uint32_t r = rnd();
+    ms += 7;
+
+    if ( ( r & 0x3FF ) == 0 ) {
+      out += "CACHE HIT:1234 SAVED:56789\r\n";
+      continue;
+    }
+
+    int n = 0;
+    if ( ( r & 0xF ) == 0 ) {
+      n = sprintf( line, "%02u:%02u:%02u.%03u -> ", (unsigned)( ms / 3600000 % 24 ),
+                   (unsigned)( ms / 60000 % 60 ), (unsigned)( ms / 1000 % 60 ), (unsigned)( ms % 1000 ) );
+    }
+    uint32_t size = ( r >> 8 ) % 33;
+    n += sprintf( line + n, "B:%u M:0X%X S:0X%X CB:0X%X L:%u DATA: ", ( r >> 4 ) & 1, 0x130 + ( ( r >> 5 ) & 0xF ),
+                  ( r & 0x40 ) ? 0xFFF : 0x140 + ( ( r >> 13 ) & 7 ), 0xE, size );
+    for ( uint32_t i = 0; i < size; i++ ) {
+      n += sprintf( line + n, "0X%X ", rnd() & 0xFF );
+    }
+    memcpy( line + n, "\r\n", 2 );
+    out.append( line, n + 2 );
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  Dump
+  Description  :  Prints an archive as log lines.
+  --------------------------------------------------------------------------------------------------*/
+static int Dump ( const char * path ) {
+  FILE * f = fopen( path, "rb" );
+  if ( !f ) {
+    perror( path );
+    return 1;
+  }
+
+  Archive::FileHeader fh;
+  if ( fread( &fh, sizeof fh, 1, f ) != 1 || memcmp( fh.Magic, Archive::FileMagic, 8 ) ||
+       fh.Version != Archive::FileVersion ) {
+    fprintf( stderr, "%s: not an archive of version %u\n", path, Archive::FileVersion );
+    return 1;
+  }
+
+  std::vector<uint8_t> block;
+  for ( uint64_t b = 0; b < fh.Blocks; b++ ) {
+    Archive::BlockHeader bh;
+    if ( fread( &bh, sizeof bh, 1, f ) != 1 || bh.Magic != Archive::BlockMagic ) {
+      fprintf( stderr, "%s: bad block %llu\n", path, (unsigned long long)b );
+      return 1;
+    }
+    block.resize( bh.Bytes );
+    memcpy( block.data(), &bh, sizeof bh );
+    if ( fread( block.data() + sizeof bh, 1, bh.Bytes - sizeof bh, f ) != bh.Bytes - sizeof bh ) {
+      return 1;
+    }
+
+    Archive::BlockColumns c = Archive::Columns( block.data(), bh.Frames );
+    for ( uint32_t i = 0; i < bh.Frames; i++ ) {
+      if ( fh.Flags & Archive::TIME_FROM_LOG ) {
+        printf( "%lld.%06lld ", (long long)( c.Time[i] / 1000000 ), (long long)( c.Time[i] % 1000000 ) );
+      }
+      printf( "B:%d M:0X%X S:0X%X CB:0X%X L:%d DATA: ", c.Flags[i] & Archive::FLAG_BROADCAST,
+              c.Master[i], c.Slave[i], c.Control[i], c.Length[i] );
+      for ( uint32_t k = c.PayloadOffset[i]; k < c.PayloadOffset[i + 1]; k++ ) {
+        printf( "0X%X ", c.Payload[k] );
+      }
+      printf( "\r\n" );
+    }
+  }
+  fclose( f );
+  return 0;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  main
+  --------------------------------------------------------------------------------------------------*/
+int main ( int argc, char * argv[] ) {
+  unsigned threads = 0;
+  int c;
+
+  while ( ( c = getopt( argc, argv, "j:h" ) ) != -1 ) {
+    switch ( c ) {
+      case 'j': threads = atoi( optarg ); break;
+      default:
+        fprintf( stderr, "usage: %s [-j threads] <log> <archive> | dump <archive> | gen <MB> <log> | bench [-j threads] <MB>\n", argv[0] );
+        return 2;
+    }
+  }
+  if ( !threads ) {
+    threads = std::max( 1u, std::thread::hardware_concurrency() );
+  }
+  InitTables();
+
+  int args = argc - optind;
+  char ** arg = argv + optind;
+
+  if ( args == 2 && !strcmp( arg[0], "dump" ) ) {
+    return Dump( arg[1] );
+  }
+
+  if ( args == 3 && !strcmp( arg[0], "gen" ) ) {
+    std::string text;
+    Synthesize( text, (size_t)atol( arg[1] ) << 20 );
+    FILE * f = fopen( arg[2], "wb" );
+    if ( !f || fwrite( text.data(), 1, text.size(), f ) != text.size() || fclose( f ) ) {
+      perror( arg[2] );
+      return 1;
+    }
+    return 0;
+  }
+
+  // Input text: a mapped log or a synthetic one.
+  const char * text;
+  size_t size;
+  std::string synthetic;
+  FILE * out = nullptr;
+  bool bench = ( args == 2 && !strcmp( arg[0], "bench" ) );
+
+  if ( bench ) {
+    Synthesize( synthetic, (size_t)atol( arg[1] ) << 20 );
+    text = synthetic.data();
+    size = synthetic.size();
+  } else if ( args == 2 ) {
+    int fd = open( arg[0], O_RDONLY );
+    struct stat st;
+    if ( fd < 0 || fstat( fd, &st ) ) {
+      perror( arg[0] );
+      return 1;
+    }
+    size = st.st_size;
+    text = size ? (const char *)mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 ) : "";
+    if ( text == MAP_FAILED ) {
+      perror( arg[0] );
+      return 1;
+    }
+    madvise( (void *)text, size, MADV_SEQUENTIAL );
+    out = fopen( arg[1], "wb" );
+    if ( !out ) {
+      perror( arg[1] );
+      return 1;
+    }
+  } else {
+    fprintf( stderr, "usage: %s [-j threads] <log> <archive> | dump <archive> | gen <MB> <log> | bench [-j threads] <MB>\n", argv[0] );
+    return 2;
+  }
+
+  auto t0 = std::chrono::steady_clock::now();
+  std::vector<FrameColumns> parts = Ingest( text, size, threads );
+  bool timed = FixTimes( parts );
+  auto t1 = std::chrono::steady_clock::now();
+
+  uint64_t bytesOut = 0;
+  if ( !WriteArchive( out, parts, timed, bytesOut ) || ( out && fclose( out ) ) ) {
+    perror( arg[1] );
+    return 1;
+  }
+  auto t2 = std::chrono::steady_clock::now();
+
+  uint64_t frames = 0, lines = 0, skipped = 0;
+  for ( auto & p : parts ) {
+    frames += p.Size();
+    lines += p.Lines;
+    skipped += p.Skipped;
+  }
+  double parse = std::chrono::duration<double>( t1 - t0 ).count();
+  double total = std::chrono::duration<double>( t2 - t0 ).count();
+
+  fprintf( stderr, "input           %.1f MB, %llu lines, %u threads\n", size / 1e6, (unsigned long long)lines, threads );
+  fprintf( stderr, "frames          %llu (%llu other lines skipped)\n", (unsigned long long)frames,
+           (unsigned long long)skipped );
+  fprintf( stderr, "archive         %.1f MB%s\n", bytesOut / 1e6, timed ? ", log time stamps" : "" );
+  fprintf( stderr, "parse           %.3f s, %.1f MB/s\n", parse, parse > 0 ? size / parse / 1e6 : 0.0 );
+  fprintf( stderr, "total           %.3f s, %.1f MB/s\n", total, total > 0 ? size / total / 1e6 : 0.0 );
+  return 0;
+}
@@ -0,0 +1,338 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  iebus_query.cpp
+  Description  :  Searches columnar archives (IebusArchive.h) by address, payload prefix and time.
+  ----------------------------------------------------------------------------------------------------
+     Build (from the repository root):
+
+       g++ -std=c++17 -O3 -march=native -pthread -o iebus_query tools/archive/iebus_query.cpp
+
+     Usage:
+
+       iebus_query [options] <archive>...
+
+       -m <addr>[-<addr>]   master address or range, hex (0x130, 130-13F)
+       -s <addr>[-<addr>]   slave address or range, hex
+       -p <bytes>           payload prefix, hex bytes ("10 01", "10,01" or "1001")
+       -t <from>:<to>       time range in seconds, either side may be empty; archives without
+                            log time stamps count frames instead
+       -b <0|1>             broadcast bit as logged (B:)
+       -c                   print the number of matches only
+       -j <threads>         worker threads (default: all cores)
+
+     Example, every frame from 0x130 to 0x140 with a payload starting with 0x10:
+
+       iebus_query -m 130 -s 140 -p 10 week1.arc week2.arc
+
+     Matches are printed in the DumpRawMessage() format in archive order, statistics go to stderr.
+
+     The archives are mapped read only and never copied: the threads take blocks one by one,
+     drop a block when its BlockIndex rules the query out (time range, address bitmaps, prefix
+     bitmaps of the first one and two payload bytes) and scan the columns of the others in
+     place, the address and time columns first, the payload only for frames still matching.
+  --------------------------------------------------------------------------------------------------*/
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "IebusArchive.h"
+
+/*--------------------------------------------------------------------------------------------------
+                                         Query
+--------------------------------------------------------------------------------------------------*/
+struct Query {
+  uint16_t              MasterMin = 0, MasterMax = Archive::AddressCount - 1;
+  uint16_t              SlaveMin = 0, SlaveMax = Archive::AddressCount - 1;
+  int64_t               TimeMin = INT64_MIN, TimeMax = INT64_MAX;
+  int                   Broadcast = -1;     // -1: any.
+  std::vector<uint8_t>  Prefix;
+};
+
+struct Block {
+  uint8_t *             Data;
+  bool                  Timed;              // Time column from the log (print it).
+};
+
+struct Stats {
+  std::atomic<uint64_t> Skipped { 0 };
+  std::atomic<uint64_t> Scanned { 0 };
+  std::atomic<uint64_t> Bytes { 0 };
+};
+
+static bool ParseRange ( const char * s, uint16_t & lo, uint16_t & hi ) {
+  char * e;
+  unsigned long a = strtoul( s, &e, 16 ), b = a;
+  if ( e == s ) return false;
+  if ( *e == '-' ) {
+    const char * f = e + 1;
+    b = strtoul( f, &e, 16 );
+    if ( e == f ) return false;
+  }
+  if ( *e || a > b || b >= Archive::AddressCount ) return false;
+  lo = a;
+  hi = b;
+  return true;
+}
+
+static bool ParsePrefix ( const char * s, std::vector<uint8_t> & out ) {
+  while ( *s ) {
+    while ( *s == ' ' || *s == ',' ) s++;
+    if ( !*s ) break;
+    if ( s[0] == '0' && ( s[1] == 'x' || s[1] == 'X' ) ) s += 2;
+    char d[3] = { s[0], 0, 0 };
+    if ( !isxdigit( (uint8_t)s[0] ) ) return false;
+    if ( isxdigit( (uint8_t)s[1] ) ) d[1] = s[1];
+    out.push_back( (uint8_t)strtoul( d, nullptr, 16 ) );
+    s += d[1] ? 2 : 1;
+  }
+  return true;
+}
+
+static bool ParseTimes ( const char * s, int64_t & lo, int64_t & hi ) {
+  const char * c = strchr( s, ':' );
+  if ( !c ) return false;
+  if ( c != s ) lo = (int64_t)( atof( s ) * 1e6 );
+  if ( c[1] ) hi = (int64_t)( atof( c + 1 ) * 1e6 );
+  return lo <= hi;
+}
+
+// Any bit of lo..hi set.
+static bool AnyBit ( const uint64_t * bits, uint32_t lo, uint32_t hi ) {
+  uint32_t a = lo >> 6, b = hi >> 6;
+  for ( uint32_t w = a; w <= b; w++ ) {
+    uint64_t m = ~(uint64_t)0;
+    if ( w == a ) m &= ~(uint64_t)0 << ( lo & 63 );
+    if ( w == b ) m &= ~(uint64_t)0 >> ( 63 - ( hi & 63 ) );
+    if ( bits[w] & m ) return true;
+  }
+  return false;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  MayMatch
+  Description  :  Tests a block index against the query.
+  Return value :  FALSE if no frame of the block can match.
+  --------------------------------------------------------------------------------------------------*/
+static bool MayMatch ( const Archive::BlockIndex * x, const Query & q ) {
+  if ( x->MaxTime < q.TimeMin || x->MinTime > q.TimeMax ) return false;
+  if ( !AnyBit( x->Master, q.MasterMin, q.MasterMax ) ) return false;
+  if ( !AnyBit( x->Slave, q.SlaveMin, q.SlaveMax ) ) return false;
+  if ( q.Prefix.size() >= 1 && !Archive::TestBit( x->Prefix1, q.Prefix[0] ) ) return false;
+  if ( q.Prefix.size() >= 2 && !Archive::TestBit( x->Prefix2, q.Prefix[0] << 8 | q.Prefix[1] ) ) return false;
+  return true;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ScanBlock
+  Description  :  Frame numbers of a block matching the query. The header columns are tested
+                  without branches, the payload only of the frames left.
+  --------------------------------------------------------------------------------------------------*/
+static void ScanBlock ( uint8_t * block, const Query & q, std::vector<uint32_t> & hits ) {
+  const Archive::BlockHeader * h = (const Archive::BlockHeader *)block;
+  Archive::BlockColumns c = Archive::Columns( block, h->Frames );
+  uint32_t n = h->Frames;
+
+  hits.resize( n );
+  uint32_t k = 0;
+  const uint16_t mLo = q.MasterMin, mSpan = q.MasterMax - q.MasterMin;
+  const uint16_t sLo = q.SlaveMin, sSpan = q.SlaveMax - q.SlaveMin;
+  const uint8_t bLo = q.Broadcast < 0 ? 0 : q.Broadcast, bSpan = q.Broadcast < 0 ? 1 : 0;
+
+  for ( uint32_t i = 0; i < n; i++ ) {
+    bool ok = ( (uint16_t)( c.Master[i] - mLo ) <= mSpan ) &
+              ( (uint16_t)( c.Slave[i] - sLo ) <= sSpan ) &
+              ( (uint8_t)( ( c.Flags[i] & Archive::FLAG_BROADCAST ) - bLo ) <= bSpan ) &
+              ( c.Time[i] >= q.TimeMin ) & ( c.Time[i] <= q.TimeMax );
+    hits[k] = i;
+    k += ok;
+  }
+
+  if ( !q.Prefix.empty() ) {
+    uint32_t len = q.Prefix.size(), kept = 0;
+    for ( uint32_t j = 0; j < k; j++ ) {
+      uint32_t i = hits[j];
+      if ( c.PayloadOffset[i + 1] - c.PayloadOffset[i] >= len &&
+           memcmp( c.Payload + c.PayloadOffset[i], q.Prefix.data(), len ) == 0 ) {
+        hits[kept++] = i;
+      }
+    }
+    k = kept;
+  }
+  hits.resize( k );
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  PrintFrame
+  Description  :  Appends frame i of a block as a log line.
+  --------------------------------------------------------------------------------------------------*/
+static void PrintFrame ( std::string & out, const Archive::BlockColumns & c, uint32_t i, bool timed ) {
+  char line[ 64 ];
+  if ( timed ) {
+    snprintf( line, sizeof line, "%lld.%06lld ", (long long)( c.Time[i] / 1000000 ),
+              (long long)( c.Time[i] % 1000000 ) );
+    out += line;
+  }
+  snprintf( line, sizeof line, "B:%d M:0X%X S:0X%X CB:0X%X L:%d DATA: ", c.Flags[i] & Archive::FLAG_BROADCAST,
+            c.Master[i], c.Slave[i], c.Control[i], c.Length[i] );
+  out += line;
+  for ( uint32_t k = c.PayloadOffset[i]; k < c.PayloadOffset[i + 1]; k++ ) {
+    snprintf( line, sizeof line, "0X%X ", c.Payload[k] );
+    out += line;
+  }
+  out += "\r\n";
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  MapArchive
+  Description  :  Maps an archive and lists its blocks.
+  --------------------------------------------------------------------------------------------------*/
+static bool MapArchive ( const char * path, std::vector<Block> & blocks, uint64_t & mapped ) {
+  int fd = open( path, O_RDONLY );
+  struct stat st;
+  if ( fd < 0 || fstat( fd, &st ) ) {
+    perror( path );
+    return false;
+  }
+  size_t size = st.st_size;
+  if ( size < sizeof( Archive::FileHeader ) ) {
+    fprintf( stderr, "%s: not an archive\n", path );
+    return false;
+  }
+  uint8_t * base = (uint8_t *)mmap( nullptr, size, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if ( base == MAP_FAILED ) {
+    perror( path );
+    return false;
+  }
+  mapped += size;
+
+  const Archive::FileHeader * fh = (const Archive::FileHeader *)base;
+  if ( memcmp( fh->Magic, Archive::FileMagic, 8 ) || fh->Version != Archive::FileVersion ) {
+    fprintf( stderr, "%s: not an archive of version %u\n", path, Archive::FileVersion );
+    return false;
+  }
+
+  uint64_t pos = sizeof( *fh );
+  for ( uint64_t b = 0; b < fh->Blocks; b++ ) {
+    const Archive::BlockHeader * bh = (const Archive::BlockHeader *)( base + pos );
+    if ( pos + sizeof( *bh ) > size || bh->Magic != Archive::BlockMagic || pos + bh->Bytes > size ) {
+      fprintf( stderr, "%s: bad block %llu\n", path, (unsigned long long)b );
+      return false;
+    }
+    blocks.push_back( { base + pos, ( fh->Flags & Archive::TIME_FROM_LOG ) != 0 } );
+    pos += bh->Bytes;
+  }
+  return true;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  main
+  --------------------------------------------------------------------------------------------------*/
+int main ( int argc, char * argv[] ) {
+  Query q;
+  unsigned threads = 0;
+  bool count = false;
+  int c;
+
+  while ( ( c = getopt( argc, argv, "m:s:p:t:b:cj:h" ) ) != -1 ) {
+    bool ok = true;
+    switch ( c ) {
+      case 'm': ok = ParseRange( optarg, q.MasterMin, q.MasterMax ); break;
+      case 's': ok = ParseRange( optarg, q.SlaveMin, q.SlaveMax ); break;
+      case 'p': ok = ParsePrefix( optarg, q.Prefix ); break;
+      case 't': ok = ParseTimes( optarg, q.TimeMin, q.TimeMax ); break;
+      case 'b': q.Broadcast = atoi( optarg ) ? 1 : 0; break;
+      case 'c': count = true; break;
+      case 'j': threads = atoi( optarg ); break;
+      default: ok = false;
+    }
+    if ( !ok ) {
+      fprintf( stderr, "usage: %s [-m addr[-addr]] [-s addr[-addr]] [-p bytes] [-t from:to] [-b 0|1] [-c] [-j threads] <archive>...\n", argv[0] );
+      return 2;
+    }
+  }
+  if ( optind >= argc ) {
+    fprintf( stderr, "usage: %s [-m addr[-addr]] [-s addr[-addr]] [-p bytes] [-t from:to] [-b 0|1] [-c] [-j threads] <archive>...\n", argv[0] );
+    return 2;
+  }
+  if ( !threads ) {
+    threads = std::max( 1u, std::thread::hardware_concurrency() );
+  }
+
+  auto t0 = std::chrono::steady_clock::now();
+
+  std::vector<Block> blocks;
+  uint64_t mapped = 0;
+  for ( int i = optind; i < argc; i++ ) {
+    if ( !MapArchive( argv[i], blocks, mapped ) ) {
+      return 1;
+    }
+  }
+
+  // Blocks are taken one by one, hits kept per block so the output stays in order.
+  std::vector<std::vector<uint32_t>> hits( blocks.size() );
+  std::atomic<size_t> next { 0 };
+  Stats st;
+
+  std::vector<std::thread> pool;
+  for ( unsigned t = 0; t < threads; t++ ) {
+    pool.emplace_back( [&]() {
+      for ( size_t b; ( b = next++ ) < blocks.size(); ) {
+        uint8_t * data = blocks[b].Data;
+        if ( !MayMatch( Archive::Index( data ), q ) ) {
+          st.Skipped++;
+          continue;
+        }
+        ScanBlock( data, q, hits[b] );
+        st.Scanned += ( (const Archive::BlockHeader *)data )->Frames;
+        st.Bytes += ( (const Archive::BlockHeader *)data )->Bytes;
+      }
+    } );
+  }
+  for ( auto & th : pool ) th.join();
+
+  auto t1 = std::chrono::steady_clock::now();
+
+  uint64_t matches = 0;
+  std::string out;
+  for ( size_t b = 0; b < blocks.size(); b++ ) {
+    matches += hits[b].size();
+    if ( count || hits[b].empty() ) continue;
+
+    const Archive::BlockHeader * h = (const Archive::BlockHeader *)blocks[b].Data;
+    Archive::BlockColumns cols = Archive::Columns( blocks[b].Data, h->Frames );
+    for ( uint32_t i : hits[b] ) {
+      PrintFrame( out, cols, i, blocks[b].Timed );
+      if ( out.size() > ( 1 << 20 ) ) {
+        fwrite( out.data(), 1, out.size(), stdout );
+        out.clear();
+      }
+    }
+  }
+  fwrite( out.data(), 1, out.size(), stdout );
+  if ( count ) {
+    printf( "%llu\n", (unsigned long long)matches );
+  }
+
+  double secs = std::chrono::duration<double>( t1 - t0 ).count();
+  fprintf( stderr, "archives        %d, %.1f MB mapped, %u threads\n", argc - optind, mapped / 1e6, threads );
+  fprintf( stderr, "blocks          %zu, %llu skipped by index\n", blocks.size(), (unsigned long long)st.Skipped.load() );
+  fprintf( stderr, "frames scanned  %llu, %llu matches\n", (unsigned long long)st.Scanned.load(),
+           (unsigned long long)matches );
+  fprintf( stderr, "search          %.3f s, %.1f MB/s of blocks scanned\n", secs,
+           secs > 0 ? st.Bytes.load() / secs / 1e6 : 0.0 );
+  return 0;
+}
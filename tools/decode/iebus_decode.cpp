@@ -0,0 +1,726 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  iebus_decode.cpp
+  Description  :  Linux decoder for logic analyzer captures of the bus line.
+  ----------------------------------------------------------------------------------------------------
+     Build (from the repository root):
+
+       g++ -std=c++17 -O3 -march=native -pthread -o iebus_decode tools/decode/iebus_decode.cpp
+
+     Usage:
+
+       iebus_decode [-f vcd|csv] [-s signal] [-c column] [-i] [-j threads] [-e] [-b MB] <file|->
+
+     Reads a VCD or CSV capture of the comparator output (PIN_IN, high = bus driven) and prints
+     every frame in the DumpRawMessage() format, the whole payload even past IEBUS_DATA_SIZE:
+
+       B:1 M:0X130 S:0X140 CB:0XF L:3 DATA: 0X10 0X1 0X1
+
+     The pulses are classified with the driver's rules, taken from IebusTimings (IebusTiming.h)
+     in Timer 0 ticks of 4 us: a start bit is longer than StartMin and shorter than StartMax ticks
+     and selects the mode, a bit is '1' if its high time is below HalfPeriod ticks. Fields carry
+     an even parity bit, a point-to-point frame ends at the first ack slot read as '1' (no ack).
+
+     Sigrok sessions (.sr) are read through sigrok-cli:
+
+       sigrok-cli -i capture.sr -O vcd | iebus_decode -
+
+     Options:
+
+       -f <format>   vcd or csv, default from the file name (vcd for stdin).
+       -s <name>     VCD: signal to decode (default: the first 1 bit signal).
+       -c <column>   CSV: level column, rows are "time in seconds, level, ..." (default 1).
+       -i            Inverted capture (low = bus driven).
+       -j <threads>  Worker threads (default: all cores).
+       -e            Print errors (parity, no ack, cut frames) with their time on stderr.
+       -b <MB>       Input block size (default 64), memory use is a few times that.
+
+     The input is read in blocks. Every block is split in one text chunk per thread (VCD chunks
+     begin at a "#time" line) which are parsed to edges in parallel. The edges become pulses and
+     a branch-free classifier (SSE2 when available) tags every pulse for every mode at once. The
+     pulses are then split again in one range per thread, each thread decoding the frames whose
+     start bit lies in its range, so ranges are aligned at start bits without a sequential scan.
+     A frame still open at the end of a block is carried to the next one.
+
+     Statistics go to stderr, with the decode rate in edges per second.
+  --------------------------------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+// Driver headers, built for the host.
+typedef uint8_t                 byte;
+#define PROGMEM
+
+#include "../../IebusTiming.h"
+
+/*--------------------------------------------------------------------------------------------------
+                                         Options
+--------------------------------------------------------------------------------------------------*/
+struct Options {
+  bool          Csv = false;
+  bool          FormatGiven = false;
+  std::string   Signal;
+  int           Column = 1;
+  bool          Invert = false;
+  unsigned      Threads = 0;
+  bool          Errors = false;
+  size_t        BlockBytes = 64u << 20;
+};
+
+/*--------------------------------------------------------------------------------------------------
+                                     Classifier tables
+  Thresholds of every mode in ns. TCNT0 counts whole ticks, so "ticks > StartMin" is
+  "width >= ( StartMin + 1 ) * 4 us" and "ticks < HalfPeriod" is "width < HalfPeriod * 4 us".
+--------------------------------------------------------------------------------------------------*/
+static const int32_t TickNs = 4000;
+
+struct ModeLimits {
+  int32_t   Half;               // '1' below.
+  int32_t   StartMin;           // Start bit from ...
+  int32_t   StartMax;           // ... up to below.
+  int64_t   MaxGap;             // Rise to rise longer than that ends a frame (two start bits).
+};
+
+static ModeLimits Limits[ IEBUS_MODE_COUNT ];
+
+static void LoadLimits ( void ) {
+  for ( int m = 0; m < IEBUS_MODE_COUNT; m++ ) {
+    Limits[m].Half     = IebusTimings[m].HalfPeriod * TickNs;
+    Limits[m].StartMin = ( IebusTimings[m].StartMin + 1 ) * TickNs;
+    Limits[m].StartMax = IebusTimings[m].StartMax * TickNs;
+    Limits[m].MaxGap   = (int64_t)IebusTimings[m].StartLength * 2 * TickNs;
+  }
+}
+
+static_assert( IEBUS_MODE_COUNT <= 4, "pulse classes hold 4 modes" );
+
+// Class of a pulse: bit m = '1' in mode m, bit 4 + m = start bit of mode m.
+#define CLASS_ONE( m )          ( 1 << (m) )
+#define CLASS_START( m )        ( 0x10 << (m) )
+#define CLASS_ANY_START         0xF0
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ClassifyPulses
+  Description  :  Tags pulses by high time, 4 per step with SSE2.
+  --------------------------------------------------------------------------------------------------*/
+static void ClassifyPulses ( const int32_t * width, uint8_t * cls, size_t n ) {
+  size_t i = 0;
+
+#ifdef __SSE2__
+  __m128i half[ IEBUS_MODE_COUNT ], lo[ IEBUS_MODE_COUNT ], hi[ IEBUS_MODE_COUNT ];
+  __m128i one[ IEBUS_MODE_COUNT ], start[ IEBUS_MODE_COUNT ];
+
+  for ( int m = 0; m < IEBUS_MODE_COUNT; m++ ) {
+    half[m]  = _mm_set1_epi32( Limits[m].Half );
+    lo[m]    = _mm_set1_epi32( Limits[m].StartMin - 1 );
+    hi[m]    = _mm_set1_epi32( Limits[m].StartMax );
+    one[m]   = _mm_set1_epi32( CLASS_ONE( m ) );
+    start[m] = _mm_set1_epi32( CLASS_START( m ) );
+  }
+
+  for ( ; i + 4 <= n; i += 4 ) {
+    __m128i w = _mm_loadu_si128( (const __m128i *)( width + i ) );
+    __m128i c = _mm_setzero_si128();
+
+    for ( int m = 0; m < IEBUS_MODE_COUNT; m++ ) {
+      __m128i isOne   = _mm_cmplt_epi32( w, half[m] );
+      __m128i isStart = _mm_and_si128( _mm_cmpgt_epi32( w, lo[m] ), _mm_cmplt_epi32( w, hi[m] ) );
+      c = _mm_or_si128( c, _mm_and_si128( isOne, one[m] ) );
+      c = _mm_or_si128( c, _mm_and_si128( isStart, start[m] ) );
+    }
+
+    c = _mm_packs_epi32( c, c );
+    c = _mm_packus_epi16( c, c );
+    uint32_t packed = (uint32_t)_mm_cvtsi128_si32( c );
+    memcpy( cls + i, &packed, 4 );
+  }
+#endif
+
+  for ( ; i < n; i++ ) {
+    int32_t w = width[i];
+    uint8_t c = 0;
+    for ( int m = 0; m < IEBUS_MODE_COUNT; m++ ) {
+      c |= ( w < Limits[m].Half ) ? CLASS_ONE( m ) : 0;
+      c |= ( w >= Limits[m].StartMin && w < Limits[m].StartMax ) ? CLASS_START( m ) : 0;
+    }
+    cls[i] = c;
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                         Parsers
+  Edges are packed as time (ns) << 1 | level.
+--------------------------------------------------------------------------------------------------*/
+typedef std::vector<uint64_t> Edges;
+
+struct VcdFormat {
+  std::string   Id;             // Identifier code of the signal.
+  uint64_t      Num = 1;        // ns = time * Num / Den
+  uint64_t      Den = 1;
+};
+
+static inline bool IsSpace ( char c ) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ParseVcdHeader
+  Description  :  Reads the definitions up to $enddefinitions.
+  Return value :  Offset of the value changes, 0 if the header is not complete in text.
+  --------------------------------------------------------------------------------------------------*/
+static size_t ParseVcdHeader ( const char * text, size_t size, const Options & opt, VcdFormat & fmt ) {
+  std::vector<std::string> tok;
+  size_t p = 0;
+
+  // Tokens up to $enddefinitions $end.
+  while ( true ) {
+    while ( p < size && IsSpace( text[p] ) ) p++;
+    if ( p >= size ) {
+      return 0;
+    }
+    size_t b = p;
+    while ( p < size && !IsSpace( text[p] ) ) p++;
+    tok.emplace_back( text + b, p - b );
+    if ( tok.size() >= 2 && tok[ tok.size() - 2 ] == "$enddefinitions" && tok.back() == "$end" ) {
+      break;
+    }
+  }
+
+  bool found = false;
+  for ( size_t i = 0; i < tok.size(); i++ ) {
+    if ( tok[i] == "$timescale" ) {
+      std::string ts;
+      for ( size_t k = i + 1; k < tok.size() && tok[k] != "$end"; k++ ) ts += tok[k];
+      uint64_t n = strtoull( ts.c_str(), nullptr, 10 );
+      std::string unit = ts.substr( ts.find_first_not_of( "0123456789" ) );
+      static const struct { const char * Unit; uint64_t Num; uint64_t Den; } units[] = {
+        { "s", 1000000000ULL, 1 }, { "ms", 1000000, 1 }, { "us", 1000, 1 },
+        { "ns", 1, 1 }, { "ps", 1, 1000 }, { "fs", 1, 1000000 },
+      };
+      for ( auto & u : units ) {
+        if ( unit == u.Unit ) {
+          fmt.Num = n * u.Num;
+          fmt.Den = u.Den;
+        }
+      }
+    }
+    // $var wire 1 ! line $end
+    if ( tok[i] == "$var" && i + 4 < tok.size() && !found ) {
+      bool oneBit = tok[i + 2] == "1";
+      if ( opt.Signal.empty() ? oneBit : tok[i + 4] == opt.Signal ) {
+        fmt.Id = tok[i + 3];
+        found = true;
+      }
+    }
+  }
+
+  if ( !found ) {
+    fprintf( stderr, "iebus_decode: no %s signal in the VCD header\n",
+             opt.Signal.empty() ? "1 bit" : opt.Signal.c_str() );
+    exit( 1 );
+  }
+  return p;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ParseVcd
+  Description  :  Value changes of the signal in text. time is the current time (VCD units) at
+                  the start and at the end.
+  --------------------------------------------------------------------------------------------------*/
+static void ParseVcd ( const char * p, const char * end, const VcdFormat & fmt, bool invert,
+                       uint64_t & time, Edges & out ) {
+  const size_t idLen = fmt.Id.size();
+  const char * id = fmt.Id.c_str();
+
+  while ( p < end ) {
+    while ( p < end && IsSpace( *p ) ) p++;
+    if ( p >= end ) {
+      break;
+    }
+
+    char c = *p;
+    if ( c == '#' ) {
+      uint64_t t = 0;
+      for ( p++; p < end && *p >= '0' && *p <= '9'; p++ ) t = t * 10 + ( *p - '0' );
+      time = t;
+      continue;
+    }
+
+    const char * b = p;
+    while ( p < end && !IsSpace( *p ) ) p++;
+
+    int level = -1;
+    if ( c == '0' || c == '1' || c == 'x' || c == 'X' || c == 'z' || c == 'Z' ) {
+      // 1!  scalar change.
+      if ( (size_t)( p - b - 1 ) == idLen && memcmp( b + 1, id, idLen ) == 0 ) {
+        level = ( c == '1' );
+      }
+    } else if ( c == 'b' || c == 'B' ) {
+      // b1 !  vector change, last bit.
+      char v = p[-1];
+      while ( p < end && IsSpace( *p ) ) p++;
+      const char * r = p;
+      while ( p < end && !IsSpace( *p ) ) p++;
+      if ( (size_t)( p - r ) == idLen && memcmp( r, id, idLen ) == 0 ) {
+        level = ( v == '1' );
+      }
+    } else if ( c == 'r' || c == 'R' ) {
+      while ( p < end && IsSpace( *p ) ) p++;
+      while ( p < end && !IsSpace( *p ) ) p++;
+    }
+    // $dumpvars, $end, $comment ... are skipped as tokens.
+
+    if ( level >= 0 ) {
+      uint64_t ns = time * fmt.Num / fmt.Den;
+      out.push_back( ( ns << 1 ) | (uint64_t)( level ^ invert ) );
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ParseCsv
+  Description  :  Rows "time (s), level, ..." in text, other rows (headers, comments) skipped.
+  --------------------------------------------------------------------------------------------------*/
+static void ParseCsv ( const char * p, const char * end, int column, bool invert, Edges & out ) {
+
+  while ( p < end ) {
+    const char * eol = (const char *)memchr( p, '\n', end - p );
+    if ( !eol ) eol = end;
+
+    char * q;
+    double seconds = strtod( p, &q );
+    if ( q != p ) {
+      const char * f = q;
+      for ( int col = 0; col < column && f < eol; col++ ) {
+        f = (const char *)memchr( f, ',', eol - f );
+        f = f ? f + 1 : eol;
+      }
+      while ( f < eol && ( *f == ' ' || *f == '"' ) ) f++;
+      if ( f < eol && *f >= '0' && *f <= '9' ) {
+        int level = strtod( f, nullptr ) >= 0.5;
+        uint64_t ns = (uint64_t)( seconds * 1e9 + 0.5 );
+        out.push_back( ( ns << 1 ) | (uint64_t)( level ^ invert ) );
+      }
+    }
+    p = eol + 1;
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                         Decoder
+--------------------------------------------------------------------------------------------------*/
+struct Stats {
+  uint64_t  Frames = 0;
+  uint64_t  Parity = 0;
+  uint64_t  NoAck = 0;
+  uint64_t  Cut = 0;            // Gap or new start bit inside a frame.
+};
+
+struct Pulses {
+  std::vector<uint64_t> Rise;   // ns
+  std::vector<int32_t>  Width;  // ns, saturated
+  std::vector<uint8_t>  Class;
+  std::vector<size_t>   Edge;   // Index of the rising edge in the edge list.
+};
+
+enum FrameEnd { FRAME_OK, FRAME_ERROR, FRAME_OPEN };
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  DecodeFrame
+  Description  :  Decodes the frame whose start bit is pulse s.
+  Return value :  FRAME_OPEN if the pulses end before the frame, next is the pulse after it.
+  --------------------------------------------------------------------------------------------------*/
+static FrameEnd DecodeFrame ( const Pulses & pl, size_t s, size_t & next, const Options & opt,
+                              Stats & st, std::string & out ) {
+  const size_t n = pl.Class.size();
+  int mode = 0;
+  while ( !( pl.Class[s] & CLASS_START( mode ) ) ) mode++;
+
+  const int64_t maxGap = Limits[mode].MaxGap;
+  size_t k = s + 1;
+  bool open = false, cut = false;
+
+  auto bit = [&]() -> uint32_t {
+    if ( open || cut ) return 0;
+    if ( k >= n ) { open = true; return 0; }
+    if ( ( pl.Class[k] & CLASS_ANY_START ) || (int64_t)( pl.Rise[k] - pl.Rise[k - 1] ) > maxGap ) {
+      cut = true;
+      return 0;
+    }
+    return ( pl.Class[k++] >> mode ) & 1;
+  };
+  auto get = [&]( int bits ) {
+    uint32_t v = 0;
+    while ( bits-- ) v = ( v << 1 ) | bit();
+    return v;
+  };
+  auto error = [&]( const char * what ) {
+    if ( opt.Errors ) {
+      fprintf( stderr, "T:%.6f %s\n", pl.Rise[s] * 1e-9, what );
+    }
+  };
+
+  bool parity = true;
+  auto field = [&]( int bits ) {
+    uint32_t v = get( bits );
+    parity &= get( 1 ) == (uint32_t)__builtin_parity( v );
+    return v;
+  };
+
+  // The ack slot: '0' = acknowledged, a point-to-point master stops at a '1'.
+  uint32_t broadcast = get( 1 );
+  bool acked = true;
+  auto ack = [&]() {
+    if ( get( 1 ) && broadcast ) acked = false;
+  };
+
+  uint32_t master  = field( 12 );
+  uint32_t slave   = field( 12 );
+  const char * where = nullptr;
+
+  if ( !parity ) where = "parity error @ address";
+  if ( !where ) { ack(); if ( !acked ) where = "no ack @ slave address"; }
+
+  uint32_t control = 0, size = 0;
+  uint8_t data[ 256 ];
+  if ( !where ) { control = field( 4 ); if ( !parity ) where = "parity error @ control"; }
+  if ( !where ) { ack(); if ( !acked ) where = "no ack @ control"; }
+  if ( !where ) { size = field( 8 ); if ( !parity ) where = "parity error @ length"; }
+  if ( !where ) { ack(); if ( !acked ) where = "no ack @ length"; }
+  for ( uint32_t i = 0; !where && i < size; i++ ) {
+    data[i] = field( 8 );
+    if ( !parity ) where = "parity error @ data";
+    if ( !where ) { ack(); if ( !acked ) where = "no ack @ data"; }
+  }
+
+  if ( open ) {
+    return FRAME_OPEN;
+  }
+  next = k;
+  if ( cut ) {
+    st.Cut++;
+    error( "frame cut" );
+    return FRAME_ERROR;
+  }
+  if ( where ) {
+    ( acked ? st.Parity : st.NoAck )++;
+    error( where );
+    return FRAME_ERROR;
+  }
+
+  // Same line as LogFormatToken() in Log.h.
+  char buf[ 64 ];
+  out += "B:";
+  out += broadcast ? '1' : '0';
+  snprintf( buf, sizeof buf, " M:0X%X S:0X%X CB:0X%X L:%u DATA: ", master, slave, control, size );
+  out += buf;
+  static const char hex[] = "0123456789ABCDEF";
+  for ( uint32_t i = 0; i < size; i++ ) {
+    out += "0X";
+    if ( data[i] >> 4 ) out += hex[ data[i] >> 4 ];
+    out += hex[ data[i] & 0xF ];
+    out += ' ';
+  }
+  out += "\r\n";
+  st.Frames++;
+  return FRAME_OK;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  DecodeRange
+  Description  :  Decodes the frames with a start bit in pulses [begin, end). open is the first
+                  start bit of a frame running past the last pulse, SIZE_MAX if none.
+  --------------------------------------------------------------------------------------------------*/
+static void DecodeRange ( const Pulses & pl, size_t begin, size_t end, const Options & opt,
+                          Stats & st, std::string & out, size_t & open ) {
+  open = SIZE_MAX;
+  size_t i = begin;
+
+  while ( i < end ) {
+    if ( !( pl.Class[i] & CLASS_ANY_START ) ) {
+      i++;
+      continue;
+    }
+    size_t next;
+    if ( DecodeFrame( pl, i, next, opt, st, out ) == FRAME_OPEN ) {
+      open = i;
+      return;
+    }
+    i = std::max( next, i + 1 );
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                         Driver
+--------------------------------------------------------------------------------------------------*/
+struct Decoder {
+  Options       Opt;
+  VcdFormat     Vcd;
+  bool          HeaderDone = false;
+  uint64_t      VcdTime = 0;
+  int           Level = -1;     // Last level seen, edges repeating it are dropped.
+  Edges         Carry;          // Edges of an open frame, decoded with the next block.
+
+  Stats         Total;
+  uint64_t      EdgeCount = 0;
+  uint64_t      Bytes = 0;
+  double        ParseSeconds = 0;
+  double        DecodeSeconds = 0;
+
+  void Block ( const char * text, size_t size, bool last );
+};
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  Decoder::Block
+  Description  :  Parses and decodes complete lines of text.
+  --------------------------------------------------------------------------------------------------*/
+void Decoder::Block ( const char * text, size_t size, bool last ) {
+  const unsigned threads = Opt.Threads;
+  auto t0 = std::chrono::steady_clock::now();
+
+  // Chunk bounds: line starts, VCD chunks at a "#time" line.
+  std::vector<size_t> bound( threads + 1, size );
+  bound[0] = 0;
+  for ( unsigned t = 1; t < threads; t++ ) {
+    size_t p = std::max( size / threads * t, bound[t - 1] );
+    const char * q = text + p;
+    while ( q && q < text + size ) {
+      q = (const char *)memchr( q, '\n', text + size - q );
+      if ( !q ) break;
+      q++;
+      if ( Opt.Csv || ( q < text + size && *q == '#' ) ) break;
+    }
+    bound[t] = q ? std::min( (size_t)( q - text ), size ) : size;
+  }
+
+  std::vector<Edges> parts( threads );
+  std::vector<uint64_t> endTime( threads, VcdTime );
+  std::vector<std::thread> pool;
+  for ( unsigned t = 0; t < threads; t++ ) {
+    pool.emplace_back( [&, t]() {
+      const char * b = text + bound[t];
+      const char * e = text + bound[t + 1];
+      parts[t].reserve( ( e - b ) / 8 );
+      if ( Opt.Csv ) {
+        ParseCsv( b, e, Opt.Column, Opt.Invert, parts[t] );
+      } else {
+        uint64_t time = VcdTime;
+        ParseVcd( b, e, Vcd, Opt.Invert, time, parts[t] );
+        endTime[t] = time;
+      }
+    } );
+  }
+  for ( auto & th : pool ) th.join();
+  pool.clear();
+  if ( !Opt.Csv ) {
+    VcdTime = endTime[ threads - 1 ];
+  }
+
+  // Carried edges first, repeated levels (CSV samples, VCD dumps) dropped.
+  Edges edges;
+  edges.swap( Carry );
+  size_t total = edges.size();
+  for ( auto & p : parts ) total += p.size();
+  edges.reserve( total );
+  for ( auto & p : parts ) {
+    for ( uint64_t e : p ) {
+      int level = e & 1;
+      if ( level != Level ) {
+        edges.push_back( e );
+        Level = level;
+      }
+    }
+    Edges().swap( p );
+  }
+  EdgeCount += edges.size();
+
+  auto t1 = std::chrono::steady_clock::now();
+
+  // Complete pulses: a rise followed by a fall.
+  Pulses pl;
+  size_t first = ( !edges.empty() && !( edges[0] & 1 ) ) ? 1 : 0;
+  size_t count = edges.size() > first ? ( edges.size() - first ) / 2 : 0;
+  pl.Rise.resize( count );
+  pl.Width.resize( count );
+  pl.Edge.resize( count );
+  pl.Class.resize( count );
+  for ( size_t k = 0; k < count; k++ ) {
+    size_t r = first + 2 * k;
+    uint64_t rise = edges[r] >> 1;
+    uint64_t width = ( edges[r + 1] >> 1 ) - rise;
+    pl.Rise[k]  = rise;
+    pl.Width[k] = (int32_t)std::min<uint64_t>( width, INT32_MAX );
+    pl.Edge[k]  = r;
+  }
+
+  std::vector<std::string> out( threads );
+  std::vector<Stats> st( threads );
+  std::vector<size_t> open( threads, SIZE_MAX );
+  for ( unsigned t = 0; t < threads; t++ ) {
+    pool.emplace_back( [&, t]() {
+      size_t b = count / threads * t;
+      size_t e = ( t + 1 == threads ) ? count : count / threads * ( t + 1 );
+      ClassifyPulses( &pl.Width[b], &pl.Class[b], e - b );
+    } );
+  }
+  for ( auto & th : pool ) th.join();
+  pool.clear();
+
+  for ( unsigned t = 0; t < threads; t++ ) {
+    pool.emplace_back( [&, t]() {
+      size_t b = count / threads * t;
+      size_t e = ( t + 1 == threads ) ? count : count / threads * ( t + 1 );
+      DecodeRange( pl, b, e, Opt, st[t], out[t], open[t] );
+    } );
+  }
+  for ( auto & th : pool ) th.join();
+
+  for ( unsigned t = 0; t < threads; t++ ) {
+    fwrite( out[t].data(), 1, out[t].size(), stdout );
+    Total.Frames += st[t].Frames;
+    Total.Parity += st[t].Parity;
+    Total.NoAck  += st[t].NoAck;
+    Total.Cut    += st[t].Cut;
+  }
+
+  // Keep an open frame, or a pulse still high, for the next block.
+  size_t keep = edges.size();
+  size_t openPulse = *std::min_element( open.begin(), open.end() );
+  if ( openPulse != SIZE_MAX ) {
+    keep = pl.Edge[ openPulse ];
+  } else if ( first + 2 * count < edges.size() ) {
+    keep = first + 2 * count;
+  }
+  if ( !last && keep < edges.size() ) {
+    Carry.assign( edges.begin() + keep, edges.end() );
+    EdgeCount -= Carry.size();
+  } else if ( last && openPulse != SIZE_MAX ) {
+    Total.Cut++;
+  }
+
+  auto t2 = std::chrono::steady_clock::now();
+  ParseSeconds += std::chrono::duration<double>( t1 - t0 ).count();
+  DecodeSeconds += std::chrono::duration<double>( t2 - t1 ).count();
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  main
+  --------------------------------------------------------------------------------------------------*/
+int main ( int argc, char * argv[] ) {
+  Decoder dec;
+  Options & opt = dec.Opt;
+  int c;
+
+  while ( ( c = getopt( argc, argv, "f:s:c:ij:eb:h" ) ) != -1 ) {
+    switch ( c ) {
+      case 'f': opt.Csv = !strcmp( optarg, "csv" ); opt.FormatGiven = true; break;
+      case 's': opt.Signal = optarg; break;
+      case 'c': opt.Column = atoi( optarg ); break;
+      case 'i': opt.Invert = true; break;
+      case 'j': opt.Threads = atoi( optarg ); break;
+      case 'e': opt.Errors = true; break;
+      case 'b': opt.BlockBytes = (size_t)atoi( optarg ) << 20; break;
+      default:
+        fprintf( stderr, "usage: %s [-f vcd|csv] [-s signal] [-c column] [-i] [-j threads] [-e] [-b MB] <file|->\n", argv[0] );
+        return 2;
+    }
+  }
+  if ( optind >= argc ) {
+    fprintf( stderr, "%s: no input\n", argv[0] );
+    return 2;
+  }
+
+  const char * path = argv[optind];
+  int fd = strcmp( path, "-" ) ? open( path, O_RDONLY ) : 0;
+  if ( fd < 0 ) {
+    perror( path );
+    return 1;
+  }
+  if ( !opt.FormatGiven ) {
+    size_t len = strlen( path );
+    opt.Csv = len > 4 && !strcasecmp( path + len - 4, ".csv" );
+  }
+  if ( !opt.Threads ) {
+    opt.Threads = std::max( 1u, std::thread::hardware_concurrency() );
+  }
+  if ( opt.BlockBytes < ( 1u << 20 ) ) {
+    opt.BlockBytes = 1u << 20;
+  }
+  LoadLimits();
+
+  auto wall = std::chrono::steady_clock::now();
+
+  // Blocks end at a line end, the rest of the line starts the next block.
+  std::vector<char> buf( opt.BlockBytes );
+  size_t have = 0;
+  bool eof = false;
+
+  while ( !eof ) {
+    ssize_t r = read( fd, buf.data() + have, buf.size() - have );
+    if ( r < 0 ) {
+      perror( path );
+      return 1;
+    }
+    eof = ( r == 0 );
+    have += r;
+    dec.Bytes += r;
+    if ( !eof && have < buf.size() ) {
+      continue;
+    }
+
+    size_t used = 0;
+    if ( !opt.Csv && !dec.HeaderDone ) {
+      used = ParseVcdHeader( buf.data(), have, opt, dec.Vcd );
+      if ( !used ) {
+        if ( eof || have == buf.size() ) {
+          fprintf( stderr, "%s: VCD header not found\n", path );
+          return 1;
+        }
+        continue;
+      }
+      dec.HeaderDone = true;
+    }
+
+    size_t end = have;
+    if ( !eof ) {
+      while ( end > used && buf[ end - 1 ] != '\n' ) end--;
+      if ( end == used ) {
+        fprintf( stderr, "%s: line longer than the block\n", path );
+        return 1;
+      }
+    }
+
+    dec.Block( buf.data() + used, end - used, eof );
+    memmove( buf.data(), buf.data() + end, have - end );
+    have -= end;
+  }
+
+  double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - wall ).count();
+  const Stats & st = dec.Total;
+
+  fflush( stdout );
+  fprintf( stderr, "frames          %llu\n", (unsigned long long)st.Frames );
+  fprintf( stderr, "parity errors   %llu\n", (unsigned long long)st.Parity );
+  fprintf( stderr, "no ack          %llu\n", (unsigned long long)st.NoAck );
+  fprintf( stderr, "cut frames      %llu\n", (unsigned long long)st.Cut );
+  fprintf( stderr, "edges           %llu\n", (unsigned long long)dec.EdgeCount );
+  fprintf( stderr, "input           %.1f MB, %u threads\n", dec.Bytes / 1e6, opt.Threads );
+  fprintf( stderr, "time            %.3f s (parse %.3f s, decode %.3f s)\n", seconds,
+           dec.ParseSeconds, dec.DecodeSeconds );
+  fprintf( stderr, "throughput      %.2f M edges/s, %.1f MB/s\n",
+           seconds > 0 ? dec.EdgeCount / seconds / 1e6 : 0.0, seconds > 0 ? dec.Bytes / seconds / 1e6 : 0.0 );
+
+  return 0;
+}
@@ -0,0 +1,315 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  iebus_edges.cpp
+  Description  :  Timing diagrams of the edge flight recorder dumps (EdgeRecorder.h).
+  ----------------------------------------------------------------------------------------------------
+     Build (from the repository root):
+
+       g++ -std=c++17 -O2 -o iebus_edges tools/edges/iebus_edges.cpp
+
+     Usage:
+
+       iebus_edges [-V out.vcd] [-a] <serial log|->
+
+     Reads the serial output of the firmware, finds the dumps
+
+       EDGES NOACK S M:2
+       E:FF 2A AF 05 8A 09 8A 09 ...
+       EDGES END
+
+     (other lines are skipped, so a whole session log can be given) and prints every pulse of
+     the ring on one line, oldest first, with its high and low time and a bar of one character
+     per Timer 0 tick (4 us). The compare points of the decoder for the mode of the dump, from
+     IebusTimings (IebusTiming.h), are drawn over the bar:
+
+       :   HalfPeriod, a pulse ending before it is read as '1'
+       |   Bit0Hold, high time of a '0'
+       !   BitLength, a bit shorter than this is followed by the next rise early
+
+     The last column is the bit as the decoder reads it, then the findings:
+
+       SHORT    high time below half of a '1': a glitch, or a '1' cut by noise
+       NEAR     high time within one tick of HalfPeriod, read either way
+       LONG     high time over a '0' by more than a tick: two drivers or a stuck line
+       EARLY    next rise before BitLength - 1: a pulse inside the bit (collision, noise)
+       LATE     next rise after BitLength + 1: a missing or late edge
+       START?   start bit outside the accepted window (StartMin .. StartMax)
+
+     -a prints the findings only. -V writes the pulses to a VCD file (1 us steps) for a wave
+     viewer, every start bit is put 1 ms after the end of the previous pulse.
+
+     The ticks are those of the bit timer: a fall is its high time, a rise the length of the
+     previous bit. Without an idle time before a start bit, the time column restarts at 0 there.
+  --------------------------------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+typedef uint8_t                 byte;
+#define PROGMEM
+
+#include "../../IebusTiming.h"
+
+static const unsigned TickUs    = 4;
+static const byte     EdgeRise  = 0x80;
+static const byte     EdgeTicks = 0x7F;
+static const byte     EdgeStart = 0xFF;
+
+/*--------------------------------------------------------------------------------------------------
+                                          Dumps
+--------------------------------------------------------------------------------------------------*/
+struct Dump {
+  std::string           Reason;
+  int                   Mode = 1;           // IEBus mode as printed, 1 based.
+  std::vector<byte>     Entries;
+  unsigned              Line = 0;           // Line of the header in the log.
+};
+
+struct Pulse {
+  bool                  Start = false;
+  unsigned              High = 0;           // Ticks.
+  int                   Period = -1;        // Ticks to the next rise, -1: not recorded.
+  unsigned              Time = 0;           // Ticks from the last start bit.
+};
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ReadDumps
+  Description  :  Collects the dumps of a serial log.
+  --------------------------------------------------------------------------------------------------*/
+static std::vector<Dump> ReadDumps ( FILE * f ) {
+  std::vector<Dump> dumps;
+  bool open = false;
+  char line[ 4096 ];
+  unsigned n = 0;
+
+  while ( fgets( line, sizeof( line ), f ) ) {
+    n++;
+    line[ strcspn( line, "\r\n" ) ] = '\0';
+
+    if ( !strncmp( line, "EDGES END", 9 ) ) {
+      open = false;
+    } else if ( !strncmp( line, "EDGES ", 6 ) ) {
+      Dump d;
+      const char * mode = strstr( line, " M:" );
+      d.Reason = std::string( line + 6, mode ? mode - line - 6 : strlen( line + 6 ) );
+      d.Mode = mode ? atoi( mode + 3 ) : 1;
+      d.Line = n;
+      dumps.push_back( d );
+      open = true;
+    } else if ( open && !strncmp( line, "E:", 2 ) ) {
+      char * p = line + 2;
+      char * end;
+      for ( unsigned long v = strtoul( p, &end, 16 ); end != p; v = strtoul( p, &end, 16 ) ) {
+        dumps.back().Entries.push_back( (byte)v );
+        p = end;
+      }
+    }
+  }
+  return dumps;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ToPulses
+  Description  :  Pairs the rises and falls of a dump. Entries before the first rise are dropped.
+  --------------------------------------------------------------------------------------------------*/
+static std::vector<Pulse> ToPulses ( const Dump & d ) {
+  std::vector<Pulse> pulses;
+  bool high = false;
+  unsigned time = 0;
+
+  for ( byte e : d.Entries ) {
+    if ( e & EdgeRise ) {
+      if ( e == EdgeStart ) {
+        time = 0;
+      } else if ( !pulses.empty() ) {
+        pulses.back().Period = e & EdgeTicks;
+        time += e & EdgeTicks;
+      }
+      Pulse p;
+      p.Start = ( e == EdgeStart );
+      p.Time = time;
+      pulses.push_back( p );
+      high = true;
+    } else if ( high ) {
+      pulses.back().High = e & EdgeTicks;
+      high = false;
+    }
+  }
+  return pulses;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  Findings
+  Description  :  Decoder reading and findings of one pulse against the timings of the mode.
+  --------------------------------------------------------------------------------------------------*/
+static std::string Findings ( const Pulse & p, const IebusTiming & t ) {
+  std::string s;
+
+  if ( p.Start ) {
+    s = "START";
+    if ( p.High <= t.StartMin || p.High >= t.StartMax ) {
+      s += " START?";
+    }
+    return s;
+  }
+
+  s = p.High < t.HalfPeriod ? "1" : "0";
+  if ( p.High * 2 < t.Bit1Hold ) {
+    s += " SHORT";
+  }
+  if ( p.High + 1 >= t.HalfPeriod && p.High <= t.HalfPeriod + 1u ) {
+    s += " NEAR";
+  }
+  if ( p.High > t.Bit0Hold + 1u ) {
+    s += " LONG";
+  }
+  if ( p.Period >= 0 && p.Period + 1 < t.BitLength ) {
+    s += " EARLY";
+  }
+  if ( p.Period > t.BitLength + 1 ) {
+    s += " LATE";
+  }
+  return s;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  Bar
+  Description  :  One character per tick: '#' high, '_' low, the compare points over it.
+  --------------------------------------------------------------------------------------------------*/
+static std::string Bar ( const Pulse & p, const IebusTiming & t ) {
+  unsigned length = p.Period >= 0 ? (unsigned)p.Period : p.High + 1;
+  if ( p.Start ) {
+    length = std::max<unsigned>( length, t.StartMax );
+  } else {
+    length = std::max<unsigned>( length, t.BitLength );
+  }
+
+  std::string s;
+  for ( unsigned i = 0; i < length; i++ ) {
+    char c = ( i < p.High ) ? '#' : ( p.Period < 0 || (int)i < p.Period ) ? '_' : ' ';
+    if ( p.Start ) {
+      if ( i == t.StartMin || i == t.StartMax ) c = '|';
+    } else if ( i == t.HalfPeriod ) {
+      c = ':';
+    } else if ( i == t.Bit0Hold ) {
+      c = '|';
+    } else if ( i == t.BitLength ) {
+      c = '!';
+    }
+    s += c;
+  }
+  return s;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  WriteVcd
+  Description  :  Pulses of every dump as one VCD signal.
+  --------------------------------------------------------------------------------------------------*/
+static void WriteVcd ( const char * path, const std::vector<Dump> & dumps ) {
+  FILE * f = fopen( path, "w" );
+  if ( f == NULL ) {
+    perror( path );
+    return;
+  }
+
+  fprintf( f, "$timescale 1 us $end\n$scope module iebus $end\n$var wire 1 ! bus $end\n"
+              "$upscope $end\n$enddefinitions $end\n#0\n0!\n" );
+
+  uint64_t now = 0;
+  for ( const Dump & d : dumps ) {
+    std::vector<Pulse> pulses = ToPulses( d );
+    uint64_t rise = now + 1000;
+
+    for ( size_t i = 0; i < pulses.size(); i++ ) {
+      const Pulse & p = pulses[i];
+      if ( i > 0 && !p.Start ) {
+        rise += (uint64_t)std::max( pulses[i - 1].Period, 1 ) * TickUs;
+      } else if ( i > 0 ) {
+        rise = now + 1000;
+      }
+      fprintf( f, "#%llu\n1!\n#%llu\n0!\n", (unsigned long long)rise,
+               (unsigned long long)( rise + std::max( p.High, 1u ) * TickUs ) );
+      now = rise + std::max( p.High, 1u ) * TickUs;
+    }
+  }
+  fclose( f );
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                           Main
+--------------------------------------------------------------------------------------------------*/
+int main ( int argc, char * argv[] ) {
+  const char * vcd = NULL;
+  bool findingsOnly = false;
+  int c;
+
+  while ( ( c = getopt( argc, argv, "V:ah" ) ) != -1 ) {
+    switch ( c ) {
+      case 'V': vcd = optarg; break;
+      case 'a': findingsOnly = true; break;
+      default:
+        fprintf( stderr, "usage: %s [-V out.vcd] [-a] <serial log|->\n", argv[0] );
+        return 2;
+    }
+  }
+  if ( optind >= argc ) {
+    fprintf( stderr, "%s: no input\n", argv[0] );
+    return 2;
+  }
+
+  const char * path = argv[optind];
+  FILE * f = strcmp( path, "-" ) ? fopen( path, "r" ) : stdin;
+  if ( f == NULL ) {
+    perror( path );
+    return 1;
+  }
+  std::vector<Dump> dumps = ReadDumps( f );
+  if ( f != stdin ) {
+    fclose( f );
+  }
+
+  for ( const Dump & d : dumps ) {
+    int mode = std::min( std::max( d.Mode - 1, 0 ), IEBUS_MODE_COUNT - 1 );
+    const IebusTiming & t = IebusTimings[ mode ];
+
+    printf( "EDGES %s, line %u, mode %d: bit %u us, '1' %u us, read '1' below %u us, '0' %u us, "
+            "start %u .. %u us\n", d.Reason.c_str(), d.Line, mode + 1, t.BitLength * TickUs,
+            t.Bit1Hold * TickUs, t.HalfPeriod * TickUs, t.Bit0Hold * TickUs,
+            ( t.StartMin + 1 ) * TickUs, ( t.StartMax - 1 ) * TickUs );
+    if ( !findingsOnly ) {
+      printf( "  %6s %5s %5s  %s\n", "t us", "high", "low", "1 char = 4 us, ':' '1' below, '|' '0', '!' bit length" );
+    }
+
+    for ( const Pulse & p : ToPulses( d ) ) {
+      std::string found = Findings( p, t );
+      if ( findingsOnly && found.find( ' ' ) == std::string::npos ) {
+        continue;
+      }
+      if ( p.Start && !findingsOnly ) {
+        printf( "  ------ start bit, idle time before it not recorded\n" );
+      }
+      char low[ 8 ] = "?";
+      if ( p.Period >= 0 ) {
+        snprintf( low, sizeof( low ), "%d", ( p.Period - (int)p.High ) * (int)TickUs );
+      }
+      printf( "  %6u %5u %5s  %-52s %s\n", p.Time * TickUs, p.High * TickUs, low,
+              Bar( p, t ).c_str(), found.c_str() );
+    }
+    printf( "\n" );
+  }
+
+  if ( vcd ) {
+    WriteVcd( vcd, dumps );
+  }
+  fprintf( stderr, "%zu dumps\n", dumps.size() );
+  return 0;
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,239 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  iebus_footprint.cpp
+  Description  :  Per symbol SRAM and flash use of a firmware build, from avr-nm.
+  ----------------------------------------------------------------------------------------------------
+     Build (from the repository root):
+
+       g++ -std=c++17 -O2 -o iebus_footprint tools/footprint/iebus_footprint.cpp
+
+     Usage:
+
+       avr-nm -S -C --size-sort SubaruDisplayEmulator_v_1_3.ino.elf > default.nm
+       iebus_footprint [-n count] [-s sram] [-f flash] <build.nm> [<other.nm>]
+
+     The ELF is the one of the Arduino build folder (arduino-cli compile --build-path <dir>, or
+     "Export compiled binary" in the IDE). avr-nm lists every symbol with its address, size and
+     type. Addresses from 0x800000 are SRAM: .data (D, d) is in SRAM and its initial value in
+     flash, .bss (B, b) is SRAM only. Lower addresses are flash: code and PROGMEM tables.
+
+     With one listing the largest symbols of SRAM and flash are printed with the totals against
+     the budgets of the ATmega328P (2048 bytes of SRAM, 32256 bytes of flash next to the
+     bootloader). SRAM not taken by symbols is left to the stack and the heap, less the string
+     literals: they have no symbol, "avr-size -A" gives them with the whole .data section.
+
+     With two listings, for instance the default build and the one with SIZE_PROFILE, the symbols
+     whose size differs are printed with the change, then the frame depth of the buffers of
+     IebusFrame (LogQueue, 40 bytes a frame) in both builds. The SRAM lines of these two builds,
+     worked out from the types (SchedulerTask is 12 bytes, 8 without the report), the flash lines
+     depend on the compiler:
+
+       SRAM      +40  LogQueue
+       SRAM      -32  SchedulerTasks
+       SRAM      -12  FrameCachePending
+       LogQueue    4 -> 5 frames
+
+     Not verified on real avr-nm output: no AVR toolchain was at hand when it was written. It was
+     only run on listings written by hand in the avr-nm format.
+
+     Options:
+
+       -n <count>    Symbols printed per memory (default 20, 0 = all).
+       -s <bytes>    SRAM budget (default 2048).
+       -f <bytes>    Flash budget (default 32256).
+  --------------------------------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+static const unsigned long SramBase     = 0x800000;
+static const unsigned long SramEnd      = 0x810000;
+static const unsigned      FrameBytes   = 40;       // sizeof( IebusFrame ) on the AVR.
+
+// Frame buffers whose depth is reported.
+static const char * const  FrameBuffers[] = { "LogQueue" };
+
+/*--------------------------------------------------------------------------------------------------
+                                         Listing
+--------------------------------------------------------------------------------------------------*/
+struct Symbol {
+  std::string           Name;
+  unsigned long         Size = 0;
+  bool                  Sram = false;       // In SRAM (.data or .bss).
+  bool                  Flash = false;      // In flash (code, PROGMEM, .data initial value).
+};
+
+struct Listing {
+  std::vector<Symbol>   Symbols;
+  unsigned long         Sram = 0;
+  unsigned long         Flash = 0;
+};
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  Load
+  Description  :  Reads an "avr-nm -S" listing, "address size type name" per line. Symbols
+                  without a size (labels, linker symbols) are skipped.
+  Return value :  False if the file cannot be read.
+  --------------------------------------------------------------------------------------------------*/
+static bool Load ( const char * path, Listing & list ) {
+  FILE * f = strcmp( path, "-" ) ? fopen( path, "r" ) : stdin;
+  if ( f == NULL ) {
+    perror( path );
+    return false;
+  }
+
+  char line[ 1024 ];
+  while ( fgets( line, sizeof( line ), f ) ) {
+    char name[ 1024 ];
+    unsigned long address, size;
+    char type;
+
+    if ( sscanf( line, "%lx %lx %c %1023[^\n]", &address, &size, &type, name ) != 4 || size == 0 ) {
+      continue;
+    }
+
+    Symbol sym;
+    sym.Name = name;
+    sym.Size = size;
+    if ( address >= SramBase && address < SramEnd ) {
+      sym.Sram  = true;
+      sym.Flash = ( type == 'D' || type == 'd' );
+    } else if ( address < SramBase ) {
+      sym.Flash = true;
+    } else {
+      continue;                               // EEPROM, fuses.
+    }
+
+    list.Sram  += sym.Sram ? size : 0;
+    list.Flash += sym.Flash ? size : 0;
+    list.Symbols.push_back( sym );
+  }
+
+  if ( f != stdin ) {
+    fclose( f );
+  }
+  return true;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  PrintLargest
+  Description  :  Largest symbols of one memory.
+  --------------------------------------------------------------------------------------------------*/
+static void PrintLargest ( const Listing & list, bool sram, unsigned count, unsigned long budget ) {
+  std::vector<const Symbol *> syms;
+  for ( const Symbol & s : list.Symbols ) {
+    if ( sram ? s.Sram : s.Flash ) {
+      syms.push_back( &s );
+    }
+  }
+  std::sort( syms.begin(), syms.end(), []( const Symbol * a, const Symbol * b ) {
+    return a->Size != b->Size ? a->Size > b->Size : a->Name < b->Name;
+  } );
+
+  unsigned long total = sram ? list.Sram : list.Flash;
+  printf( "%s %lu of %lu bytes (%.1f%%), %lu free\n", sram ? "SRAM " : "Flash", total, budget,
+          100.0 * total / budget, total < budget ? budget - total : 0 );
+
+  for ( size_t i = 0; i < syms.size() && ( count == 0 || i < count ); i++ ) {
+    printf( "  %6lu  %5.1f%%  %s%s\n", syms[i]->Size, 100.0 * syms[i]->Size / budget,
+            syms[i]->Name.c_str(), sram && syms[i]->Flash ? " (initialised)" : "" );
+  }
+  printf( "\n" );
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  PrintChanges
+  Description  :  Symbols whose size differs between two listings, and the frame buffer depths.
+  --------------------------------------------------------------------------------------------------*/
+static void PrintChanges ( const Listing & a, const Listing & b ) {
+  std::map<std::string, std::pair<const Symbol *, const Symbol *>> both;
+  for ( const Symbol & s : a.Symbols ) both[ s.Name ].first = &s;
+  for ( const Symbol & s : b.Symbols ) both[ s.Name ].second = &s;
+
+  struct Change { const char * Memory; long Delta; std::string Name; };
+  std::vector<Change> changes;
+
+  for ( auto & it : both ) {
+    const Symbol * x = it.second.first;
+    const Symbol * y = it.second.second;
+    long sx = x ? (long)x->Size : 0, sy = y ? (long)y->Size : 0;
+    if ( sx == sy ) {
+      continue;
+    }
+    const Symbol * s = y ? y : x;
+    changes.push_back( { s->Sram ? "SRAM " : "Flash", sy - sx, it.first } );
+  }
+  std::sort( changes.begin(), changes.end(), []( const Change & p, const Change & q ) {
+    int c = strcmp( p.Memory, q.Memory );
+    return c != 0 ? c > 0 : labs( p.Delta ) > labs( q.Delta );
+  } );
+
+  printf( "SRAM   %lu -> %lu bytes (%+ld)\n", a.Sram, b.Sram, (long)b.Sram - (long)a.Sram );
+  printf( "Flash  %lu -> %lu bytes (%+ld)\n\n", a.Flash, b.Flash, (long)b.Flash - (long)a.Flash );
+
+  for ( const Change & c : changes ) {
+    printf( "%s  %+6ld  %s\n", c.Memory, c.Delta, c.Name.c_str() );
+  }
+  printf( "\n" );
+
+  for ( const char * name : FrameBuffers ) {
+    auto it = both.find( name );
+    if ( it == both.end() ) {
+      continue;
+    }
+    unsigned long x = it->second.first ? it->second.first->Size : 0;
+    unsigned long y = it->second.second ? it->second.second->Size : 0;
+    printf( "%-10s  %lu -> %lu frames\n", name, x / FrameBytes, y / FrameBytes );
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                           Main
+--------------------------------------------------------------------------------------------------*/
+int main ( int argc, char * argv[] ) {
+  unsigned count = 20;
+  unsigned long sram = 2048, flash = 32256;
+  int c;
+
+  while ( ( c = getopt( argc, argv, "n:s:f:h" ) ) != -1 ) {
+    switch ( c ) {
+      case 'n': count = atoi( optarg ); break;
+      case 's': sram = strtoul( optarg, NULL, 0 ); break;
+      case 'f': flash = strtoul( optarg, NULL, 0 ); break;
+      default:
+        fprintf( stderr, "usage: %s [-n count] [-s sram] [-f flash] <build.nm> [<other.nm>]\n", argv[0] );
+        return 2;
+    }
+  }
+  if ( optind >= argc || argc - optind > 2 ) {
+    fprintf( stderr, "%s: one or two avr-nm listings expected\n", argv[0] );
+    return 2;
+  }
+
+  Listing first, second;
+  if ( !Load( argv[ optind ], first ) ) {
+    return 1;
+  }
+
+  if ( argc - optind == 1 ) {
+    PrintLargest( first, true, count, sram );
+    PrintLargest( first, false, count, flash );
+    return first.Sram > sram || first.Flash > flash;
+  }
+
+  if ( !Load( argv[ optind + 1 ], second ) ) {
+    return 1;
+  }
+  PrintChanges( first, second );
+  return 0;
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,1430 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  iebus_gateway.cpp
+  Description  :  Serial link daemon: shares the frame stream of the device with local clients.
+  ----------------------------------------------------------------------------------------------------
+     Build (from the repository root):
+
+       g++ -std=c++17 -O2 -pthread -o iebus_gateway tools/gateway/iebus_gateway.cpp
+
+     Usage:
+
+       iebus_gateway [options] <serial port>      serve the device on the serial port
+       iebus_gateway [options] -L <fps>           serve the loopback device, 0 = as fast as it can
+       iebus_gateway sub [-B] [-t s] <socket>     subscriber for load tests: counts the frames
+
+     Options:
+
+       -s <path>     Unix socket for the clients (default /tmp/iebus.sock).
+       -P <path>     PTY for a client that only opens serial ports, linked at <path>. Repeatable.
+       -b <baud>     Serial speed (default 115200).
+       -m <MB>       Most MB a stream keeps for clients that lag (default 64).
+       -r <s>        Print the rates every <s> seconds (default 10, 0 = at exit only).
+       -t <s>        Exit after <s> seconds.
+       -B            Loopback: the device sends binary records instead of text.
+
+     One process owns the serial port, several loggers, dashboards and test scripts read it. The
+     device output is decoded as it comes: DumpRawMessage() lines
+
+       B:1 M:0X130 S:0X140 CB:0XF L:3 DATA: 0X10 0X1 0X1
+
+     or binary frame records (Record, RECORD_FRAME, for a device printing them), the reports of
+     the injection commands (TX:..., Inject.h) and other lines. Every frame is stored once in two
+     streams, text (the line behind a time stamp "seconds.us ", as iebus_ingest and iebus_decode
+     read it, other lines of the device as they are) and binary (Record and the payload, with
+     the time and a sequence number). A stream is a list of chunks, records never span two. The
+     clients share them: each keeps its position and is written straight from the chunks with
+     writev(), nothing is copied per client. A chunk is freed when every client is past it. A
+     client that lags by more than -m MB loses the oldest chunk: the rest of the record it is in
+     is copied for it, the text clients get "GW LOST:<bytes>", the binary ones see the gap in
+     the sequence numbers.
+
+     A socket client writes lines. Its first one picks the stream, "binary" or "text" (another
+     line starts text and is run), nothing is sent before. TX requests are the lines of an iebus_inject script: send, every, stop
+     and clear. The gateway sends them to the device as injection commands, batching the send
+     lines of a client that are waiting, as the window of the status lines takes them (Inject.h),
+     and routes the reports back to the client with its own tags, as "TX:1AQ"
+     lines, or RECORD_REPORT records (Control tag, Flags status) for binary clients. The
+     periodic slots are the ones of the device, shared by all clients. A PTY client reads text.
+
+     One thread runs everything on epoll: device, listening socket, clients, a 100 ms timer (TX
+     timeout, rates) and the signals. -L replaces the serial port by a loopback device on a
+     socketpair, in a thread of its own: it prints random frames (iebus_ingest gen) at <fps>,
+     and answers the injection commands, so the gateway and its clients can be load tested:
+
+       iebus_gateway -L 0 -t 10 &
+       iebus_gateway sub -B -t 9 /tmp/iebus.sock & iebus_gateway sub -t 9 /tmp/iebus.sock
+  --------------------------------------------------------------------------------------------------*/
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../inject/InjectHost.h"
+
+/*--------------------------------------------------------------------------------------------------
+                                        Binary records
+--------------------------------------------------------------------------------------------------*/
+const uint8_t RECORD_FRAME  = 0xB5;         // Frame, Size payload bytes follow.
+const uint8_t RECORD_REPORT = 0xB6;         // TX report: Control = tag, Flags = InjectStatus.
+
+const uint8_t FLAG_BROADCAST = 0x01;        // Broadcast bit as sent, 1 = point-to-point.
+
+struct Record {
+  uint8_t       Magic;
+  uint8_t       Flags;
+  uint8_t       Control;
+  uint8_t       Size;                       // Payload bytes stored behind the record.
+  uint16_t      Master;
+  uint16_t      Slave;
+  uint8_t       Length;                     // Length field of the frame.
+  uint8_t       Reserved[3];
+  uint32_t      Sequence;                   // Frames of the gateway, 0 from the device.
+  uint64_t      TimeUs;                     // CLOCK_REALTIME at reception, 0 from the device.
+};
+
+static_assert( sizeof( Record ) == 24, "packed layout" );
+
+static const size_t LineMax = 512;          // Longer device lines are cut.
+
+static uint64_t NowUs ( clockid_t clock = CLOCK_MONOTONIC ) {
+  struct timespec ts;
+  clock_gettime( clock, &ts );
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                         Text lines
+--------------------------------------------------------------------------------------------------*/
+static uint8_t Hex[ 256 ];                  // Digit value, 0xFF if not a hex digit.
+
+static void InitTables ( void ) {
+  memset( Hex, 0xFF, sizeof Hex );
+  for ( int i = 0; i < 10; i++ ) Hex[ '0' + i ] = i;
+  for ( int i = 0; i < 6; i++ ) Hex[ 'A' + i ] = Hex[ 'a' + i ] = 10 + i;
+}
+
+static inline const char * ReadHex ( const char * p, const char * end, uint32_t & v ) {
+  const char * b = p;
+  v = 0;
+  while ( p < end && Hex[ (uint8_t)*p ] != 0xFF ) {
+    v = ( v << 4 ) | Hex[ (uint8_t)*p++ ];
+  }
+  return p == b ? nullptr : p;
+}
+
+static inline const char * ReadDec ( const char * p, const char * end, uint32_t & v ) {
+  const char * b = p;
+  v = 0;
+  while ( p < end && (unsigned)( *p - '0' ) < 10 ) {
+    v = v * 10 + ( *p++ - '0' );
+  }
+  return p == b ? nullptr : p;
+}
+
+static inline const char * Expect ( const char * p, const char * end, const char * s, size_t n ) {
+  return ( p && (size_t)( end - p ) >= n && memcmp( p, s, n ) == 0 ) ? p + n : nullptr;
+}
+
+#define EXPECT( p, s )          ( p = Expect( p, end, s, sizeof( s ) - 1 ) )
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ParseFrameLine
+  Description  :  Fields and payload of a DumpRawMessage() line, without the line end.
+  Return value :  FALSE if the line is not a frame line.
+  --------------------------------------------------------------------------------------------------*/
+static bool ParseFrameLine ( const char * p, const char * end, Record & r, uint8_t * data ) {
+  uint32_t broadcast, master, slave, control, length;
+
+  if ( !EXPECT( p, "B:" ) || !( p = ReadDec( p, end, broadcast ) ) || !EXPECT( p, " M:0X" ) ||
+       !( p = ReadHex( p, end, master ) ) || !EXPECT( p, " S:0X" ) ||
+       !( p = ReadHex( p, end, slave ) ) || !EXPECT( p, " CB:0X" ) ||
+       !( p = ReadHex( p, end, control ) ) || !EXPECT( p, " L:" ) ||
+       !( p = ReadDec( p, end, length ) ) || !EXPECT( p, " DATA:" ) ) {
+    return false;
+  }
+
+  memset( &r, 0, sizeof r );
+  r.Magic   = RECORD_FRAME;
+  r.Flags   = broadcast ? FLAG_BROADCAST : 0;
+  r.Master  = (uint16_t)master;
+  r.Slave   = (uint16_t)slave;
+  r.Control = (uint8_t)control;
+  r.Length  = (uint8_t)length;
+
+  while ( p < end && r.Size < IEBUS_DATA_SIZE ) {
+    uint32_t v;
+    while ( p < end && *p == ' ' ) p++;
+    if ( !EXPECT( p, "0X" ) || !( p = ReadHex( p, end, v ) ) ) {
+      break;
+    }
+    data[ r.Size++ ] = (uint8_t)v;
+  }
+  return true;
+}
+
+static inline char * PutHex ( char * out, uint32_t v ) {
+  static const char digits[] = "0123456789ABCDEF";
+  char tmp[ 8 ];
+  int n = 0;
+  do {
+    tmp[ n++ ] = digits[ v & 0xF ];
+    v >>= 4;
+  } while ( v );
+  while ( n ) *out++ = tmp[ --n ];
+  return out;
+}
+
+static inline char * PutDec ( char * out, uint64_t v, int digits = 1 ) {
+  char tmp[ 20 ];
+  int n = 0;
+  do {
+    tmp[ n++ ] = '0' + v % 10;
+    v /= 10;
+  } while ( v || n < digits );
+  while ( n ) *out++ = tmp[ --n ];
+  return out;
+}
+
+// DumpRawMessage() line of a record, "\r\n" included. Returns the end.
+static char * FormatFrameLine ( char * out, const Record & r, const uint8_t * data ) {
+  memcpy( out, "B:", 2 );            out = PutDec( out + 2, r.Flags & FLAG_BROADCAST );
+  memcpy( out, " M:0X", 5 );         out = PutHex( out + 5, r.Master );
+  memcpy( out, " S:0X", 5 );         out = PutHex( out + 5, r.Slave );
+  memcpy( out, " CB:0X", 6 );        out = PutHex( out + 6, r.Control );
+  memcpy( out, " L:", 3 );           out = PutDec( out + 3, r.Length );
+  memcpy( out, " DATA: ", 7 );       out += 7;
+  for ( unsigned i = 0; i < r.Size; i++ ) {
+    memcpy( out, "0X", 2 );
+    out = PutHex( out + 2, data[i] );
+    *out++ = ' ';
+  }
+  memcpy( out, "\r\n", 2 );
+  return out + 2;
+}
+
+// "seconds.us " in front of the frame lines of the text stream.
+static char * FormatStamp ( char * out, uint64_t us ) {
+  out = PutDec( out, us / 1000000 );
+  *out++ = '.';
+  out = PutDec( out, us % 1000000, 6 );
+  *out++ = ' ';
+  return out;
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                          Streams
+  A stream is the list of its chunks, each holding whole records, addressed by the byte position
+  from the start of the stream. Clients keep a position and are written from the chunks.
+--------------------------------------------------------------------------------------------------*/
+static const size_t ChunkBytes = 256 * 1024;
+
+struct Chunk {
+  uint64_t              Base;               // Position of Data[0].
+  size_t                Used = 0;
+  std::vector<uint32_t> Starts;             // Offsets of the records.
+  char                  Data[ ChunkBytes ];
+};
+
+struct Stream {
+  std::deque<Chunk *>   Chunks;
+  std::vector<Chunk *>  Spare;
+  uint64_t              End = 0;            // Position after the last record.
+  uint64_t              MaxBytes = 64ull << 20;
+  uint64_t              Records = 0;
+
+  ~Stream () {
+    for ( Chunk * c : Chunks ) delete c;
+    for ( Chunk * c : Spare ) delete c;
+  }
+
+  // Room for a record of up to n bytes, in the last chunk or a new one.
+  char * Reserve ( size_t n ) {
+    if ( Chunks.empty() || Chunks.back()->Used + n > ChunkBytes ) {
+      Chunk * c;
+      if ( Spare.empty() ) {
+        c = new Chunk;
+      } else {
+        c = Spare.back();
+        Spare.pop_back();
+      }
+      c->Base = End;
+      c->Used = 0;
+      c->Starts.clear();
+      Chunks.push_back( c );
+    }
+    return Chunks.back()->Data + Chunks.back()->Used;
+  }
+
+  void Commit ( size_t n ) {
+    Chunk * c = Chunks.back();
+    c->Starts.push_back( (uint32_t)c->Used );
+    c->Used += n;
+    End += n;
+    Records++;
+  }
+
+  void Append ( const char * p, size_t n ) {
+    memcpy( Reserve( n ), p, n );
+    Commit( n );
+  }
+
+  uint64_t Begin ( void ) const { return Chunks.empty() ? End : Chunks.front()->Base; }
+
+  uint64_t Bytes ( void ) const { return End - Begin(); }
+
+  size_t Find ( uint64_t pos ) const {
+    auto it = std::upper_bound( Chunks.begin(), Chunks.end(), pos,
+                                []( uint64_t v, const Chunk * c ) { return v < c->Base; } );
+    return ( it - Chunks.begin() ) - 1;
+  }
+
+  // Up to max iovecs from pos to stop.
+  int Vectors ( uint64_t pos, uint64_t stop, struct iovec * iov, int max ) const {
+    int n = 0;
+    if ( pos >= stop ) {
+      return 0;
+    }
+    for ( size_t i = Find( pos ); i < Chunks.size() && n < max && Chunks[i]->Base < stop; i++ ) {
+      const Chunk * c = Chunks[i];
+      size_t off = pos > c->Base ? pos - c->Base : 0;
+      size_t end = std::min<uint64_t>( c->Used, stop - c->Base );
+      if ( off < end ) {
+        iov[n].iov_base = (void *)( c->Data + off );
+        iov[n].iov_len  = end - off;
+        n++;
+      }
+    }
+    return n;
+  }
+
+  // Start of the first record at or after pos.
+  uint64_t NextRecord ( uint64_t pos ) const {
+    if ( pos >= End ) {
+      return End;
+    }
+    const Chunk * c = Chunks[ Find( pos ) ];
+    auto it = std::lower_bound( c->Starts.begin(), c->Starts.end(), (uint32_t)( pos - c->Base ) );
+    return it == c->Starts.end() ? c->Base + c->Used : c->Base + *it;
+  }
+
+  // Frees the chunks before pos.
+  void Trim ( uint64_t pos ) {
+    while ( Chunks.size() > 1 && Chunks[1]->Base <= pos ) {
+      Spare.push_back( Chunks.front() );
+      Chunks.pop_front();
+    }
+    if ( Chunks.size() == 1 && pos >= End && Chunks.front()->Used > ChunkBytes / 2 ) {
+      Spare.push_back( Chunks.front() );
+      Chunks.pop_front();
+    }
+    while ( Spare.size() > 4 ) {
+      delete Spare.back();
+      Spare.pop_back();
+    }
+  }
+};
+
+/*--------------------------------------------------------------------------------------------------
+                                          Clients
+--------------------------------------------------------------------------------------------------*/
+struct Client {
+  int                   Fd;
+  bool                  Pty = false;
+  bool                  Binary = false;
+  bool                  Chosen = false;     // Stream picked, by the first line.
+  bool                  Armed = false;      // EPOLLOUT waited for.
+  uint64_t              Pos;                // In its stream.
+  std::string           Out;                // Private bytes, sent before the stream.
+  std::string           Replies;            // TX reports, sent between two records.
+  std::string           In;                 // Partial line.
+  uint8_t               NextTag = 0;        // Tags of the script lines without tag=.
+  uint64_t              Sent = 0;
+  uint64_t              Lost = 0;
+  std::string           Name;
+};
+
+// A TX request waiting for the device, with the client tags of its records.
+struct TxCommand {
+  int                   Client;             // Fd.
+  InjectHost::ScriptLine::Kind What;
+  std::vector<InjectHost::Frame> Frames;    // SEND: batched, EVERY: one.
+  uint8_t               Slot = 0;
+  unsigned long         Ms = 0;
+};
+
+// A command sent to the device, waiting for its reports.
+struct TxSent {
+  TxCommand             Command;
+  size_t                Answers;            // Reports closing it still to come.
+  std::map<uint8_t, size_t> Queued;         // Queued bytes by device tag of the records.
+};
+
+// Owner of a device tag.
+struct TxTag {
+  int                   Client;             // Fd.
+  uint8_t               Tag;                // Tag of the client.
+  bool                  Periodic;           // Reported until stopped.
+};
+
+struct Gateway {
+  int                   Epoll = -1;
+  int                   Device = -1;
+  int                   Listen = -1;
+  int                   Timer = -1;
+  int                   Signals = -1;
+  std::string           SocketPath;
+  std::vector<std::string> PtyLinks;
+  unsigned              RateSeconds = 10;
+  unsigned              RunSeconds = 0;
+
+  Stream                Text, Binary;
+  std::map<int, std::unique_ptr<Client>> Clients;
+
+  std::vector<char>     DeviceIn;           // Decoder input.
+  size_t                DeviceUsed = 0;
+  std::string           DeviceOut;
+  bool                  DeviceArmed = false;
+
+  std::deque<TxCommand> TxQueue;
+  std::deque<TxSent>    TxInFlight;         // Oldest first, the device runs them in order.
+  InjectHost::Window    TxWindow;
+  uint64_t              TxSentAt = 0;       // Last command sent or answered.
+  uint8_t               TxNextTag = 0;
+  std::map<uint8_t, TxTag> TxTags;          // By device tag.
+
+  uint32_t              Sequence = 0;
+  uint64_t              Frames = 0, Lines = 0, BytesIn = 0;
+  uint64_t              StartUs = 0, RateUs = 0, RateFrames = 0;
+  bool                  Stop = false;
+};
+
+static void Watch ( Gateway & g, int fd, uint32_t events, int op = EPOLL_CTL_ADD ) {
+  struct epoll_event ev = {};
+  ev.events  = events;
+  ev.data.fd = fd;
+  epoll_ctl( g.Epoll, op, fd, &ev );
+}
+
+static void SetNonBlocking ( int fd ) {
+  fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+}
+
+static void CloseClient ( Gateway & g, int fd ) {
+  auto it = g.Clients.find( fd );
+  if ( it == g.Clients.end() || it->second->Pty ) {
+    return;
+  }
+  epoll_ctl( g.Epoll, EPOLL_CTL_DEL, fd, nullptr );
+  close( fd );
+  g.Clients.erase( it );
+
+  // Its requests: dropped if waiting, reports of the others nobody's. The periodic frames keep
+  // running and their tags, until stopped.
+  for ( auto t = g.TxTags.begin(); t != g.TxTags.end(); ) {
+    if ( t->second.Client != fd ) {
+      ++t;
+    } else if ( t->second.Periodic ) {
+      ( t++ )->second.Client = -1;
+    } else {
+      t = g.TxTags.erase( t );
+    }
+  }
+  g.TxQueue.erase( std::remove_if( g.TxQueue.begin(), g.TxQueue.end(),
+                                   [fd]( const TxCommand & c ) { return c.Client == fd; } ),
+                   g.TxQueue.end() );
+  for ( TxSent & sent : g.TxInFlight ) {
+    if ( sent.Command.Client == fd ) {
+      sent.Command.Client = -1;
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  FlushClient
+  Description  :  Writes the private bytes, then the stream, until the client would block.
+  --------------------------------------------------------------------------------------------------*/
+static void FlushClient ( Gateway & g, Client & c ) {
+  Stream & s = c.Binary ? g.Binary : g.Text;
+
+  while ( c.Chosen ) {
+    struct iovec iov[ 16 ];
+    int n = 0;
+    if ( !c.Out.empty() ) {
+      iov[0].iov_base = (void *)c.Out.data();
+      iov[0].iov_len  = c.Out.size();
+      n = 1;
+    } else {
+      uint64_t stop = s.End;
+      if ( !c.Replies.empty() ) {
+        stop = s.NextRecord( c.Pos );
+        if ( stop == c.Pos ) {
+          c.Out.swap( c.Replies );
+          continue;
+        }
+      }
+      n = s.Vectors( c.Pos, stop, iov, 16 );
+    }
+    if ( n == 0 ) {
+      break;
+    }
+
+    ssize_t w = writev( c.Fd, iov, n );
+    if ( w < 0 ) {
+      if ( errno == EAGAIN || errno == EWOULDBLOCK || c.Pty ) {
+        if ( !c.Armed ) {
+          Watch( g, c.Fd, EPOLLIN | EPOLLOUT, EPOLL_CTL_MOD );
+          c.Armed = true;
+        }
+        return;
+      }
+      shutdown( c.Fd, SHUT_RDWR );          // Closed by ReadClient(), c may be in use.
+      return;
+    }
+    c.Sent += w;
+    if ( !c.Out.empty() ) {
+      c.Out.erase( 0, w );
+    } else {
+      c.Pos += w;
+    }
+  }
+  if ( c.Armed ) {
+    Watch( g, c.Fd, EPOLLIN, EPOLL_CTL_MOD );
+    c.Armed = false;
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  Limit
+  Description  :  Drops the oldest chunk of a stream over MaxBytes. The clients in it keep the
+                  rest of their record and lose the chunk.
+  --------------------------------------------------------------------------------------------------*/
+static void Limit ( Gateway & g, Stream & s, bool binary ) {
+  while ( s.Chunks.size() > 1 && s.Bytes() > s.MaxBytes ) {
+    const Chunk * old = s.Chunks.front();
+    uint64_t next = s.Chunks[1]->Base;
+
+    for ( auto & it : g.Clients ) {
+      Client & c = *it.second;
+      if ( !c.Chosen || c.Binary != binary || c.Pos >= next ) {
+        continue;
+      }
+      uint32_t off = (uint32_t)( c.Pos - old->Base );
+      auto rec = std::upper_bound( old->Starts.begin(), old->Starts.end(), off );
+      uint32_t recordEnd = ( rec == old->Starts.end() ) ? (uint32_t)old->Used : *rec;
+      bool inRecord = rec != old->Starts.begin() && *( rec - 1 ) != off;
+
+      // Rest of the record the client is in, a whole record else.
+      if ( inRecord ) {
+        c.Out.append( old->Data + off, recordEnd - off );
+        off = recordEnd;
+      }
+      c.Lost += old->Used - off;
+      if ( !binary ) {
+        char note[ 40 ];
+        char * e = PutDec( (char *)memcpy( note, "GW LOST:", 8 ) + 8, old->Used - off );
+        memcpy( e, "\r\n", 2 );
+        c.Out.append( note, e + 2 - note );
+      }
+      c.Pos = next;
+    }
+    s.Trim( next );
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                        TX requests
+--------------------------------------------------------------------------------------------------*/
+static void Reply ( Gateway & g, int fd, uint8_t tag, char status ) {
+  auto it = g.Clients.find( fd );
+  if ( it == g.Clients.end() ) {
+    return;
+  }
+  Client & c = *it->second;
+  if ( c.Binary ) {
+    Record r = {};
+    r.Magic   = RECORD_REPORT;
+    r.Flags   = (uint8_t)status;
+    r.Control = tag;
+    c.Replies.append( (const char *)&r, sizeof r );
+  } else {
+    char line[ 12 ] = "TX:";
+    line[3] = "0123456789ABCDEF"[ tag >> 4 ];
+    line[4] = "0123456789ABCDEF"[ tag & 0xF ];
+    line[5] = status;
+    memcpy( line + 6, " \r\n", 3 );
+    c.Replies.append( line, 9 );
+  }
+  FlushClient( g, c );
+}
+
+// Next device tag, mapped to the client tag.
+static uint8_t DeviceTag ( Gateway & g, int fd, uint8_t tag, bool periodic ) {
+  uint8_t t = g.TxNextTag++;
+  for ( int i = 0; i < 255 && ( t == 0 || g.TxTags.count( t ) ); i++ ) {
+    t = g.TxNextTag++;          // 00 is the tag of the command reports, others can be in use.
+  }
+  g.TxTags[ t ] = { fd, tag, periodic };
+  return t;
+}
+
+// Sends the waiting commands while the window of the device takes them (Inject.h).
+static void SendNextCommand ( Gateway & g ) {
+  while ( !g.TxQueue.empty() ) {
+    const TxCommand & cmd = g.TxQueue.front();
+    InjectHost::ScriptLine line;
+    line.What   = cmd.What;
+    line.Slot   = cmd.Slot;
+    line.Ms     = cmd.Ms;
+    line.Record = cmd.Frames[0];
+
+    size_t bytes = 4, queued = 0;
+    if ( cmd.What == InjectHost::ScriptLine::SEND ) {
+      for ( const InjectHost::Frame & f : cmd.Frames ) {
+        bytes  += InjectHost::RecordBytes( f );
+        queued += InjectHost::QueuedBytes( f );
+      }
+    } else {
+      bytes = InjectHost::LinePacket( line ).size();
+    }
+    if ( !g.TxWindow.Fits( bytes, queued ) ) {
+      return;
+    }
+
+    TxSent sent = { cmd, cmd.What == InjectHost::ScriptLine::SEND ? cmd.Frames.size() : 1, {} };
+    std::vector<uint8_t> packet;
+    g.TxQueue.pop_front();
+
+    if ( sent.Command.What == InjectHost::ScriptLine::SEND ) {
+      std::vector<uint8_t> payload;
+      for ( InjectHost::Frame f : sent.Command.Frames ) {
+        f.Tag = DeviceTag( g, sent.Command.Client, f.Tag, false );
+        sent.Queued[ f.Tag ] = InjectHost::QueuedBytes( f );
+        InjectHost::AppendRecord( payload, f );
+      }
+      packet = InjectHost::Packet( INJECT_CMD_SEND, payload );
+    } else {
+      if ( line.What == InjectHost::ScriptLine::EVERY ) {
+        line.Record.Tag = DeviceTag( g, sent.Command.Client, line.Record.Tag, true );
+      }
+      packet = InjectHost::LinePacket( line );
+    }
+
+    g.DeviceOut.append( (const char *)packet.data(), packet.size() );
+    g.TxWindow.Sending( packet.size(), queued );
+    if ( g.TxInFlight.empty() ) {
+      g.TxSentAt = NowUs();
+    }
+    g.TxInFlight.push_back( sent );
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ClientLine
+  Description  :  Runs a line of a client: stream choice or TX request.
+  --------------------------------------------------------------------------------------------------*/
+static void ClientLine ( Gateway & g, Client & c, const std::string & text ) {
+  if ( !c.Chosen ) {
+    c.Chosen = true;
+    c.Binary = text == "binary";
+    c.Pos    = ( c.Binary ? g.Binary : g.Text ).End;
+    if ( text == "binary" || text == "text" ) {
+      return;
+    }
+  }
+
+  InjectHost::ScriptLine line = InjectHost::ParseScriptLine( text.c_str(), c.NextTag );
+  switch ( line.What ) {
+    case InjectHost::ScriptLine::EMPTY:
+      return;
+
+    case InjectHost::ScriptLine::BAD:
+    case InjectHost::ScriptLine::SLEEP:
+      Reply( g, c.Fd, 0, INJECT_BAD );
+      return;
+
+    case InjectHost::ScriptLine::SEND:
+    {
+      // Batched with the send lines of the client still waiting, while the records fit.
+      for ( auto it = g.TxQueue.rbegin(); it != g.TxQueue.rend(); ++it ) {
+        if ( it->Client != c.Fd ) {
+          continue;
+        }
+        if ( it->What == InjectHost::ScriptLine::SEND ) {
+          size_t bytes = InjectHost::RecordBytes( line.Record );
+          for ( const InjectHost::Frame & f : it->Frames ) {
+            bytes += InjectHost::RecordBytes( f );
+          }
+          if ( bytes <= INJECT_COMMAND_SIZE ) {
+            it->Frames.push_back( line.Record );
+            return;
+          }
+        }
+        break;
+      }
+      g.TxQueue.push_back( { c.Fd, line.What, { line.Record } } );
+      break;
+    }
+
+    default:
+      g.TxQueue.push_back( { c.Fd, line.What, { line.Record }, line.Slot, line.Ms } );
+      break;
+  }
+  SendNextCommand( g );
+}
+
+static void ReadClient ( Gateway & g, Client & c ) {
+  char buf[ 4096 ];
+  ssize_t n = read( c.Fd, buf, sizeof buf );
+
+  if ( n <= 0 ) {
+    if ( n == 0 || ( errno != EAGAIN && errno != EINTR ) ) {
+      CloseClient( g, c.Fd );
+    }
+    return;
+  }
+
+  c.In.append( buf, n );
+  size_t eol;
+  while ( ( eol = c.In.find( '\n' ) ) != std::string::npos ) {
+    std::string line = c.In.substr( 0, eol );
+    c.In.erase( 0, eol + 1 );
+    if ( !line.empty() && line.back() == '\r' ) {
+      line.pop_back();
+    }
+    ClientLine( g, c, line );
+  }
+  if ( c.In.size() > LineMax ) {
+    c.In.clear();
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                          Device
+--------------------------------------------------------------------------------------------------*/
+static void StoreFrame ( Gateway & g, Record & r, const uint8_t * data, const char * line, size_t lineBytes ) {
+  uint64_t now = NowUs( CLOCK_REALTIME );
+
+  r.Sequence = g.Sequence++;
+  r.TimeUs   = now;
+
+  char * b = g.Binary.Reserve( sizeof r + r.Size );
+  memcpy( b, &r, sizeof r );
+  memcpy( b + sizeof r, data, r.Size );
+  g.Binary.Commit( sizeof r + r.Size );
+
+  // Time stamp and the line of the device, formatted for a binary device.
+  char * t = g.Text.Reserve( 24 + LineMax + 8 );
+  char * e = FormatStamp( t, now );
+  if ( line ) {
+    memcpy( e, line, lineBytes );
+    e += lineBytes;
+  } else {
+    e = FormatFrameLine( e, r, data );
+  }
+  g.Text.Commit( e - t );
+  g.Frames++;
+}
+
+static void DeviceReport ( Gateway & g, const char * line ) {
+  std::vector<InjectHost::Report> reports;
+  InjectHost::ParseReports( line, reports );
+  g.TxWindow.Line( line );
+
+  for ( const InjectHost::Report & r : reports ) {
+    auto it = r.Tag ? g.TxTags.find( r.Tag ) : g.TxTags.end();
+    bool answer = InjectHost::Answers( r.Status );
+
+    int current = g.TxInFlight.empty() ? -1 : g.TxInFlight.front().Command.Client;
+
+    if ( it != g.TxTags.end() ) {
+      TxTag owner = it->second;
+      Reply( g, owner.Client, owner.Tag, r.Status );
+      // A queued frame is done once sent, failed or refused, a periodic one once stopped.
+      if ( owner.Periodic ? ( r.Status == INJECT_STOPPED || r.Status == INJECT_BAD ||
+                              r.Status == INJECT_OVERFLOW ) : r.Status != INJECT_QUEUED ) {
+        g.TxTags.erase( it );
+      }
+      // Slot of another client stopped.
+      if ( answer && owner.Client != current ) {
+        Reply( g, current, 0, r.Status );
+      }
+    } else if ( answer ) {
+      // Tag 00: bad command, clear, stop of a free slot.
+      Reply( g, current, 0, r.Status );
+    }
+
+    if ( answer && !g.TxInFlight.empty() ) {
+      TxSent & sent = g.TxInFlight.front();
+      auto q = sent.Queued.find( r.Tag );
+      if ( q != sent.Queued.end() ) {
+        g.TxWindow.Answered( q->second );
+        sent.Queued.erase( q );
+      }
+      if ( --sent.Answers == 0 || r.Status == INJECT_BAD ) {
+        // The records after a bad one are not read.
+        for ( const auto & rest : sent.Queued ) {
+          g.TxWindow.Answered( rest.second );
+        }
+        g.TxInFlight.pop_front();
+        g.TxWindow.CommandDone();
+      }
+      g.TxSentAt = NowUs();
+    }
+  }
+  SendNextCommand( g );
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  Decode
+  Description  :  Takes the complete lines and records of the device input.
+  --------------------------------------------------------------------------------------------------*/
+static void Decode ( Gateway & g ) {
+  const char * p   = g.DeviceIn.data();
+  const char * end = p + g.DeviceUsed;
+  uint8_t data[ 256 ];
+
+  while ( p < end ) {
+    if ( (uint8_t)*p == RECORD_FRAME ) {
+      if ( (size_t)( end - p ) < sizeof( Record ) ) {
+        break;
+      }
+      Record r;
+      memcpy( &r, p, sizeof r );
+      if ( (size_t)( end - p ) < sizeof r + r.Size ) {
+        break;
+      }
+      memcpy( data, p + sizeof r, r.Size );
+      p += sizeof r + r.Size;
+      StoreFrame( g, r, data, nullptr, 0 );
+      continue;
+    }
+
+    const char * eol = (const char *)memchr( p, '\n', end - p );
+    if ( !eol ) {
+      if ( end - p > (long)LineMax ) {
+        eol = p + LineMax - 1;      // Cut, no line end seen.
+      } else {
+        break;
+      }
+    }
+    size_t bytes = std::min<size_t>( eol + 1 - p, LineMax );
+    const char * e = ( eol > p && eol[-1] == '\r' ) ? eol - 1 : eol;
+    Record r;
+
+    g.Lines++;
+    if ( p[0] == 'B' && ParseFrameLine( p, e, r, data ) ) {
+      StoreFrame( g, r, data, p, bytes );
+    } else if ( !strncmp( p, "TX:", 3 ) ) {
+      DeviceReport( g, std::string( p, e ).c_str() );
+    } else {
+      if ( !strncmp( p, "TX LOST:", 8 ) ) {
+        g.TxWindow.Line( std::string( p, e ).c_str() );
+        SendNextCommand( g );
+      }
+      g.Text.Append( p, bytes );
+    }
+    p = eol + 1;
+  }
+
+  size_t rest = end - p;
+  memmove( g.DeviceIn.data(), p, rest );
+  g.DeviceUsed = rest;
+}
+
+static void FlushDevice ( Gateway & g ) {
+  while ( !g.DeviceOut.empty() ) {
+    ssize_t w = write( g.Device, g.DeviceOut.data(), g.DeviceOut.size() );
+    if ( w < 0 ) {
+      if ( errno == EAGAIN ) {
+        break;
+      }
+      perror( "device write" );
+      g.Stop = true;
+      return;
+    }
+    g.DeviceOut.erase( 0, w );
+  }
+  bool arm = !g.DeviceOut.empty();
+  if ( arm != g.DeviceArmed ) {
+    Watch( g, g.Device, EPOLLIN | ( arm ? (uint32_t)EPOLLOUT : 0 ), EPOLL_CTL_MOD );
+    g.DeviceArmed = arm;
+  }
+}
+
+static void ReadDevice ( Gateway & g ) {
+  for ( int round = 0; round < 16; round++ ) {
+    if ( g.DeviceIn.size() - g.DeviceUsed < 65536 ) {
+      g.DeviceIn.resize( g.DeviceUsed + 65536 );
+    }
+    ssize_t n = read( g.Device, g.DeviceIn.data() + g.DeviceUsed, g.DeviceIn.size() - g.DeviceUsed );
+    if ( n <= 0 ) {
+      if ( n == 0 || ( errno != EAGAIN && errno != EINTR ) ) {
+        fprintf( stderr, "device closed\n" );
+        g.Stop = true;
+      }
+      break;
+    }
+    g.BytesIn    += n;
+    g.DeviceUsed += n;
+    Decode( g );
+  }
+
+  Limit( g, g.Text, false );
+  Limit( g, g.Binary, true );
+
+  uint64_t textMin = g.Text.End, binaryMin = g.Binary.End;
+  std::vector<int> fds;
+  for ( auto & it : g.Clients ) {
+    fds.push_back( it.first );
+  }
+  for ( int fd : fds ) {
+    auto it = g.Clients.find( fd );
+    if ( it == g.Clients.end() ) {
+      continue;
+    }
+    Client & c = *it->second;
+    if ( !c.Armed ) {
+      FlushClient( g, c );
+    }
+  }
+  for ( auto & it : g.Clients ) {
+    if ( !it.second->Chosen ) {
+      continue;
+    }
+    uint64_t & m = it.second->Binary ? binaryMin : textMin;
+    m = std::min( m, it.second->Pos );
+  }
+  g.Text.Trim( textMin );
+  g.Binary.Trim( binaryMin );
+  FlushDevice( g );
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                     Loopback device
+  Prints random frames at a given rate and answers the injection commands like the firmware,
+  on its end of a socketpair.
+--------------------------------------------------------------------------------------------------*/
+static std::atomic<bool> LoopbackStop( false );
+static const uint16_t LoopbackAddress = 0x140;   // MY_ADDRESS of the default Settings.h.
+
+static void Loopback ( int fd, unsigned long fps, bool binary ) {
+  uint32_t seed = 0xACE1;
+  auto rnd = [&]() { seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5; return seed; };
+  std::string out, in;
+  std::map<uint8_t, uint8_t> slots;         // Periodic slot: tag.
+  uint64_t start = NowUs(), frames = 0;
+
+  auto frame = [&]( Record & r, const uint8_t * data ) {
+    if ( binary ) {
+      out.append( (const char *)&r, sizeof r );
+      out.append( (const char *)data, r.Size );
+    } else {
+      char line[ LineMax ];
+      out.append( line, FormatFrameLine( line, r, data ) - line );
+    }
+  };
+
+  while ( !LoopbackStop ) {
+    // Injection commands: reports, the frames sent as DumpOutgoing prints them.
+    char buf[ 1024 ];
+    ssize_t n;
+    while ( ( n = recv( fd, buf, sizeof buf, MSG_DONTWAIT ) ) > 0 ) {
+      in.append( buf, n );
+    }
+    while ( in.size() >= 4 ) {
+      if ( (uint8_t)in[0] != INJECT_SYNC_BYTE ) {
+        in.erase( 0, 1 );
+        continue;
+      }
+      size_t len = (uint8_t)in[2];
+      if ( in.size() < 4 + len ) {
+        break;
+      }
+      const uint8_t * pk = (const uint8_t *)in.data();
+      uint8_t crc = 0;
+      for ( size_t i = 1; i < 3 + len; i++ ) crc = InjectCrc8( crc, pk[i] );
+
+      std::string reports;
+      if ( crc != pk[ 3 + len ] ) {
+        reports = "TX:00B \r\n";
+      } else if ( pk[1] == INJECT_CMD_SEND ) {
+        for ( size_t i = 3; i < 3 + len; ) {
+          const uint8_t * rec = pk + i;
+          size_t header = INJECT_WIRE_HEADER + ( ( rec[1] & INJECT_MASTER ) ? 2 : 0 );
+          const uint8_t * field = rec + header - 3;
+          Record r = {};
+          r.Magic   = RECORD_FRAME;
+          r.Flags   = ( rec[1] & INJECT_BROADCAST ) ? 0 : FLAG_BROADCAST;
+          r.Master  = ( rec[1] & INJECT_MASTER ) ? ( rec[2] << 8 | rec[3] ) : LoopbackAddress;
+          r.Control = field[0] >> 4;
+          r.Slave   = ( field[0] & 0xF ) << 8 | field[1];
+          r.Size    = r.Length = field[2];
+          char tag[ 16 ];
+          snprintf( tag, sizeof tag, "TX:%02XQ \r\n", rec[0] );
+          out += tag;
+          frame( r, rec + header );
+          snprintf( tag, sizeof tag, "TX:%02XS \r\n", rec[0] );
+          out += tag;
+          i += header + field[2];
+        }
+      } else if ( pk[1] == INJECT_CMD_PERIODIC ) {
+        // Not sent: the loopback only tells the slot started or stopped.
+        char tag[ 16 ];
+        if ( len > 3 ) {
+          slots[ pk[3] ] = pk[6];
+          snprintf( tag, sizeof tag, "TX:%02XQ \r\n", pk[6] );
+        } else {
+          snprintf( tag, sizeof tag, "TX:%02XC \r\n", slots.count( pk[3] ) ? slots[ pk[3] ] : 0 );
+          slots.erase( pk[3] );
+        }
+        reports = tag;
+      } else {
+        slots.clear();
+        reports = "TX:00C \r\n";
+      }
+      out += reports;
+      in.erase( 0, 4 + len );
+    }
+
+    // Frames due by the rate, a batch at a time.
+    uint64_t due = fps ? ( NowUs() - start ) * fps / 1000000 : frames + 256;
+    for ( ; frames < due && out.size() < 65536; frames++ ) {
+      uint32_t v = rnd();
+      uint8_t data[ IEBUS_DATA_SIZE ];
+      Record r = {};
+      r.Magic   = RECORD_FRAME;
+      r.Flags   = ( v >> 4 ) & 1;
+      r.Master  = 0x130 + ( ( v >> 5 ) & 0xF );
+      r.Slave   = ( v & 0x40 ) ? 0xFFF : 0x140 + ( ( v >> 13 ) & 7 );
+      r.Control = 0xE;
+      r.Size    = r.Length = ( v >> 8 ) % 33;
+      for ( unsigned i = 0; i < r.Size; i++ ) data[i] = (uint8_t)rnd();
+      frame( r, data );
+    }
+
+    if ( out.empty() ) {
+      usleep( 1000 );
+      continue;
+    }
+    size_t done = 0;
+    while ( done < out.size() && !LoopbackStop ) {
+      ssize_t w = send( fd, out.data() + done, out.size() - done, MSG_NOSIGNAL );
+      if ( w < 0 ) {
+        if ( errno == EAGAIN || errno == EINTR ) {
+          struct pollfd p = { fd, POLLOUT, 0 };
+          poll( &p, 1, 100 );
+          continue;
+        }
+        return;
+      }
+      done += w;
+    }
+    out.clear();
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                          Setup
+--------------------------------------------------------------------------------------------------*/
+static speed_t BaudRate ( unsigned long baud ) {
+  switch ( baud ) {
+    case 9600:   return B9600;
+    case 19200:  return B19200;
+    case 38400:  return B38400;
+    case 57600:  return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    default:     return 0;
+  }
+}
+
+static int OpenPort ( const char * path, unsigned long baud ) {
+  int fd = open( path, O_RDWR | O_NOCTTY | O_NONBLOCK );
+  if ( fd < 0 ) {
+    return -1;
+  }
+  struct termios tio;
+  if ( tcgetattr( fd, &tio ) == 0 ) {
+    cfmakeraw( &tio );
+    cfsetispeed( &tio, BaudRate( baud ) );
+    cfsetospeed( &tio, BaudRate( baud ) );
+    tio.c_cflag |= CLOCAL | CREAD;
+    tcsetattr( fd, TCSANOW, &tio );
+  }
+  return fd;
+}
+
+static int ListenOn ( const std::string & path ) {
+  int fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0 );
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  strncpy( addr.sun_path, path.c_str(), sizeof( addr.sun_path ) - 1 );
+  unlink( path.c_str() );
+  if ( fd < 0 || bind( fd, (struct sockaddr *)&addr, sizeof addr ) < 0 || listen( fd, 16 ) < 0 ) {
+    return -1;
+  }
+  return fd;
+}
+
+// PTY master for a client, the slave linked at path. The slave stays open in the gateway, so
+// the master does not hang up while no program has it open.
+static int OpenPty ( const std::string & path ) {
+  int fd = posix_openpt( O_RDWR | O_NOCTTY | O_NONBLOCK );
+  if ( fd < 0 || grantpt( fd ) < 0 || unlockpt( fd ) < 0 ) {
+    return -1;
+  }
+  const char * name = ptsname( fd );
+  int slave = open( name, O_RDWR | O_NOCTTY );
+  struct termios tio;
+  if ( slave >= 0 && tcgetattr( slave, &tio ) == 0 ) {
+    cfmakeraw( &tio );
+    tcsetattr( slave, TCSANOW, &tio );
+  }
+  unlink( path.c_str() );
+  if ( symlink( name, path.c_str() ) < 0 ) {
+    return -1;
+  }
+  return fd;
+}
+
+static void AddClient ( Gateway & g, int fd, bool pty, const std::string & name ) {
+  std::unique_ptr<Client> c( new Client );
+  c->Fd     = fd;
+  c->Pty    = pty;
+  c->Chosen = pty;
+  c->Pos    = g.Text.End;
+  c->Name   = name;
+  SetNonBlocking( fd );
+  Watch( g, fd, EPOLLIN );
+  g.Clients[ fd ] = std::move( c );
+}
+
+static void PrintRates ( Gateway & g, bool total ) {
+  uint64_t now = NowUs();
+  double seconds = ( now - ( total ? g.StartUs : g.RateUs ) ) / 1e6;
+  uint64_t frames = g.Frames - ( total ? 0 : g.RateFrames );
+
+  fprintf( stderr, "%s frames %llu (%.0f/s), lines %llu, %.1f MB in, %zu clients, streams %.1f + %.1f MB\n",
+           total ? "total" : "gw   ", (unsigned long long)frames, seconds > 0 ? frames / seconds : 0.0,
+           (unsigned long long)g.Lines, g.BytesIn / 1e6, g.Clients.size(), g.Text.Bytes() / 1e6,
+           g.Binary.Bytes() / 1e6 );
+  if ( total ) {
+    for ( auto & it : g.Clients ) {
+      const Client & c = *it.second;
+      fprintf( stderr, "  client %-20s %s %.1f MB sent, %.1f MB lost\n", c.Name.c_str(),
+               c.Binary ? "binary" : "text  ", c.Sent / 1e6, c.Lost / 1e6 );
+    }
+  }
+  g.RateUs     = now;
+  g.RateFrames = g.Frames;
+}
+
+static void Tick ( Gateway & g ) {
+  uint64_t expirations;
+  if ( read( g.Timer, &expirations, sizeof expirations ) < 0 ) {
+    return;
+  }
+  uint64_t now = NowUs();
+
+  // The device did not report on the commands: they are given up, the window starts over.
+  if ( !g.TxInFlight.empty() && now - g.TxSentAt > 500000 ) {
+    for ( const TxSent & sent : g.TxInFlight ) {
+      Reply( g, sent.Command.Client, 0, INJECT_BAD );
+    }
+    g.TxInFlight.clear();
+    g.TxWindow = InjectHost::Window();
+    SendNextCommand( g );
+    FlushDevice( g );
+  }
+  if ( g.RateSeconds && now - g.RateUs >= g.RateSeconds * 1000000ull ) {
+    PrintRates( g, false );
+  }
+  if ( g.RunSeconds && now - g.StartUs >= g.RunSeconds * 1000000ull ) {
+    g.Stop = true;
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  Serve
+  Description  :  Event loop of the gateway.
+  --------------------------------------------------------------------------------------------------*/
+static int Serve ( Gateway & g ) {
+  struct epoll_event events[ 64 ];
+
+  g.StartUs = g.RateUs = NowUs();
+  while ( !g.Stop ) {
+    int n = epoll_wait( g.Epoll, events, 64, -1 );
+    if ( n < 0 && errno != EINTR ) {
+      perror( "epoll_wait" );
+      return 1;
+    }
+    for ( int i = 0; i < n && !g.Stop; i++ ) {
+      int fd = events[i].data.fd;
+      uint32_t ev = events[i].events;
+
+      if ( fd == g.Device ) {
+        if ( ev & EPOLLOUT ) FlushDevice( g );
+        if ( ev & ( EPOLLIN | EPOLLHUP | EPOLLERR ) ) ReadDevice( g );
+      } else if ( fd == g.Listen ) {
+        int c;
+        while ( ( c = accept( g.Listen, nullptr, nullptr ) ) >= 0 ) {
+          AddClient( g, c, false, "socket " + std::to_string( c ) );
+        }
+      } else if ( fd == g.Timer ) {
+        Tick( g );
+      } else if ( fd == g.Signals ) {
+        g.Stop = true;
+      } else {
+        auto it = g.Clients.find( fd );
+        if ( it == g.Clients.end() ) {
+          continue;
+        }
+        Client & c = *it->second;
+        if ( ev & EPOLLOUT ) {
+          c.Armed = false;
+          Watch( g, fd, EPOLLIN, EPOLL_CTL_MOD );
+          FlushClient( g, c );
+        }
+        if ( g.Clients.count( fd ) && ( ev & ( EPOLLIN | EPOLLHUP | EPOLLERR ) ) ) {
+          ReadClient( g, c );
+          FlushDevice( g );
+        }
+      }
+    }
+  }
+  PrintRates( g, true );
+  return 0;
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                         Subscriber
+  Counts the frames of a stream: iebus_gateway sub [-B] [-t s] <socket>.
+--------------------------------------------------------------------------------------------------*/
+static int Subscribe ( int argc, char * argv[] ) {
+  bool binary = false;
+  unsigned seconds = 10;
+  int c;
+
+  optind = 2;
+  while ( ( c = getopt( argc, argv, "Bt:" ) ) != -1 ) {
+    switch ( c ) {
+      case 'B': binary = true; break;
+      case 't': seconds = strtoul( optarg, nullptr, 0 ); break;
+      default:
+        fprintf( stderr, "usage: %s sub [-B] [-t s] <socket>\n", argv[0] );
+        return 2;
+    }
+  }
+  if ( optind >= argc ) {
+    fprintf( stderr, "%s: no socket\n", argv[0] );
+    return 2;
+  }
+
+  int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  strncpy( addr.sun_path, argv[optind], sizeof( addr.sun_path ) - 1 );
+  if ( connect( fd, (struct sockaddr *)&addr, sizeof addr ) < 0 ) {
+    perror( argv[optind] );
+    return 1;
+  }
+  const char * hello = binary ? "binary\n" : "text\n";
+  if ( write( fd, hello, strlen( hello ) ) < 0 ) {
+    return 1;
+  }
+
+  std::vector<char> buf( 1 << 20 );
+  size_t used = 0;
+  uint64_t frames = 0, lines = 0, bytes = 0, gaps = 0;
+  uint32_t next = 0;
+  bool first = true;
+  uint64_t start = NowUs(), end = start + seconds * 1000000ull;
+
+  while ( NowUs() < end ) {
+    struct pollfd p = { fd, POLLIN, 0 };
+    if ( poll( &p, 1, 100 ) <= 0 ) {
+      continue;
+    }
+    ssize_t n = read( fd, buf.data() + used, buf.size() - used );
+    if ( n <= 0 ) {
+      break;
+    }
+    bytes += n;
+    used  += n;
+
+    size_t at = 0;
+    if ( binary ) {
+      while ( used - at >= sizeof( Record ) ) {
+        Record r;
+        memcpy( &r, buf.data() + at, sizeof r );
+        if ( used - at < sizeof r + r.Size ) {
+          break;
+        }
+        if ( r.Magic == RECORD_FRAME ) {
+          gaps += !first && r.Sequence != next;
+          next  = r.Sequence + 1;
+          first = false;
+          frames++;
+        }
+        at += sizeof r + r.Size;
+      }
+    } else {
+      const char * p0 = buf.data();
+      const char * e;
+      while ( ( e = (const char *)memchr( p0 + at, '\n', used - at ) ) ) {
+        const char * b = (const char *)memchr( p0 + at, 'B', e - ( p0 + at ) );
+        frames += b && b + 1 < e && b[1] == ':';
+        lines++;
+        at = e + 1 - p0;
+      }
+    }
+    memmove( buf.data(), buf.data() + at, used - at );
+    used -= at;
+  }
+
+  double s = ( NowUs() - start ) / 1e6;
+  printf( "%s frames %llu (%.0f/s), %.1f MB (%.1f MB/s)", binary ? "binary" : "text", (unsigned long long)frames,
+          frames / s, bytes / 1e6, bytes / 1e6 / s );
+  if ( binary ) {
+    printf( ", %llu sequence gaps\n", (unsigned long long)gaps );
+  } else {
+    printf( ", %llu lines\n", (unsigned long long)lines );
+  }
+  close( fd );
+  return 0;
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                           Main
+--------------------------------------------------------------------------------------------------*/
+int main ( int argc, char * argv[] ) {
+  Gateway g;
+  unsigned long baud = 115200;
+  long loopbackFps = -1;
+  bool loopbackBinary = false;
+  int c;
+
+  InitTables();
+  if ( argc > 1 && !strcmp( argv[1], "sub" ) ) {
+    return Subscribe( argc, argv );
+  }
+
+  g.SocketPath = "/tmp/iebus.sock";
+  while ( ( c = getopt( argc, argv, "s:P:b:m:r:t:L:Bh" ) ) != -1 ) {
+    switch ( c ) {
+      case 's': g.SocketPath = optarg; break;
+      case 'P': g.PtyLinks.push_back( optarg ); break;
+      case 'b': baud = strtoul( optarg, nullptr, 0 ); break;
+      case 'm': g.Text.MaxBytes = g.Binary.MaxBytes = strtoull( optarg, nullptr, 0 ) << 20; break;
+      case 'r': g.RateSeconds = strtoul( optarg, nullptr, 0 ); break;
+      case 't': g.RunSeconds = strtoul( optarg, nullptr, 0 ); break;
+      case 'L': loopbackFps = strtol( optarg, nullptr, 0 ); break;
+      case 'B': loopbackBinary = true; break;
+      default:
+        fprintf( stderr, "usage: %s [-s socket] [-P pty]... [-b baud] [-m MB] [-r s] [-t s] <serial port> | -L fps [-B]\n"
+                         "       %s sub [-B] [-t s] <socket>\n", argv[0], argv[0] );
+        return 2;
+    }
+  }
+
+  std::thread loopback;
+  if ( loopbackFps >= 0 ) {
+    int pair[2];
+    if ( socketpair( AF_UNIX, SOCK_STREAM, 0, pair ) < 0 ) {
+      perror( "socketpair" );
+      return 1;
+    }
+    int size = 1 << 20;
+    setsockopt( pair[0], SOL_SOCKET, SO_RCVBUF, &size, sizeof size );
+    g.Device = pair[0];
+    SetNonBlocking( g.Device );
+    loopback = std::thread( Loopback, pair[1], (unsigned long)loopbackFps, loopbackBinary );
+  } else {
+    if ( optind >= argc ) {
+      fprintf( stderr, "%s: no serial port (or -L)\n", argv[0] );
+      return 2;
+    }
+    if ( BaudRate( baud ) == 0 ) {
+      fprintf( stderr, "%s: unsupported baud rate %lu\n", argv[0], baud );
+      return 2;
+    }
+    g.Device = OpenPort( argv[optind], baud );
+    if ( g.Device < 0 ) {
+      perror( argv[optind] );
+      return 1;
+    }
+  }
+
+  g.Epoll  = epoll_create1( 0 );
+  g.Listen = ListenOn( g.SocketPath );
+  if ( g.Listen < 0 ) {
+    perror( g.SocketPath.c_str() );
+    return 1;
+  }
+
+  g.Timer = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK );
+  struct itimerspec its = { { 0, 100000000 }, { 0, 100000000 } };
+  timerfd_settime( g.Timer, 0, &its, nullptr );
+
+  sigset_t mask;
+  sigemptyset( &mask );
+  sigaddset( &mask, SIGINT );
+  sigaddset( &mask, SIGTERM );
+  sigprocmask( SIG_BLOCK, &mask, nullptr );
+  g.Signals = signalfd( -1, &mask, SFD_NONBLOCK );
+  signal( SIGPIPE, SIG_IGN );
+
+  Watch( g, g.Device, EPOLLIN );
+  Watch( g, g.Listen, EPOLLIN );
+  Watch( g, g.Timer, EPOLLIN );
+  Watch( g, g.Signals, EPOLLIN );
+
+  for ( const std::string & link : g.PtyLinks ) {
+    int fd = OpenPty( link );
+    if ( fd < 0 ) {
+      perror( link.c_str() );
+      return 1;
+    }
+    AddClient( g, fd, true, link );
+  }
+
+  int rc = Serve( g );
+
+  LoopbackStop = true;
+  if ( loopback.joinable() ) {
+    shutdown( g.Device, SHUT_RDWR );        // Wakes the thread up in send().
+    loopback.join();
+  }
+  unlink( g.SocketPath.c_str() );
+  for ( const std::string & link : g.PtyLinks ) {
+    unlink( link.c_str() );
+  }
+  return rc;
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,278 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  InjectHost.h
+  Description  :  Host side of the frame injection protocol (Inject.h): command packets and the
+                  parsing of the status reports. Used by iebus_inject and the simulator.
+--------------------------------------------------------------------------------------------------*/
+#ifndef _INJECT_HOST_H_
+#define _INJECT_HOST_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _SIM_ARDUINO_H_
+typedef uint8_t         byte;
+typedef unsigned int    word;
+#endif
+#include "../../IebusFrame.h"
+#include "../../Inject.h"
+
+namespace InjectHost {
+
+// Frame of a command, the fields of the frame record.
+struct Frame {
+  uint8_t               Tag = 0;
+  bool                  Broadcast = false;
+  uint8_t               Mode = 1;           // IebusMode, 1 = IEBus mode 2.
+  int                   Master = -1;        // -1: the address of the device.
+  uint16_t              Slave = 0;
+  uint8_t               Control = 0xF;
+  std::vector<uint8_t>  Data;
+};
+
+struct Report {
+  uint8_t               Tag;
+  char                  Status;             // InjectStatus.
+};
+
+inline size_t RecordBytes ( const Frame & f ) {
+  return INJECT_WIRE_HEADER + ( f.Master >= 0 ? 2 : 0 ) + f.Data.size();
+}
+
+// Bytes of the record in the queue of the device.
+inline size_t QueuedBytes ( const Frame & f ) {
+  return INJECT_RECORD_HEADER + f.Data.size();
+}
+
+inline void AppendRecord ( std::vector<uint8_t> & out, const Frame & f ) {
+  out.push_back( f.Tag );
+  out.push_back( ( f.Broadcast ? INJECT_BROADCAST : 0 ) | ( f.Master >= 0 ? INJECT_MASTER : 0 ) |
+                 ( f.Mode & INJECT_MODE ) );
+  if ( f.Master >= 0 ) {
+    out.push_back( (uint8_t)( f.Master >> 8 ) );
+    out.push_back( (uint8_t)f.Master );
+  }
+  out.push_back( (uint8_t)( ( f.Control << 4 ) | ( ( f.Slave >> 8 ) & 0x0F ) ) );
+  out.push_back( (uint8_t)f.Slave );
+  out.push_back( (uint8_t)f.Data.size() );
+  out.insert( out.end(), f.Data.begin(), f.Data.end() );
+}
+
+inline std::vector<uint8_t> Packet ( uint8_t command, const std::vector<uint8_t> & payload ) {
+  std::vector<uint8_t> p = { INJECT_SYNC_BYTE, command, (uint8_t)payload.size() };
+  p.insert( p.end(), payload.begin(), payload.end() );
+
+  uint8_t crc = 0;
+  for ( size_t i = 1; i < p.size(); i++ ) {
+    crc = InjectCrc8( crc, p[i] );
+  }
+  p.push_back( crc );
+  return p;
+}
+
+inline std::vector<uint8_t> Periodic ( uint8_t slot, uint16_t periodMs, const Frame * f ) {
+  std::vector<uint8_t> payload = { slot, (uint8_t)( periodMs >> 8 ), (uint8_t)periodMs };
+  if ( f ) {
+    AppendRecord( payload, *f );
+  }
+  return Packet( INJECT_CMD_PERIODIC, payload );
+}
+
+// A line of an iebus_inject script (iebus_inject.cpp tells the syntax).
+struct ScriptLine {
+  enum Kind { EMPTY, SEND, EVERY, STOP, CLEAR, SLEEP, BAD };
+
+  Kind                  What = EMPTY;
+  Frame                 Record;             // SEND, EVERY.
+  unsigned long         Ms = 0;             // EVERY: period, SLEEP: wait.
+  uint8_t               Slot = 0;           // EVERY, STOP.
+};
+
+// "<slave> [options] [: data bytes]", the tag counted in nextTag unless given.
+inline bool ParseFrame ( std::istringstream & in, Frame & f, uint8_t & nextTag ) {
+  std::string word;
+  bool tagged = false;
+
+  if ( !( in >> word ) ) {
+    return false;
+  }
+  f.Slave = (uint16_t)strtoul( word.c_str(), nullptr, 0 );
+
+  while ( in >> word && word != ":" ) {
+    if ( word == "bcast" ) {
+      f.Broadcast = true;
+    } else if ( !word.compare( 0, 7, "master=" ) ) {
+      f.Master = (int)strtoul( word.c_str() + 7, nullptr, 0 );
+    } else if ( !word.compare( 0, 8, "control=" ) ) {
+      f.Control = (uint8_t)strtoul( word.c_str() + 8, nullptr, 0 );
+    } else if ( !word.compare( 0, 5, "mode=" ) ) {
+      f.Mode = (uint8_t)( atoi( word.c_str() + 5 ) - 1 );
+    } else if ( !word.compare( 0, 4, "tag=" ) ) {
+      f.Tag = (uint8_t)strtoul( word.c_str() + 4, nullptr, 0 );
+      tagged = true;
+    } else {
+      return false;
+    }
+  }
+  while ( in >> word ) {
+    f.Data.push_back( (uint8_t)strtoul( word.c_str(), nullptr, 0 ) );
+  }
+  if ( !tagged ) {
+    f.Tag = nextTag++;
+  }
+  return f.Data.size() <= IEBUS_DATA_SIZE && f.Mode < 2;
+}
+
+inline ScriptLine ParseScriptLine ( const char * text, uint8_t & nextTag ) {
+  ScriptLine line;
+  std::string s( text );
+  std::string cmd;
+
+  s = s.substr( 0, s.find( '#' ) );
+  std::istringstream in( s );
+  if ( !( in >> cmd ) ) {
+    return line;
+  }
+
+  bool ok = false;
+  if ( cmd == "send" ) {
+    line.What = ScriptLine::SEND;
+    ok = ParseFrame( in, line.Record, nextTag );
+  } else if ( cmd == "every" ) {
+    unsigned long slot;
+    line.What = ScriptLine::EVERY;
+    ok = (bool)( in >> line.Ms >> slot ) && line.Ms > 0 && line.Ms <= 0xFFFF && slot <= 0xFF &&
+         ParseFrame( in, line.Record, nextTag ) && RecordBytes( line.Record ) + 3 <= INJECT_COMMAND_SIZE;
+    line.Slot = (uint8_t)slot;
+  } else if ( cmd == "stop" ) {
+    unsigned long slot;
+    line.What = ScriptLine::STOP;
+    ok = (bool)( in >> slot ) && slot <= 0xFF;
+    line.Slot = (uint8_t)slot;
+  } else if ( cmd == "clear" ) {
+    line.What = ScriptLine::CLEAR;
+    ok = true;
+  } else if ( cmd == "sleep" ) {
+    line.What = ScriptLine::SLEEP;
+    ok = (bool)( in >> line.Ms );
+  }
+  if ( !ok ) {
+    line.What = ScriptLine::BAD;
+  }
+  return line;
+}
+
+// Packet of an EVERY, STOP or CLEAR line, SEND lines are batched by the caller.
+inline std::vector<uint8_t> LinePacket ( const ScriptLine & line ) {
+  switch ( line.What ) {
+    case ScriptLine::EVERY: return Periodic( line.Slot, (uint16_t)line.Ms, &line.Record );
+    case ScriptLine::STOP:  return Periodic( line.Slot, 0, nullptr );
+    case ScriptLine::CLEAR: return Packet( INJECT_CMD_CLEAR, {} );
+    default:                return {};
+  }
+}
+
+// Reports of a "TX:1AQ 1BS F:97 R:212" line, false for other lines.
+inline bool ParseReports ( const char * line, std::vector<Report> & out ) {
+  if ( strncmp( line, "TX:", 3 ) ) {
+    return false;
+  }
+  const char * p = line + 3;
+  while ( p[0] && p[1] && p[2] && p[1] != ':' && p[2] != '\r' && p[2] != '\n' ) {
+    char hex[3] = { p[0], p[1], 0 };
+    out.push_back( { (uint8_t)strtoul( hex, nullptr, 16 ), p[2] } );
+    p += 3;
+    while ( *p == ' ' ) {
+      p++;
+    }
+  }
+  return true;
+}
+
+// Free queue bytes and bytes read of a "TX:" or "TX LOST:" line, false without them.
+inline bool ParseWindow ( const char * line, unsigned & free, uint8_t & read ) {
+  const char * f = strncmp( line, "TX", 2 ) ? nullptr : strstr( line, " F:" );
+  const char * r = f ? strstr( f, " R:" ) : nullptr;
+
+  if ( !r ) {
+    return false;
+  }
+  free = (unsigned)strtoul( f + 3, nullptr, 10 );
+  read = (uint8_t)strtoul( r + 3, nullptr, 10 );
+  return true;
+}
+
+// Flow control of a host (Inject.h): commands go while their bytes fit the serial RX buffer of
+// the device and their records its queue, by the last status line, without waiting for the
+// reports of the commands before.
+struct Window {
+  unsigned long         Sent = 0;           // Bytes written to the device.
+  uint8_t               Read = 0;           // R of the last status line.
+  int                   Free = -1;          // F of the last status line, -1 before the first one.
+  size_t                Unanswered = 0;     // Queued bytes of the records not reported Q or O yet.
+  size_t                Commands = 0;       // Commands not answered yet.
+
+  void Line ( const char * line ) {
+    unsigned free;
+    uint8_t read;
+    if ( ParseWindow( line, free, read ) ) {
+      Free = (int)free;
+      Read = read;
+    }
+  }
+
+  // Command bytes the RX buffer takes now.
+  size_t Room ( void ) const {
+    return INJECT_RX_BYTES - (uint8_t)( Sent - Read );
+  }
+
+  // Queued bytes the next command may take, 0 if it shall wait. Before the first line a
+  // command goes when the last one is answered, as without a window.
+  size_t Credit ( void ) const {
+    if ( Free < 0 ) {
+      return Commands ? 0 : SIZE_MAX;
+    }
+    return ( (size_t)Free > Unanswered ) ? Free - Unanswered : 0;
+  }
+
+  bool Fits ( size_t packet, size_t queued ) const {
+    return packet <= Room() && queued <= Credit();
+  }
+
+  void Sending ( size_t packet, size_t queued ) {
+    Sent += packet;
+    Unanswered += queued;
+    Commands++;
+  }
+
+  // A record reported Q or O, or not read at all (B).
+  void Answered ( size_t queued ) {
+    Unanswered -= std::min( queued, Unanswered );
+  }
+
+  void CommandDone ( void ) {
+    if ( Commands && --Commands == 0 ) {
+      Unanswered = 0;
+      Read = (uint8_t)Sent;
+    }
+  }
+};
+
+// Reports closing a command: every command gets at least one.
+inline bool Answers ( char status ) {
+  return status == INJECT_QUEUED || status == INJECT_OVERFLOW || status == INJECT_BAD ||
+         status == INJECT_STOPPED;
+}
+
+} // namespace InjectHost
+
+#endif // _INJECT_HOST_H_
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,333 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  iebus_inject.cpp
+  Description  :  Sends frames through a USE_INJECT firmware from a text script (Inject.h).
+  ----------------------------------------------------------------------------------------------------
+     Build (from the repository root):
+
+       g++ -std=c++17 -O2 -o iebus_inject tools/inject/iebus_inject.cpp
+
+     Usage:
+
+       iebus_inject [-b baud] [-t ms] [-w ms] [-v] <serial port> <script|->
+
+     The script has one command a line, '#' starts a comment:
+
+       send  <slave> [options] [: data bytes]          queue a frame
+       every <ms> <slot> <slave> [options] [: data]    send a frame every <ms> ms in <slot>
+       stop  <slot>                                    stop a periodic frame
+       clear                                           empty the queue, stop the periodic frames
+       sleep <ms>                                      wait
+
+     Options: bcast (broadcast), master=<address> (default: the device address), control=<cb>
+     (default 0xF), mode=<1|2> (IEBus mode, default 2), tag=<n> (default: counted from 0).
+     Numbers are C style (0x130, 500). Following send lines go in one command as long as the
+     records fit its INJECT_COMMAND_SIZE bytes:
+
+       send 0x130 : 0x1F
+       send 0xFFF bcast : 0x12
+       every 500 0 0x130 : 0x10 0x01 0x01
+
+     A command is sent as soon as the window of the firmware takes it (Inject.h): its bytes fit
+     the serial RX buffer of the device and its records the queue, by the last status line, so
+     the next commands are on their way while the queue is sent. Before the first status line a
+     command waits for the reports of the last one. After -t ms (default 200) without room or
+     without the reports of the commands sent, these count as failed and the next one goes.
+     The reports are printed as they come ("1A queued", "1A sent", "1B failed (no ack)"), -v
+     prints the other lines of the firmware too. After the script the tool reads the reports for
+     -w ms more (default 1000), and exits with 1 if a frame was not queued or a command was bad.
+  --------------------------------------------------------------------------------------------------*/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "InjectHost.h"
+
+/*--------------------------------------------------------------------------------------------------
+                                        Serial port
+--------------------------------------------------------------------------------------------------*/
+static speed_t BaudRate ( unsigned long baud ) {
+  switch ( baud ) {
+    case 9600:   return B9600;
+    case 19200:  return B19200;
+    case 38400:  return B38400;
+    case 57600:  return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    default:     return 0;
+  }
+}
+
+static int OpenPort ( const char * path, unsigned long baud ) {
+  int fd = open( path, O_RDWR | O_NOCTTY );
+  if ( fd < 0 ) {
+    return -1;
+  }
+
+  struct termios tio;
+  if ( tcgetattr( fd, &tio ) == 0 ) {
+    cfmakeraw( &tio );
+    cfsetispeed( &tio, BaudRate( baud ) );
+    cfsetospeed( &tio, BaudRate( baud ) );
+    tio.c_cflag |= CLOCAL | CREAD;
+    tcsetattr( fd, TCSANOW, &tio );
+  }
+  return fd;
+}
+
+static uint64_t NowMs ( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                          Reports
+--------------------------------------------------------------------------------------------------*/
+// A command sent and not answered yet.
+struct Command {
+  size_t                      Answers;      // Reports closing it still to come.
+  std::map<uint8_t, size_t>   Queued;       // Queued bytes by tag of the records.
+};
+
+struct Session {
+  int                 Fd = -1;
+  bool                Verbose = false;
+  std::string         Pending;              // Received, no end of line yet.
+  InjectHost::Window  Window;
+  std::deque<Command> InFlight;             // Oldest first, the firmware runs them in order.
+  unsigned long       Failures = 0;         // Frames not queued, bad commands.
+};
+
+static const char * StatusText ( char status ) {
+  switch ( status ) {
+    case INJECT_QUEUED:   return "queued";
+    case INJECT_SENT:     return "sent";
+    case INJECT_FAILED:   return "failed (no ack)";
+    case INJECT_OVERFLOW: return "queue full, not queued";
+    case INJECT_BAD:      return "bad command";
+    case INJECT_STOPPED:  return "stopped";
+    default:              return "?";
+  }
+}
+
+// A report closing the oldest command in flight.
+static void Answer ( Session & s, const InjectHost::Report & r ) {
+  if ( s.InFlight.empty() ) {
+    return;
+  }
+  Command & c = s.InFlight.front();
+  auto it = c.Queued.find( r.Tag );
+  if ( it != c.Queued.end() ) {
+    s.Window.Answered( it->second );
+    c.Queued.erase( it );
+  }
+  c.Answers--;
+  if ( r.Status == INJECT_BAD ) {
+    // The records after a bad one are not read.
+    for ( const auto & q : c.Queued ) {
+      s.Window.Answered( q.second );
+    }
+    c.Answers = 0;
+  }
+  if ( c.Answers == 0 ) {
+    s.InFlight.pop_front();
+    s.Window.CommandDone();
+  }
+}
+
+static void HandleLine ( Session & s, const std::string & line ) {
+  std::vector<InjectHost::Report> reports;
+
+  s.Window.Line( line.c_str() );
+  if ( !InjectHost::ParseReports( line.c_str(), reports ) ) {
+    if ( s.Verbose || !strncmp( line.c_str(), "TX LOST:", 8 ) ) {
+      fputs( line.c_str(), stdout );
+    }
+    return;
+  }
+  for ( const InjectHost::Report & r : reports ) {
+    printf( "%02X %s\n", r.Tag, StatusText( r.Status ) );
+    if ( InjectHost::Answers( r.Status ) ) {
+      Answer( s, r );
+    }
+    if ( r.Status == INJECT_BAD || r.Status == INJECT_OVERFLOW ) {
+      s.Failures++;
+    }
+  }
+  fflush( stdout );
+}
+
+// Reads the lines of the firmware until the deadline or until done() is true.
+template <typename Done>
+static void ReadUntil ( Session & s, uint64_t deadline, Done done ) {
+  while ( !done() ) {
+    uint64_t now = NowMs();
+    if ( now >= deadline ) {
+      return;
+    }
+
+    struct pollfd p = { s.Fd, POLLIN, 0 };
+    if ( poll( &p, 1, (int)( deadline - now ) ) <= 0 ) {
+      continue;
+    }
+
+    char buf[ 256 ];
+    ssize_t n = read( s.Fd, buf, sizeof( buf ) );
+    if ( n <= 0 ) {
+      return;
+    }
+    s.Pending.append( buf, n );
+
+    size_t eol;
+    while ( ( eol = s.Pending.find( '\n' ) ) != std::string::npos ) {
+      HandleLine( s, s.Pending.substr( 0, eol + 1 ) );
+      s.Pending.erase( 0, eol + 1 );
+    }
+  }
+}
+
+// Commands sent and not answered after timeoutMs count as failed, the window starts over.
+static void GiveUp ( Session & s ) {
+  for ( size_t i = 0; i < s.InFlight.size(); i++ ) {
+    printf( "no report on the command\n" );
+    s.Failures++;
+  }
+  s.InFlight.clear();
+  s.Window = InjectHost::Window();
+}
+
+static void SendCommand ( Session & s, const std::vector<uint8_t> & packet, Command command, unsigned timeoutMs ) {
+  size_t queued = 0;
+  for ( const auto & q : command.Queued ) {
+    queued += q.second;
+  }
+
+  ReadUntil( s, NowMs() + timeoutMs, [&]() { return s.Window.Fits( packet.size(), queued ); } );
+  if ( !s.Window.Fits( packet.size(), queued ) ) {
+    GiveUp( s );
+  }
+
+  if ( write( s.Fd, packet.data(), packet.size() ) != (ssize_t)packet.size() ) {
+    perror( "write" );
+    exit( 1 );
+  }
+  s.Window.Sending( packet.size(), queued );
+  s.InFlight.push_back( command );
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                           Main
+--------------------------------------------------------------------------------------------------*/
+int main ( int argc, char * argv[] ) {
+  unsigned long baud = 115200;
+  unsigned timeoutMs = 200, waitMs = 1000;
+  Session s;
+  int c;
+
+  while ( ( c = getopt( argc, argv, "b:t:w:vh" ) ) != -1 ) {
+    switch ( c ) {
+      case 'b': baud = strtoul( optarg, nullptr, 0 ); break;
+      case 't': timeoutMs = strtoul( optarg, nullptr, 0 ); break;
+      case 'w': waitMs = strtoul( optarg, nullptr, 0 ); break;
+      case 'v': s.Verbose = true; break;
+      default:
+        fprintf( stderr, "usage: %s [-b baud] [-t ms] [-w ms] [-v] <serial port> <script|->\n", argv[0] );
+        return 2;
+    }
+  }
+  if ( optind + 2 > argc ) {
+    fprintf( stderr, "%s: serial port and script needed\n", argv[0] );
+    return 2;
+  }
+  if ( BaudRate( baud ) == 0 ) {
+    fprintf( stderr, "%s: unsupported baud rate %lu\n", argv[0], baud );
+    return 2;
+  }
+
+  const char * script = argv[ optind + 1 ];
+  FILE * f = strcmp( script, "-" ) ? fopen( script, "r" ) : stdin;
+  if ( f == NULL ) {
+    perror( script );
+    return 1;
+  }
+  s.Fd = OpenPort( argv[optind], baud );
+  if ( s.Fd < 0 ) {
+    perror( argv[optind] );
+    return 1;
+  }
+
+  // Send lines are batched until a record does not fit or another command follows.
+  std::vector<uint8_t> batch;
+  Command batched = { 0, {} };
+  uint8_t nextTag = 0;
+  unsigned lineNo = 0;
+  char line[ 512 ];
+
+  auto flush = [&]() {
+    if ( batched.Answers ) {
+      SendCommand( s, InjectHost::Packet( INJECT_CMD_SEND, batch ), batched, timeoutMs );
+      batch.clear();
+      batched = { 0, {} };
+    }
+  };
+
+  while ( fgets( line, sizeof( line ), f ) ) {
+    InjectHost::ScriptLine cmd = InjectHost::ParseScriptLine( line, nextTag );
+    lineNo++;
+
+    switch ( cmd.What ) {
+      case InjectHost::ScriptLine::EMPTY:
+        break;
+
+      case InjectHost::ScriptLine::SEND:
+        if ( batch.size() + InjectHost::RecordBytes( cmd.Record ) > INJECT_COMMAND_SIZE ) {
+          flush();
+        }
+        InjectHost::AppendRecord( batch, cmd.Record );
+        batched.Answers++;
+        batched.Queued[ cmd.Record.Tag ] += InjectHost::QueuedBytes( cmd.Record );
+        break;
+
+      case InjectHost::ScriptLine::SLEEP:
+        flush();
+        ReadUntil( s, NowMs() + cmd.Ms, []() { return false; } );
+        break;
+
+      case InjectHost::ScriptLine::BAD:
+        fprintf( stderr, "%s:%u: bad line\n", script, lineNo );
+        return 2;
+
+      default:
+        flush();
+        SendCommand( s, InjectHost::LinePacket( cmd ), { 1, {} }, timeoutMs );
+        break;
+    }
+  }
+  flush();
+
+  ReadUntil( s, NowMs() + timeoutMs, [&]() { return s.InFlight.empty(); } );
+  GiveUp( s );
+  ReadUntil( s, NowMs() + waitMs, []() { return false; } );
+
+  if ( f != stdin ) {
+    fclose( f );
+  }
+  close( s.Fd );
+  return s.Failures ? 1 : 0;
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,168 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  Arduino.h
+  Description  :  Minimal Arduino core for building the sketch on a Linux host against SimBus.h.
+--------------------------------------------------------------------------------------------------*/
+#ifndef _SIM_ARDUINO_H_
+#define _SIM_ARDUINO_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+typedef uint8_t                 byte;
+typedef unsigned int            word;
+
+#define HIGH                    1
+#define LOW                     0
+#define INPUT                   0
+#define OUTPUT                  1
+
+#define DEC                     10
+#define HEX                     16
+
+#define bitSet( value, bit )    ( ( value ) |= ( 1UL << ( bit ) ) )
+#define bitClear( value, bit )  ( ( value ) &= ~( 1UL << ( bit ) ) )
+#define bit( b )                ( 1UL << ( b ) )
+
+// Cost of firmware code between register accesses, see SIM_CYCLES in IEBUS.h.
+#define SIM_CYCLES( cycles )    Sim::Advance( cycles )
+
+inline void pinMode ( uint8_t, uint8_t ) {}
+inline void digitalWrite ( uint8_t, uint8_t ) {}
+
+// As the Timer 0 overflow interrupt of the Arduino core counts them: 1.024 ms an overflow, 4 us a
+// count. Both stand still while the firmware restarts TCNT0 before it overflows.
+inline unsigned long millis ( void ) {
+  uint64_t n = TCNT0.OverflowCount();
+  return (unsigned long)( n + n * 3 / 125 );
+}
+inline unsigned long micros ( void ) {
+  return (unsigned long)( ( ( TCNT0.OverflowCount() << 8 ) + TCNT0.Sample() ) * ( Sim::Timer0Prescaler / Sim::CyclesPerUs ) );
+}
+inline void delay ( unsigned long ms ) { Sim::Advance( (uint64_t)ms * ( F_CPU / 1000UL ) ); }
+inline void delayMicroseconds ( unsigned int us ) { Sim::Advance( Sim::Us( us ) ); }
+
+/*--------------------------------------------------------------------------------------------------
+  Serial port: output is collected in Out (and counted), input is fed through In.
+  Like HardwareSerial, write() returns at once while the 64 byte TX buffer has room and blocks
+  (advancing the virtual clock) at the UART speed once it is full. Bytes given to Send() arrive
+  at the UART speed after the ones sent before, into the 64 byte RX buffer (63 used): a byte
+  arriving on a full buffer is lost and counted in RxOverruns.
+--------------------------------------------------------------------------------------------------*/
+struct SimSerial {
+  std::string         Out;
+  std::deque<uint8_t> In;
+  std::deque<std::pair<uint64_t, uint8_t>> Wire;  // Bytes on the way, with their arrival time.
+  uint64_t            RxOverruns = 0;
+  uint64_t            Bytes = 0;
+  bool                Echo = false;
+  bool                Keep = true;
+
+  static const uint32_t TxBufferSize = 64;
+  static const uint32_t RxBufferSize = 64;
+  static const uint32_t WriteCycles  = 50;
+  uint64_t            CyclesPerByte = 0;    // 0 until begin(): infinitely fast port.
+  uint64_t            TxPending = 0;
+  uint64_t            TxDrainedAt = 0;
+
+  void begin ( unsigned long baud ) { CyclesPerByte = F_CPU * 10ULL / baud; }
+
+  void Drain ( void ) {
+    if ( !CyclesPerByte ) {
+      TxPending = 0;
+      return;
+    }
+    uint64_t sent = ( Sim::Now - TxDrainedAt ) / CyclesPerByte;
+    if ( sent >= TxPending ) {
+      TxPending = 0;
+      TxDrainedAt = Sim::Now;
+    } else {
+      TxPending -= sent;
+      TxDrainedAt += sent * CyclesPerByte;
+    }
+  }
+
+  size_t write ( uint8_t c ) {
+    Sim::Advance( WriteCycles );
+    Drain();
+    if ( TxPending >= TxBufferSize ) {
+      Sim::Advance( TxDrainedAt + CyclesPerByte - Sim::Now );
+      Drain();
+    }
+    if ( CyclesPerByte ) {
+      if ( TxPending == 0 ) TxDrainedAt = Sim::Now;
+      TxPending++;
+    }
+    Bytes++;
+    if ( Keep ) Out += (char)c;
+    if ( Echo ) fputc( c, stdout );
+    return 1;
+  }
+  size_t write ( const uint8_t * buf, size_t n ) {
+    for ( size_t i = 0; i < n; i++ ) write( buf[i] );
+    return n;
+  }
+
+  size_t print ( const char * s ) { size_t n = 0; while ( *s ) n += write( (uint8_t)*s++ ); return n; }
+  size_t print ( char c ) { return write( (uint8_t)c ); }
+  size_t print ( unsigned long v, int base = DEC ) {
+    char buf[ 24 ];
+    snprintf( buf, sizeof( buf ), base == HEX ? "%lX" : "%lu", v );
+    return print( buf );
+  }
+  size_t print ( long v, int base = DEC ) {
+    if ( base == DEC && v < 0 ) return print( '-' ) + print( (unsigned long)-v );
+    return print( (unsigned long)v, base );
+  }
+  size_t print ( int v, int base = DEC )          { return print( (long)v, base ); }
+  size_t print ( unsigned int v, int base = DEC ) { return print( (unsigned long)v, base ); }
+  size_t print ( uint8_t v, int base = DEC )      { return print( (unsigned long)v, base ); }
+
+  size_t println ( void ) { return print( "\r\n" ); }
+  template <typename T> size_t println ( T v ) { size_t n = print( v ); return n + println(); }
+  template <typename T> size_t println ( T v, int base ) { size_t n = print( v, base ); return n + println(); }
+
+  int availableForWrite ( void ) {
+    Drain();
+    return ( TxPending >= TxBufferSize - 1 ) ? 0 : (int)( TxBufferSize - 1 - TxPending );
+  }
+
+  void Send ( const uint8_t * buf, size_t n ) {
+    uint64_t t = Wire.empty() ? Sim::Now : std::max( Sim::Now, Wire.back().first );
+    for ( size_t i = 0; i < n; i++ ) {
+      t += CyclesPerByte;
+      Wire.push_back( { t, buf[i] } );
+    }
+  }
+  void Receive ( void ) {
+    while ( !Wire.empty() && Wire.front().first <= Sim::Now ) {
+      if ( In.size() < RxBufferSize - 1 ) {
+        In.push_back( Wire.front().second );
+      } else {
+        RxOverruns++;
+      }
+      Wire.pop_front();
+    }
+  }
+
+  int available ( void ) { Receive(); return (int)In.size(); }
+  int read ( void ) {
+    Receive();
+    if ( In.empty() ) return -1;
+    int c = In.front();
+    In.pop_front();
+    return c;
+  }
+  void flush ( void ) {}
+};
+
+inline SimSerial Serial;
+
+#endif // _SIM_ARDUINO_H_
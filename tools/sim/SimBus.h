@@ -0,0 +1,766 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  SimBus.h
+  Description  :  Virtual-time IEBus model for running the firmware on a Linux host.
+  ----------------------------------------------------------------------------------------------------
+     The firmware only ever observes time through TCNT0 and the bus through PIND, so both are
+     replaced by objects that advance a virtual 16 MHz clock on every read. Each read costs
+     PollCycles cycles, which is roughly what one iteration of a `while ( TCNT0 < x );` loop
+     costs on the ATmega328P.
+
+     The bus is the wired-OR of a remote side (a list of high intervals, e.g. a head unit sending
+     frames or acking ours) and the firmware's own output pin. Everything the firmware drives is
+     recorded as edges and decoded on the fly by TxObserver, which also lets the remote side
+     extend ack bits exactly like a real slave would.
+  --------------------------------------------------------------------------------------------------*/
+#ifndef _SIM_BUS_H_
+#define _SIM_BUS_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#ifndef F_CPU
+  #define F_CPU                 16000000UL
+#endif
+
+namespace Sim {
+
+/*--------------------------------------------------------------------------------------------------
+                                       Virtual clock
+--------------------------------------------------------------------------------------------------*/
+
+const uint32_t CyclesPerUs      = F_CPU / 1000000UL;
+const uint32_t Timer0Prescaler  = 64;
+
+inline uint64_t Us ( double us ) { return (uint64_t)( us * CyclesPerUs + 0.5 ); }
+inline double   ToUs ( uint64_t cycles ) { return (double)cycles / CyclesPerUs; }
+
+// Thrown when the firmware keeps polling past Deadline, i.e. it would have hung on the bus.
+struct Stall : std::runtime_error {
+  Stall () : std::runtime_error( "firmware stalled waiting for the bus" ) {}
+};
+
+inline uint64_t Now         = 0;
+inline uint64_t Deadline    = UINT64_MAX;
+inline uint32_t PollCycles  = 4;
+
+inline void Advance ( uint64_t cycles ) {
+  Now += cycles;
+  if ( Now > Deadline ) {
+    throw Stall();
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                         Bus model
+--------------------------------------------------------------------------------------------------*/
+
+struct Interval { uint64_t Rise; uint64_t Fall; };
+struct Edge     { uint64_t Time; bool Level; };
+
+inline std::vector<Interval> Remote;        // High intervals driven by the remote side, by Rise.
+inline size_t                RemoteCursor = 0;
+inline bool                  OutLevel = false;
+inline std::vector<Edge>     OutEdges;      // Everything the firmware drove on its output pin.
+inline uint8_t               OutMask = 0;   // _BV( PIN_OUT ), set by the host program.
+inline unsigned long         LineEdits = 0; // Changes of the line history (drives, firmware edges).
+
+inline void DriveRemote ( uint64_t rise, uint64_t fall ) {
+  Interval iv = { rise, fall };
+  auto it = std::upper_bound( Remote.begin() + RemoteCursor, Remote.end(), iv,
+                              []( const Interval & a, const Interval & b ) { return a.Rise < b.Rise; } );
+  Remote.insert( it, iv );
+  LineEdits++;
+}
+
+// Takes back a high interval driven ahead of the firmware (a start bit the remote master does
+// not send after all, or sends again with its frame).
+inline void UndriveRemote ( uint64_t rise, uint64_t fall ) {
+  for ( size_t i = Remote.size(); i > 0; i-- ) {
+    if ( Remote[i - 1].Rise == rise && Remote[i - 1].Fall == fall ) {
+      Remote.erase( Remote.begin() + ( i - 1 ) );
+      if ( i - 1 < RemoteCursor ) {
+        RemoteCursor--;
+      }
+      LineEdits++;
+      return;
+    }
+  }
+}
+
+inline bool RemoteLevel ( uint64_t t ) {
+  while ( RemoteCursor < Remote.size() && Remote[RemoteCursor].Fall <= t ) {
+    RemoteCursor++;
+  }
+  for ( size_t i = RemoteCursor; i < Remote.size() && Remote[i].Rise <= t; i++ ) {
+    if ( Remote[i].Fall > t ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool OutLevelAt ( uint64_t t ) {
+  auto it = std::upper_bound( OutEdges.begin(), OutEdges.end(), t,
+                              []( uint64_t v, const Edge & e ) { return v < e.Time; } );
+  return it != OutEdges.begin() && ( it - 1 )->Level;
+}
+
+inline bool Line ( void ) {
+  return OutLevel || RemoteLevel( Now );
+}
+
+// Longest pulse the remote side drives (start bit 165 us).
+const uint64_t MaxPulse = 1000 * CyclesPerUs;
+
+// Remote level at any time t, without moving the cursor.
+inline bool RemoteLevelAt ( uint64_t t ) {
+  uint64_t from = t > MaxPulse ? t - MaxPulse : 0;
+  auto it = std::lower_bound( Remote.begin(), Remote.end(), from,
+                              []( const Interval & a, uint64_t v ) { return a.Rise < v; } );
+  for ( ; it != Remote.end() && it->Rise <= t; ++it ) {
+    if ( it->Fall > t ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool LineAt ( uint64_t t ) {
+  return OutLevelAt( t ) || RemoteLevelAt( t );
+}
+
+// Latest rising (or falling) edge of the line in ( from, to ], 0 if none.
+inline uint64_t LastLineEdge ( uint64_t from, uint64_t to, bool rising ) {
+  static std::vector<uint64_t> times;
+  times.clear();
+  uint64_t lo = from > MaxPulse ? from - MaxPulse : 0;
+  auto it = std::lower_bound( Remote.begin(), Remote.end(), lo,
+                              []( const Interval & a, uint64_t v ) { return a.Rise < v; } );
+  for ( ; it != Remote.end() && it->Rise <= to; ++it ) {
+    if ( it->Rise > from ) times.push_back( it->Rise );
+    if ( it->Fall > from && it->Fall <= to ) times.push_back( it->Fall );
+  }
+  auto oe = std::upper_bound( OutEdges.begin(), OutEdges.end(), from,
+                              []( uint64_t v, const Edge & e ) { return v < e.Time; } );
+  for ( ; oe != OutEdges.end() && oe->Time <= to; ++oe ) {
+    times.push_back( oe->Time );
+  }
+  std::sort( times.begin(), times.end() );
+  for ( auto t = times.rbegin(); t != times.rend(); ++t ) {
+    if ( LineAt( *t ) == rising && LineAt( *t - 1 ) != rising ) {
+      return *t;
+    }
+  }
+  return 0;
+}
+
+// Time of the next remote rising edge at or after t, UINT64_MAX if none is scheduled.
+inline uint64_t NextRemoteRise ( uint64_t t ) {
+  for ( size_t i = RemoteCursor; i < Remote.size(); i++ ) {
+    if ( Remote[i].Rise >= t ) {
+      return Remote[i].Rise;
+    }
+  }
+  return UINT64_MAX;
+}
+
+// First time after t the line leaves its level at t, UINT64_MAX if it stays.
+inline uint64_t NextLineChange ( uint64_t t ) {
+  if ( OutLevel ) {
+    return UINT64_MAX;
+  }
+  if ( !RemoteLevel( t ) ) {
+    return NextRemoteRise( t );
+  }
+  // End of the overlapping high intervals around t.
+  uint64_t end = t;
+  for ( bool grew = true; grew; ) {
+    grew = false;
+    for ( size_t i = RemoteCursor; i < Remote.size() && Remote[i].Rise <= end; i++ ) {
+      if ( Remote[i].Fall > end ) {
+        end = Remote[i].Fall;
+        grew = true;
+      }
+    }
+  }
+  return end;
+}
+
+// Drops the bus history before t (long replays), the levels from t on stay the same.
+inline void Forget ( uint64_t t ) {
+  size_t r = 0;
+  while ( r < RemoteCursor && Remote[r].Fall < t ) r++;
+  Remote.erase( Remote.begin(), Remote.begin() + r );
+  RemoteCursor -= r;
+
+  auto it = std::lower_bound( OutEdges.begin(), OutEdges.end(), t,
+                              []( const Edge & e, uint64_t v ) { return e.Time < v; } );
+  if ( it != OutEdges.begin() ) {
+    OutEdges.erase( OutEdges.begin(), it - 1 );   // The edge before t gives the level at t.
+  }
+}
+
+inline void Reset ( void ) {
+  Now = 0;
+  Deadline = UINT64_MAX;
+  Remote.clear();
+  RemoteCursor = 0;
+  OutLevel = false;
+  OutEdges.clear();
+  LineEdits++;
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                         Frames
+--------------------------------------------------------------------------------------------------*/
+
+struct Frame {
+  bool      Broadcast;          // Raw broadcast bit: 1 = point-to-point, 0 = broadcast.
+  uint16_t  Master;
+  uint16_t  Slave;
+  uint8_t   Control;
+  uint8_t   Size;
+  uint8_t   Data[ 256 ];
+  uint64_t  Start;              // Rising edge of the start bit.
+  uint64_t  End;                // End of the last bit.
+  uint16_t  AckCount;           // Ack slots that were acknowledged.
+  uint16_t  AckSlots;           // Ack slots in the frame.
+  uint8_t   Mode;               // IEBus mode, index of Modes[].
+};
+
+// Nominal transmit timings of the remote side, see IEBUS.h theory block.
+struct Timing {
+  uint64_t  StartHigh = Us( 165 );
+  uint64_t  StartLow  = Us( 30 );
+  uint64_t  Bit1High  = Us( 20 );
+  uint64_t  Bit0High  = Us( 33 );
+  uint64_t  BitLength = Us( 40 );
+  uint64_t  AckHigh   = Us( 33 );   // A slave stretches our '1' to a '0'.
+  uint64_t  Sample    = Us( 26 );   // Half way between a '1' and a '0'.
+};
+
+inline Timing Nominal;
+
+// All durations times k, k > 1 is a slower bit rate.
+inline Timing Scaled ( const Timing & tm, double k ) {
+  Timing s;
+  s.StartHigh = (uint64_t)( tm.StartHigh * k + 0.5 );
+  s.StartLow  = (uint64_t)( tm.StartLow * k + 0.5 );
+  s.Bit1High  = (uint64_t)( tm.Bit1High * k + 0.5 );
+  s.Bit0High  = (uint64_t)( tm.Bit0High * k + 0.5 );
+  s.BitLength = (uint64_t)( tm.BitLength * k + 0.5 );
+  s.AckHigh   = (uint64_t)( tm.AckHigh * k + 0.5 );
+  s.Sample    = (uint64_t)( tm.Sample * k + 0.5 );
+  return s;
+}
+
+// Nominal timings per IEBus mode, indexed like IebusTimings (IebusTiming.h): mode 1, mode 2.
+inline const Timing Modes[] = { Scaled( Nominal, 1.5 ), Nominal };
+const int ModeCount = sizeof( Modes ) / sizeof( Modes[0] );
+
+// Mode whose nominal start bit is closest to a measured one.
+inline int ModeOfStart ( uint64_t width ) {
+  int best = 0;
+  for ( int m = 1; m < ModeCount; m++ ) {
+    if ( std::llabs( (long long)( Modes[m].StartHigh - width ) ) <
+         std::llabs( (long long)( Modes[best].StartHigh - width ) ) ) {
+      best = m;
+    }
+  }
+  return best;
+}
+
+inline bool Parity ( uint32_t v ) { return __builtin_parity( v ); }
+
+// Frame layout as a bit stream, ack slots flagged. Ack bits are sent as the master drives them.
+inline void FrameBits ( const Frame & f, std::vector<uint8_t> & bits, std::vector<uint8_t> & ack ) {
+  bits.clear();
+  ack.clear();
+  auto put = [&]( uint32_t v, int n, bool isAck ) {
+    for ( int i = n - 1; i >= 0; i-- ) {
+      bits.push_back( ( v >> i ) & 1 );
+      ack.push_back( isAck );
+    }
+  };
+  uint8_t ackBit = f.Broadcast ? 1 : 0;
+
+  put( f.Broadcast, 1, false );
+  put( f.Master, 12, false );   put( Parity( f.Master ), 1, false );
+  put( f.Slave, 12, false );    put( Parity( f.Slave ), 1, false );    put( ackBit, 1, true );
+  put( f.Control, 4, false );   put( Parity( f.Control ), 1, false );  put( ackBit, 1, true );
+  put( f.Size, 8, false );      put( Parity( f.Size ), 1, false );     put( ackBit, 1, true );
+  for ( int i = 0; i < f.Size; i++ ) {
+    put( f.Data[i], 8, false ); put( Parity( f.Data[i] ), 1, false );  put( ackBit, 1, true );
+  }
+}
+
+// Index of the bit following the last ack slot, or 0 if bits do not reach the length field yet.
+inline size_t FrameLength ( const std::vector<uint8_t> & bits ) {
+  if ( bits.size() < 43 ) {
+    return 0;
+  }
+  uint32_t size = 0;
+  for ( int i = 34; i < 42; i++ ) {
+    size = ( size << 1 ) | bits[i];
+  }
+  return 44 + size * 10;
+}
+
+inline bool IsAckSlot ( size_t k ) {
+  return k == 27 || k == 33 || k == 43 || ( k >= 44 && ( k - 44 ) % 10 == 9 );
+}
+
+// Decode a complete bit stream (ack slots included). Returns false on a parity error.
+inline bool ParseBits ( const std::vector<uint8_t> & bits, Frame & f ) {
+  size_t pos = 0;
+  bool ok = true;
+  auto get = [&]( int n ) {
+    uint32_t v = 0;
+    for ( int i = 0; i < n; i++ ) {
+      v = ( v << 1 ) | ( pos < bits.size() ? bits[pos] : 0 );
+      pos++;
+    }
+    return v;
+  };
+  auto field = [&]( int n ) {
+    uint32_t v = get( n );
+    if ( get( 1 ) != (uint32_t)Parity( v ) ) {
+      ok = false;
+    }
+    return v;
+  };
+
+  f.Broadcast = get( 1 );
+  f.Master    = field( 12 );
+  f.Slave     = field( 12 );   get( 1 );
+  f.Control   = field( 4 );    get( 1 );
+  f.Size      = field( 8 );    get( 1 );
+  for ( int i = 0; i < f.Size; i++ ) {
+    f.Data[i] = field( 8 );    get( 1 );
+  }
+  return ok;
+}
+
+// Queue a frame from the remote side starting at t0. Returns the end time of the frame.
+// The rise time of every ack slot is appended to ackSlots so acks can be checked afterwards.
+inline uint64_t SendFrame ( uint64_t t0, const Frame & f, std::vector<uint64_t> * ackSlots = nullptr,
+                            const Timing & tm = Nominal ) {
+  static std::vector<uint8_t> bits, ack;
+  FrameBits( f, bits, ack );
+
+  uint64_t t = t0;
+  DriveRemote( t, t + tm.StartHigh );
+  t += tm.StartHigh + tm.StartLow;
+
+  for ( size_t i = 0; i < bits.size(); i++ ) {
+    DriveRemote( t, t + ( bits[i] ? tm.Bit1High : tm.Bit0High ) );
+    if ( ack[i] && ackSlots ) {
+      ackSlots->push_back( t );
+    }
+    t += tm.BitLength;
+  }
+  return t;
+}
+
+// A point-to-point ack slot counts as acknowledged if the line is still high at the sample point.
+inline bool AckedAt ( uint64_t rise, const Timing & tm = Nominal ) {
+  return OutLevelAt( rise + tm.Sample );
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                       TxObserver
+  Decodes what the firmware drives and plays the slave side: ack slots of point-to-point frames
+  sent to one of AckAddresses are stretched to a '0', like a real slave would do.
+--------------------------------------------------------------------------------------------------*/
+
+struct TxObserver {
+  std::vector<uint16_t> AckAddresses;
+  bool                  AckAll = false;   // Ack every point-to-point frame.
+  std::vector<Frame>    Frames;         // Completed frames.
+  void                  ( *Done )( const Frame & f ) = nullptr;  // Called for every completed frame.
+  uint32_t              Aborted = 0;    // Frames cut short by the firmware (no ack).
+  uint64_t              AbortedCycles = 0;  // Bus time of the frames cut short, up to their last bit.
+  Timing                Tm;             // Timings of the frame in progress, from its start bit.
+  int                   Mode = 0;
+
+  bool                  InFrame = false;
+  uint64_t              FrameStart = 0;
+  uint64_t              RiseT = 0;
+  uint64_t              LastRise = 0;   // Rise before RiseT: the last bit of a frame a start bit cuts.
+  std::vector<uint8_t>  Bits;
+  uint16_t              AckCount = 0;
+
+  bool AcksFor ( uint16_t slave ) const {
+    return AckAll || std::find( AckAddresses.begin(), AckAddresses.end(), slave ) != AckAddresses.end();
+  }
+
+  uint16_t SlaveSoFar ( void ) const {
+    uint16_t v = 0;
+    for ( int i = 14; i < 26; i++ ) {
+      v = ( v << 1 ) | Bits[i];
+    }
+    return v;
+  }
+
+  void Rise ( uint64_t t ) {
+    if ( InFrame && RiseT && t - RiseT > Us( 400 ) ) {
+      Aborted++;
+      AbortedCycles += RiseT + Tm.BitLength - FrameStart;
+      InFrame = false;
+    }
+    LastRise = RiseT;
+    RiseT = t;
+    size_t k = Bits.size();
+    if ( InFrame && IsAckSlot( k ) && Bits[0] == 1 && AcksFor( SlaveSoFar() ) ) {
+      DriveRemote( t, t + Tm.AckHigh );
+      AckCount++;
+    }
+  }
+
+  void Fall ( uint64_t t ) {
+    uint64_t width = t - RiseT;
+
+    if ( width > Us( 100 ) ) {
+      if ( InFrame ) {
+        Aborted++;
+        AbortedCycles += LastRise + Tm.BitLength - FrameStart;
+      }
+      InFrame = true;
+      Mode = ModeOfStart( width );
+      Tm = Modes[ Mode ];
+      FrameStart = RiseT;
+      Bits.clear();
+      AckCount = 0;
+      return;
+    }
+    if ( !InFrame ) {
+      return;
+    }
+
+    Bits.push_back( width < Tm.Sample ? 1 : 0 );
+
+    size_t len = FrameLength( Bits );
+    if ( len && Bits.size() == len ) {
+      Frame f = {};
+      ParseBits( Bits, f );
+      f.Start    = FrameStart;
+      f.End      = RiseT + Tm.BitLength;
+      f.AckCount = AckCount;
+      f.AckSlots = 3 + f.Size;
+      f.Mode     = Mode;
+      Frames.push_back( f );
+      InFrame = false;
+      if ( Done ) {
+        Done( f );
+      }
+    }
+  }
+};
+
+inline TxObserver * Observer = nullptr;
+
+/*--------------------------------------------------------------------------------------------------
+                                    Register stand-ins
+--------------------------------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------------------------------
+                                       Poll loops
+  Busy loops like `while ( TCNT0 < x );`, `while ( INPUT_IS_SET );` or the TCNT0 / PIND loop of
+  IsAvcBusFree() read the same registers over and over with nothing else in between. Once the
+  last reads repeat with a period of one or two reads, from the same places of the code and
+  with the same values, every further period that would read the same values again is skipped
+  at once (FastPoll): up to the next change of a value read. The reads left happen at the
+  same cycles as without the skip, so the results do not change, only the wall time. Other
+  costs (Advance() outside a read, writes) end the loop. The place of a read is the return
+  address of the register read, straight code reads at other places. One period is no proof:
+  the line check of LogDrain() runs twice for free when a log line ends, and not a third time.
+
+  A compare of TCNT0 with a limit (`TCNT0 < x`, `>=`, `>`) is one read whose value is the
+  result: it stays the same up to the tick where the count reaches the limit or wraps, so the
+  bit loops are skipped to their end at once instead of tick by tick.
+--------------------------------------------------------------------------------------------------*/
+
+inline bool FastPoll = true;
+
+typedef uint8_t  ( *PollSampler )( const void * reg, int arg );
+typedef uint64_t ( *PollHorizon )( const void * reg, int arg );
+
+struct PollRead {
+  const void *  Site;           // Return address of the read.
+  const void *  Reg;
+  int           Arg;            // Limit of a TCNT0 compare.
+  uint8_t       Value;
+  PollSampler   Sample;
+  PollHorizon   Stable;         // First time after Now the value may change.
+};
+
+template <typename R> uint8_t  PollSample ( const void * reg, int ) { return ( (const R *)reg )->Sample(); }
+template <typename R> uint64_t PollStable ( const void * reg, int ) { return ( (const R *)reg )->Stable(); }
+
+inline PollRead  Polls[ 4 ];                // Last reads, newest last.
+inline unsigned  PollCount = 0;             // Reads in a row with no other cost.
+inline uint64_t  PollEnd = UINT64_MAX;      // Now after the last read.
+
+// Whole periods of the poll loop ahead that read the same values again.
+inline uint64_t PollPeriodsAhead ( const void * site, int arg ) {
+  for ( unsigned p = 1; p <= 2 && PollCount >= 2 * p; p++ ) {
+    const PollRead * older = Polls + 4 - 2 * p;
+    const PollRead * newer = Polls + 4 - p;
+    bool periodic = ( newer[0].Site == site && newer[0].Arg == arg );
+    for ( unsigned k = 0; k < p; k++ ) {
+      periodic &= older[k].Site == newer[k].Site && older[k].Arg == newer[k].Arg &&
+                  older[k].Value == newer[k].Value;
+    }
+    if ( !periodic ) {
+      continue;
+    }
+    // Read k of period j happens at Now + ( j * p + k + 1 ) * PollCycles.
+    uint64_t periods = UINT64_MAX;
+    for ( unsigned k = 0; k < p; k++ ) {
+      if ( newer[k].Sample( newer[k].Reg, newer[k].Arg ) != newer[k].Value ) {
+        return 0;
+      }
+      uint64_t stable = newer[k].Stable( newer[k].Reg, newer[k].Arg );
+      uint64_t first = Now + ( k + 1 ) * PollCycles;
+      if ( stable != UINT64_MAX ) {
+        periods = std::min<uint64_t>( periods, stable > first ? ( stable - first - 1 ) / ( p * PollCycles ) + 1 : 0 );
+      }
+    }
+    return periods == UINT64_MAX ? 0 : periods * p;
+  }
+  return 0;
+}
+
+inline uint8_t Poll ( const void * site, const void * reg, int arg, PollSampler sample, PollHorizon stable ) {
+  if ( Now != PollEnd ) {
+    PollCount = 0;
+  } else if ( FastPoll && PollCount >= 2 ) {
+    uint64_t reads = PollPeriodsAhead( site, arg );
+    if ( reads ) {
+      Advance( reads * PollCycles );
+    }
+  }
+
+  Advance( PollCycles );
+  uint8_t v = sample( reg, arg );
+  Polls[0] = Polls[1];
+  Polls[1] = Polls[2];
+  Polls[2] = Polls[3];
+  Polls[3] = { site, reg, arg, v, sample, stable };
+  PollCount++;
+  PollEnd = Now;
+  return v;
+}
+
+template <typename R> uint8_t PollRegister ( R & reg, const void * site ) {
+  return Poll( site, &reg, 0, PollSample<R>, PollStable<R> );
+}
+
+// 8 bit Timer0 running at F_CPU / 64. Its overflows are counted for millis() and micros(), and
+// a write of the count drops the part of a period run so far, as on the ATmega328P.
+struct Timer0Reg {
+  uint64_t Base = 0;
+  uint64_t Overflows = 0;             // Overflows before Base.
+
+  uint8_t  Sample ( void ) const { return (uint8_t)( ( Now - Base ) / Timer0Prescaler ); }
+  uint64_t Stable ( void ) const { return Base + ( ( Now - Base ) / Timer0Prescaler + 1 ) * Timer0Prescaler; }
+  uint64_t OverflowCount ( void ) const { return Overflows + ( Now - Base ) / ( Timer0Prescaler * 256 ); }
+
+  __attribute__(( noinline )) operator uint8_t () { return PollRegister( *this, __builtin_return_address( 0 ) ); }
+
+  // TCNT0 < limit. The result changes when the count reaches the limit or wraps to 0.
+  static uint8_t BelowSample ( const void * reg, int limit ) { return ( (const Timer0Reg *)reg )->Sample() < limit; }
+  static uint64_t BelowStable ( const void * reg, int limit ) {
+    const Timer0Reg * t = (const Timer0Reg *)reg;
+    uint64_t ticks = ( Now - t->Base ) / Timer0Prescaler;
+    int count = (uint8_t)ticks;
+    if ( limit <= 0 || limit > 255 ) {
+      return UINT64_MAX;
+    }
+    ticks += ( count < limit ) ? limit - count : 256 - count;
+    return t->Base + ticks * Timer0Prescaler;
+  }
+  bool Below ( int limit, const void * site ) { return Poll( site, this, limit, BelowSample, BelowStable ); }
+
+  Timer0Reg & operator = ( uint8_t v ) {
+    Advance( 1 );
+    Overflows = OverflowCount();
+    Base = Now - (uint64_t)v * Timer0Prescaler;
+    return *this;
+  }
+};
+
+// The compares of the firmware's wait loops, each one read of TCNT0.
+template <typename T> __attribute__(( noinline )) bool operator <  ( Timer0Reg & t, T limit ) { return  t.Below( (int)limit, __builtin_return_address( 0 ) ); }
+template <typename T> __attribute__(( noinline )) bool operator >= ( Timer0Reg & t, T limit ) { return !t.Below( (int)limit, __builtin_return_address( 0 ) ); }
+template <typename T> __attribute__(( noinline )) bool operator >  ( Timer0Reg & t, T limit ) { return !t.Below( (int)limit + 1, __builtin_return_address( 0 ) ); }
+
+// Input port: every bit reads the bus level, so any PIN_IN works.
+struct InputReg {
+  uint8_t  Sample ( void ) const { return Line() ? 0xFF : 0x00; }
+  uint64_t Stable ( void ) const { return NextLineChange( Now ); }
+
+  __attribute__(( noinline )) operator uint8_t () { return PollRegister( *this, __builtin_return_address( 0 ) ); }
+};
+
+// Output port: changes of OutMask are recorded as edges of the firmware's driver.
+struct OutputReg {
+  uint8_t Value = 0;
+
+  void Store ( uint8_t v ) {
+    Advance( 2 );
+    bool level = ( v & OutMask ) != 0;
+    Value = v;
+    if ( OutMask && level != OutLevel ) {
+      OutLevel = level;
+      OutEdges.push_back( { Now, level } );
+      LineEdits++;
+      if ( Observer ) {
+        if ( level ) Observer->Rise( Now ); else Observer->Fall( Now );
+      }
+    }
+  }
+  operator uint8_t () const { return Value; }
+  OutputReg & operator |= ( unsigned long v ) { Store( Value | (uint8_t)v ); return *this; }
+  OutputReg & operator &= ( unsigned long v ) { Store( Value & (uint8_t)v ); return *this; }
+  OutputReg & operator = ( unsigned long v )  { Store( (uint8_t)v ); return *this; }
+};
+
+// Analog comparator status: ACO follows the bus, the other bits are configuration.
+struct ComparatorReg {
+  uint8_t Value = 0;
+
+  operator uint8_t () {
+    Advance( PollCycles );
+    return ( Value & ~0x20 ) | ( Line() ? 0x20 : 0x00 );
+  }
+  ComparatorReg & operator = ( uint8_t v ) { Value = v; return *this; }
+};
+
+// Timer1 at F_CPU / 8 with input capture from the comparator. Captures are computed lazily
+// from the line history whenever TIFR1 or ICR1 is looked at. The capture loops of the firmware
+// look several times per us: up to the next line change the history is not scanned again.
+struct Capture {
+  bool      Rising = true;
+  bool      Flag = false;
+  uint64_t  From = 0;       // Edges after this time are not captured yet.
+  uint64_t  Scanned = 0;    // ... and none of the selected polarity happened up to here.
+  uint64_t  Quiet = 0;      // No line change before this time ...
+  unsigned long Edits = 0;  // ... while LineEdits is this.
+  uint16_t  Icr = 0;
+
+  void Update ( void ) {
+    if ( Now < Quiet && Edits == LineEdits ) {
+      Scanned = Now;
+      return;
+    }
+    Quiet = NextLineChange( Now );
+    Edits = LineEdits;
+
+    uint64_t edge = LastLineEdge( std::max( From, Scanned ), Now, Rising );
+    Scanned = Now;
+    if ( edge ) {
+      Icr = (uint16_t)( ( edge + 4 ) / 8 );   // 4 cycles of noise canceller.
+      Flag = true;
+      From = edge;
+    }
+  }
+  void Select ( bool rising ) {
+    if ( rising != Rising ) {
+      Update();
+      Rising = rising;
+      From = Now;
+    }
+  }
+  void Clear ( void ) {
+    Update();
+    Flag = false;
+  }
+};
+
+inline Capture Capture1;
+
+struct Tifr1Reg {
+  operator uint8_t () {
+    Advance( PollCycles );
+    Capture1.Update();
+    return Capture1.Flag ? 0x20 : 0x00;
+  }
+  Tifr1Reg & operator = ( uint8_t v ) {
+    Advance( 1 );
+    if ( v & 0x20 ) Capture1.Clear();
+    return *this;
+  }
+};
+
+struct Icr1Reg {
+  operator uint16_t () {
+    Advance( 2 );
+    Capture1.Update();
+    return Capture1.Icr;
+  }
+};
+
+// Timer 1 count, free running at F_CPU / 8 (trace stamps).
+struct Tcnt1Reg {
+  operator uint16_t () {
+    Advance( 2 );
+    return (uint16_t)( Now / 8 );
+  }
+};
+
+struct Tccr1bReg {
+  uint8_t Value = 0;
+
+  operator uint8_t () const { return Value; }
+  Tccr1bReg & operator = ( unsigned v ) {
+    Advance( 1 );
+    Value = (uint8_t)v;
+    Capture1.Select( Value & 0x40 );
+    return *this;
+  }
+  Tccr1bReg & operator |= ( unsigned v ) { return *this = Value | v; }
+  Tccr1bReg & operator &= ( unsigned v ) { return *this = Value & v; }
+};
+
+} // namespace Sim
+
+/*--------------------------------------------------------------------------------------------------
+                                   AVR register names
+--------------------------------------------------------------------------------------------------*/
+
+inline Sim::Timer0Reg   TCNT0;
+inline Sim::InputReg    PIND;
+inline Sim::OutputReg   PORTD;
+
+inline uint8_t          DDRB, PORTB, PINB, DDRC, PORTC, DDRD, TCCR0A, TCCR0B, MCUSR;
+
+inline Sim::ComparatorReg ACSR;
+inline Sim::Tifr1Reg    TIFR1;
+inline Sim::Icr1Reg     ICR1;
+inline Sim::Tccr1bReg   TCCR1B;
+inline Sim::Tcnt1Reg    TCNT1;
+inline uint8_t          TCCR1A, DIDR1;
+
+#define ACO                     5
+#define ACIC                    2
+#define ICF1                    5
+#define ICES1                   6
+#define ICNC1                   7
+#define CS11                    1
+#define AIN0D                   0
+#define AIN1D                   1
+
+#define PORT5                   5
+#define CS00                    0
+#define CS01                    1
+#define CS02                    2
+
+#define _BV( bit )              ( 1 << ( bit ) )
+#define bit_is_set( sfr, bit )  ( (uint8_t)( sfr ) & _BV( bit ) )
+#define bit_is_clear( sfr, bit ) ( !( (uint8_t)( sfr ) & _BV( bit ) ) )
+
+#endif // _SIM_BUS_H_
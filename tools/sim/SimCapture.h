@@ -0,0 +1,173 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  SimCapture.h
+  Description  :  Loads recorded bus traffic for the simulator replay.
+  ----------------------------------------------------------------------------------------------------
+     Two capture formats are read:
+
+       text      DumpRawMessage() lines, as logged by the firmware, optionally behind a time
+                 stamp "12:34:56.789 -> " (Arduino serial monitor) or seconds "1234.567 ".
+                 Other lines (reports, errors) are skipped.
+       archive   Columnar archive of tools/archive (IebusArchive.h), told by its magic.
+
+     A log line keeps IEBUS_DATA_SIZE payload bytes, longer frames are replayed with the bytes
+     past it zeroed. Captures have no IEBus mode, the replay sends them in the mode it is given.
+  --------------------------------------------------------------------------------------------------*/
+#ifndef _SIM_CAPTURE_H_
+#define _SIM_CAPTURE_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "SimBus.h"
+#include "../archive/IebusArchive.h"
+
+namespace Sim {
+
+struct CaptureFrame {
+  Frame         F;
+  int64_t       TimeUs;         // From the capture, -1 if it has none.
+  unsigned long Line;           // Line (text) or frame number (archive), for reports.
+};
+
+// Time stamp in front of "B:", -1 if none.
+inline int64_t CaptureStamp ( const char * s, size_t n ) {
+  std::string stamp( s, n );
+  unsigned h, m, sec, ms;
+  double secs;
+  if ( sscanf( stamp.c_str(), " %u:%u:%u.%u", &h, &m, &sec, &ms ) == 4 ) {
+    return ( ( (int64_t)h * 60 + m ) * 60 + sec ) * 1000000 + (int64_t)ms * 1000;
+  }
+  if ( sscanf( stamp.c_str(), " %lf", &secs ) == 1 ) {
+    return (int64_t)( secs * 1e6 + 0.5 );
+  }
+  return -1;
+}
+
+// One DumpRawMessage() line, false if the line is no frame.
+inline bool ParseCaptureLine ( const char * line, CaptureFrame & cf ) {
+  const char * b = line;
+  while ( ( b = strstr( b, "B:" ) ) && b != line && b[-1] != ' ' ) {
+    b += 2;
+  }
+  if ( !b ) {
+    return false;
+  }
+
+  unsigned broadcast, master, slave, control, size;
+  int used;
+  if ( sscanf( b, "B:%u M:0X%X S:0X%X CB:0X%X L:%u DATA:%n", &broadcast, &master, &slave, &control,
+               &size, &used ) != 5 ) {
+    return false;
+  }
+
+  Frame & f = cf.F;
+  f = {};
+  f.Broadcast = broadcast;
+  f.Master    = master;
+  f.Slave     = slave;
+  f.Control   = control;
+  f.Size      = size;
+
+  const char * p = b + used;
+  for ( unsigned i = 0; i < size; i++ ) {
+    unsigned v;
+    int n;
+    if ( sscanf( p, " 0X%X%n", &v, &n ) != 1 ) {
+      break;
+    }
+    f.Data[i] = v;
+    p += n;
+  }
+  cf.TimeUs = CaptureStamp( line, b - line );
+  return true;
+}
+
+// Archive whose magic was read already.
+inline bool LoadArchive ( FILE * in, std::vector<CaptureFrame> & out ) {
+  Archive::FileHeader fh;
+  const size_t rest = sizeof fh - sizeof fh.Magic;
+  if ( fread( (char *)&fh + sizeof fh.Magic, 1, rest, in ) != rest || fh.Version != Archive::FileVersion ) {
+    return false;
+  }
+
+  std::vector<uint8_t> block;
+  for ( uint64_t b = 0; b < fh.Blocks; b++ ) {
+    Archive::BlockHeader bh;
+    if ( fread( &bh, sizeof bh, 1, in ) != 1 || bh.Magic != Archive::BlockMagic ) {
+      return false;
+    }
+    block.resize( bh.Bytes );
+    memcpy( block.data(), &bh, sizeof bh );
+    if ( fread( block.data() + sizeof bh, 1, bh.Bytes - sizeof bh, in ) != bh.Bytes - sizeof bh ) {
+      return false;
+    }
+
+    Archive::BlockColumns c = Archive::Columns( block.data(), bh.Frames );
+    for ( uint32_t i = 0; i < bh.Frames; i++ ) {
+      CaptureFrame cf = {};
+      cf.F.Broadcast = c.Flags[i] & Archive::FLAG_BROADCAST;
+      cf.F.Master    = c.Master[i];
+      cf.F.Slave     = c.Slave[i];
+      cf.F.Control   = c.Control[i];
+      cf.F.Size      = c.Length[i];
+      memcpy( cf.F.Data, c.Payload + c.PayloadOffset[i], c.PayloadOffset[i + 1] - c.PayloadOffset[i] );
+      cf.TimeUs      = ( fh.Flags & Archive::TIME_FROM_LOG ) ? c.Time[i] : -1;
+      cf.Line        = out.size() + 1;
+      out.push_back( cf );
+    }
+  }
+  return true;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  LoadCapture
+  Description  :  Reads the frames of a capture in recorded order.
+  Return value :  FALSE if the file cannot be read.
+  --------------------------------------------------------------------------------------------------*/
+inline bool LoadCapture ( const char * path, std::vector<CaptureFrame> & out ) {
+  FILE * in = strcmp( path, "-" ) ? fopen( path, "rb" ) : stdin;
+  if ( !in ) {
+    return false;
+  }
+
+  char magic[ 8 ] = {};
+  size_t got = fread( magic, 1, sizeof magic, in );
+  if ( got == sizeof magic && memcmp( magic, Archive::FileMagic, sizeof magic ) == 0 ) {
+    bool ok = LoadArchive( in, out );
+    if ( in != stdin ) {
+      fclose( in );
+    }
+    return ok;
+  }
+
+  // Text: the magic bytes read are the first characters.
+  std::string line;
+  unsigned long number = 0;
+  size_t k = 0;
+  int c;
+  do {
+    c = k < got ? (uint8_t)magic[ k++ ] : fgetc( in );
+    if ( c != '\n' && c != EOF ) {
+      line += (char)c;
+      continue;
+    }
+    number++;
+    CaptureFrame cf;
+    if ( ParseCaptureLine( line.c_str(), cf ) ) {
+      cf.Line = number;
+      out.push_back( cf );
+    }
+    line.clear();
+  } while ( c != EOF );
+
+  if ( in != stdin ) {
+    fclose( in );
+  }
+  return true;
+}
+
+} // namespace Sim
+
+#endif // _SIM_CAPTURE_H_
@@ -0,0 +1,279 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  SimWaveform.h
+  Description  :  Golden timing envelopes of a transmitted frame, and VCD export of the bus.
+  ----------------------------------------------------------------------------------------------------
+     MeasureFrame() takes the edges the firmware drove for one frame (OutEdges) and checks them
+     against the frame it should be: every pulse is decoded ('1' below the compare point) and
+     matched bit for bit with FrameBits(), so a bit, a parity or an ack slot out of place is an
+     error, then every width is compared with the envelope of its kind in GoldenEnvelopes:
+
+       start high    high time of the start bit
+       start length  start bit rise to the first bit rise
+       '1' high      data bit '1' (broadcast bit, addresses, control, length, payload)
+       '0' high      data bit '0'
+       parity high   parity bit, against the '1' or '0' figure of its value
+       ack slot      point-to-point ack slot: the firmware drives a '1', the slave stretches it
+       bcast ack     broadcast ack slot: the firmware drives a '0' itself (HandleAcknowledge)
+       bit length    rise to the next rise, start bit aside
+
+     The envelopes are the bit figures of the modes (IebusTiming.h, IEBUS.h theory) with a
+     band of a Timer 0 tick, the phase of the prescaler on the chip, and a little for the code
+     between the timer and the pin, narrowed where the band would reach the compare point of a
+     receiver: the '1'/'0' decision (HalfPeriod) and the accepted start bit window. They are
+     written out here on purpose, not taken from IebusTimings: a change of that table shows up
+     as a deviation. WaveStats keeps per kind the deviations from the nominal figure, the worst
+     one tells how much of the band is used.
+
+     WriteVcd() dumps the firmware drive, the remote side (slave acks) and the wired-OR line as
+     three wires for a waveform viewer, in steps of 100 ps (a 16 MHz cycle is 62.5 ns).
+  --------------------------------------------------------------------------------------------------*/
+#ifndef _SIM_WAVEFORM_H_
+#define _SIM_WAVEFORM_H_
+
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "SimBus.h"
+
+namespace Sim {
+
+/*--------------------------------------------------------------------------------------------------
+                                     Golden envelopes
+--------------------------------------------------------------------------------------------------*/
+enum WaveKind {
+  WAVE_START_HIGH = 0,
+  WAVE_START_LENGTH,
+  WAVE_ONE_HIGH,
+  WAVE_ZERO_HIGH,
+  WAVE_PARITY_HIGH,
+  WAVE_ACK_HIGH,
+  WAVE_BCAST_ACK_HIGH,
+  WAVE_BIT_LENGTH,
+  WAVE_KINDS
+};
+
+inline const char * const WaveKindNames[ WAVE_KINDS ] =
+{
+  "start high", "start length", "'1' high", "'0' high", "parity high", "ack slot", "bcast ack",
+  "bit length"
+};
+
+struct WaveEnvelope {
+  double    NominalUs;
+  double    BandUs;             // Accepted: nominal +- band.
+};
+
+// Per IEBus mode, indexed like IebusTimings, rows like WaveKind. Parity uses the '1' / '0' rows.
+inline const WaveEnvelope GoldenEnvelopes[ ModeCount ][ WAVE_KINDS ] =
+{
+  {   // IEBus mode 1: '1' / '0' compare point 40 us, start bit accepted 228 .. 280 us.
+    { 248, 6 }, { 292, 8 }, { 30, 6 }, { 50, 6 }, { 0, 0 }, { 30, 6 }, { 50, 6 }, { 60, 6 }
+  },
+  {   // IEBus mode 2: compare point 28 us, start bit accepted 164 .. 188 us.
+    { 168, 4 }, { 188, 6 }, { 20, 5 }, { 33, 4 }, { 0, 0 }, { 20, 5 }, { 33, 4 }, { 40, 4 }
+  },
+};
+
+// Compare point between a '1' and a '0' of the envelopes of a mode.
+inline double GoldenHalfUs ( int mode ) {
+  return ( GoldenEnvelopes[ mode ][ WAVE_ONE_HIGH ].NominalUs + GoldenEnvelopes[ mode ][ WAVE_ZERO_HIGH ].NominalUs ) / 2;
+}
+
+struct WaveStats {
+  unsigned long Count = 0;
+  unsigned long Outside = 0;    // Measurements out of the band.
+  double        MinDevUs = 0;
+  double        MaxDevUs = 0;
+  double        WorstShare = 0;       // Largest deviation / band, 1 is the edge of the band.
+
+  void Add ( double us, const WaveEnvelope & env ) {
+    double dev = us - env.NominalUs;
+    if ( Count == 0 || dev < MinDevUs ) MinDevUs = dev;
+    if ( Count == 0 || dev > MaxDevUs ) MaxDevUs = dev;
+    if ( fabs( dev ) > env.BandUs ) Outside++;
+    WorstShare = std::max( WorstShare, fabs( dev ) / env.BandUs );
+    Count++;
+  }
+};
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  IsParityBit
+  Description  :  Parity position in the frame bit stream of FrameBits().
+  --------------------------------------------------------------------------------------------------*/
+inline bool IsParityBit ( size_t k ) {
+  return k == 13 || k == 26 || k == 32 || k == 42 || ( k >= 44 && ( k - 44 ) % 10 == 8 );
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  MeasureFrame
+  Description  :  Checks the drive of one frame against the expected frame and the envelopes.
+  Argument(s)  :  edges -> Edges the firmware drove for the frame, from the start bit rise.
+                  expected -> Frame it should be.
+                  mode -> IEBus mode, row of GoldenEnvelopes.
+                  bitCount -> Bits after the start bit, FrameBits() size unless the frame is
+                  cut short (no ack).
+                  stats -> WAVE_KINDS entries, the measurements are added.
+  Return value :  Empty if the bits are the expected ones and every width is in its band, else
+                  what is wrong first.
+  --------------------------------------------------------------------------------------------------*/
+inline std::string MeasureFrame ( const std::vector<Edge> & edges, const Frame & expected, int mode,
+                                  size_t bitCount, WaveStats * stats ) {
+  const WaveEnvelope * env = GoldenEnvelopes[ mode ];
+  std::vector<uint8_t> bits, ack;
+  std::string error;
+  char text[ 160 ];
+
+  FrameBits( expected, bits, ack );
+  bits.resize( std::min( bitCount, bits.size() ) );
+
+  // Pulses: a rise and its fall.
+  std::vector<uint64_t> rise, fall;
+  for ( size_t i = 0; i + 1 < edges.size(); i += 2 ) {
+    if ( !edges[i].Level || edges[i + 1].Level ) {
+      return "edges do not alternate";
+    }
+    rise.push_back( edges[i].Time );
+    fall.push_back( edges[i + 1].Time );
+  }
+  if ( edges.size() % 2 ) {
+    return "the pin is left high";
+  }
+  if ( rise.size() != bits.size() + 1 ) {
+    snprintf( text, sizeof text, "%zu bits driven after the start bit, %zu expected", rise.size() - 1, bits.size() );
+    error = text;
+  }
+
+  auto check = [&]( WaveKind kind, double us, const WaveEnvelope & e, size_t bit ) {
+    stats[ kind ].Add( us, e );
+    if ( error.empty() && fabs( us - e.NominalUs ) > e.BandUs ) {
+      snprintf( text, sizeof text, "%s %.2f us at %s %zu, %.0f +- %.0f us", WaveKindNames[ kind ], us,
+                bit ? "bit" : "start bit", bit ? bit - 1 : 0, e.NominalUs, e.BandUs );
+      error = text;
+    }
+  };
+
+  if ( rise.empty() ) {
+    return "nothing driven";
+  }
+  check( WAVE_START_HIGH, ToUs( fall[0] - rise[0] ), env[ WAVE_START_HIGH ], 0 );
+  if ( rise.size() > 1 ) {
+    check( WAVE_START_LENGTH, ToUs( rise[1] - rise[0] ), env[ WAVE_START_LENGTH ], 0 );
+  }
+
+  double half = GoldenHalfUs( mode );
+  for ( size_t p = 1; p < rise.size(); p++ ) {
+    size_t k = p - 1;
+    double high = ToUs( fall[p] - rise[p] );
+    uint8_t value = high < half ? 1 : 0;
+
+    if ( k < bits.size() && value != bits[k] && error.empty() ) {
+      snprintf( text, sizeof text, "bit %zu is a '%d', '%d' expected%s", k, value, bits[k],
+                IsParityBit( k ) ? " (parity)" : IsAckSlot( k ) ? " (ack slot)" : "" );
+      error = text;
+    }
+
+    const WaveEnvelope & e = env[ value ? WAVE_ONE_HIGH : WAVE_ZERO_HIGH ];
+    if ( IsAckSlot( k ) ) {
+      if ( expected.Broadcast ) {
+        check( WAVE_ACK_HIGH, high, env[ WAVE_ACK_HIGH ], p );
+      } else {
+        check( WAVE_BCAST_ACK_HIGH, high, env[ WAVE_BCAST_ACK_HIGH ], p );
+      }
+    } else if ( IsParityBit( k ) ) {
+      check( WAVE_PARITY_HIGH, high, e, p );
+    } else {
+      check( value ? WAVE_ONE_HIGH : WAVE_ZERO_HIGH, high, e, p );
+    }
+    if ( p + 1 < rise.size() ) {
+      check( WAVE_BIT_LENGTH, ToUs( rise[p + 1] - rise[p] ), env[ WAVE_BIT_LENGTH ], p );
+    }
+  }
+  return error;
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                        VCD export
+--------------------------------------------------------------------------------------------------*/
+struct WaveMark {
+  uint64_t      Time;
+  std::string   Text;           // Written as a comment at Time.
+};
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  WriteVcd
+  Description  :  Writes the firmware drive, the remote side and the line as a VCD file.
+  Argument(s)  :  path -> File to write.
+                  out -> Edges of the firmware (OutEdges).
+                  remote -> High intervals of the remote side, by Rise.
+                  marks -> Comments, by Time (frame names).
+  Return value :  FALSE if the file cannot be written.
+  --------------------------------------------------------------------------------------------------*/
+inline bool WriteVcd ( const char * path, const std::vector<Edge> & out, const std::vector<Interval> & remote,
+                       const std::vector<WaveMark> & marks ) {
+  FILE * f = fopen( path, "w" );
+  if ( f == NULL ) {
+    return false;
+  }
+
+  // Changes of the remote level: overlapping intervals merged.
+  std::vector<Edge> slave;
+  for ( size_t i = 0; i < remote.size(); ) {
+    uint64_t from = remote[i].Rise, to = remote[i].Fall;
+    for ( i++; i < remote.size() && remote[i].Rise <= to; i++ ) {
+      to = std::max( to, remote[i].Fall );
+    }
+    slave.push_back( { from, true } );
+    slave.push_back( { to, false } );
+  }
+
+  fprintf( f, "$comment IEBus transmit conformance, iebus_sim $end\n" );
+  fprintf( f, "$timescale 100 ps $end\n" );
+  fprintf( f, "$scope module iebus $end\n" );
+  fprintf( f, "$var wire 1 o out $end\n" );
+  fprintf( f, "$var wire 1 s slave $end\n" );
+  fprintf( f, "$var wire 1 l line $end\n" );
+  fprintf( f, "$upscope $end\n$enddefinitions $end\n" );
+  fprintf( f, "#0\n$dumpvars\n0o\n0s\n0l\n$end\n" );
+
+  size_t a = 0, b = 0, m = 0;
+  bool o = false, s = false, line = false;
+  uint64_t last = UINT64_MAX;
+
+  while ( a < out.size() || b < slave.size() || m < marks.size() ) {
+    uint64_t t = UINT64_MAX;
+    if ( a < out.size() ) t = std::min( t, out[a].Time );
+    if ( b < slave.size() ) t = std::min( t, slave[b].Time );
+    if ( m < marks.size() ) t = std::min( t, marks[m].Time );
+
+    if ( t != last ) {
+      fprintf( f, "#%llu\n", (unsigned long long)( t * 10000000000ULL / F_CPU ) );
+      last = t;
+    }
+    for ( ; m < marks.size() && marks[m].Time == t; m++ ) {
+      fprintf( f, "$comment %s $end\n", marks[m].Text.c_str() );
+    }
+    for ( ; a < out.size() && out[a].Time == t; a++ ) {
+      if ( out[a].Level != o ) {
+        o = out[a].Level;
+        fprintf( f, "%do\n", o );
+      }
+    }
+    for ( ; b < slave.size() && slave[b].Time == t; b++ ) {
+      if ( slave[b].Level != s ) {
+        s = slave[b].Level;
+        fprintf( f, "%ds\n", s );
+      }
+    }
+    if ( ( o || s ) != line ) {
+      line = o || s;
+      fprintf( f, "%dl\n", line );
+    }
+  }
+  return fclose( f ) == 0;
+}
+
+} // namespace Sim
+
+#endif // _SIM_WAVEFORM_H_
@@ -0,0 +1,11 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  avr/interrupt.h
+  Description  :  Host stand-in, interrupts do not exist in the virtual machine.
+--------------------------------------------------------------------------------------------------*/
+#ifndef _SIM_AVR_INTERRUPT_H_
+#define _SIM_AVR_INTERRUPT_H_
+
+#define cli()
+#define sei()
+
+#endif
@@ -0,0 +1,11 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  avr/io.h
+  Description  :  Host stand-in for the AVR register file used by the IEBUS driver. Register reads
+                  advance the virtual clock of SimBus.h so the driver's busy-wait loops terminate.
+--------------------------------------------------------------------------------------------------*/
+#ifndef _SIM_AVR_IO_H_
+#define _SIM_AVR_IO_H_
+
+#include "../SimBus.h"
+
+#endif
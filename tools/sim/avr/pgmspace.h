@@ -0,0 +1,37 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  avr/pgmspace.h
+  Description  :  Host stand-in, flash and SRAM share one address space on the host.
+--------------------------------------------------------------------------------------------------*/
+#ifndef _SIM_AVR_PGMSPACE_H_
+#define _SIM_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR( s )                       ( s )
+
+#define pgm_read_byte( addr )           ( *(const unsigned char *)( addr ) )
+#define pgm_read_byte_near( addr )      ( *(const unsigned char *)( addr ) )
+#define pgm_read_word_near( addr )      SimReadWord( addr )
+#define pgm_read_ptr( addr )            SimReadPtr( addr )
+
+// The low 16 bits of a word (32 bits on the host, little endian) like the AVR reads them, copied
+// so that the compiler sees no type punning.
+inline uint16_t SimReadWord ( const void * addr ) {
+  uint16_t v;
+  memcpy( &v, addr, sizeof v );
+  return v;
+}
+
+inline void * SimReadPtr ( const void * addr ) {
+  void * v;
+  memcpy( &v, addr, sizeof v );
+  return v;
+}
+
+#define memcpy_P                        memcpy
+#define strlen_P                        strlen
+#define strcpy_P                        strcpy
+
+#endif
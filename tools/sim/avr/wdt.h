@@ -0,0 +1,14 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  avr/wdt.h
+  Description  :  Host stand-in, the watchdog is replaced by the simulator stall deadline.
+--------------------------------------------------------------------------------------------------*/
+#ifndef _SIM_AVR_WDT_H_
+#define _SIM_AVR_WDT_H_
+
+#define WDTO_2S                 7
+
+#define wdt_enable( timeout )
+#define wdt_disable()
+#define wdt_reset()
+
+#endif
@@ -0,0 +1,1740 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  iebus_sim.cpp
+  Description  :  Linux bus simulator running the unmodified firmware in virtual time.
+  ----------------------------------------------------------------------------------------------------
+     Build (from the repository root):
+
+       g++ -std=c++17 -O2 -Wall -Wextra -I tools/sim -o iebus_sim tools/sim/iebus_sim.cpp
+
+     The firmware headers are compiled with the warnings of the host compiler on, and build
+     without one in every configuration of Settings.h.
+
+     Settings.h reads the bus through the external comparator, the input capture backend is
+     built with -DINNER_COMPARATOR=true. Frames lost in the rx checks, by build:
+
+                                                                   external   capture
+       ./iebus_sim rx               back to back frames              0          0
+       ./iebus_sim rx -g 5000       start bits after a long idle     0          0
+       ./iebus_sim rx -M -g 2000    both modes                       0          0
+       ./iebus_sim rx -N 2000       impulse noise                    1.6 %      1.9 %
+
+     The external comparator sees a start bit that rises during a scheduler task late and
+     allows for 36 us of it (Scheduler.h): LogDrain stops at the rise, the other tasks are
+     shorter. On a clean bus every pulse it rejects is a lost frame, "rejected pulses" shall
+     read 0 there.
+
+     Firmware code between register accesses is free unless annotated with SIM_CYCLES().
+
+     Modes:
+
+       rx   The LoadTest.h generator plays a head unit sending frames to the firmware, which
+            runs AvcReadMessage() and the scheduler tasks against the simulated line. Reports
+            decoded/lost frames and acks given for MY_ADDRESS.
+       tx   The firmware runs LoadTestService() as a master, a simulated slave acks frames sent
+            to HU_ADDRESS (or all with -A). Reports the frames per second achieved on the bus.
+       margin  rx of every IEBus mode with the head unit timings scaled from 70 % to 130 %,
+            200 frames per step 20 ms apart unless -n / -g are given. Reports the compare
+            point margins of IebusTimings and the range decoded and acked without a loss.
+       replay <capture>  Sends the recorded frames of the other devices (SimCapture.h: log
+            text or archive) to the firmware, at their recorded times if the capture has time
+            stamps, at least -g us apart (default 1000). Frames the firmware sends are compared
+            in order with the ones recorded from the emulated devices between the same frames,
+            registration broadcasts are only counted. Reports divergences (-v: all, else the
+            first 20) and the replay speed, exits with 1 on a divergence.
+
+            The capture shall hold the whole bus traffic, e.g. iebus_decode output: the
+            firmware log leaves out the pings it answers and repeats (frame cache).
+
+            The serial volume of a drive with and without the frame cache is the "serial bytes"
+            of this build and of one with -DUSE_FRAME_CACHE=false on the same capture.
+
+            Speed, one core, external comparator, 2831 frames (26.8 s back to back): 180..250x
+            real time back to back, 650..830x with the frames 40 ms apart (25 frames/s) and
+            1400..1800x 100 ms apart. An idle bus costs about 0.25 us of wall time a ms (the
+            scheduler pass), a frame about 40 us: FastPoll skips every wait loop of a bit to
+            its end, as it knows the TCNT0 compares, but a bit still takes about 7 register
+            reads. The capture backend times pulses with TCNT1 arithmetic, which is not
+            skipped: 30x back to back, 130x 40 ms apart.
+
+       hu   The firmware plays the head unit (HuEmulator.h) until it has sent -n pings and
+            waited for the last answer. -i displays (MY_ADDRESS, MY_ADDRESS + 1, ...) register,
+            ack and answer pings and net scans -l us (default 500) after the end of the frame,
+            50 us later for every further display. Prints the firmware's per device statistics,
+            one line per scheduler run as the firmware does.
+
+       inject  A host sends the generated frames (-n) through the serial injection commands
+            (Inject.h) at the serial speed, each command as soon as the window of the status
+            lines takes it (InjectHost::Window). The firmware queues and sends them, a simulated
+            slave acks like in tx. -p adds a periodic broadcast every -p ms. Reports the frames
+            per second, the bus time used, the time the queue was empty with frames still to
+            send, frames on the bus other than the ones queued (exit 1) and serial bytes lost.
+            The bus is saturated: 95 % busy with the aborted frames, 98 % with -A, the rest are
+            the gaps between frames, at 202 frames/s where tx sends the same frames at 207. The
+            queue runs empty for 1.5 % of the time, at the start and on runs of short frames
+            cut after a missing ack.
+
+       conform  Transmit conformance: the display frames are sent by AvcRegisterMe(),
+            AvcAnswerPing() (CmdDdisplayAnsver2) and SendMessage_P( CmdHuPing ), acked by the
+            simulated head unit, and the answer and CmdHuPing once more without an ack, in
+            every IEBus mode (-m: one). An unacked answer shall leave the device registering. The edges the firmware drives are decoded bit for bit against the frame
+            (parity, ack slots, broadcast acks, the cut after a missing ack) and every width
+            is checked against the golden envelopes of SimWaveform.h. Prints the frames and
+            per bit kind the deviations from the golden figure and the share of the band the
+            worst one uses, exits with 1 if a frame fails. -o writes the waveform as VCD.
+
+       parity  Parity() (ParityTable, IEBUS.h) against counting the '1' bits, for every value
+            of a 12 bit field, 0 .. 0XFFF. Exits with 1 if one differs.
+
+       cache  FrameCacheUpdate() (FrameCache.h) against a model of the cache for -n frames of
+            3 keys per set, so entries are evicted: repeats, payloads changed in one byte, in
+            length or in all bytes, and payloads longer than FRAME_CACHE_DATA. The RPT queue is
+            drained after every 8th frame on average, so it fills up now and then, and a report
+            sweep ends the run. Checks every answer, the HIT and SAVED totals and every RPT line,
+            prints what the frames covered and exits with 1 on a difference.
+
+     Options:
+
+       -n <frames>   Frames to generate (default 1000).
+       -r <fps>      Frame rate, 0 = back to back (default 0).
+       -g <us>       Minimum gap between frames on the bus (default 100).
+       -s <seed>     Generator seed (default LOAD_TEST_SEED).
+       -i <count>    rx: emulate <count> devices (MY_ADDRESS, MY_ADDRESS + 1, ... up to IDENTITY_MAX)
+                     and spread the frames for MY_ADDRESS over them. Reports per device the slack
+                     left in the ack window after the address match.
+       -m <mode>     IEBus mode of the frames, 1 or 2 (default IEBUS_MODE).
+       -M            rx: alternate the IEBus modes frame by frame (auto detection).
+       -S            Use LoadTestScript instead of random frames.
+       -A            tx: ack every point-to-point frame.
+       -l <us>       hu: answer latency of the first display.
+       -d            Dump frames sent by the firmware, like a build without LOAD_TEST_MODE.
+       -u            hu: the last display goes away after half the pings.
+       -N <rate>     rx, margin: impulse noise, <rate> high pulses per second at random times on
+                     top of the traffic (ignition noise), of 1 us up to -W us (default 6). Reports
+                     the reads the firmware gave up and the time they took from the loop.
+       -P            Run every poll of the input loops (no FastPoll, SimBus.h), same results, slower.
+       -p <ms>       inject: period of the periodic broadcast, 0 = none (default).
+       -o <file>     conform: write the edges (firmware, slave, line) as VCD.
+       -v            Echo the firmware serial output.
+  --------------------------------------------------------------------------------------------------*/
+#include "Arduino.h"
+#include "../../SubaruDisplayEmulator_v_1_3.ino"
+#include "SimCapture.h"
+#include "SimWaveform.h"
+#include "../inject/InjectHost.h"
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <unistd.h>
+
+/*--------------------------------------------------------------------------------------------------
+                                         Options
+--------------------------------------------------------------------------------------------------*/
+struct Options {
+  unsigned long Frames = 1000;
+  unsigned long Rate = 0;
+  unsigned long GapUs = 100;
+  bool          Script = false;
+  bool          AckAll = false;
+  bool          Dump = false;
+  bool          Verbose = false;
+  unsigned      Identities = 1;
+  int           Mode = IEBUS_MODE;  // IEBus mode, index of IebusTimings.
+  bool          Mixed = false;      // rx: alternate the modes frame by frame.
+  double        Scale = 1.0;        // rx: remote timings times Scale (bit rate error).
+  const char *  Capture = nullptr;  // replay: capture file.
+  unsigned long LatencyUs = 500;    // hu: answer latency of the first display.
+  bool          Unplug = false;     // hu: the last display goes away half way.
+  unsigned long NoiseRate = 0;      // rx: noise impulses per second.
+  unsigned long NoiseWidthUs = 6;   // rx: longest noise impulse.
+  unsigned long PeriodMs = 0;       // inject: period of the periodic frame, 0 = none.
+  const char *  Vcd = nullptr;      // conform: VCD file of the edges.
+};
+
+// Reads given up by the firmware (AvcReadMessage() false): on a pulse that is no start bit, or
+// after a start bit (parity error, abort, no ack). The loop is blocked meanwhile.
+struct FailedReads {
+  unsigned long Rejected = 0;       // Pulse shorter than any start bit.
+  uint64_t      RejectedCycles = 0;
+  unsigned long Doomed = 0;         // Decode started and failed.
+  uint64_t      DoomedCycles = 0;
+  uint64_t      LongestCycles = 0;
+  unsigned long Impulses = 0;       // Noise impulses put on the bus.
+};
+
+static FailedReads Failed;
+static unsigned long LoopStalls = 0;      // Stalls between the frames (RunLoopUntil).
+static std::mt19937_64 NoiseRandom;
+
+// Ack window after the slave address: the device must stretch the master's '1' before the
+// master releases the line. Slack = master release - start of the device's drive.
+struct AckWindow {
+  unsigned long Frames = 0;
+  unsigned long Acked = 0;
+  double        MinSlackUs = 1e9;
+  double        SumSlackUs = 0;
+};
+
+static AckWindow Windows[ IDENTITY_MAX ];
+
+// One pass of loop() around the bus check: wdt_reset(), calls, scheduler deadline compare.
+static const uint64_t LoopCycles = 24;
+
+struct Report {
+  unsigned long Frames = 0;         // Frames put on the bus.
+  unsigned long Decoded = 0;        // rx: decoded identical by the firmware. tx: complete on the bus.
+  unsigned long AckExpected = 0;    // rx: point-to-point frames for MY_ADDRESS.
+  unsigned long AckOk = 0;          // rx: ... fully acknowledged.
+  unsigned long Stalls = 0;
+  uint64_t      BusCycles = 0;
+  double        WallSeconds = 0;
+};
+
+// replay: recorded frames of the emulated devices against the ones sent in the replay.
+struct ReplayReport {
+  unsigned long Recorded = 0;       // Frames from the emulated devices in the capture ...
+  unsigned long Replayed = 0;       // ... and sent by the firmware in the replay, registrations aside.
+  unsigned long Matched = 0;
+  unsigned long Different = 0;
+  unsigned long Missing = 0;
+  unsigned long Extra = 0;
+  unsigned long RegRecorded = 0;    // Registration broadcasts, periodic: counted only.
+  unsigned long RegReplayed = 0;
+};
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ToSimFrame
+  Description  :  Copies a firmware frame into a simulator frame.
+  --------------------------------------------------------------------------------------------------*/
+static Sim::Frame ToSimFrame ( const IebusFrame & frame ) {
+  Sim::Frame f = {};
+  f.Broadcast = frame.Broadcast;
+  f.Master    = frame.MasterAddress;
+  f.Slave     = frame.SlaveAddress;
+  f.Control   = frame.Control;
+  f.Size      = frame.DataSize;
+  f.Mode      = frame.Mode;
+  memcpy( f.Data, frame.Data, IEBUS_STORED( &frame ) );
+  return f;
+}
+
+static bool SameFrame ( const Sim::Frame & a, const Sim::Frame & b ) {
+  return a.Mode == b.Mode && a.Broadcast == b.Broadcast && a.Master == b.Master && a.Slave == b.Slave &&
+         a.Control == b.Control && a.Size == b.Size && memcmp( a.Data, b.Data, a.Size ) == 0;
+}
+
+// Same fields as logged: no mode, payload up to IEBUS_DATA_SIZE.
+static bool SameLogged ( const Sim::Frame & a, const Sim::Frame & b ) {
+  return a.Broadcast == b.Broadcast && a.Master == b.Master && a.Slave == b.Slave && a.Control == b.Control &&
+         a.Size == b.Size && memcmp( a.Data, b.Data, std::min<int>( a.Size, IEBUS_DATA_SIZE ) ) == 0;
+}
+
+static std::string FrameText ( const Sim::Frame & f ) {
+  char buf[ 64 ];
+  snprintf( buf, sizeof buf, "B:%d M:0X%X S:0X%X CB:0X%X L:%d DATA:", f.Broadcast, f.Master, f.Slave,
+            f.Control, f.Size );
+  std::string text = buf;
+  for ( int i = 0; i < std::min<int>( f.Size, IEBUS_DATA_SIZE ); i++ ) {
+    snprintf( buf, sizeof buf, " 0X%X", f.Data[i] );
+    text += buf;
+  }
+  return text;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  PrintSerial
+  Description  :  Serial bytes of the firmware and, with the frame cache, the repeats it kept off
+                  the port and the bytes their dumps would have taken. A build with
+                  -DUSE_FRAME_CACHE=false prints the volume without the cache for the same frames.
+  --------------------------------------------------------------------------------------------------*/
+static void PrintSerial ( void ) {
+  printf( "serial bytes    %llu\n", (unsigned long long)Serial.Bytes );
+#if (USE_FRAME_CACHE)
+  printf( "frame cache     %lu repeats not dumped, %lu bytes saved\n", FrameCacheHits, FrameCacheSavedBytes );
+#endif
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ReadMessage
+  Description  :  AvcReadMessage() with the time of a failed read counted in Failed.
+  --------------------------------------------------------------------------------------------------*/
+static bool ReadMessage ( void ) {
+  bool line = Sim::Line();
+  uint64_t from = Sim::Now;
+  bool ok = AvcReadMessage( &RxFrame );
+
+  if ( !ok && line ) {
+    uint64_t spent = Sim::Now - from;
+    if ( spent < Sim::Us( 100 ) ) {
+      Failed.Rejected++;
+      Failed.RejectedCycles += spent;
+    } else {
+      Failed.Doomed++;
+      Failed.DoomedCycles += spent;
+      Failed.LongestCycles = std::max( Failed.LongestCycles, spent );
+    }
+  }
+  return ok;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  InjectNoise
+  Description  :  Impulses at random times in [ from, to ), opt.NoiseRate a second on average.
+  --------------------------------------------------------------------------------------------------*/
+static void InjectNoise ( const Options & opt, uint64_t from, uint64_t to ) {
+  if ( opt.NoiseRate == 0 ) {
+    return;
+  }
+  std::exponential_distribution<double> gap( (double)opt.NoiseRate / F_CPU );
+  std::uniform_int_distribution<uint64_t> width( Sim::Us( 1 ), Sim::Us( std::max<unsigned long>( opt.NoiseWidthUs, 1 ) ) );
+
+  for ( uint64_t t = from + (uint64_t)gap( NoiseRandom ); t < to; t += (uint64_t)gap( NoiseRandom ) + 1 ) {
+    Sim::DriveRemote( t, t + width( NoiseRandom ) );
+    Failed.Impulses++;
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ReceiveFrame
+  Description  :  Lets the firmware poll the bus until the remote frame ending at end is over.
+  Return value :  TRUE if the firmware decoded the frame identical to sent.
+  --------------------------------------------------------------------------------------------------*/
+static bool ReceiveFrame ( const Sim::Frame & sent, uint64_t end, Report & rep ) {
+  bool decoded = false;
+
+  Sim::Deadline = end + Sim::Us( 20000 );
+  while ( true ) {
+    if ( !Sim::Line() ) {
+      uint64_t rise = Sim::NextRemoteRise( Sim::Now );
+      if ( rise >= end ) {
+        break;
+      }
+      Sim::Now = rise + Sim::PollCycles;
+    }
+    try {
+      decoded |= ReadMessage() && SameFrame( ToSimFrame( RxFrame ), sent );
+      SchedulerService();
+    } catch ( Sim::Stall & ) {
+      rep.Stalls++;
+      Sim::Now = end;
+      break;
+    }
+    Sim::Advance( LoopCycles );
+  }
+  Sim::Deadline = UINT64_MAX;
+  return decoded;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ClockCycles
+  Description  :  Simulator time at which ClockMillis() reaches ms, now if it has.
+  --------------------------------------------------------------------------------------------------*/
+static uint64_t ClockCycles ( unsigned long ms ) {
+  long ahead = (long)( ms - ClockMillis() );
+  return ahead > 0 ? Sim::Now - Sim::Us( ClockRest ) + (uint64_t)ahead * ( F_CPU / 1000 ) : Sim::Now;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  SkipTo
+  Description  :  Skips idle loop passes up to t. Their SchedulerService() calls keep Clock.h
+                  from missing a Timer 1 wrap: ClockMillis() is called every 10 ms on the way.
+  --------------------------------------------------------------------------------------------------*/
+static void SkipTo ( uint64_t t ) {
+  while ( t > Sim::Now + Sim::Us( 10000 ) ) {
+    Sim::Now += Sim::Us( 10000 );
+    ClockMillis();
+  }
+  Sim::Now = std::max( Sim::Now, t );
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  RunLoopUntil
+  Description  :  Runs loop() until next, or gap after the last edge the firmware drove since
+                  txEdges (log output, registration, answers). Idle passes are skipped up to the
+                  next scheduler task or noise impulse. A firmware still reading 20 ms after
+                  next is counted in LoopStalls. With startHigh, the start bit of the next frame
+                  is on the bus from next during the passes that run the scheduler, as a task
+                  that runs over next sees it on the real bus. It is taken back when the firmware
+                  drives the bus meanwhile (the remote master waits) and before returning, the
+                  caller sends the whole frame.
+  Return value :  Time the remote side may send again.
+  --------------------------------------------------------------------------------------------------*/
+static uint64_t RunLoopUntil ( uint64_t next, size_t txEdges, uint64_t gap, uint64_t startHigh = 0 ) {
+  uint64_t ahead = 0;               // Rise of the start bit driven ahead, 0 if none.
+
+  try {
+    while ( true ) {
+      if ( Sim::OutEdges.size() > txEdges ) {
+        next = std::max( next, Sim::OutEdges.back().Time + gap );
+      }
+      if ( ahead && ahead != next ) {
+        Sim::UndriveRemote( ahead, ahead + startHigh );
+        ahead = 0;
+      }
+      if ( Sim::Now >= next ) {
+        break;
+      }
+      Sim::Deadline = next + Sim::Us( 20000 );
+
+      // Idle passes of loop() do nothing until a task is due or the line rises (noise).
+      uint64_t due = ClockCycles( SchedulerNext );
+      uint64_t rise = Sim::Line() ? Sim::Now : Sim::NextRemoteRise( Sim::Now );
+      if ( Sim::Now < due ) {
+        if ( rise >= std::min( next, due ) ) {
+          SkipTo( std::min( next, due ) );
+        } else {
+          Sim::Now = std::max( Sim::Now, rise + Sim::PollCycles );
+          ReadMessage();
+          Sim::Advance( LoopCycles );
+        }
+        continue;
+      }
+      // The scheduler listens for a free bus first (IsAvcBusFree, one bit of the current mode):
+      // a start bit in that window would be seen and no task would run.
+      if ( Sim::Now + Sim::Us( 4 * ( Timing.BitLength + 2 ) ) + LoopCycles >= next ) {
+        SkipTo( next );
+        break;
+      }
+      if ( startHigh && !ahead ) {
+        ahead = next;
+        Sim::DriveRemote( ahead, ahead + startHigh );
+      }
+      ReadMessage();
+      SchedulerService();
+      Sim::Advance( LoopCycles );
+    }
+  } catch ( Sim::Stall & ) {
+    LoopStalls++;
+    next = std::max( next, Sim::Now );
+  }
+  if ( ahead ) {
+    Sim::UndriveRemote( ahead, ahead + startHigh );
+  }
+  Sim::Deadline = UINT64_MAX;
+  return next;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  RunRx
+  Description  :  Generator as head unit, firmware receiving.
+  --------------------------------------------------------------------------------------------------*/
+static Report RunRx ( const Options & opt ) {
+  Report rep;
+  uint64_t period = opt.Rate ? F_CPU / opt.Rate : 0;
+  uint64_t gap = Sim::Us( opt.GapUs );
+  uint64_t start = Sim::Now + Sim::Us( 1000 );
+  uint64_t t = start;
+  uint64_t end = t;
+
+  // One frame ahead: its start bit goes on the bus while the scheduler tasks of the gap run.
+  IebusFrame generated;
+  LoadTestNextFrame( &generated );
+
+  for ( unsigned long n = 0; n < opt.Frames; n++ ) {
+    if ( opt.Mixed ) {
+      generated.Mode = n % IEBUS_MODE_COUNT;
+    }
+    Sim::Frame sent = ToSimFrame( generated );
+    sent.Master = HU_ADDRESS;
+    Sim::Timing tm = Sim::Scaled( Sim::Modes[ sent.Mode ], opt.Scale );
+
+    unsigned target = 0;
+    bool forMe = sent.Slave == MY_ADDRESS;
+    if ( forMe ) {
+      target = n % IdentityCount;
+      sent.Slave = Identities[ target ].Address;
+    }
+
+    std::vector<uint64_t> acks;
+    size_t txEdges = Sim::OutEdges.size();
+    uint64_t frameStart = t;
+    end = Sim::SendFrame( t, sent, &acks, tm );
+    InjectNoise( opt, std::max( t, Sim::Now ), end );
+    rep.Frames++;
+
+    bool decoded = ReceiveFrame( sent, end, rep );
+
+    // The firmware may have answered (ping), the remote master waits for the bus to be free.
+    uint64_t next = std::max( end, Sim::Now ) + gap;
+    if ( period ) {
+      next = std::max( next, frameStart + period );
+    }
+    InjectNoise( opt, std::max( end, Sim::Now ), next );
+    LoadTestNextFrame( &generated );
+    if ( opt.Mixed ) {
+      generated.Mode = ( n + 1 ) % IEBUS_MODE_COUNT;
+    }
+    uint64_t startHigh = n + 1 < opt.Frames ? Sim::Scaled( Sim::Modes[ generated.Mode ], opt.Scale ).StartHigh : 0;
+    next = RunLoopUntil( next, txEdges, gap, startHigh );
+    t = next;
+
+    if ( decoded ) {
+      rep.Decoded++;
+    }
+    // FindIdentity() would charge its cycles to the bus clock.
+    if ( sent.Broadcast == MSG_NORMAL && forMe ) {
+      rep.AckExpected++;
+      bool all = true;
+      for ( uint64_t a : acks ) {
+        all &= Sim::AckedAt( a, tm );
+      }
+      rep.AckOk += all;
+
+      // First ack slot follows the slave address parity.
+      AckWindow & w = Windows[ target ];
+      uint64_t rise = acks[0];
+      auto it = std::lower_bound( Sim::OutEdges.begin() + txEdges, Sim::OutEdges.end(), rise,
+                                  []( const Sim::Edge & e, uint64_t v ) { return e.Time < v; } );
+      w.Frames++;
+      if ( Sim::AckedAt( rise, tm ) && it != Sim::OutEdges.end() && it->Level ) {
+        double slack = Sim::ToUs( (int64_t)( rise + tm.Bit1High ) - (int64_t)it->Time );
+        w.Acked++;
+        w.SumSlackUs += slack;
+        w.MinSlackUs = std::min( w.MinSlackUs, slack );
+      }
+    }
+  }
+
+  rep.BusCycles = std::max( end, Sim::Now ) - start;
+  return rep;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  RunTx
+  Description  :  Firmware as load-test master, simulated slave acking.
+  --------------------------------------------------------------------------------------------------*/
+static Report RunTx ( const Options & opt, Sim::TxObserver & obs ) {
+  Report rep;
+  uint64_t start = Sim::Now;
+
+  LoadTestPeriod = opt.Rate ? 1000000UL / opt.Rate : 0;
+  LoadTestDue = ClockMicros();
+  timerLoadTestReport = ClockMillis();
+
+  while ( LoadTestSent + LoadTestFailed < opt.Frames ) {
+    // Same as loop() in a LOAD_TEST_MODE build.
+    AvcReadMessage( &RxFrame );
+    LoadTestService();
+    SchedulerService();
+    Sim::Advance( Sim::Us( opt.GapUs ) / 4 + 1 );
+  }
+
+  rep.Frames    = LoadTestSent + LoadTestFailed;
+  rep.Decoded   = obs.Frames.size();
+  rep.BusCycles = Sim::Now - start;
+  return rep;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  IsRegistration
+  Description  :  Registration broadcast of an emulated device (IdentityRegisterTask), sent on a
+                  timer rather than as an answer, so it is counted and not compared in place.
+  --------------------------------------------------------------------------------------------------*/
+static bool IsRegistration ( const Sim::Frame & f ) {
+  for ( byte i = 0; i < IdentityCount; i++ ) {
+    AvcOutMessage * reg = Identities[i].Config->Register;
+    if ( f.Master == Identities[i].Address && f.Broadcast == reg->Mode && f.Size == reg->DataSize &&
+         memcmp( f.Data, reg->Data, reg->DataSize ) == 0 ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool IsEmulated ( uint16_t address ) {
+  return FindIdentity( address ) != NULL;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  CompareAnswers
+  Description  :  Compares the frames the firmware sent after an injected frame with the ones
+                  recorded after it, in order. Prints the divergences.
+  --------------------------------------------------------------------------------------------------*/
+static void CompareAnswers ( const Options & opt, const Sim::CaptureFrame * after,
+                             const std::vector<const Sim::CaptureFrame *> & recorded,
+                             const std::vector<Sim::Frame> & replayed, ReplayReport & rr ) {
+  size_t n = std::max( recorded.size(), replayed.size() );
+  unsigned long before = rr.Different + rr.Missing + rr.Extra;
+
+  for ( size_t i = 0; i < n; i++ ) {
+    const char * what;
+    if ( i >= replayed.size() ) {
+      rr.Missing++;
+      what = "missing";
+    } else if ( i >= recorded.size() ) {
+      rr.Extra++;
+      what = "extra";
+    } else if ( SameLogged( recorded[i]->F, replayed[i] ) ) {
+      rr.Matched++;
+      continue;
+    } else {
+      rr.Different++;
+      what = "different";
+    }
+
+    if ( before++ < 20 || opt.Verbose ) {
+      printf( "divergence      %s after line %lu (%s)\n", what, after ? after->Line : 0UL,
+              after ? FrameText( after->F ).c_str() : "capture start" );
+      if ( i < recorded.size() ) {
+        printf( "  recorded      line %lu: %s\n", recorded[i]->Line, FrameText( recorded[i]->F ).c_str() );
+      }
+      if ( i < replayed.size() ) {
+        printf( "  replayed      %s\n", FrameText( replayed[i] ).c_str() );
+      }
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  RunReplay
+  Description  :  Sends the recorded frames of the other devices to the firmware, at their
+                  recorded times when the capture has any, and compares what the firmware sends
+                  back with the frames recorded from the emulated devices. loop() runs up to
+                  every frame like in rx, with its start bit ahead.
+  --------------------------------------------------------------------------------------------------*/
+static Report RunReplay ( const Options & opt, Sim::TxObserver & obs,
+                          const std::vector<Sim::CaptureFrame> & capture, ReplayReport & rr ) {
+  Report rep;
+  uint64_t gap = Sim::Us( opt.GapUs );
+  uint64_t start = Sim::Now + Sim::Us( 1000 );
+  uint64_t t = start;
+  int64_t base = -1;
+
+  const Sim::CaptureFrame * after = nullptr;
+  std::vector<const Sim::CaptureFrame *> recorded;
+  size_t answersFrom = obs.Frames.size();
+  size_t txEdges = 0;               // Edges the firmware drove before the last injected frame.
+
+  // Compares the frames sent since answersFrom with recorded, registrations apart.
+  auto settle = [&]() {
+    std::vector<Sim::Frame> replayed;
+    for ( size_t k = answersFrom; k < obs.Frames.size(); k++ ) {
+      if ( IsRegistration( obs.Frames[k] ) ) {
+        rr.RegReplayed++;
+      } else {
+        replayed.push_back( obs.Frames[k] );
+      }
+    }
+    rr.Replayed += replayed.size();
+    CompareAnswers( opt, after, recorded, replayed, rr );
+    recorded.clear();
+
+    // Long captures: keep the history of the current frames only.
+    obs.Frames.clear();
+    answersFrom = 0;
+    Sim::Forget( Sim::Now - std::min<uint64_t>( Sim::Now, Sim::Us( 100000 ) ) );
+  };
+
+  for ( const Sim::CaptureFrame & cf : capture ) {
+    if ( IsEmulated( cf.F.Master ) ) {
+      if ( IsRegistration( cf.F ) ) {
+        rr.RegRecorded++;
+      } else {
+        rr.Recorded++;
+        recorded.push_back( &cf );
+      }
+      continue;
+    }
+
+    Sim::Frame sent = cf.F;
+    sent.Mode = opt.Mode;
+    Sim::Timing tm = Sim::Modes[ sent.Mode ];
+
+    // Recorded time, not before the bus is free again.
+    if ( cf.TimeUs >= 0 ) {
+      if ( base < 0 ) {
+        base = cf.TimeUs;
+      }
+      if ( cf.TimeUs > base ) {
+        t = std::max( t, start + (uint64_t)( cf.TimeUs - base ) * Sim::CyclesPerUs );
+      }
+    }
+
+    // The loop runs up to the frame, its start bit goes on the bus while the scheduler tasks run.
+    if ( rep.Frames ) {
+      t = RunLoopUntil( t, txEdges, gap, tm.StartHigh );
+    }
+
+    // Frames sent since the last injected one answered it.
+    settle();
+    after = &cf;
+
+    std::vector<uint64_t> acks;
+    txEdges = Sim::OutEdges.size();
+    uint64_t end = Sim::SendFrame( t, sent, &acks, tm );
+    rep.Frames++;
+    if ( ReceiveFrame( sent, end, rep ) ) {
+      rep.Decoded++;
+    }
+    if ( sent.Broadcast == MSG_NORMAL && IsEmulated( sent.Slave ) ) {
+      rep.AckExpected++;
+      bool all = true;
+      for ( uint64_t a : acks ) {
+        all &= Sim::AckedAt( a, tm );
+      }
+      rep.AckOk += all;
+    }
+
+    t = std::max( end, Sim::Now ) + gap;
+  }
+
+  // Answers to the last frame.
+  RunLoopUntil( Sim::Now + Sim::Us( 20000 ), Sim::OutEdges.size(), gap );
+  settle();
+
+  rep.BusCycles = Sim::Now - start;
+  return rep;
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                    Head unit emulator
+  hu: the firmware plays the head unit (HuEmulator.h). Simulated displays register once, ack the
+  frames sent to them and answer a ping or net scan after their latency.
+--------------------------------------------------------------------------------------------------*/
+struct SimDisplay {
+  uint16_t      Address;
+  uint64_t      Latency;            // End of the ping to the start of the answer.
+  bool          Plugged = true;
+  unsigned long Pings = 0;
+  unsigned long Answers = 0;
+};
+
+static std::vector<SimDisplay> Displays;
+static uint64_t     DisplaysBusy = 0;   // End of the last answer queued.
+static Sim::Timing  DisplayTiming;
+
+static void DisplaySend ( const SimDisplay & d, uint64_t t, bool broadcast, const uint8_t * data, uint8_t size ) {
+  Sim::Frame f = {};
+  f.Broadcast = broadcast ? MSG_BCAST : MSG_NORMAL;
+  f.Master    = d.Address;
+  f.Slave     = broadcast ? BROADCAST_ADDRESS : HU_ADDRESS;
+  f.Control   = CONTROL_FLAGS;
+  f.Size      = size;
+  memcpy( f.Data, data, size );
+  // Answers queue up behind each other like on the bus.
+  t = std::max( t, DisplaysBusy + DisplayTiming.BitLength * 4 );
+  DisplaysBusy = Sim::SendFrame( t, f, nullptr, DisplayTiming );
+}
+
+// TxObserver::Done: pings and net scans of the firmware.
+static void DisplaysSee ( const Sim::Frame & f ) {
+  if ( f.Master != HU_ADDRESS || f.Size != 3 || f.Data[0] != 0x10 || f.Data[2] != 0x01 ) {
+    return;
+  }
+  for ( SimDisplay & d : Displays ) {
+    bool scan = ( f.Broadcast == MSG_BCAST );
+    if ( !d.Plugged || ( !scan && f.Slave != d.Address ) ) {
+      continue;
+    }
+    const uint8_t answer[] = { 0x11, f.Data[1], 0x01, 0x02, 0x85, 0x93 };   // CmdDdisplayAnsver2
+    d.Pings += !scan;
+    d.Answers++;
+    DisplaySend( d, f.End + d.Latency, false, answer, sizeof answer );
+  }
+}
+
+static unsigned long HuPingsSent ( void ) {
+  unsigned long n = 0;
+  for ( byte i = 0; i < HuDeviceCount; i++ ) {
+    n += HuDevices[i].Pings;
+  }
+  return n;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  RunHu
+  Description  :  Firmware as head unit running HuScript, simulated displays answering, until the
+                  firmware has sent opt.Frames pings.
+  --------------------------------------------------------------------------------------------------*/
+static Report RunHu ( const Options & opt, Sim::TxObserver & obs ) {
+  Report rep;
+  uint64_t start = Sim::Now;
+
+  // Same identity and tasks as a HU_EMULATOR_MODE build, the report is printed at the end.
+  PlayHeadUnit = true;
+  IdentityCount = 1;
+  Identities[0].Address = HU_ADDRESS;
+  SchedulerCount = 0;
+  SchedulerAdd( LogDrain, 1 );
+#if (USE_FRAME_CACHE)
+  SchedulerAdd( FrameCacheDrain, 1 );
+  SchedulerAdd( FrameCacheReport, FRAME_CACHE_REPORT );
+#endif
+  HuDue = ClockMillis();
+
+  DisplayTiming = Sim::Modes[ opt.Mode ];
+  obs.AckAddresses.clear();
+  obs.Done = DisplaysSee;
+  for ( unsigned i = 0; i < opt.Identities; i++ ) {
+    SimDisplay d;
+    d.Address = MY_ADDRESS + i;
+    d.Latency = Sim::Us( opt.LatencyUs + 50 * i );
+    Displays.push_back( d );
+    obs.AckAddresses.push_back( d.Address );
+
+    const uint8_t reg[] = { 0x12 };    // CmdDdisplayReg
+    DisplaySend( d, Sim::Now + Sim::Us( 10000 + 20000 * i ), true, reg, sizeof reg );
+  }
+
+  // The answer to the last ping is counted too.
+  while ( HuPingsSent() < opt.Frames || HuWaiting != NULL ) {
+    // -u: the last display goes away half way, its pings are not acked any more.
+    if ( opt.Unplug && Displays.back().Plugged && HuPingsSent() >= opt.Frames / 2 ) {
+      Displays.back().Plugged = false;
+      obs.AckAddresses.pop_back();
+    }
+
+    // Same as loop() in a HU_EMULATOR_MODE build.
+    AvcReadMessage( &RxFrame );
+    HuEmulatorService();
+    SchedulerService();
+    Sim::Advance( LoopCycles );
+
+    // Idle passes do nothing until a step, ping, timeout or task is due or a display sends.
+    if ( !Sim::Line() && HuPingNext >= HuDeviceCount ) {
+      uint64_t due = std::min( ClockCycles( HuDue ), ClockCycles( SchedulerNext ) );
+      unsigned long waited = ClockMicros() - HuSent;
+      if ( HuWaiting != NULL && waited < HU_REPLY_TIMEOUT * 1000UL ) {
+        due = std::min( due, Sim::Now + Sim::Us( HU_REPLY_TIMEOUT * 1000UL - waited ) );
+      }
+      uint64_t until = std::min( due, Sim::NextRemoteRise( Sim::Now ) );
+      if ( until > Sim::Now && until != UINT64_MAX ) {
+        SkipTo( until );
+      }
+    }
+  }
+
+  rep.Frames    = obs.Frames.size();
+  rep.BusCycles = Sim::Now - start;
+  return rep;
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                          inject
+--------------------------------------------------------------------------------------------------*/
+struct InjectCounts {
+  unsigned long Commands = 0;
+  unsigned long Queued = 0;
+  unsigned long Sent = 0;
+  unsigned long Failed = 0;
+  unsigned long Overflow = 0;       // Queue full, sent again in a later command.
+  unsigned long Bad = 0;
+  unsigned long Lost = 0;           // Reports lost on the device (TX LOST).
+  unsigned long Periodic = 0;       // Sends of the periodic frame.
+  unsigned long Different = 0;      // Frames on the bus not the ones queued, in order.
+  uint64_t      Starved = 0;        // Cycles the queue was empty with frames still to send.
+};
+
+static const uint8_t InjectPeriodicTag = 0xFF;
+
+static Sim::Frame ToSimFrame ( const InjectHost::Frame & h ) {
+  Sim::Frame f = {};
+  f.Broadcast = h.Broadcast ? MSG_BCAST : MSG_NORMAL;
+  f.Master    = h.Master >= 0 ? h.Master : Identities[0].Address;
+  f.Slave     = h.Slave;
+  f.Control   = h.Control;
+  f.Size      = h.Data.size();
+  f.Mode      = h.Mode;
+  memcpy( f.Data, h.Data.data(), h.Data.size() );
+  return f;
+}
+
+static InjectHost::Frame ToInjectFrame ( const IebusFrame & frame, uint8_t tag ) {
+  InjectHost::Frame f;
+  f.Tag       = tag;
+  f.Broadcast = frame.Broadcast == MSG_BCAST;
+  f.Mode      = frame.Mode;
+  f.Slave     = frame.SlaveAddress;
+  f.Control   = frame.Control;
+  f.Data.assign( frame.Data, frame.Data + IEBUS_STORED( &frame ) );
+  return f;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  RunInject
+  Description  :  Host sending the generated frames through the injection commands (Inject.h)
+                  at the serial speed, a command as soon as the window of the status lines
+                  takes a record, as many records as it takes. The firmware queues and sends them, a
+                  simulated slave acks like in tx. With -p the firmware also sends a periodic
+                  broadcast every -p ms.
+  --------------------------------------------------------------------------------------------------*/
+static Report RunInject ( const Options & opt, Sim::TxObserver & obs, InjectCounts & ic ) {
+  Report rep;
+  uint64_t start = Sim::Now;
+
+  // Same tasks as a USE_INJECT build, without the registration broadcasts.
+  SchedulerCount = 0;
+  SchedulerAdd( LogDrain, 1 );
+  SchedulerAdd( InjectPoll, 1 );
+  Serial.Keep = true;
+
+  std::deque<InjectHost::Frame> pending;    // Generated, not queued yet.
+  std::map<uint8_t, InjectHost::Frame> inFlight;
+  std::deque<std::vector<uint8_t>> commands;    // Tags of the commands waiting for their reports.
+  std::deque<Sim::Frame> expected;          // Sent in commands, in order: the reports of a frame
+                                            // may come after it is on the bus.
+  InjectHost::Window window;
+  unsigned long generated = 0;
+  uint8_t nextTag = 0;
+  size_t scanned = 0, checked = 0;
+  Sim::Frame periodicFrame = {};
+
+  if ( opt.PeriodMs ) {
+    InjectHost::Frame f;
+    f.Tag       = InjectPeriodicTag;
+    f.Broadcast = true;
+    f.Mode      = opt.Mode;
+    f.Master    = HU_ADDRESS;
+    f.Slave     = BROADCAST_ADDRESS;
+    f.Data      = { 0x12 };
+    periodicFrame = ToSimFrame( f );
+    std::vector<uint8_t> p = InjectHost::Periodic( 0, opt.PeriodMs, &f );
+    Serial.Send( p.data(), p.size() );
+    window.Sending( p.size(), 0 );
+    commands.push_back( { InjectPeriodicTag } );
+    ic.Commands++;
+  }
+
+  while ( ic.Sent + ic.Failed < opt.Frames ) {
+    while ( pending.size() < 16 && generated < opt.Frames ) {
+      IebusFrame frame;
+      LoadTestNextFrame( &frame );
+      frame.DataSize = IEBUS_STORED( &frame );
+      pending.push_back( ToInjectFrame( frame, nextTag ) );
+      nextTag = ( nextTag + 1 ) % InjectPeriodicTag;
+      generated++;
+    }
+
+    // The next command as soon as the window takes a record, as many as it takes.
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> tags;
+    size_t queued = 0;
+    while ( !pending.empty() && payload.size() + InjectHost::RecordBytes( pending.front() ) <= INJECT_COMMAND_SIZE &&
+            window.Fits( 4 + payload.size() + InjectHost::RecordBytes( pending.front() ),
+                         queued + InjectHost::QueuedBytes( pending.front() ) ) ) {
+      InjectHost::AppendRecord( payload, pending.front() );
+      queued += InjectHost::QueuedBytes( pending.front() );
+      inFlight[ pending.front().Tag ] = pending.front();
+      tags.push_back( pending.front().Tag );
+      expected.push_back( ToSimFrame( pending.front() ) );
+      pending.pop_front();
+    }
+    if ( !tags.empty() ) {
+      std::vector<uint8_t> p = InjectHost::Packet( INJECT_CMD_SEND, payload );
+      Serial.Send( p.data(), p.size() );
+      window.Sending( p.size(), queued );
+      commands.push_back( tags );
+      ic.Commands++;
+    }
+
+    // Same as loop() in a USE_INJECT build.
+    uint64_t pass = Sim::Now;
+    bool starved = InjectQueueUsed == 0 && ( !pending.empty() || !commands.empty() );
+    AvcReadMessage( &RxFrame );
+    InjectService();
+    SchedulerService();
+    Sim::Advance( LoopCycles );
+    if ( starved ) {
+      ic.Starved += Sim::Now - pass;
+    }
+
+    // Reports printed since the last pass.
+    size_t eol;
+    while ( ( eol = Serial.Out.find( '\n', scanned ) ) != std::string::npos ) {
+      std::string line = Serial.Out.substr( scanned, eol + 1 - scanned );
+      std::vector<InjectHost::Report> reports;
+      scanned = eol + 1;
+
+      if ( !strncmp( line.c_str(), "TX LOST:", 8 ) ) {
+        ic.Lost += strtoul( line.c_str() + 8, nullptr, 10 );
+      }
+      window.Line( line.c_str() );
+      InjectHost::ParseReports( line.c_str(), reports );
+      for ( const InjectHost::Report & r : reports ) {
+        bool periodic = r.Tag == InjectPeriodicTag;
+        if ( InjectHost::Answers( r.Status ) && !commands.empty() ) {
+          // Commands run in order: the answers are the ones of the oldest.
+          std::vector<uint8_t> & command = commands.front();
+          auto it = std::find( command.begin(), command.end(), r.Tag );
+          if ( it != command.end() ) {
+            window.Answered( periodic ? 0 : InjectHost::QueuedBytes( inFlight[ r.Tag ] ) );
+            command.erase( it );
+          }
+          if ( r.Status == INJECT_BAD ) {
+            // The records not reported are sent again.
+            for ( uint8_t tag : command ) {
+              window.Answered( InjectHost::QueuedBytes( inFlight[ tag ] ) );
+              pending.push_front( inFlight[ tag ] );
+            }
+            command.clear();
+          }
+          if ( command.empty() ) {
+            commands.pop_front();
+            window.CommandDone();
+          }
+        }
+        switch ( r.Status ) {
+          case INJECT_QUEUED:
+            ic.Queued += !periodic;
+            break;
+          case INJECT_OVERFLOW: ic.Overflow++; pending.push_front( inFlight[ r.Tag ] ); break;
+          case INJECT_BAD:      ic.Bad++; break;
+          case INJECT_SENT:     periodic ? ic.Periodic++ : ic.Sent++; break;
+          case INJECT_FAILED:   periodic ? ic.Periodic++ : ic.Failed++; break;
+        }
+      }
+    }
+    Serial.Out.erase( 0, scanned );
+    scanned = 0;
+
+    // Frames on the bus against the queued ones in order, the periodic broadcast aside. The
+    // frames cut short (no ack) are not seen complete and skipped.
+    for ( ; checked < obs.Frames.size(); checked++ ) {
+      const Sim::Frame & f = obs.Frames[ checked ];
+      if ( opt.PeriodMs && SameFrame( f, periodicFrame ) ) {
+        continue;
+      }
+      auto it = std::find_if( expected.begin(), expected.end(),
+                              [&]( const Sim::Frame & e ) { return SameFrame( f, e ); } );
+      if ( it == expected.end() ) {
+        ic.Different++;
+      } else {
+        expected.erase( expected.begin(), it + 1 );
+      }
+    }
+  }
+
+  rep.Frames    = ic.Sent + ic.Failed;
+  rep.Decoded   = obs.Frames.size();
+  rep.BusCycles = Sim::Now - start;
+  return rep;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  RunConform
+  Description  :  Transmit conformance: the frames of the display sent by their own functions in
+                  every IEBus mode (or -m), the drive checked against the golden envelopes
+                  (SimWaveform.h). Prints a line per frame and the worst deviation per bit kind,
+                  writes the edges as VCD with -o.
+  Return value :  Frames that failed.
+  --------------------------------------------------------------------------------------------------*/
+enum ConformSend { CONFORM_REGISTER, CONFORM_ANSWER, CONFORM_PING };
+
+struct ConformCase {
+  const char *  Name;
+  ConformSend   Send;
+  bool          Acked;          // The simulated HU acks.
+};
+
+static const ConformCase ConformCases[] =
+{
+  { "AvcRegisterMe",              CONFORM_REGISTER, true },
+  { "CmdDdisplayAnsver2",         CONFORM_ANSWER,   true },
+  { "CmdDdisplayAnsver2, no ack", CONFORM_ANSWER,   false },
+  { "CmdHuPing",                  CONFORM_PING,     true },
+  { "CmdHuPing, no ack",          CONFORM_PING,     false },
+};
+
+static unsigned long RunConform ( const Options & opt, Sim::TxObserver & obs, int onlyMode ) {
+  unsigned long failed = 0;
+  std::vector<Sim::WaveMark> marks;
+
+  for ( int mode = 0; mode < IEBUS_MODE_COUNT; mode++ ) {
+    if ( onlyMode >= 0 && mode != onlyMode ) {
+      continue;
+    }
+    Sim::WaveStats stats[ Sim::WAVE_KINDS ];
+
+    // The display of IdentityTable, sending in this mode.
+    AvcIdentityStruct config = { MY_ADDRESS, &CmdDdisplayReg, &CmdDdisplayAnsver2, (byte)mode };
+    AvcIdentity id = { MY_ADDRESS, ID_REGISTERING, 0x05, 0, &config };
+
+    printf( "mode %d\n", mode + 1 );
+    for ( const ConformCase & cc : ConformCases ) {
+      AvcOutMessage * msg = cc.Send == CONFORM_REGISTER ? &CmdDdisplayReg :
+                            cc.Send == CONFORM_ANSWER ? &CmdDdisplayAnsver2 : &CmdHuPing;
+      IebusFrame frame;
+      LoadHeader_P( &frame, msg, &id );
+      memcpy_P( frame.Data, msg->Data, frame.DataSize );
+      if ( cc.Send == CONFORM_ANSWER ) {
+        frame.Data[1] = id.Handle;
+      }
+      Sim::Frame expected = ToSimFrame( frame );
+
+      obs.AckAddresses.assign( cc.Acked ? 1 : 0, HU_ADDRESS );
+      obs.AckAll = false;
+      Sim::Now += Sim::Us( 2000 );
+      size_t first = Sim::OutEdges.size();
+      marks.push_back( { Sim::Now, std::string( "mode " ) + std::to_string( mode + 1 ) + " " + cc.Name } );
+
+      bool sent = false;
+      std::string error;
+      Sim::Deadline = Sim::Now + Sim::Us( 100000 );
+      try {
+        switch ( cc.Send ) {
+          case CONFORM_REGISTER: sent = AvcRegisterMe( &id ); break;
+          case CONFORM_ANSWER:   id.State = ID_REGISTERING; AvcAnswerPing( &id ); sent = id.State == ID_REGISTERED; break;
+          case CONFORM_PING:     sent = SendMessage_P( &CmdHuPing, &id ); break;
+        }
+      } catch ( Sim::Stall & ) {
+        error = "stalled";
+      }
+      Sim::Deadline = UINT64_MAX;
+
+      // A frame nobody acks ends after the ack slot of the slave address.
+      std::vector<uint8_t> bits, ack;
+      Sim::FrameBits( expected, bits, ack );
+      bool complete = cc.Acked || !expected.Broadcast;
+      size_t bitCount = complete ? bits.size() : 28;
+
+      std::vector<Sim::Edge> edges( Sim::OutEdges.begin() + first, Sim::OutEdges.end() );
+      if ( error.empty() ) {
+        error = Sim::MeasureFrame( edges, expected, mode, bitCount, stats );
+      }
+      if ( error.empty() && sent != complete ) {
+        error = complete ? "reported not sent" : "reported sent without an ack";
+      }
+
+      printf( "  %-26s %-62s %3zu bits  %s\n", cc.Name, FrameText( expected ).c_str(),
+              edges.size() / 2 ? edges.size() / 2 - 1 : 0, error.empty() ? "ok" : ( "FAIL: " + error ).c_str() );
+      failed += !error.empty();
+    }
+
+    printf( "  %-14s %6s %8s %9s %9s %9s %6s\n", "bit kind", "count", "golden", "min dev", "max dev",
+            "band", "worst" );
+    for ( int k = 0; k < Sim::WAVE_KINDS; k++ ) {
+      const Sim::WaveStats & s = stats[k];
+      if ( s.Count == 0 ) {
+        continue;
+      }
+      const Sim::WaveEnvelope & env = Sim::GoldenEnvelopes[ mode ][ k ];
+      char golden[ 16 ] = "'1'/'0'", band[ 16 ] = "'1'/'0'";
+      if ( k != Sim::WAVE_PARITY_HIGH ) {
+        snprintf( golden, sizeof golden, "%.0f us", env.NominalUs );
+        snprintf( band, sizeof band, "+-%.0f us", env.BandUs );
+      }
+      printf( "  %-14s %6lu %8s %+8.2f %+8.2f %9s %5.0f%%%s\n", Sim::WaveKindNames[k], s.Count, golden,
+              s.MinDevUs, s.MaxDevUs, band, 100.0 * s.WorstShare, s.Outside ? "  OUT" : "" );
+    }
+    printf( "\n" );
+  }
+
+  if ( opt.Vcd ) {
+    if ( Sim::WriteVcd( opt.Vcd, Sim::OutEdges, Sim::Remote, marks ) ) {
+      printf( "vcd             %s\n", opt.Vcd );
+    } else {
+      fprintf( stderr, "cannot write %s\n", opt.Vcd );
+      failed++;
+    }
+  }
+  return failed;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  RunMargin
+  Description  :  Decode margins of every mode: compare points of IebusTimings against the nominal
+                  pulses, then rx with the remote timings scaled from 0.70 to 1.30 (bit rate
+                  +43 % .. -23 %). Prints the range decoded and acked without a loss.
+  --------------------------------------------------------------------------------------------------*/
+static void RunMargin ( Options opt ) {
+
+  for ( int mode = 0; mode < IEBUS_MODE_COUNT; mode++ ) {
+    const IebusTiming & row = IebusTimings[ mode ];
+    const Sim::Timing & nom = Sim::Modes[ mode ];
+
+    // TCNT0 counts whole ticks: a start is taken from ( StartMin + 1 ) ticks up to StartMax.
+    double startHigh = Sim::ToUs( nom.StartHigh );
+    double bit1High = Sim::ToUs( nom.Bit1High );
+    double bit0High = Sim::ToUs( nom.Bit0High );
+
+    printf( "mode %d\n", mode + 1 );
+    printf( "  start  %5.1f us, accepted %3d .. %3d us: margin -%.1f / +%.1f us\n", startHigh,
+            4 * ( row.StartMin + 1 ), 4 * row.StartMax, startHigh - 4 * ( row.StartMin + 1 ),
+            4 * row.StartMax - startHigh );
+    printf( "  '1'    %5.1f us, '0' from %3d us:        margin %.1f us\n", bit1High,
+            4 * row.HalfPeriod, 4 * row.HalfPeriod - bit1High );
+    printf( "  '0'    %5.1f us, '1' below %3d us:       margin %.1f us\n", bit0High,
+            4 * row.HalfPeriod, bit0High - 4 * row.HalfPeriod );
+
+    bool clean[ 131 ] = {};
+    for ( int percent = 70; percent <= 130; percent++ ) {
+      opt.Mode = mode;
+      opt.Scale = percent / 100.0;
+      LoadTestMode = mode;
+
+      Report rep = RunRx( opt );
+      clean[ percent ] = rep.Decoded == rep.Frames && rep.AckOk == rep.AckExpected && !rep.Stalls;
+
+      if ( percent % 5 == 0 || opt.Verbose ) {
+        printf( "  timing %3d%%  decoded %5.1f%%  acked %5.1f%%\n", percent,
+                100.0 * rep.Decoded / rep.Frames,
+                rep.AckExpected ? 100.0 * rep.AckOk / rep.AckExpected : 100.0 );
+      }
+    }
+
+    // Widest clean range around 100 %.
+    if ( !clean[ 100 ] ) {
+      printf( "  not clean at the nominal timings\n\n" );
+      continue;
+    }
+    int low = 100, high = 100;
+    while ( low > 70 && clean[ low - 1 ] ) low--;
+    while ( high < 130 && clean[ high + 1 ] ) high++;
+    printf( "  clean from %d%% to %d%% of the nominal timings (bit rate %+.0f%% .. %+.0f%%)\n\n",
+            low, high, 100.0 / high * 100.0 - 100.0, 100.0 / low * 100.0 - 100.0 );
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                         Frame cache
+  cache: FrameCacheUpdate() frame by frame against a model of the cache written from the
+  description of FrameCache.h, and the RPT / CACHE lines FrameCacheDrain() prints.
+--------------------------------------------------------------------------------------------------*/
+#if (USE_FRAME_CACHE)
+struct CacheModelEntry {
+  unsigned long Key = 0;
+  unsigned      Repeats = 0;
+  uint64_t      LastSeen = 0;
+  unsigned      Size = 0;
+  std::vector<uint8_t> Data;        // Kept up to FRAME_CACHE_DATA bytes.
+};
+
+struct CacheCounts {
+  unsigned long Frames = 0;
+  unsigned long Hits = 0;
+  unsigned long New = 0;
+  unsigned long Evicted = 0;        // New frames that took the place of another.
+  unsigned long ChangedByte = 0;    // Same length, a byte differs.
+  unsigned long ChangedSize = 0;    // Same bytes, other length.
+  unsigned long ChangedOther = 0;   // New payload.
+  unsigned long Long = 0;           // Longer than FRAME_CACHE_DATA.
+  unsigned long Deferred = 0;       // Repeats queued for a RPT line.
+  unsigned long KeptFull = 0;       // Repeats left in a changed entry, queue full.
+  unsigned long LostFull = 0;       // Repeats of an evicted entry, queue full: only in HIT.
+  unsigned long Lines = 0;          // RPT lines checked.
+  unsigned long Wrong = 0;
+};
+
+static CacheModelEntry CacheModel[ FRAME_CACHE_SIZE ];
+static std::deque<std::pair<unsigned long, unsigned>> CacheModelPending;
+static CacheCounts     CacheSeen;
+
+// Characters of the dump line of a frame, from the tokens the log prints.
+static unsigned long CacheDumpLength ( const IebusFrame & f ) {
+  char buf[ USART_BUFFER_SIZE ];
+  unsigned long length = 0;
+  for ( byte token = 0; LogFormatToken( &f, token, buf ); token++ ) {
+    length += strlen( buf );
+  }
+  return length;
+}
+
+static void CacheWrong ( const char * what, unsigned long frame ) {
+  if ( CacheSeen.Wrong++ < 20 ) {
+    printf( "  frame %lu: %s\n", frame, what );
+  }
+}
+
+// Repeats of an entry to the RPT queue, false if it is full.
+static bool CacheModelDefer ( CacheModelEntry & e ) {
+  if ( e.Repeats == 0 ) {
+    return true;
+  }
+  if ( CacheModelPending.size() >= FRAME_CACHE_PENDING ) {
+    return false;
+  }
+  CacheModelPending.push_back( { e.Key, e.Repeats } );
+  CacheSeen.Deferred++;
+  e.Repeats = 0;
+  return true;
+}
+
+// TRUE if the frame shall be dumped, as FrameCacheUpdate().
+static bool CacheModelUpdate ( const IebusFrame & f, uint64_t clock, unsigned long & saved ) {
+  unsigned long key = FRAME_CACHE_VALID | ( (unsigned long)f.MasterAddress << 16 ) | ( f.SlaveAddress << 4 ) | ( f.Control & 0xF );
+  unsigned set = (byte)( f.MasterAddress ^ ( f.MasterAddress >> 7 ) ^ f.SlaveAddress ^ ( f.SlaveAddress >> 5 ) ^ f.Control ) % FRAME_CACHE_SETS;
+  CacheModelEntry * ways = &CacheModel[ set * FRAME_CACHE_WAYS ];
+  bool fits = f.DataSize <= FRAME_CACHE_DATA;
+  std::vector<uint8_t> data( f.Data, f.Data + ( fits ? f.DataSize : 0 ) );
+
+  CacheSeen.Long += !fits;
+
+  for ( unsigned w = 0; w < FRAME_CACHE_WAYS; w++ ) {
+    CacheModelEntry & e = ways[w];
+    if ( e.Key != key ) {
+      continue;
+    }
+    e.LastSeen = clock;
+    if ( fits && e.Size == f.DataSize && e.Data == data ) {
+      e.Repeats++;
+      CacheSeen.Hits++;
+      saved += CacheDumpLength( f );
+      return false;
+    }
+    if ( e.Size == f.DataSize && e.Size <= FRAME_CACHE_DATA ) {
+      CacheSeen.ChangedByte++;
+    } else if ( e.Size <= FRAME_CACHE_DATA && fits &&
+                std::equal( data.begin(), data.begin() + std::min( data.size(), e.Data.size() ), e.Data.begin() ) ) {
+      CacheSeen.ChangedSize++;
+    } else {
+      CacheSeen.ChangedOther++;
+    }
+    if ( !CacheModelDefer( e ) ) {
+      CacheSeen.KeptFull++;
+    }
+    e.Size = f.DataSize;
+    e.Data = data;
+    return true;
+  }
+
+  // An empty way, else the one seen longest ago, the first of them.
+  CacheModelEntry * victim = nullptr;
+  for ( unsigned w = 0; w < FRAME_CACHE_WAYS && !victim; w++ ) {
+    if ( ways[w].Key == 0 ) {
+      victim = &ways[w];
+    }
+  }
+  if ( !victim ) {
+    victim = &ways[0];
+    for ( unsigned w = 1; w < FRAME_CACHE_WAYS; w++ ) {
+      if ( ways[w].LastSeen < victim->LastSeen ) {
+        victim = &ways[w];
+      }
+    }
+    CacheSeen.Evicted++;
+    if ( !CacheModelDefer( *victim ) ) {
+      CacheSeen.LostFull++;
+    }
+  }
+  CacheSeen.New++;
+  victim->Key = key;
+  victim->Repeats = 0;
+  victim->LastSeen = clock;
+  victim->Size = f.DataSize;
+  victim->Data = data;
+  return true;
+}
+
+// Lets FrameCacheDrain() print one line from an empty TX buffer, returns it.
+static std::string CacheDrainLine ( void ) {
+  SkipTo( Sim::Now + Sim::Us( 10000 ) );
+  size_t from = Serial.Out.size();
+  FrameCacheDrain();
+  return Serial.Out.substr( from );
+}
+
+// The RPT line of a pending record against the model queue.
+static void CacheCheckLine ( const std::string & line, unsigned long key, unsigned repeats, unsigned long frame ) {
+  char expected[ 64 ];
+  snprintf( expected, sizeof expected, "RPT:%u M:0X%lX S:0X%lX CB:0X%lX\r\n", repeats,
+            ( key >> 16 ) & 0xFFF, ( key >> 4 ) & 0xFFF, key & 0xF );
+  CacheSeen.Lines++;
+  if ( line != expected ) {
+    std::string what = "printed \"" + line.substr( 0, line.find( '\r' ) ) + "\", model \"" +
+                       std::string( expected, strcspn( expected, "\r" ) ) + "\"";
+    CacheWrong( what.c_str(), frame );
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  RunCache
+  Description  :  Feeds opt.Frames frames to FrameCacheUpdate() and checks every answer against
+                  the model. The keys are 3 per set on average, so entries are evicted, and the
+                  payloads repeat, change in one byte or in length, or get longer than
+                  FRAME_CACHE_DATA. The RPT queue is drained after every 8th frame on average
+                  and so fills up now and then. Ends with a report sweep: the RPT lines of all
+                  entries and the CACHE line.
+  Return value :  Differences found.
+  --------------------------------------------------------------------------------------------------*/
+static unsigned long RunCache ( const Options & opt ) {
+  std::mt19937 random( LoadTestSeed );
+  auto below = [&]( unsigned n ) { return (unsigned)( random() % n ); };
+
+  struct Source { word Master, Slave; byte Control; std::vector<uint8_t> Data; };
+  std::vector<Source> sources( 3 * FRAME_CACHE_SETS );
+  for ( Source & s : sources ) {
+    s.Master  = below( 0x1000 );
+    s.Slave   = below( 0x1000 );
+    s.Control = below( 16 );
+    s.Data.resize( 1 + below( FRAME_CACHE_DATA ) );
+    for ( uint8_t & b : s.Data ) b = below( 256 );
+  }
+
+  Serial.Keep = true;
+  unsigned long saved = 0;
+
+  for ( unsigned long n = 0; n < opt.Frames; n++ ) {
+    Source & s = sources[ below( sources.size() ) ];
+    unsigned kind = below( 20 );
+    // Another payload: a byte, the length or all of it.
+    if ( kind == 16 ) {
+      s.Data[ below( s.Data.size() ) ] ^= 1 + below( 255 );
+    } else if ( kind == 17 ) {
+      s.Data.resize( s.Data.size() > 1 && ( s.Data.size() == FRAME_CACHE_DATA || below( 2 ) ) ? s.Data.size() - 1 : s.Data.size() + 1, 0x5A );
+    } else if ( kind == 18 ) {
+      s.Data.resize( 1 + below( FRAME_CACHE_DATA ) );
+      for ( uint8_t & b : s.Data ) b = below( 256 );
+    }
+
+    IebusFrame f = {};
+    f.Broadcast     = MSG_NORMAL;
+    f.MasterAddress = s.Master;
+    f.SlaveAddress  = s.Slave;
+    f.Control       = s.Control;
+    f.DataSize      = s.Data.size();
+    memcpy( f.Data, s.Data.data(), s.Data.size() );
+    if ( kind == 19 ) {
+      // Once longer than the cache keeps: the next frame of the key is dumped as changed.
+      f.DataSize = FRAME_CACHE_DATA + 1 + below( IEBUS_DATA_SIZE - FRAME_CACHE_DATA );
+      memset( f.Data + s.Data.size(), 0xA5, f.DataSize - s.Data.size() );
+    }
+
+    CacheSeen.Frames++;
+    bool expected = CacheModelUpdate( f, n + 1, saved );
+    if ( FrameCacheUpdate( &f ) != expected ) {
+      CacheWrong( expected ? "repeat, the model dumps it" : "dumped, the model counts a repeat", n );
+    }
+
+    if ( below( 8 ) == 0 && !CacheModelPending.empty() ) {
+      auto record = CacheModelPending.front();
+      CacheModelPending.pop_front();
+      CacheCheckLine( CacheDrainLine(), record.first, record.second, n );
+    }
+  }
+
+  // The queue, then the sweep: the entries with repeats in cache order and the CACHE line.
+  while ( !CacheModelPending.empty() ) {
+    auto record = CacheModelPending.front();
+    CacheModelPending.pop_front();
+    CacheCheckLine( CacheDrainLine(), record.first, record.second, opt.Frames );
+  }
+  FrameCacheReport();
+  bool reported = false;
+  for ( CacheModelEntry & e : CacheModel ) {
+    if ( e.Repeats ) {
+      CacheCheckLine( CacheDrainLine(), e.Key, e.Repeats, opt.Frames );
+      reported = true;
+    }
+  }
+  char total[ 64 ];
+  snprintf( total, sizeof total, "CACHE HIT:%lu SAVED:%lu\r\n", CacheSeen.Hits, saved );
+  std::string line = CacheDrainLine();
+  if ( reported ? line != total : !line.empty() ) {
+    CacheWrong( ( "printed \"" + line.substr( 0, line.find( '\r' ) ) + "\", model \"" +
+                  std::string( total, strcspn( total, "\r" ) ) + "\"" ).c_str(), opt.Frames );
+  }
+  if ( !CacheDrainLine().empty() ) {
+    CacheWrong( "a line after the CACHE line", opt.Frames );
+  }
+
+  const CacheCounts & c = CacheSeen;
+  printf( "mode            cache (%d entries, %d ways, %d payload bytes, %d pending)\n",
+          FRAME_CACHE_SIZE, FRAME_CACHE_WAYS, FRAME_CACHE_DATA, FRAME_CACHE_PENDING );
+  printf( "frames          %lu, %lu keys\n", c.Frames, (unsigned long)sources.size() );
+  printf( "hits            %lu\n", c.Hits );
+  printf( "new             %lu, %lu of them evicting the least recently seen entry\n", c.New, c.Evicted );
+  printf( "changed         %lu a byte, %lu the length, %lu all bytes\n", c.ChangedByte, c.ChangedSize, c.ChangedOther );
+  printf( "not kept        %lu longer than %d bytes\n", c.Long, FRAME_CACHE_DATA );
+  printf( "repeats         %lu queued, %lu kept on a full queue, %lu evicted on a full queue\n",
+          c.Deferred, c.KeptFull, c.LostFull );
+  printf( "lines           %lu RPT lines and the CACHE line checked\n", c.Lines );
+  return c.Wrong;
+}
+#endif
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  RunParity
+  Description  :  Parity() of the firmware (ParityTable) against counting the '1' bits, for every
+                  field value of up to 12 bits. Prints the first 20 values that differ.
+  Return value :  Values that differ.
+  --------------------------------------------------------------------------------------------------*/
+static unsigned long RunParity ( void ) {
+  unsigned long wrong = 0;
+
+  for ( word v = 0; v <= 0xFFF; v++ ) {
+    unsigned ones = 0;
+    for ( word bits = v; bits; bits >>= 1 ) {
+      ones += bits & 1;
+    }
+    if ( Parity( v ) != (bool)( ones & 1 ) ) {
+      if ( wrong++ < 20 ) {
+        printf( "  0X%03X: %u '1' bits, Parity() %d\n", v, ones, Parity( v ) );
+      }
+    }
+  }
+  return wrong;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  main
+  --------------------------------------------------------------------------------------------------*/
+int main ( int argc, char * argv[] ) {
+  Options opt;
+  bool framesGiven = false;
+  bool gapGiven = false;
+  bool modeGiven = false;
+  int c;
+
+  while ( ( c = getopt( argc, argv, "n:r:g:s:i:m:l:N:W:p:o:MSAduPvh" ) ) != -1 ) {
+    switch ( c ) {
+      case 'n': opt.Frames = strtoul( optarg, nullptr, 0 ); framesGiven = true; break;
+      case 'r': opt.Rate = strtoul( optarg, nullptr, 0 ); break;
+      case 'g': opt.GapUs = strtoul( optarg, nullptr, 0 ); gapGiven = true; break;
+      case 's': LoadTestSeed = (uint16_t)strtoul( optarg, nullptr, 0 ); break;
+      case 'i': opt.Identities = strtoul( optarg, nullptr, 0 ); break;
+      case 'm': opt.Mode = atoi( optarg ) - 1; modeGiven = true; break;
+      case 'l': opt.LatencyUs = strtoul( optarg, nullptr, 0 ); break;
+      case 'M': opt.Mixed = true; break;
+      case 'S': opt.Script = true; break;
+      case 'A': opt.AckAll = true; break;
+      case 'd': opt.Dump = true; break;
+      case 'u': opt.Unplug = true; break;
+      case 'N': opt.NoiseRate = strtoul( optarg, nullptr, 0 ); break;
+      case 'W': opt.NoiseWidthUs = strtoul( optarg, nullptr, 0 ); break;
+      case 'p': opt.PeriodMs = strtoul( optarg, nullptr, 0 ); break;
+      case 'o': opt.Vcd = optarg; break;
+      case 'P': Sim::FastPoll = false; break;
+      case 'v': opt.Verbose = true; break;
+      default:
+        fprintf( stderr, "usage: %s rx|tx|margin|replay [capture]|hu|inject|conform|parity|cache [-n frames] [-r fps] [-g gap_us] [-s seed] [-i count] [-m mode] [-l us] [-N rate] [-W us] [-p ms] [-o vcd] [-M] [-S] [-A] [-d] [-u] [-P] [-v]\n", argv[0] );
+        return 2;
+    }
+  }
+  if ( optind >= argc || ( strcmp( argv[optind], "rx" ) && strcmp( argv[optind], "tx" ) &&
+                           strcmp( argv[optind], "margin" ) && strcmp( argv[optind], "replay" ) &&
+                           strcmp( argv[optind], "hu" ) && strcmp( argv[optind], "inject" ) &&
+                           strcmp( argv[optind], "conform" ) && strcmp( argv[optind], "parity" ) &&
+                           strcmp( argv[optind], "cache" ) ) ) {
+    fprintf( stderr, "%s: mode must be rx, tx, margin, replay, hu, inject, conform, parity or cache\n", argv[0] );
+    return 2;
+  }
+  bool replay = !strcmp( argv[optind], "replay" );
+  if ( replay && optind + 1 >= argc ) {
+    fprintf( stderr, "%s: replay needs a capture file\n", argv[0] );
+    return 2;
+  }
+  if ( opt.Mode < 0 || opt.Mode >= IEBUS_MODE_COUNT ) {
+    fprintf( stderr, "%s: IEBus mode must be 1 .. %d\n", argv[0], IEBUS_MODE_COUNT );
+    return 2;
+  }
+  bool rx = !strcmp( argv[optind], "rx" );
+  bool margin = !strcmp( argv[optind], "margin" );
+
+  Sim::OutMask = _BV( PIN_OUT );
+  Sim::TxObserver obs;
+  obs.AckAddresses.push_back( HU_ADDRESS );
+  obs.AckAll = opt.AckAll;
+  Sim::Observer = &obs;
+  NoiseRandom.seed( LoadTestSeed );
+
+  Serial.Echo = opt.Verbose;
+  Serial.Keep = false;
+  setup();
+
+  // Extra devices reuse the display configuration at the following addresses.
+  for ( unsigned i = IdentityCount; i < opt.Identities && i < IDENTITY_MAX; i++ ) {
+    Identities[i] = Identities[0];
+    Identities[i].Address = MY_ADDRESS + i;
+    IdentityCount++;
+  }
+
+  LoadTestRandomFrames = !opt.Script;
+  LoadTestMode = opt.Mode;
+  DumpOutgoing = opt.Dump;
+
+  if ( margin ) {
+    // Timing only: the frames do not queue behind the log output.
+    if ( !framesGiven ) {
+      opt.Frames = 200;
+    }
+    if ( !gapGiven ) {
+      opt.GapUs = 20000;
+    }
+    RunMargin( opt );
+    return 0;
+  }
+
+  if ( !strcmp( argv[optind], "parity" ) ) {
+    unsigned long wrong = RunParity();
+    printf( "parity          %s (%lu of 4096 values differ)\n", wrong ? "FAIL" : "ok", wrong );
+    return wrong ? 1 : 0;
+  }
+
+  if ( !strcmp( argv[optind], "cache" ) ) {
+#if (USE_FRAME_CACHE)
+    unsigned long wrong = RunCache( opt );
+    printf( "cache           %s (%lu differences)\n", wrong ? "FAIL" : "ok", wrong );
+    return wrong ? 1 : 0;
+#else
+    fprintf( stderr, "%s: cache needs USE_FRAME_CACHE\n", argv[0] );
+    return 2;
+#endif
+  }
+
+  if ( !strcmp( argv[optind], "conform" ) ) {
+    unsigned long failed = RunConform( opt, obs, modeGiven ? opt.Mode : -1 );
+    printf( "conformance     %s (%lu frames failed)\n", failed ? "FAIL" : "ok", failed );
+    return failed ? 1 : 0;
+  }
+
+  if ( replay ) {
+    std::vector<Sim::CaptureFrame> capture;
+    if ( !Sim::LoadCapture( argv[ optind + 1 ], capture ) ) {
+      fprintf( stderr, "%s: cannot read capture %s\n", argv[0], argv[ optind + 1 ] );
+      return 1;
+    }
+    if ( !gapGiven ) {
+      opt.GapUs = 1000;
+    }
+    obs.AckAll = true;
+
+    ReplayReport rr;
+    auto wall = std::chrono::steady_clock::now();
+    Report rep = RunReplay( opt, obs, capture, rr );
+    rep.WallSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - wall ).count();
+    double busSeconds = (double)rep.BusCycles / F_CPU;
+
+    printf( "mode            replay\n" );
+    printf( "iebus mode      %d\n", opt.Mode + 1 );
+    printf( "capture         %zu frames\n", capture.size() );
+    printf( "injected        %lu, decoded %lu, lost %lu\n", rep.Frames, rep.Decoded, rep.Frames - rep.Decoded );
+    printf( "acked for me    %lu/%lu\n", rep.AckOk, rep.AckExpected );
+    printf( "answers         recorded %lu, replayed %lu\n", rr.Recorded, rr.Replayed );
+    printf( "  matched       %lu\n", rr.Matched );
+    printf( "  different     %lu\n", rr.Different );
+    printf( "  missing       %lu\n", rr.Missing );
+    printf( "  extra         %lu\n", rr.Extra );
+    printf( "registrations   recorded %lu, replayed %lu\n", rr.RegRecorded, rr.RegReplayed );
+    printf( "stalls          %lu\n", rep.Stalls );
+    PrintSerial();
+    printf( "bus time        %.3f s\n", busSeconds );
+    printf( "wall time       %.3f s (%.0fx real time, %.0f frames/s)\n", rep.WallSeconds,
+            rep.WallSeconds > 0 ? busSeconds / rep.WallSeconds : 0.0,
+            rep.WallSeconds > 0 ? rep.Frames / rep.WallSeconds : 0.0 );
+    return ( rr.Different + rr.Missing + rr.Extra ) ? 1 : 0;
+  }
+
+  if ( !strcmp( argv[optind], "hu" ) ) {
+    auto wall = std::chrono::steady_clock::now();
+    Report rep = RunHu( opt, obs );
+    rep.WallSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - wall ).count();
+    double busSeconds = (double)rep.BusCycles / F_CPU;
+
+    printf( "mode            hu\n" );
+    printf( "iebus mode      %d\n", opt.Mode + 1 );
+    printf( "frames on bus   %lu sent by the firmware, %u aborted (no ack)\n", rep.Frames, obs.Aborted );
+    for ( const SimDisplay & d : Displays ) {
+      printf( "display 0x%03X   latency %.0f us, answered %lu (%lu pings)%s\n", d.Address, Sim::ToUs( d.Latency ),
+              d.Answers, d.Pings, d.Plugged ? "" : ", unplugged half way" );
+    }
+    printf( "bus time        %.3f s\n", busSeconds );
+    printf( "wall time       %.3f s (%.0fx real time)\n", rep.WallSeconds,
+            rep.WallSeconds > 0 ? busSeconds / rep.WallSeconds : 0.0 );
+    printf( "firmware report\n" );
+    LogFlush();
+    Serial.Echo = true;
+    // One line per run, 1 ms apart as the scheduler runs it, from an empty TX buffer.
+    SkipTo( Sim::Now + Sim::Us( 10000 ) );
+    do {
+      HuEmulatorReport();
+      SkipTo( Sim::Now + Sim::Us( 1000 ) );
+    } while ( HuReportLine != 0 );
+    return 0;
+  }
+
+  if ( !strcmp( argv[optind], "inject" ) ) {
+    InjectCounts ic;
+    auto wall = std::chrono::steady_clock::now();
+    Report rep = RunInject( opt, obs, ic );
+    rep.WallSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - wall ).count();
+    double busSeconds = (double)rep.BusCycles / F_CPU;
+    uint64_t busy = 0;
+    for ( const Sim::Frame & f : obs.Frames ) {
+      busy += f.End - f.Start;
+    }
+
+    printf( "mode            inject\n" );
+    printf( "iebus mode      %d\n", opt.Mode + 1 );
+    printf( "commands        %lu (%llu bytes on the serial port, %llu lost in the RX buffer)\n", ic.Commands,
+            (unsigned long long)( Serial.Bytes ), (unsigned long long)Serial.RxOverruns );
+    printf( "queued          %lu, queue full %lu (sent again), bad %lu\n", ic.Queued, ic.Overflow, ic.Bad );
+    printf( "sent ok         %lu\n", ic.Sent );
+    printf( "failed (no ack) %lu\n", ic.Failed );
+    printf( "on the bus      %lu complete, %u aborted, %lu not the frame queued\n", rep.Decoded, obs.Aborted,
+            ic.Different );
+    if ( opt.PeriodMs ) {
+      printf( "periodic        %lu sent every %lu ms (%.0f expected)\n", ic.Periodic, opt.PeriodMs,
+              busSeconds * 1000 / opt.PeriodMs );
+    }
+    printf( "reports lost    %lu\n", ic.Lost );
+    printf( "queue empty     %.1f ms with frames still to send\n", ic.Starved * 1000.0 / F_CPU );
+    printf( "bus time        %.3f s, %.1f %% busy (%.1f %% with the aborted frames)\n", busSeconds,
+            rep.BusCycles ? 100.0 * busy / rep.BusCycles : 0.0,
+            rep.BusCycles ? 100.0 * ( busy + obs.AbortedCycles ) / rep.BusCycles : 0.0 );
+    printf( "frames/s        %.1f\n", busSeconds > 0 ? rep.Frames / busSeconds : 0.0 );
+    printf( "wall time       %.3f s (%.0fx real time)\n", rep.WallSeconds,
+            rep.WallSeconds > 0 ? busSeconds / rep.WallSeconds : 0.0 );
+    return ( ic.Different || ic.Bad ) ? 1 : 0;
+  }
+
+  auto wall = std::chrono::steady_clock::now();
+  Report rep = rx ? RunRx( opt ) : RunTx( opt, obs );
+  rep.WallSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - wall ).count();
+
+  double busSeconds = (double)rep.BusCycles / F_CPU;
+
+  printf( "mode            %s\n", rx ? "rx" : "tx" );
+  if ( opt.Mixed && rx ) {
+    printf( "iebus mode      mixed\n" );
+  } else {
+    printf( "iebus mode      %d\n", opt.Mode + 1 );
+  }
+  printf( "frames          %lu\n", rep.Frames );
+  if ( rx ) {
+    printf( "decoded         %lu\n", rep.Decoded );
+    printf( "lost            %lu (%.2f%%)\n", rep.Frames - rep.Decoded,
+            rep.Frames ? 100.0 * ( rep.Frames - rep.Decoded ) / rep.Frames : 0.0 );
+    printf( "acked for me    %lu/%lu\n", rep.AckOk, rep.AckExpected );
+    printf( "stalls          %lu\n", rep.Stalls + LoopStalls );
+    if ( opt.NoiseRate ) {
+      printf( "noise           %lu impulses (%lu/s, 1 .. %lu us)\n", Failed.Impulses, opt.NoiseRate, opt.NoiseWidthUs );
+    }
+    printf( "rejected pulses %lu, %.1f ms\n", Failed.Rejected, Sim::ToUs( Failed.RejectedCycles ) / 1000 );
+    printf( "failed decodes  %lu, %.1f ms (%.2f%% of the bus time), longest %.0f us\n", Failed.Doomed,
+            Sim::ToUs( Failed.DoomedCycles ) / 1000, rep.BusCycles ? 100.0 * Failed.DoomedCycles / rep.BusCycles : 0.0,
+            Sim::ToUs( Failed.LongestCycles ) );
+    printf( "log dropped     %lu (LOG_QUEUE_DEPTH %d)\n", LogDropped, LOG_QUEUE_DEPTH );
+    for ( unsigned i = 0; i < IdentityCount; i++ ) {
+      const AckWindow & w = Windows[i];
+      printf( "device 0x%03X    match #%u: acked %lu/%lu, ack slack min %.1f us avg %.1f us\n",
+              Identities[i].Address, i + 1, w.Acked, w.Frames, w.Acked ? w.MinSlackUs : 0.0,
+              w.Acked ? w.SumSlackUs / w.Acked : 0.0 );
+    }
+    // The match runs in the low time of the parity bit (shortest after a '0') plus the slack.
+    double minSlack = 1e9;
+    for ( unsigned i = 0; i < IdentityCount; i++ ) {
+      if ( Windows[i].Acked ) minSlack = std::min( minSlack, Windows[i].MinSlackUs );
+    }
+    if ( minSlack < 1e9 ) {
+      double lowUs = Sim::ToUs( Sim::Nominal.BitLength - Sim::Nominal.Bit0High );
+      double budget = ( lowUs + minSlack ) * Sim::CyclesPerUs;
+      printf( "ack budget      %.1f us low + %.1f us slack = %.0f cycles, match uses %u cycles"
+              " (12 per device), room for %.0f devices\n", lowUs, minSlack, budget, 12 * IdentityCount,
+              budget / 12 );
+    }
+  } else {
+    printf( "sent ok         %lu\n", LoadTestSent );
+    printf( "failed (no ack) %lu\n", LoadTestFailed );
+    printf( "on the bus      %lu complete, %u aborted\n", rep.Decoded, obs.Aborted );
+    unsigned long inMode = std::count_if( obs.Frames.begin(), obs.Frames.end(),
+                                          [&]( const Sim::Frame & f ) { return f.Mode == opt.Mode; } );
+    printf( "in iebus mode   %lu\n", inMode );
+  }
+  printf( "bus time        %.3f s\n", busSeconds );
+  printf( "frames/s        %.1f\n", busSeconds > 0 ? rep.Frames / busSeconds : 0.0 );
+  PrintSerial();
+  printf( "wall time       %.3f s (%.0fx real time)\n", rep.WallSeconds,
+          rep.WallSeconds > 0 ? busSeconds / rep.WallSeconds : 0.0 );
+
+  return 0;
+}
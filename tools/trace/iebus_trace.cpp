@@ -0,0 +1,314 @@
+/*--------------------------------------------------------------------------------------------------
+  Name         :  iebus_trace.cpp
+  Description  :  Per stage latency histograms of the firmware tracepoints (Trace.h).
+  ----------------------------------------------------------------------------------------------------
+     Build (from the repository root):
+
+       g++ -std=c++17 -O2 -o iebus_trace tools/trace/iebus_trace.cpp
+
+     Usage:
+
+       iebus_trace [-H] [-n count] <serial log|->
+
+     Reads the serial output of a USE_TRACE build, finds the tracepoint lines
+
+       T:01 3A0C 02 3D42 07 4213 03 4215 07 43F3
+       TRACE FULL
+
+     (other lines are skipped, so a whole session log can be given) and times every stage, the
+     step from one tracepoint to the next, in Timer 1 ticks of 0.5 us. "TRACE FULL" ends a
+     window: the firmware dropped tracepoints after the last one, no stage spans it. Stages
+     longer than the 32.768 ms of the Timer 1 wrap come out short.
+
+     Printed:
+
+       stages     Per pair of tracepoints seen one after the other ("DATA > REPLY"): count, min,
+                  avg, median, 99th percentile and max in us and the share of the traced time,
+                  the -n (default 30, 0 = all) longest in total. -H adds a histogram of every
+                  stage, one row per power of two of us.
+       ping       From the end of a ping (DATA, last ack) to the start bit of the answer
+                  (BUS_FREE), the average and longest of its parts:
+                    decode    DATA > REPLY, back from AvcReadMessage() to the answer
+                    load      REPLY > REPLY_LOADED, answer frame loaded from IdentityTable
+                    bus free  REPLY_LOADED > BUS_FREE, SendMessage() up to IsAvcBusFree()
+                  and of the dumps and scheduler tasks (logging) in the same time, then the
+                  time on the bus of the answer (BUS_FREE > SENT).
+
+     Tasks are numbered in the order of SchedulerAdd() in setup(): TASK0 is LogDrain.
+  --------------------------------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../../Trace.h"
+
+static const double TickUs = 0.5;           // Timer 1 at F_CPU / 8.
+
+static const char * const PointNames[] =
+{
+  "?", "START", "MASTER", "SLAVE", "CONTROL", "SIZE", "DATA", "ACK", "REPLY", "REPLY_LOADED",
+  "BUS_FREE", "SENT", "REPLY_END", "DUMP", "DUMP_END", "TASK_END"
+};
+
+/*--------------------------------------------------------------------------------------------------
+                                        Tracepoints
+--------------------------------------------------------------------------------------------------*/
+struct Event {
+  unsigned      Id;
+  uint64_t      Time;                       // Ticks, unwrapped within the window.
+  unsigned      Window;
+};
+
+static std::string Name ( unsigned id ) {
+  if ( id >= TRACE_TASK ) {
+    return "TASK" + std::to_string( id - TRACE_TASK );
+  }
+  return id < sizeof( PointNames ) / sizeof( PointNames[0] ) ? PointNames[ id ] : "?";
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Name         :  ReadEvents
+  Description  :  Collects the tracepoints of a serial log.
+  --------------------------------------------------------------------------------------------------*/
+static std::vector<Event> ReadEvents ( FILE * f, unsigned & windows ) {
+  std::vector<Event> events;
+  char line[ 4096 ];
+  bool open = false;
+  uint16_t last = 0;
+  uint64_t time = 0;
+
+  windows = 0;
+  while ( fgets( line, sizeof( line ), f ) ) {
+    if ( !strncmp( line, "TRACE FULL", 10 ) ) {
+      open = false;
+      continue;
+    }
+    if ( strncmp( line, "T:", 2 ) ) {
+      continue;
+    }
+
+    char * p = line + 2;
+    unsigned id, tick;
+    int used;
+    while ( sscanf( p, "%x %x %n", &id, &tick, &used ) == 2 ) {
+      p += used;
+      if ( !open ) {
+        open = true;
+        windows++;
+        time = 0;
+      } else {
+        time += (uint16_t)( tick - last );
+      }
+      last = (uint16_t)tick;
+      events.push_back( { id, time, windows } );
+    }
+  }
+  return events;
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                          Stages
+--------------------------------------------------------------------------------------------------*/
+struct Stage {
+  std::string           Name;
+  std::vector<uint64_t> Ticks;
+  uint64_t              Total = 0;
+};
+
+static double Percentile ( const std::vector<uint64_t> & sorted, double p ) {
+  size_t i = (size_t)( p * ( sorted.size() - 1 ) + 0.5 );
+  return sorted[ std::min( i, sorted.size() - 1 ) ] * TickUs;
+}
+
+static void PrintHistogram ( const std::vector<uint64_t> & ticks ) {
+  std::map<int, size_t> rows;
+  size_t most = 0;
+
+  for ( uint64_t t : ticks ) {
+    double us = t * TickUs;
+    int row = 0;
+    while ( ( 1u << row ) < us ) {
+      row++;
+    }
+    most = std::max( most, ++rows[ row ] );
+  }
+  for ( auto & r : rows ) {
+    printf( "      <= %6u us %8zu  %s\n", 1u << r.first, r.second,
+            std::string( ( r.second * 50 + most - 1 ) / most, '#' ).c_str() );
+  }
+}
+
+static void PrintStages ( const std::vector<Event> & events, unsigned count, bool histograms ) {
+  std::map<std::string, Stage> stages;
+  uint64_t traced = 0;
+
+  for ( size_t i = 1; i < events.size(); i++ ) {
+    const Event & a = events[i - 1];
+    const Event & b = events[i];
+    if ( a.Window != b.Window ) {
+      continue;
+    }
+    std::string name = Name( a.Id ) + " > " + Name( b.Id );
+    Stage & s = stages[ name ];
+    s.Name = name;
+    s.Ticks.push_back( b.Time - a.Time );
+    s.Total += b.Time - a.Time;
+    traced += b.Time - a.Time;
+  }
+
+  std::vector<Stage *> order;
+  for ( auto & it : stages ) {
+    std::sort( it.second.Ticks.begin(), it.second.Ticks.end() );
+    order.push_back( &it.second );
+  }
+  std::sort( order.begin(), order.end(), []( const Stage * x, const Stage * y ) {
+    return x->Total != y->Total ? x->Total > y->Total : x->Name < y->Name;
+  } );
+
+  printf( "%-28s %8s %9s %9s %9s %9s %9s %6s\n", "stage", "count", "min us", "avg us", "p50 us",
+          "p99 us", "max us", "time" );
+  for ( size_t i = 0; i < order.size() && ( count == 0 || i < count ); i++ ) {
+    const Stage & s = *order[i];
+    printf( "%-28s %8zu %9.1f %9.1f %9.1f %9.1f %9.1f %5.1f%%\n", s.Name.c_str(), s.Ticks.size(),
+            s.Ticks.front() * TickUs, (double)s.Total / s.Ticks.size() * TickUs,
+            Percentile( s.Ticks, 0.5 ), Percentile( s.Ticks, 0.99 ), s.Ticks.back() * TickUs,
+            traced ? 100.0 * s.Total / traced : 0.0 );
+    if ( histograms ) {
+      PrintHistogram( s.Ticks );
+    }
+  }
+  printf( "\n" );
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                       Ping budget
+--------------------------------------------------------------------------------------------------*/
+struct Part {
+  const char *  Name;
+  uint64_t      Sum = 0;
+  uint64_t      Max = 0;
+  unsigned long Count = 0;
+
+  void Add ( uint64_t t ) {
+    Sum += t;
+    Max = std::max( Max, t );
+    Count++;
+  }
+};
+
+static void PrintPing ( const std::vector<Event> & events ) {
+  Part budget { "ping > answer start" }, decode { "decode" }, load { "load" }, busFree { "bus free" },
+       logging { "dumps and tasks" }, air { "answer on the bus" };
+
+  for ( size_t i = 0; i < events.size(); i++ ) {
+    if ( events[i].Id != TRACE_DATA ) {
+      continue;
+    }
+
+    // DATA, REPLY, REPLY_LOADED, BUS_FREE in this order in the window, no frame in between.
+    uint64_t at[4] = { events[i].Time, 0, 0, 0 };
+    const unsigned want[4] = { TRACE_DATA, TRACE_REPLY, TRACE_REPLY_LOADED, TRACE_BUS_FREE };
+    uint64_t tasks = 0, taskStart = 0;
+    size_t k = i + 1, step = 1;
+
+    for ( ; k < events.size() && step < 4; k++ ) {
+      const Event & e = events[k];
+      if ( e.Window != events[i].Window || e.Id == TRACE_START_BIT ) {
+        break;
+      }
+      if ( e.Id == want[ step ] ) {
+        at[ step++ ] = e.Time;
+      } else if ( e.Id >= TRACE_TASK || e.Id == TRACE_DUMP ) {
+        taskStart = e.Time;
+      } else if ( e.Id == TRACE_TASK_END || e.Id == TRACE_DUMP_END ) {
+        tasks += e.Time - taskStart;
+      }
+    }
+    if ( step < 4 ) {
+      continue;
+    }
+
+    budget.Add( at[3] - at[0] );
+    decode.Add( at[1] - at[0] );
+    load.Add( at[2] - at[1] );
+    busFree.Add( at[3] - at[2] );
+    logging.Add( tasks );
+
+    for ( ; k < events.size() && events[k].Window == events[i].Window; k++ ) {
+      if ( events[k].Id == TRACE_SENT ) {
+        air.Add( events[k].Time - at[3] );
+        break;
+      }
+    }
+  }
+
+  if ( budget.Count == 0 ) {
+    printf( "no ping answered in the trace\n" );
+    return;
+  }
+
+  printf( "%-28s %8s %9s %9s %6s\n", "ping", "count", "avg us", "max us", "share" );
+  for ( const Part * p : { &budget, &decode, &load, &busFree, &logging, &air } ) {
+    printf( "%-28s %8lu %9.1f %9.1f", p->Name, p->Count, (double)p->Sum / p->Count * TickUs,
+            p->Max * TickUs );
+    if ( p != &budget && p != &air ) {
+      printf( " %5.1f%%", budget.Sum ? 100.0 * p->Sum / budget.Sum : 0.0 );
+    }
+    printf( "\n" );
+  }
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                           Main
+--------------------------------------------------------------------------------------------------*/
+int main ( int argc, char * argv[] ) {
+  bool histograms = false;
+  unsigned count = 30;
+  int c;
+
+  while ( ( c = getopt( argc, argv, "Hn:h" ) ) != -1 ) {
+    switch ( c ) {
+      case 'H': histograms = true; break;
+      case 'n': count = atoi( optarg ); break;
+      default:
+        fprintf( stderr, "usage: %s [-H] [-n count] <serial log|->\n", argv[0] );
+        return 2;
+    }
+  }
+  if ( optind >= argc ) {
+    fprintf( stderr, "%s: no input\n", argv[0] );
+    return 2;
+  }
+
+  const char * path = argv[optind];
+  FILE * f = strcmp( path, "-" ) ? fopen( path, "r" ) : stdin;
+  if ( f == NULL ) {
+    perror( path );
+    return 1;
+  }
+  unsigned windows;
+  std::vector<Event> events = ReadEvents( f, windows );
+  if ( f != stdin ) {
+    fclose( f );
+  }
+
+  fprintf( stderr, "%zu tracepoints in %u windows\n", events.size(), windows );
+  if ( events.empty() ) {
+    return 1;
+  }
+
+  PrintStages( events, count, histograms );
+  PrintPing( events );
+  return 0;
+}
+
+/*--------------------------------------------------------------------------------------------------
+                                         End of file.
+--------------------------------------------------------------------------------------------------*/